@@ -0,0 +1,126 @@
+// alloc_tracker.cpp
+
+#include "alloc_tracker.h"
+
+#ifdef TRACK_ALLOCATIONS
+
+#include "atomic.h"
+#include <stdlib.h>
+#include <new>
+
+// glibc lets the program replace malloc() & co, and exports the allocator behind them.
+// Elsewhere, only operator new and new[] are counted.
+#ifdef __GLIBC__
+	extern "C" void*	__libc_malloc(size_t size);
+	extern "C" void*	__libc_calloc(size_t nb, size_t size);
+	extern "C" void*	__libc_realloc(void* ptr, size_t size);
+	#define RAW_MALLOC(size)	__libc_malloc(size)
+#else
+	#define RAW_MALLOC(size)	malloc(size)
+#endif
+
+#if __cplusplus >= 201103L
+	#define NEW_THROW_SPEC
+	#define DELETE_THROW_SPEC	noexcept
+#else
+	#define NEW_THROW_SPEC		throw(std::bad_alloc)
+	#define DELETE_THROW_SPEC	throw()
+#endif
+
+THREAD_LOCAL AllocCounters	alloc_tracker_counters = {0, 0};
+static bool					s_enabled = false;
+
+//-----------------------------------------------------------------------------
+void allocTrackerSetEnabled(bool enabled)
+{
+	atomicStoreRelaxed(&s_enabled, enabled);
+}
+
+//-----------------------------------------------------------------------------
+bool allocTrackerIsEnabled()
+{
+	return atomicLoadRelaxed(&s_enabled);
+}
+
+//-----------------------------------------------------------------------------
+static inline void countAllocation(size_t size)
+{
+	if(atomicLoadRelaxed(&s_enabled))
+	{
+		alloc_tracker_counters.bytes += size;
+		alloc_tracker_counters.calls++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void* operator new(size_t size) NEW_THROW_SPEC
+{
+	countAllocation(size);
+	void*	ptr = RAW_MALLOC(size ? size : 1);
+	if(!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+//-----------------------------------------------------------------------------
+void* operator new[](size_t size) NEW_THROW_SPEC
+{
+	countAllocation(size);
+	void*	ptr = RAW_MALLOC(size ? size : 1);
+	if(!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+//-----------------------------------------------------------------------------
+void operator delete(void* ptr) DELETE_THROW_SPEC
+{
+	free(ptr);
+}
+
+//-----------------------------------------------------------------------------
+void operator delete[](void* ptr) DELETE_THROW_SPEC
+{
+	free(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+//-----------------------------------------------------------------------------
+void operator delete(void* ptr, size_t size) noexcept
+{
+	(void)size;
+	free(ptr);
+}
+
+//-----------------------------------------------------------------------------
+void operator delete[](void* ptr, size_t size) noexcept
+{
+	(void)size;
+	free(ptr);
+}
+#endif
+
+#ifdef __GLIBC__
+//-----------------------------------------------------------------------------
+extern "C" void* malloc(size_t size) __THROW
+{
+	countAllocation(size);
+	return __libc_malloc(size);
+}
+
+//-----------------------------------------------------------------------------
+extern "C" void* calloc(size_t nb, size_t size) __THROW
+{
+	countAllocation(nb * size);
+	return __libc_calloc(nb, size);
+}
+
+//-----------------------------------------------------------------------------
+extern "C" void* realloc(void* ptr, size_t size) __THROW
+{
+	countAllocation(size);
+	return __libc_realloc(ptr, size);
+}
+#endif // __GLIBC__
+
+#endif // TRACK_ALLOCATIONS
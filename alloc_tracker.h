@@ -0,0 +1,46 @@
+// alloc_tracker.h
+// Counts the heap allocations of each thread, for the profiler: the calls to operator new and new[], and with glibc
+// to malloc(), calloc() and realloc(), and the bytes they requested. Replacing the global allocation functions
+// affects the whole program, so the hooks are only compiled in with TRACK_ALLOCATIONS defined.
+// The counters of a thread are thread-local and only grow: the allocations of a scope are the difference
+// between two reads, even when the tracking is switched on or off in the meantime.
+
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <stdint.h>
+#include "thread.h"
+
+//#define TRACK_ALLOCATIONS	// or define TRACK_ALLOCATIONS on the command line
+
+struct AllocCounters
+{
+	uint64_t	bytes;
+	uint64_t	calls;
+};
+
+#ifdef TRACK_ALLOCATIONS
+	extern THREAD_LOCAL AllocCounters	alloc_tracker_counters;	// Only written by the hooks, on the thread itself
+
+	// Any thread. While the tracking is off, each allocation pays a relaxed load and a branch.
+	void	allocTrackerSetEnabled(bool enabled);
+	bool	allocTrackerIsEnabled();
+
+	// Allocations of the calling thread since it started, while the tracking was on
+	inline AllocCounters	allocTrackerGetCounters()	{return alloc_tracker_counters;}
+
+	inline bool	allocTrackerIsAvailable()	{return true;}
+#else
+	inline void	allocTrackerSetEnabled(bool enabled)	{(void)enabled;}
+	inline bool	allocTrackerIsEnabled()				{return false;}
+
+	inline AllocCounters	allocTrackerGetCounters()
+	{
+		AllocCounters	counters = {0, 0};
+		return counters;
+	}
+
+	inline bool	allocTrackerIsAvailable()	{return false;}
+#endif
+
+#endif // ALLOC_TRACKER_H
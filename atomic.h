@@ -0,0 +1,69 @@
+// atomic.h
+// Thin interface over the compiler atomic intrinsics: GCC/Clang __atomic builtins and MSVC.
+// Only aligned integer and pointer types are supported. The variables themselves are not declared
+// volatile: every access that can race with another thread must go through these functions.
+
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+// Orderings: use relaxed for flags and counters that publish nothing else, and an acquire load
+// paired with a release store when the value tells the reader that other data is ready.
+// On x86 both cost a plain mov; on ARM, acquire and release become ldar/stlr or a dmb.
+
+#if defined(_MSC_VER) && (defined(_M_ARM) || defined(_M_ARM64))
+	#include <intrin.h>
+
+	// Volatile accesses are plain loads and stores on ARM (/volatile:iso): add the barriers explicitly
+	template<class T>	inline T	atomicLoadRelaxed(const volatile T* p)			{return *p;}
+	template<class T>	inline T	atomicLoadAcquire(const volatile T* p)			{T val = *p; __dmb(_ARM_BARRIER_ISH); return val;}
+	template<class T>	inline void	atomicStoreRelaxed(volatile T* p, T val)		{*p = val;}
+	template<class T>	inline void	atomicStoreRelease(volatile T* p, T val)		{__dmb(_ARM_BARRIER_ISH); *p = val;}
+	inline void		atomicFenceSeqCst()											{__dmb(_ARM_BARRIER_ISH);}
+
+#elif defined(_MSC_VER)
+	#include <intrin.h>
+
+	// On x86 and x64, aligned loads have acquire semantics and aligned stores have release semantics:
+	// we only need to prevent the compiler from reordering the accesses.
+	template<class T>	inline T	atomicLoadRelaxed(const volatile T* p)			{return *p;}
+	template<class T>	inline T	atomicLoadAcquire(const volatile T* p)			{T val = *p; _ReadWriteBarrier(); return val;}
+	template<class T>	inline void	atomicStoreRelaxed(volatile T* p, T val)		{*p = val;}
+	template<class T>	inline void	atomicStoreRelease(volatile T* p, T val)		{_ReadWriteBarrier(); *p = val;}
+	inline void		atomicFenceSeqCst()											{_mm_mfence();}
+
+#else	// GCC, Clang
+	template<class T>	inline T	atomicLoadRelaxed(const volatile T* p)			{return __atomic_load_n(p, __ATOMIC_RELAXED);}
+	template<class T>	inline T	atomicLoadAcquire(const volatile T* p)			{return __atomic_load_n(p, __ATOMIC_ACQUIRE);}
+	template<class T>	inline void	atomicStoreRelaxed(volatile T* p, T val)		{__atomic_store_n(p, val, __ATOMIC_RELAXED);}
+	template<class T>	inline void	atomicStoreRelease(volatile T* p, T val)		{__atomic_store_n(p, val, __ATOMIC_RELEASE);}
+	inline void		atomicFenceSeqCst()											{__atomic_thread_fence(__ATOMIC_SEQ_CST);}
+
+	// Read-modify-write operations are sequentially consistent, like the MSVC _Interlocked functions
+	template<class T>	inline bool	atomicCompareExchange(volatile T* p, T expected, T desired)
+	{
+		return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	}
+	template<class T>	inline T	atomicFetchAdd(volatile T* p, T val)			{return __atomic_fetch_add(p, val, __ATOMIC_SEQ_CST);}
+	template<class T>	inline T	atomicExchange(volatile T* p, T val)			{return __atomic_exchange_n(p, val, __ATOMIC_SEQ_CST);}
+#endif
+
+#ifdef _MSC_VER
+	// Read-modify-write operations: 32-bit types only, the _Interlocked functions are full barriers
+	template<class T>	inline bool	atomicCompareExchange(volatile T* p, T expected, T desired)
+	{
+		typedef char	only_32_bit_types[sizeof(T) == sizeof(long) ? 1 : -1];
+		return _InterlockedCompareExchange((volatile long*)p, (long)desired, (long)expected) == (long)expected;
+	}
+	template<class T>	inline T	atomicFetchAdd(volatile T* p, T val)
+	{
+		typedef char	only_32_bit_types[sizeof(T) == sizeof(long) ? 1 : -1];
+		return (T)_InterlockedExchangeAdd((volatile long*)p, (long)val);
+	}
+	template<class T>	inline T	atomicExchange(volatile T* p, T val)
+	{
+		typedef char	only_32_bit_types[sizeof(T) == sizeof(long) ? 1 : -1];
+		return (T)_InterlockedExchange((volatile long*)p, (long)val);
+	}
+#endif
+
+#endif // __ATOMIC_H__
@@ -0,0 +1,298 @@
+// event_latency.cpp
+// Microbenchmark of the wake-up latency of the thread.h primitives, compared with a plain
+// mutex + condition variable event (the previous pthread implementation).
+// - ping-pong: time between eventTrigger() on one thread and the return of eventWait() on another
+// - fan-out: time between the release of N workers and the last of them running, as in a frame update
+// Usage: event_latency [nb_iterations] [nb_workers]
+// POSIX only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "../thread.h"
+#include "../hp_timer.h"
+
+//-----------------------------------------------------------------------------
+// Reference: mutex + condition variable
+struct CondEvent
+{
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	bool			triggered;
+};
+
+static void condEventCreate(CondEvent* event)
+{
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->triggered = false;
+}
+
+static void condEventDestroy(CondEvent* event)
+{
+	pthread_cond_destroy(&event->cond);
+	pthread_mutex_destroy(&event->mutex);
+}
+
+static void condEventTrigger(CondEvent* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->triggered = true;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->mutex);
+}
+
+static void condEventReset(CondEvent* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->triggered = false;
+	pthread_mutex_unlock(&event->mutex);
+}
+
+static void condEventWait(CondEvent* event)
+{
+	pthread_mutex_lock(&event->mutex);
+	while(!event->triggered)
+		pthread_cond_wait(&event->cond, &event->mutex);
+	pthread_mutex_unlock(&event->mutex);
+}
+
+// Same interface for both implementations
+struct FutexEventOps
+{
+	typedef Event	Type;
+	static void	create(Event* e)	{eventCreate(e);}
+	static void	destroy(Event* e)	{eventDestroy(e);}
+	static void	trigger(Event* e)	{eventTrigger(e);}
+	static void	reset(Event* e)		{eventReset(e);}
+	static void	wait(Event* e)		{eventWait(e);}
+};
+
+struct CondEventOps
+{
+	typedef CondEvent	Type;
+	static void	create(CondEvent* e)	{condEventCreate(e);}
+	static void	destroy(CondEvent* e)	{condEventDestroy(e);}
+	static void	trigger(CondEvent* e)	{condEventTrigger(e);}
+	static void	reset(CondEvent* e)		{condEventReset(e);}
+	static void	wait(CondEvent* e)		{condEventWait(e);}
+};
+
+//-----------------------------------------------------------------------------
+static void printStats(const char* name, std::vector<uint64_t>& latencies)
+{
+	std::sort(latencies.begin(), latencies.end());
+	size_t n = latencies.size();
+	printf("%-28s min %8.2lfus   median %8.2lfus   p99 %8.2lfus   max %8.2lfus\n", name,
+		   double(latencies[0]) / 1000.0, double(latencies[n/2]) / 1000.0,
+		   double(latencies[n*99/100]) / 1000.0, double(latencies[n-1]) / 1000.0);
+}
+
+//-----------------------------------------------------------------------------
+// Ping-pong: the main thread triggers "ping" and records the time, the worker measures when it wakes up
+template<class Ops>
+struct PingPong
+{
+	typename Ops::Type		ping;
+	typename Ops::Type		pong;
+	volatile uint64_t		trigger_time;
+	std::vector<uint64_t>	latencies;
+	int						nb_iterations;
+
+	static void* workerProc(void* user_data)
+	{
+		PingPong* pp = (PingPong*)user_data;
+		for(int i=0 ; i < pp->nb_iterations ; i++)
+		{
+			Ops::wait(&pp->ping);
+			pp->latencies[i] = getTimeNs() - pp->trigger_time;
+			Ops::reset(&pp->ping);
+			Ops::trigger(&pp->pong);
+		}
+		return NULL;
+	}
+
+	void run(const char* name, int nb_iter)
+	{
+		nb_iterations = nb_iter;
+		latencies.resize(nb_iter);
+		Ops::create(&ping);
+		Ops::create(&pong);
+
+		ThreadHandle thread = threadCreate(&workerProc, this);
+		for(int i=0 ; i < nb_iterations ; i++)
+		{
+			trigger_time = getTimeNs();
+			Ops::trigger(&ping);
+			Ops::wait(&pong);
+			Ops::reset(&pong);
+		}
+		threadJoin(thread);
+
+		Ops::destroy(&ping);
+		Ops::destroy(&pong);
+		printStats(name, latencies);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Fan-out with one event pair per worker, triggered and waited one by one
+template<class Ops>
+struct EventFanOut
+{
+	struct Worker
+	{
+		EventFanOut*		p_bench;
+		typename Ops::Type	update_event;
+		typename Ops::Type	main_event;
+		uint64_t			wake_time;
+	};
+
+	std::vector<Worker>		workers;
+	volatile bool			shut;
+
+	static void* workerProc(void* user_data)
+	{
+		Worker* w = (Worker*)user_data;
+		while(true)
+		{
+			Ops::wait(&w->update_event);
+			Ops::reset(&w->update_event);
+			if(w->p_bench->shut)
+				break;
+			w->wake_time = getTimeNs();
+			Ops::trigger(&w->main_event);
+		}
+		return NULL;
+	}
+
+	void run(const char* name, int nb_iterations, int nb_workers)
+	{
+		workers.resize(nb_workers);
+		shut = false;
+		std::vector<ThreadHandle>	threads(nb_workers);
+		for(int i=0 ; i < nb_workers ; i++)
+		{
+			workers[i].p_bench = this;
+			Ops::create(&workers[i].update_event);
+			Ops::create(&workers[i].main_event);
+			threads[i] = threadCreate(&workerProc, &workers[i]);
+		}
+
+		std::vector<uint64_t>	latencies(nb_iterations);
+		for(int iter=0 ; iter < nb_iterations ; iter++)
+		{
+			uint64_t start = getTimeNs();
+			for(int i=0 ; i < nb_workers ; i++)
+				Ops::trigger(&workers[i].update_event);
+
+			uint64_t last_wake = 0;
+			for(int i=0 ; i < nb_workers ; i++)
+			{
+				Ops::wait(&workers[i].main_event);
+				Ops::reset(&workers[i].main_event);
+				last_wake = std::max(last_wake, workers[i].wake_time);
+			}
+			latencies[iter] = last_wake - start;
+		}
+
+		shut = true;
+		for(int i=0 ; i < nb_workers ; i++)
+		{
+			Ops::trigger(&workers[i].update_event);
+			threadJoin(threads[i]);
+			Ops::destroy(&workers[i].update_event);
+			Ops::destroy(&workers[i].main_event);
+		}
+		printStats(name, latencies);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Fan-out with two barriers: one to release the workers, one to wait for them
+struct BarrierFanOut
+{
+	Barrier					start_barrier;
+	Barrier					end_barrier;
+	std::vector<uint64_t>	wake_times;
+	int						nb_iterations;
+
+	struct Worker
+	{
+		BarrierFanOut*	p_bench;
+		int				index;
+	};
+
+	static void* workerProc(void* user_data)
+	{
+		Worker* w = (Worker*)user_data;
+		BarrierFanOut* b = w->p_bench;
+		for(int i=0 ; i < b->nb_iterations ; i++)
+		{
+			barrierWait(&b->start_barrier);
+			b->wake_times[w->index] = getTimeNs();
+			barrierWait(&b->end_barrier);
+		}
+		return NULL;
+	}
+
+	void run(const char* name, int nb_iter, int nb_workers)
+	{
+		nb_iterations = nb_iter;
+		wake_times.resize(nb_workers);
+		barrierCreate(&start_barrier, nb_workers+1);
+		barrierCreate(&end_barrier, nb_workers+1);
+
+		std::vector<Worker>			workers(nb_workers);
+		std::vector<ThreadHandle>	threads(nb_workers);
+		for(int i=0 ; i < nb_workers ; i++)
+		{
+			workers[i].p_bench = this;
+			workers[i].index = i;
+			threads[i] = threadCreate(&workerProc, &workers[i]);
+		}
+
+		std::vector<uint64_t>	latencies(nb_iterations);
+		for(int iter=0 ; iter < nb_iterations ; iter++)
+		{
+			uint64_t start = getTimeNs();
+			barrierWait(&start_barrier);
+			barrierWait(&end_barrier);
+			latencies[iter] = *std::max_element(wake_times.begin(), wake_times.end()) - start;
+		}
+
+		for(int i=0 ; i < nb_workers ; i++)
+			threadJoin(threads[i]);
+		barrierDestroy(&start_barrier);
+		barrierDestroy(&end_barrier);
+		printStats(name, latencies);
+	}
+};
+
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int nb_iterations = argc > 1 ? atoi(argv[1]) : 10000;
+	int nb_workers = argc > 2 ? atoi(argv[2]) : 4;
+	if(nb_iterations < 1 || nb_workers < 1)
+	{
+		fprintf(stderr, "Usage: %s [nb_iterations] [nb_workers]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	initTimer();
+	printf("%d iterations, %d workers, %d cores\n\n", nb_iterations, nb_workers, threadGetNbCores());
+
+	printf("--- Ping-pong: trigger -> wait returns ---\n");
+	PingPong<CondEventOps>().run("condvar event", nb_iterations);
+	PingPong<FutexEventOps>().run("thread.h event", nb_iterations);
+
+	printf("\n--- Fan-out: release -> last worker runs ---\n");
+	EventFanOut<CondEventOps>().run("condvar event pairs", nb_iterations, nb_workers);
+	EventFanOut<FutexEventOps>().run("thread.h event pairs", nb_iterations, nb_workers);
+	BarrierFanOut().run("thread.h barriers", nb_iterations, nb_workers);
+
+	shutTimer();
+	return EXIT_SUCCESS;
+}
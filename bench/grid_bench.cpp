@@ -0,0 +1,133 @@
+// grid_bench.cpp
+// Microbenchmark of the grid height update: the original per-vertex cosf/sinf loop against the
+// separable kernel of grid_simd.h, on each SIMD path the CPU supports.
+// - contiguous: the heights are a float array
+// - interleaved: the heights are pos[1] in the pos+color vertices of Grid
+// The error is measured against a double precision reference.
+// Usage: grid_bench [nb_iterations] [grid_size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "../grid_simd.h"
+#include "../hp_timer.h"
+
+static const float	Y_FLOOR = -3.0f;
+static const float	Y_DISTO = 0.5f;
+static const size_t	VERTEX_STRIDE = 6;	// pos[3] + col[3]
+
+// Keep the compiler from dropping the updates
+static volatile float	s_sink;
+
+//-----------------------------------------------------------------------------
+// The loop of Grid::update before vectorization, but row-major
+static void updateReference(float* heights, size_t stride, int size, float t)
+{
+	for(int y=0 ; y < size ; y++)
+	{
+		float fy = float(y) / float(size);
+		for(int x=0 ; x < size ; x++)
+		{
+			float fx = float(x) / float(size);
+			float f = cosf(10.0f*fx + 10.0f*t) + sinf(13.0f*fy + 8.0f*t);
+			heights[(x + y*size)*stride] = Y_FLOOR + f*Y_DISTO;
+		}
+	}
+}
+
+static void updateSeparable(float* heights, size_t stride, int size, float t)
+{
+	GridWaveParams	params;
+	params.width = size;
+	params.height = size;
+	params.x_freq = 10.0f / float(size);
+	params.x_phase = (float)fmod(10.0*t, 2.0*3.14159265358979323846);
+	params.y_freq = 13.0f / float(size);
+	params.y_phase = (float)fmod(8.0*t, 2.0*3.14159265358979323846);
+	params.floor = Y_FLOOR;
+	params.amplitude = Y_DISTO;
+	gridWaveUpdateRows(params, 0, size, heights, stride);
+}
+
+static double maxError(const float* heights, size_t stride, int size, float t)
+{
+	double err = 0.0;
+	for(int y=0 ; y < size ; y++)
+	{
+		for(int x=0 ; x < size ; x++)
+		{
+			double fx = double(x) / double(size);
+			double fy = double(y) / double(size);
+			double h = Y_FLOOR + Y_DISTO * (cos(10.0*fx + 10.0*t) + sin(13.0*fy + 8.0*t));
+			err = std::max(err, fabs(h - (double)heights[(x + y*size)*stride]));
+		}
+	}
+	return err;
+}
+
+//-----------------------------------------------------------------------------
+typedef void	(*UpdateFunc)(float* heights, size_t stride, int size, float t);
+
+// Median time of an update in microseconds
+static double timeUpdate(UpdateFunc func, float* heights, size_t stride, int size, int nb_iterations)
+{
+	std::vector<uint64_t>	times(nb_iterations);
+	for(int i=0 ; i < nb_iterations ; i++)
+	{
+		float t = 0.016f * float(i);
+		uint64_t start = getTimeNs();
+		func(heights, stride, size, t);
+		times[i] = getTimeNs() - start;
+		s_sink = heights[(i % size) * stride];
+	}
+	std::sort(times.begin(), times.end());
+	return double(times[nb_iterations/2]) / 1000.0;
+}
+
+static void runLayout(const char* layout, size_t stride, int size, int nb_iterations)
+{
+	std::vector<float>	heights((size_t)size * (size_t)size * stride, 0.0f);
+	float				t_check = 12.345f;
+
+	printf("--- %s ---\n", layout);
+	double ref_time = timeUpdate(&updateReference, &heights[0], stride, size, nb_iterations);
+	updateReference(&heights[0], stride, size, t_check);
+	printf("%-20s %10.2lfus               max error %.2e\n", "cosf/sinf per vertex", ref_time,
+		   maxError(&heights[0], stride, size, t_check));
+
+	for(int path=0 ; path < NB_SIMD_PATHS ; path++)
+	{
+		if(!simdSetPath((SimdPath)path))
+			continue;
+		double time = timeUpdate(&updateSeparable, &heights[0], stride, size, nb_iterations);
+		updateSeparable(&heights[0], stride, size, t_check);
+		printf("%-20s %10.2lfus  x%-8.1lf  max error %.2e\n", simdGetPathName((SimdPath)path), time,
+			   ref_time / time, maxError(&heights[0], stride, size, t_check));
+	}
+	simdSetPath(simdGetBestPath());
+	printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int nb_iterations = argc > 1 ? atoi(argv[1]) : 200;
+	int size = argc > 2 ? atoi(argv[2]) : 300;
+	if(nb_iterations < 1 || size < 2 || size > GRID_WAVE_MAX_WIDTH)
+	{
+		fprintf(stderr, "Usage: %s [nb_iterations] [grid_size <= %d]\n", argv[0], GRID_WAVE_MAX_WIDTH);
+		return EXIT_FAILURE;
+	}
+
+	initTimer();
+	printf("%d iterations, %dx%d grid, best path: %s\n\n", nb_iterations, size, size,
+		   simdGetPathName(simdGetBestPath()));
+
+	runLayout("contiguous heights", 1, size, nb_iterations);
+	runLayout("interleaved vertices", VERTEX_STRIDE, size, nb_iterations);
+
+	shutTimer();
+	return EXIT_SUCCESS;
+}
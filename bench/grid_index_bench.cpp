@@ -0,0 +1,69 @@
+// grid_index_bench.cpp
+// Compares the index layouts of grid_indices.h: number of indices, size of the index buffer and
+// vertices transformed per triangle (ACMR) with FIFO vertex caches of several sizes.
+// The GPU time of each layout shows in the "[GPU] draw grid" markers of the demo: press I to switch.
+// Usage: grid_index_bench [grid_size] [block_width]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../grid_indices.h"
+
+static const int	CACHE_SIZES[] = {16, 32, 64};
+static const int	NB_CACHE_SIZES = sizeof(CACHE_SIZES) / sizeof(CACHE_SIZES[0]);
+
+static void printLayout(const char* name, const std::vector<uint32_t>& indices, size_t index_size,
+						bool strips, size_t nb_draws)
+{
+	printf("%-28s %9lu indices %9.1lf KB %4lu draw(s)   ACMR", name, (unsigned long)indices.size(),
+		   double(indices.size() * index_size) / 1024.0, (unsigned long)nb_draws);
+	for(int i=0 ; i < NB_CACHE_SIZES ; i++)
+		printf("  %d: %.3f", CACHE_SIZES[i],
+			   gridComputeACMR(&indices[0], indices.size(), strips, GRID_RESTART_INDEX_32, CACHE_SIZES[i]));
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	int size = argc > 1 ? atoi(argv[1]) : 300;
+	int block_width = argc > 2 ? atoi(argv[2]) : 6;
+	if(size < 2 || size > 0xFFFF/2)
+	{
+		fprintf(stderr, "Usage: %s [grid_size] [block_width]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%dx%d grid, %d triangles, strips in blocks of %d quads\n\n", size, size,
+		   2*(size-1)*(size-1), block_width);
+
+	std::vector<uint32_t>	indices;
+	gridBuildTriangles(size, size, indices);
+	printLayout("triangles 32-bit", indices, sizeof(uint32_t), false, 1);
+
+	gridBuildStrips(size, size, 0, GRID_RESTART_INDEX_32, indices);
+	printLayout("strips 32-bit, whole rows", indices, sizeof(uint32_t), true, 1);
+
+	gridBuildStrips(size, size, block_width, GRID_RESTART_INDEX_32, indices);
+	printLayout("strips 32-bit, blocks", indices, sizeof(uint32_t), true, 1);
+
+	// 16-bit: the buffer holds one band (plus the last one), the ACMR is measured on all the draws
+	GridBands16	bands;
+	gridBuildStrips16(size, size, block_width, bands);
+	indices.clear();
+	for(int band=0 ; band < bands.nb_bands ; band++)
+	{
+		uint32_t	base_vertex = (uint32_t)(bands.getFirstRow(band) * size);
+		size_t		offset = bands.getOffset(band);
+		if(band > 0)
+			indices.push_back(GRID_RESTART_INDEX_32);
+		for(size_t i=0 ; i < bands.getNbIndices(band) ; i++)
+		{
+			uint16_t index = bands.indices[offset + i];
+			indices.push_back(index == GRID_RESTART_INDEX_16 ? GRID_RESTART_INDEX_32 : base_vertex + index);
+		}
+	}
+	printf("%-28s %9lu indices %9.1lf KB in the buffer\n", "strips 16-bit, bands",
+		   (unsigned long)bands.indices.size(), double(bands.indices.size() * sizeof(uint16_t)) / 1024.0);
+	printLayout("  drawn", indices, sizeof(uint16_t), true, (size_t)bands.nb_bands);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,536 @@
+// profiler_bench.cpp
+// Microbenchmarks of the hot paths of the profiler:
+// - push_pop: pushCpuMarker() + popCpuMarker(), on 1 thread and on N threads at the same time,
+//   with the events collected by the main thread, past the markers kept per frame (they are dropped)
+//   and with the recording stopped
+// - timer: getTimeNs() and the other clocks of the platform
+// - synchronize_frame: collecting one frame of markers from 32 threads
+// - pick_markers: hover hit-testing on the displayed frame
+// - hole_array: iterating a HoleArray with begin()/next(), against the dense loop the profiler uses
+// Each result is the median time of an operation over batches. The results are printed, and written
+// as JSON if an output file is given, to track them across releases.
+// Usage: profiler_bench [output.json] [nb_batches]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "../profiler.h"
+#include "../hole_array.h"
+#include "../hp_timer.h"
+#include "../thread.h"
+#include "../atomic.h"
+
+#if defined(__MACH__)
+	#include <mach/mach_time.h>
+#elif defined(__linux__)
+	#include <sys/time.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+	#include <x86intrin.h>
+	#define HAS_RDTSC
+#elif defined(_M_IX86) || defined(_M_X64)
+	#include <intrin.h>
+	#define HAS_RDTSC
+#endif
+
+static const int	NB_MAX_THREADS = 32;			// What the profiler can record, with the main thread
+static const int	NB_MARKERS_PER_BATCH = 100;		// The markers the profiler keeps per thread and per frame
+
+struct Result
+{
+	char		name[64];
+	size_t		nb_iterations;	// Operations timed, over all the batches
+	double		median_ns;		// Per operation
+	double		min_ns;
+	double		items_per_second;	// All the threads together, 0 if not relevant
+};
+
+static std::vector<Result>	s_results;
+static int					s_nb_batches = 200;
+
+// Keep the compiler from dropping the timed code
+static volatile uint64_t	s_sink;
+
+//-----------------------------------------------------------------------------
+/// Record a result from the times of the batches, in nanoseconds for nb_ops_per_batch operations
+static void addResult(const char* name, std::vector<uint64_t>& batch_times, size_t nb_ops_per_batch, double items_per_second=0.0)
+{
+	std::sort(batch_times.begin(), batch_times.end());
+
+	Result	result;
+	strncpy(result.name, name, sizeof(result.name));
+	result.name[sizeof(result.name)-1] = '\0';
+	result.nb_iterations = batch_times.size() * nb_ops_per_batch;
+	result.median_ns = double(batch_times[batch_times.size()/2]) / double(nb_ops_per_batch);
+	result.min_ns = double(batch_times[0]) / double(nb_ops_per_batch);
+	result.items_per_second = items_per_second;
+	s_results.push_back(result);
+
+	printf("%-40s %10.1lf ns %10.1lf ns", result.name, result.median_ns, result.min_ns);
+	if(items_per_second > 0.0)
+		printf("  %8.2lf M/s", items_per_second / 1e6);
+	printf("\n");
+}
+
+//-----------------------------------------------------------------------------
+// Threads that run the same task together, started and stopped by the main thread.
+// The profiler never forgets a thread: the same threads are used by all the benchmarks.
+//-----------------------------------------------------------------------------
+typedef void	(*TaskFunc)(int thread_index);
+
+struct ThreadPool
+{
+	ThreadHandle	handles[NB_MAX_THREADS];
+	int				nb_threads;		// Without the main thread
+	Barrier			start_barrier;
+	Barrier			end_barrier;
+	TaskFunc		task;
+	int				nb_active;		// Threads [0, nb_active) run the task
+	int32_t			nb_done;
+	bool			quit;
+};
+
+static ThreadPool	s_pool;
+
+static void* poolThread(void* arg)
+{
+	int index = (int)(size_t)arg;
+	while(true)
+	{
+		barrierWait(&s_pool.start_barrier);
+		if(s_pool.quit)
+			break;
+		if(index < s_pool.nb_active)
+			s_pool.task(index);
+		atomicFetchAdd(&s_pool.nb_done, (int32_t)1);
+		barrierWait(&s_pool.end_barrier);
+	}
+	return NULL;
+}
+
+static void poolInit(int nb_threads)
+{
+	s_pool.nb_threads = nb_threads;
+	s_pool.quit = false;
+	barrierCreate(&s_pool.start_barrier, nb_threads+1);
+	barrierCreate(&s_pool.end_barrier, nb_threads+1);
+	for(int i=0 ; i < nb_threads ; i++)
+	{
+		char	name[THREAD_NAME_MAX_LENGTH];
+		sprintf(name, "Bench %d", i);
+
+		ThreadOptions	options;
+		options.name = name;
+		s_pool.handles[i] = threadCreate(&poolThread, (void*)(size_t)i, options);
+	}
+}
+
+static void poolShut()
+{
+	s_pool.quit = true;
+	barrierWait(&s_pool.start_barrier);
+	for(int i=0 ; i < s_pool.nb_threads ; i++)
+		threadJoin(s_pool.handles[i]);
+	barrierDestroy(&s_pool.start_barrier);
+	barrierDestroy(&s_pool.end_barrier);
+}
+
+/// Run the task on nb_active threads. The main thread collects the events while they run.
+static void poolRun(TaskFunc task, int nb_active, bool collect)
+{
+	s_pool.task = task;
+	s_pool.nb_active = nb_active;
+	atomicStoreRelaxed(&s_pool.nb_done, (int32_t)0);
+
+	barrierWait(&s_pool.start_barrier);
+	while(atomicLoadAcquire(&s_pool.nb_done) < s_pool.nb_threads)
+	{
+		if(collect)
+			profiler.synchronizeFrame();
+		else
+			threadYield();
+	}
+	barrierWait(&s_pool.end_barrier);
+}
+
+//-----------------------------------------------------------------------------
+// Access to the internals of the profiler
+//-----------------------------------------------------------------------------
+class ProfilerBench
+{
+public:
+	static size_t	getNbRecordedThreads()	{return profiler.m_nb_cpu_threads;}
+	static bool		isViewValid()			{return profiler.m_live_view.valid;}
+
+	static size_t	pickMarkers(float fx, float fy, const char** line_name)
+	{
+		const Profiler::Marker*	chosen_markers[32];
+		return profiler.pickMarkers(profiler.m_live_view, fx, fy, chosen_markers, 32, line_name);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// push_pop
+//-----------------------------------------------------------------------------
+static std::vector<uint64_t>	s_thread_batch_times[NB_MAX_THREADS];
+
+static uint64_t timePushPopBatch()
+{
+	uint64_t start = getTimeNs();
+	for(int i=0 ; i < NB_MARKERS_PER_BATCH ; i++)
+	{
+		PROFILER_PUSH_CPU_MARKER("Bench", COLOR_RED);
+		PROFILER_POP_CPU_MARKER();
+	}
+	return getTimeNs() - start;
+}
+
+static void pushPopTask(int thread_index)
+{
+	std::vector<uint64_t>&	times = s_thread_batch_times[thread_index];
+	times.clear();
+	for(int batch=0 ; batch < s_nb_batches ; batch++)
+	{
+		times.push_back(timePushPopBatch());
+
+		// Leave the main thread the time to collect the events
+		uint64_t resume_time = getTimeNs() + 20000;
+		while(getTimeNs() < resume_time)
+			threadYield();
+	}
+}
+
+static void benchPushPop(int max_threads)
+{
+	// --- One thread: the main thread, which collects its events between the batches ---
+	{
+		std::vector<uint64_t>	times;
+		for(int batch=0 ; batch < s_nb_batches ; batch++)
+		{
+			times.push_back(timePushPopBatch());
+			profiler.synchronizeFrame();
+		}
+		addResult("push_pop/threads:1", times, NB_MARKERS_PER_BATCH);
+	}
+
+	// --- Past the markers kept per frame: every push is dropped ---
+	{
+		std::vector<uint64_t>	times;
+		for(int batch=0 ; batch < s_nb_batches ; batch++)
+		{
+			// Fill the frame: the pushes of the timed batch are beyond its markers
+			for(int i=0 ; i < NB_MARKERS_PER_BATCH ; i++)
+			{
+				PROFILER_PUSH_CPU_MARKER("Fill", COLOR_GREEN);
+				PROFILER_POP_CPU_MARKER();
+			}
+			times.push_back(timePushPopBatch());
+			profiler.synchronizeFrame();
+		}
+		addResult("push_pop/dropped", times, NB_MARKERS_PER_BATCH);
+	}
+
+	// --- Recording stopped ---
+	{
+		profiler.setRecording(false);
+		std::vector<uint64_t>	times;
+		for(int batch=0 ; batch < s_nb_batches ; batch++)
+			times.push_back(timePushPopBatch());
+		addResult("push_pop/stopped", times, NB_MARKERS_PER_BATCH);
+		profiler.setRecording(true);
+	}
+
+	// --- N threads at the same time ---
+	for(int nb_threads=2 ; nb_threads <= max_threads ; nb_threads *= 2)
+	{
+		size_t		nb_dropped = profiler.getNbDroppedCpuMarkers();
+		uint64_t	start = getTimeNs();
+		poolRun(&pushPopTask, nb_threads, true);
+		uint64_t	elapsed = getTimeNs() - start;
+		nb_dropped = profiler.getNbDroppedCpuMarkers() - nb_dropped;
+
+		std::vector<uint64_t>	times;
+		for(int i=0 ; i < nb_threads ; i++)
+			times.insert(times.end(), s_thread_batch_times[i].begin(), s_thread_batch_times[i].end());
+
+		double	nb_markers = double(nb_threads) * double(s_nb_batches) * double(NB_MARKERS_PER_BATCH);
+		char	name[64];
+		sprintf(name, "push_pop/threads:%d", nb_threads);
+		addResult(name, times, NB_MARKERS_PER_BATCH, nb_markers / (double(elapsed) * 1e-9));
+		if(nb_dropped)
+			printf("    %.1lf%% of the markers dropped\n", 100.0 * double(nb_dropped) / nb_markers);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// timer
+//-----------------------------------------------------------------------------
+static const int	NB_TIMER_CALLS_PER_BATCH = 1000;
+
+#define BENCH_TIMER(name, expression)									\
+	{																	\
+		std::vector<uint64_t>	times;									\
+		for(int batch=0 ; batch < s_nb_batches ; batch++)				\
+		{																\
+			uint64_t	sum = 0;										\
+			uint64_t	start = getTimeNs();							\
+			for(int i=0 ; i < NB_TIMER_CALLS_PER_BATCH ; i++)			\
+				sum += (uint64_t)(expression);							\
+			times.push_back(getTimeNs() - start);						\
+			s_sink = sum;												\
+		}																\
+		addResult(name, times, NB_TIMER_CALLS_PER_BATCH);				\
+	}
+
+#if defined(__linux__)
+static uint64_t clockNs(clockid_t clock_id)
+{
+	struct timespec	ts;
+	clock_gettime(clock_id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t gettimeofdayUs()
+{
+	struct timeval	tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+}
+#endif
+
+static void benchTimers()
+{
+	BENCH_TIMER("timer/getTimeNs", getTimeNs());
+#if defined(_WIN32)
+	LARGE_INTEGER	counter;
+	BENCH_TIMER("timer/QueryPerformanceCounter", (QueryPerformanceCounter(&counter), counter.QuadPart));
+	BENCH_TIMER("timer/GetTickCount", GetTickCount());
+#elif defined(__MACH__)
+	BENCH_TIMER("timer/mach_absolute_time", mach_absolute_time());
+#elif defined(__linux__)
+	BENCH_TIMER("timer/CLOCK_REALTIME", clockNs(CLOCK_REALTIME));
+	BENCH_TIMER("timer/CLOCK_MONOTONIC", clockNs(CLOCK_MONOTONIC));
+	#ifdef CLOCK_MONOTONIC_RAW
+	BENCH_TIMER("timer/CLOCK_MONOTONIC_RAW", clockNs(CLOCK_MONOTONIC_RAW));
+	#endif
+	#ifdef CLOCK_MONOTONIC_COARSE
+	BENCH_TIMER("timer/CLOCK_MONOTONIC_COARSE", clockNs(CLOCK_MONOTONIC_COARSE));
+	#endif
+	BENCH_TIMER("timer/gettimeofday", gettimeofdayUs());
+#endif
+#ifdef HAS_RDTSC
+	BENCH_TIMER("timer/rdtsc", __rdtsc());
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// synchronize_frame
+//-----------------------------------------------------------------------------
+static const int	NB_MARKERS_PER_FRAME = 100;	// Per thread, what the rings are sized for
+
+static void emitFrameMarkers()
+{
+	// A frame of nested markers, 3 levels deep
+	for(int i=0 ; i < NB_MARKERS_PER_FRAME ; i += 4)
+	{
+		PROFILER_PUSH_CPU_MARKER("Level 0", COLOR_RED);
+		PROFILER_PUSH_CPU_MARKER("Level 1", COLOR_GREEN);
+		PROFILER_PUSH_CPU_MARKER("Level 2", COLOR_BLUE);
+		PROFILER_POP_CPU_MARKER();
+		PROFILER_PUSH_CPU_MARKER("Level 2", COLOR_BLUE);
+		PROFILER_POP_CPU_MARKER();
+		PROFILER_POP_CPU_MARKER();
+		PROFILER_POP_CPU_MARKER();
+	}
+}
+
+static void frameTask(int thread_index)
+{
+	emitFrameMarkers();
+}
+
+static void benchSynchronizeFrame()
+{
+	std::vector<uint64_t>	times;
+	for(int batch=0 ; batch < s_nb_batches ; batch++)
+	{
+		poolRun(&frameTask, s_pool.nb_threads, false);
+		emitFrameMarkers();
+
+		uint64_t start = getTimeNs();
+		profiler.synchronizeFrame();
+		times.push_back(getTimeNs() - start);
+
+		profiler.draw();	// invisible: only reads the displayed frame, for pick_markers
+	}
+
+	char	name[64];
+	sprintf(name, "synchronize_frame/threads:%d", (int)ProfilerBench::getNbRecordedThreads());
+	addResult(name, times, 1);
+}
+
+//-----------------------------------------------------------------------------
+// pick_markers
+//-----------------------------------------------------------------------------
+static const int	NB_PICKS_PER_AXIS = 32;
+
+static void benchPickMarkers()
+{
+	if(!ProfilerBench::isViewValid())
+	{
+		printf("pick_markers: no frame to display\n");
+		return;
+	}
+
+	// A grid of points over the lines of the profiler, at the bottom of the window
+	std::vector<uint64_t>	times;
+	size_t					nb_picked = 0;
+	for(int batch=0 ; batch < s_nb_batches ; batch++)
+	{
+		uint64_t start = getTimeNs();
+		for(int y=0 ; y < NB_PICKS_PER_AXIS ; y++)
+		{
+			for(int x=0 ; x < NB_PICKS_PER_AXIS ; x++)
+			{
+				const char*	line_name;
+				nb_picked += ProfilerBench::pickMarkers(float(x) / float(NB_PICKS_PER_AXIS),
+														0.4f * float(y) / float(NB_PICKS_PER_AXIS), &line_name);
+			}
+		}
+		times.push_back(getTimeNs() - start);
+	}
+	s_sink = nb_picked;
+	addResult("pick_markers", times, NB_PICKS_PER_AXIS*NB_PICKS_PER_AXIS);
+}
+
+//-----------------------------------------------------------------------------
+// hole_array
+//-----------------------------------------------------------------------------
+struct BenchElement
+{
+	uint64_t	value;
+	char		pad[56];
+};
+
+static const size_t	HOLE_ARRAY_SIZE = 32;
+static const int	NB_HOLE_ARRAY_LOOPS_PER_BATCH = 1000;
+
+static void benchHoleArray(const char* name, size_t nb_used, bool dense)
+{
+	HoleArray<BenchElement, HOLE_ARRAY_SIZE>	array;
+	for(size_t i=0 ; i < HOLE_ARRAY_SIZE ; i++)
+		array.get(array.add()).value = i;
+
+	// Holes in the middle: only with begin()/next() iterations
+	for(size_t i=nb_used ; i < HOLE_ARRAY_SIZE ; i++)
+		array.remove(dense ? i : (i*7) % HOLE_ARRAY_SIZE);
+
+	std::vector<uint64_t>	times;
+	for(int batch=0 ; batch < s_nb_batches ; batch++)
+	{
+		uint64_t	sum = 0;
+		uint64_t	start = getTimeNs();
+		for(int loop=0 ; loop < NB_HOLE_ARRAY_LOOPS_PER_BATCH ; loop++)
+		{
+			if(dense)
+			{
+				const BenchElement*	elements = array.getPtr();
+				for(size_t i=0 ; i < nb_used ; i++)
+					sum += elements[i].value;
+			}
+			else
+			{
+				for(size_t i=array.begin() ; i != array.getMaxSize() ; i=array.next(i))
+					sum += array.get(i).value;
+			}
+		}
+		times.push_back(getTimeNs() - start);
+		s_sink = sum;
+	}
+	addResult(name, times, NB_HOLE_ARRAY_LOOPS_PER_BATCH);
+}
+
+static void benchHoleArrays()
+{
+	benchHoleArray("hole_array/dense_loop/used:32", 32, true);
+	benchHoleArray("hole_array/next/used:32", 32, false);
+	benchHoleArray("hole_array/next/used:8", 8, false);
+}
+
+//-----------------------------------------------------------------------------
+static bool writeJson(const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if(!file)
+	{
+		fprintf(stderr, "*** FAILED opening %s\n", filename);
+		return false;
+	}
+
+	char		date[64];
+	time_t		now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"context\": {\n");
+	fprintf(file, "    \"date\": \"%s\",\n", date);
+	fprintf(file, "    \"num_cpus\": %d,\n", threadGetNbCores());
+	fprintf(file, "    \"nb_batches\": %d,\n", s_nb_batches);
+	fprintf(file, "    \"marker_overhead_ns\": %.3lf\n", profiler.getMarkerOverheadNs());
+	fprintf(file, "  },\n");
+	fprintf(file, "  \"benchmarks\": [\n");
+	for(size_t i=0 ; i < s_results.size() ; i++)
+	{
+		const Result&	r = s_results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"iterations\": %lu, \"real_time\": %.3lf, \"min_time\": %.3lf, \"time_unit\": \"ns\"",
+				r.name, (unsigned long)r.nb_iterations, r.median_ns, r.min_ns);
+		if(r.items_per_second > 0.0)
+			fprintf(file, ", \"items_per_second\": %.1lf", r.items_per_second);
+		fprintf(file, "}%s\n", i+1 < s_results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+
+	fclose(file);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	const char* json_filename = argc > 1 ? argv[1] : NULL;
+	s_nb_batches = argc > 2 ? atoi(argv[2]) : 200;
+	if(s_nb_batches < 1)
+	{
+		fprintf(stderr, "Usage: %s [output.json] [nb_batches]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	initTimer();
+	threadSetName("Main");
+
+	// No window: the profiler is not drawn, draw() only reads the frames
+	PROFILER_INIT(1280, 720, 0, 0);
+	profiler.setVisible(false);
+
+	poolInit(NB_MAX_THREADS-1);
+	printf("%d cores, %d batches\n\n", threadGetNbCores(), s_nb_batches);
+	printf("%-40s %13s %13s\n", "benchmark", "median", "min");
+
+	benchPushPop(16);
+	benchTimers();
+	benchSynchronizeFrame();
+	benchPickMarkers();
+	benchHoleArrays();
+
+	poolShut();
+	PROFILER_SHUT();
+	shutTimer();
+
+	if(json_filename && !writeJson(json_filename))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+// capture_writer.cpp
+
+#include "capture_writer.h"
+#include "atomic.h"
+
+//-----------------------------------------------------------------------------
+CaptureWriter::CaptureWriter()
+{
+	m_shut = true;
+	m_file = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/// Launch the writer thread
+void CaptureWriter::start()
+{
+	mutexCreate(&m_mutex);
+	eventCreate(&m_command_event);
+
+	m_shut = false;
+	ThreadOptions	options;
+	options.name = "Capture writer";
+	m_thread_handle = threadCreate(&runWrapper, this, options);
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::stop()
+{
+	if(m_shut)
+		return;
+
+	// The writer thread empties the queue before it checks m_shut
+	atomicStoreRelaxed(&m_shut, true);
+	eventTrigger(&m_command_event);
+	threadJoin(m_thread_handle);
+
+	if(m_file)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	eventDestroy(&m_command_event);
+	mutexDestroy(&m_mutex);
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::openFile(const char* filename)
+{
+	std::string	text(filename);
+	queue(COMMAND_OPEN, &text);
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::write(std::string* text)
+{
+	if(!text->empty())
+		queue(COMMAND_WRITE, text);
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::closeFile()
+{
+	queue(COMMAND_CLOSE, NULL);
+}
+
+//-----------------------------------------------------------------------------
+/// Swapping the text in avoids copying it under the lock
+void CaptureWriter::queue(CommandType type, std::string* text)
+{
+	mutexLock(&m_mutex);
+	m_commands.push_back(Command());
+	m_commands.back().type = type;
+	if(text)
+		m_commands.back().text.swap(*text);
+	eventTrigger(&m_command_event);
+	mutexUnlock(&m_mutex);
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::process(Command& command)
+{
+	switch(command.type)
+	{
+	case COMMAND_OPEN:
+		if(m_file)
+			fclose(m_file);
+		m_file = fopen(command.text.c_str(), "w");
+		if(!m_file)
+			fprintf(stderr, "*** CaptureWriter: FAILED opening %s\n", command.text.c_str());
+		break;
+
+	case COMMAND_WRITE:
+		if(m_file && fwrite(command.text.data(), 1, command.text.size(), m_file) != command.text.size())
+		{
+			fprintf(stderr, "*** CaptureWriter: FAILED writing the capture file\n");
+			fclose(m_file);
+			m_file = NULL;
+		}
+		break;
+
+	case COMMAND_CLOSE:
+		if(m_file)
+		{
+			fclose(m_file);
+			m_file = NULL;
+		}
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::run()
+{
+	for(;;)
+	{
+		eventWait(&m_command_event);
+
+		mutexLock(&m_mutex);
+		m_processed_commands.swap(m_commands);
+		eventReset(&m_command_event);
+		mutexUnlock(&m_mutex);
+
+		for(size_t i=0 ; i < m_processed_commands.size() ; i++)
+			process(m_processed_commands[i]);
+		m_processed_commands.clear();
+
+		// Commands queued before stop() are already in m_commands, and trigger the event again
+		if(atomicLoadRelaxed(&m_shut))
+		{
+			mutexLock(&m_mutex);
+			bool empty = m_commands.empty();
+			mutexUnlock(&m_mutex);
+			if(empty)
+				break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void* CaptureWriter::runWrapper(void* user_data)
+{
+	CaptureWriter*	writer = (CaptureWriter*)user_data;
+	writer->run();
+	return NULL;
+}
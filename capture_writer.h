@@ -0,0 +1,59 @@
+// capture_writer.h
+// Writes the capture files of the profiler on a thread of its own, so that synchronizeFrame() does not wait for
+// the disk. The main thread formats the events and queues them, the writer thread opens, fills and closes the
+// files in the order of the queue.
+
+#ifndef CAPTURE_WRITER_H
+#define CAPTURE_WRITER_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "thread.h"
+
+class CaptureWriter
+{
+private:
+	enum CommandType
+	{
+		COMMAND_OPEN = 0,	// text: name of the file
+		COMMAND_WRITE,		// text: data appended to the file
+		COMMAND_CLOSE
+	};
+
+	struct Command
+	{
+		CommandType	type;
+		std::string	text;
+	};
+
+	// --- Queue, written by the main thread, emptied by the writer thread ---
+	std::vector<Command>	m_commands;
+	Mutex					m_mutex;
+	Event					m_command_event;
+
+	ThreadHandle	m_thread_handle;
+	bool			m_shut;
+
+	// --- Only used by the writer thread ---
+	std::vector<Command>	m_processed_commands;
+	FILE*					m_file;	// NULL when no file is open, or when opening it failed
+
+	void	queue(CommandType type, std::string* text);
+	void	process(Command& command);
+	void	run();
+	static void*	runWrapper(void* user_data);
+
+public:
+	CaptureWriter();
+
+	void	start();
+	void	stop();		// Writes what is queued before returning
+
+	// Main thread
+	void	openFile(const char* filename);
+	void	write(std::string* text);	// Takes the content of text, which is left empty
+	void	closeFile();
+};
+
+#endif // CAPTURE_WRITER_H
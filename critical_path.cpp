@@ -0,0 +1,443 @@
+// critical_path.cpp
+
+#include "critical_path.h"
+#include "atomic.h"
+#include <assert.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+CriticalPathAnalyzer::CriticalPathAnalyzer()
+{
+	m_frame = -1;
+	m_frame_start = 0;
+	m_frame_end = 0;
+	m_main_line = 0;
+	m_nb_markers = 0;
+	m_nb_flow_points = 0;
+	m_in_frame = false;
+	m_busy = false;
+	m_next_path = 0;
+	m_shut = true;
+}
+
+//-----------------------------------------------------------------------------
+/// Launch the analyzer thread
+void CriticalPathAnalyzer::start()
+{
+	mutexCreate(&m_mutex);
+	eventCreate(&m_frame_event);
+
+	m_shut = false;
+	ThreadOptions	options;
+	options.name = "Critical path";
+	m_thread_handle = threadCreate(&runWrapper, this, options);
+}
+
+//-----------------------------------------------------------------------------
+void CriticalPathAnalyzer::stop()
+{
+	if(m_shut)
+		return;
+
+	atomicStoreRelaxed(&m_shut, true);
+	eventTrigger(&m_frame_event);	// wake up the analyzer thread if it waits for a frame
+	threadJoin(m_thread_handle);
+
+	eventDestroy(&m_frame_event);
+	mutexDestroy(&m_mutex);
+}
+
+//-----------------------------------------------------------------------------
+/// Start copying a frame. Returns false if the frame is skipped.
+bool CriticalPathAnalyzer::beginFrame(int frame, uint64_t start, uint64_t end, size_t main_line)
+{
+	assert(!m_in_frame);
+
+	mutexLock(&m_mutex);
+	bool busy = m_busy;
+	mutexUnlock(&m_mutex);
+
+	if(busy)
+		return false;
+
+	m_frame = frame;
+	m_frame_start = start;
+	m_frame_end = end;
+	m_main_line = main_line;
+	m_nb_markers = 0;
+	m_nb_flow_points = 0;
+	m_in_frame = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+/// The markers are clamped to the frame, the ones out of it are ignored. wait: the thread was blocked, not working.
+void CriticalPathAnalyzer::addMarker(size_t line, const char* name, uint64_t start, uint64_t end, bool wait)
+{
+	assert(m_in_frame);
+	assert((m_nb_markers == 0 || m_markers[m_nb_markers-1].line <= line) && "the markers must be sorted by line");
+
+	if(line >= NB_MAX_LINES || m_nb_markers == NB_MAX_MARKERS)
+		return;
+	if(end <= m_frame_start || start >= m_frame_end)
+		return;
+
+	Marker&	marker = m_markers[m_nb_markers++];
+	marker.line = line;
+	marker.start = (start < m_frame_start) ? m_frame_start : start;
+	marker.end = (end > m_frame_end) ? m_frame_end : end;
+	marker.wait = wait;
+	strncpy(marker.name, name, NAME_MAX_LENGTH);
+	marker.name[NAME_MAX_LENGTH-1] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+/// Flow points of the frame and of the previous one, where the begins of the flows may be
+void CriticalPathAnalyzer::addFlowPoint(size_t line, bool begin, uint32_t id, uint64_t time)
+{
+	assert(m_in_frame);
+
+	if(line >= NB_MAX_LINES || m_nb_flow_points == NB_MAX_FLOW_POINTS)
+		return;
+
+	FlowPoint&	point = m_flow_points[m_nb_flow_points++];
+	point.line = line;
+	point.time = time;
+	point.id = id;
+	point.begin = begin;
+}
+
+//-----------------------------------------------------------------------------
+/// Hand the frame to the analyzer thread
+void CriticalPathAnalyzer::endFrame()
+{
+	assert(m_in_frame);
+	m_in_frame = false;
+
+	mutexLock(&m_mutex);
+	m_busy = true;
+	eventTrigger(&m_frame_event);
+	mutexUnlock(&m_mutex);
+}
+
+//-----------------------------------------------------------------------------
+bool CriticalPathAnalyzer::getPath(int frame, Path* path)
+{
+	bool found = false;
+
+	mutexLock(&m_mutex);
+	for(size_t i=0 ; i < NB_PATHS && !found ; i++)
+	{
+		if(m_paths[i].frame == frame)
+		{
+			*path = m_paths[i];
+			found = true;
+		}
+	}
+	mutexUnlock(&m_mutex);
+
+	return found;
+}
+
+//-----------------------------------------------------------------------------
+/// Find the critical path of the frame into m_path
+void CriticalPathAnalyzer::analyze()
+{
+	m_path.frame = m_frame;
+	m_path.nb_steps = 0;
+	m_path.truncated = false;
+
+	// --- Markers of each line ---
+	size_t m = 0;
+	for(size_t line=0 ; line <= NB_MAX_LINES ; line++)
+	{
+		m_line_first_marker[line] = m;
+		while(m < m_nb_markers && m_markers[m].line == line)
+			m++;
+	}
+
+	for(size_t line=0 ; line < NB_MAX_LINES ; line++)
+		sortWorkEnds(line);
+
+	matchFlows();
+
+	// --- Walk back from the end of the frame, the segments are found from the last to the first ---
+	size_t		nb_segments = 0;
+	size_t		line = m_main_line;
+	uint64_t	time = m_frame_end;
+	while(time > m_frame_start && line < NB_MAX_LINES)
+	{
+		// Most recent flow that ends on this line before the current time
+		const Flow*	flows = &m_flows[m_line_first_flow[line]];
+		size_t&		nb_flows = m_line_nb_flows[line];
+		while(nb_flows > 0 && flows[nb_flows-1].end_time > time)
+			nb_flows--;
+
+		if(nb_flows == 0)
+		{
+			Segment&	segment = m_segments[nb_segments++];
+			segment.line = line;
+			segment.start = m_frame_start;
+			segment.end = time;
+			break;
+		}
+
+		const Flow&	flow = flows[--nb_flows];
+
+		// The thread did something else in the meantime: it did not wait for this flow
+		if(workedBetween(line, flow.begin_time, flow.end_time))
+			continue;
+
+		if(flow.end_time < time)
+		{
+			Segment&	segment = m_segments[nb_segments++];
+			segment.line = line;
+			segment.start = flow.end_time;
+			segment.end = time;
+		}
+
+		line = flow.begin_line;
+		time = flow.begin_time;
+	}
+
+	// --- Name the segments after the innermost markers, in time order ---
+	for(size_t l=0 ; l < NB_MAX_LINES ; l++)
+	{
+		m_next_marker[l] = m_line_first_marker[l];
+		m_nb_open[l] = 0;
+	}
+
+	for(size_t s=nb_segments ; s > 0 ; s--)
+		addSteps(m_segments[s-1]);
+}
+
+//-----------------------------------------------------------------------------
+/// Find the begin of the flows that end in the frame, and group them by end line.
+/// The begin of a flow is the most recent begin with the same id: ids are usually used once.
+void CriticalPathAnalyzer::matchFlows()
+{
+	static const uint32_t	SLOT_MASK = NB_FLOW_SLOTS-1;
+
+	// --- Most recent begin of each id, in an open addressing hash table ---
+	memset(m_flow_slots, 0, sizeof(m_flow_slots));
+	for(size_t p=0 ; p < m_nb_flow_points ; p++)
+	{
+		const FlowPoint&	point = m_flow_points[p];
+		if(!point.begin)
+			continue;
+
+		uint32_t slot = (point.id * 2654435761u) & SLOT_MASK;
+		while(m_flow_slots[slot] && m_flow_points[m_flow_slots[slot]-1].id != point.id)
+			slot = (slot+1) & SLOT_MASK;
+
+		if(!m_flow_slots[slot] || m_flow_points[m_flow_slots[slot]-1].time < point.time)
+			m_flow_slots[slot] = p+1;
+	}
+
+	// --- Counting sort of the flows by end line: count, then place them ---
+	for(size_t line=0 ; line < NB_MAX_LINES ; line++)
+		m_line_nb_flows[line] = 0;
+
+	for(int pass=0 ; pass < 2 ; pass++)
+	{
+		for(size_t p=0 ; p < m_nb_flow_points ; p++)
+		{
+			const FlowPoint&	end = m_flow_points[p];
+			if(end.begin || end.time < m_frame_start || end.time > m_frame_end)
+				continue;
+
+			uint32_t slot = (end.id * 2654435761u) & SLOT_MASK;
+			while(m_flow_slots[slot] && m_flow_points[m_flow_slots[slot]-1].id != end.id)
+				slot = (slot+1) & SLOT_MASK;
+			if(!m_flow_slots[slot])
+				continue;
+
+			const FlowPoint&	begin = m_flow_points[m_flow_slots[slot]-1];
+			if(begin.line == end.line || begin.time > end.time)
+				continue;
+
+			size_t index = m_line_nb_flows[end.line]++;
+			if(pass == 1)
+			{
+				Flow&	flow = m_flows[m_line_first_flow[end.line] + index];
+				flow.begin_line = begin.line;
+				flow.begin_time = begin.time;
+				flow.end_time = end.time;
+			}
+		}
+
+		if(pass == 0)
+		{
+			size_t first = 0;
+			for(size_t line=0 ; line < NB_MAX_LINES ; line++)
+			{
+				m_line_first_flow[line] = first;
+				first += m_line_nb_flows[line];
+				m_line_nb_flows[line] = 0;
+			}
+			m_line_first_flow[NB_MAX_LINES] = first;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Sort the end times of the markers of a line, but the waits. The markers of a thread are nested,
+/// so they close in the order of a stack sweep.
+void CriticalPathAnalyzer::sortWorkEnds(size_t line)
+{
+	size_t		first = m_line_first_marker[line];
+	size_t		last = m_line_first_marker[line+1];
+	size_t*		stack = &m_stacks[first];
+	uint64_t*	ends = &m_work_ends[first];
+	size_t		nb_open = 0;
+	size_t		nb_ends = 0;
+
+	for(size_t m=first ; m <= last ; m++)
+	{
+		// Close the markers that ended before this one started, all of them after the last one
+		while(nb_open > 0 && (m == last || m_markers[stack[nb_open-1]].end <= m_markers[m].start))
+		{
+			const Marker&	closed = m_markers[stack[--nb_open]];
+			if(!closed.wait)
+				ends[nb_ends++] = closed.end;
+		}
+
+		if(m < last)
+			stack[nb_open++] = m;
+	}
+
+	m_line_nb_work_ends[line] = nb_ends;
+}
+
+//-----------------------------------------------------------------------------
+/// Did a marker but the waits end in ]start, end]? The calls for a line must have decreasing end times.
+bool CriticalPathAnalyzer::workedBetween(size_t line, uint64_t start, uint64_t end)
+{
+	const uint64_t*	ends = &m_work_ends[m_line_first_marker[line]];
+	size_t&			nb_ends = m_line_nb_work_ends[line];
+	while(nb_ends > 0 && ends[nb_ends-1] > end)
+		nb_ends--;
+
+	return nb_ends > 0 && ends[nb_ends-1] > start;
+}
+
+//-----------------------------------------------------------------------------
+/// Split a segment of the path by innermost marker. The calls for a line must follow the time order.
+void CriticalPathAnalyzer::addSteps(const Segment& segment)
+{
+	size_t			line = segment.line;
+	size_t			last = m_line_first_marker[line+1];
+	size_t*			stack = &m_stacks[m_line_first_marker[line]];
+	size_t&			nb_open = m_nb_open[line];
+	size_t&			next = m_next_marker[line];
+
+	uint64_t time = segment.start;
+	while(time < segment.end)
+	{
+		// Markers open at this time
+		while(true)
+		{
+			if(nb_open > 0 && m_markers[stack[nb_open-1]].end <= time)
+				nb_open--;
+			else if(next < last && m_markers[next].start <= time)
+				stack[nb_open++] = next++;
+			else
+				break;
+		}
+
+		// Until the innermost marker ends or another one starts
+		uint64_t change = segment.end;
+		if(nb_open > 0 && m_markers[stack[nb_open-1]].end < change)
+			change = m_markers[stack[nb_open-1]].end;
+		if(next < last && m_markers[next].start < change)
+			change = m_markers[next].start;
+
+		addStep(line, time, change, nb_open > 0 ? m_markers[stack[nb_open-1]].name : "");
+		time = change;
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Append a step to the path, or extend the last one if it is the same marker on the same line.
+/// Short steps, e.g. the gaps between two markers, are merged with the previous step on the same line:
+/// the longer one gives its name.
+void CriticalPathAnalyzer::addStep(size_t line, uint64_t start, uint64_t end, const char* name)
+{
+	if(m_path.nb_steps > 0)
+	{
+		Step&	last = m_path.steps[m_path.nb_steps-1];
+		if(last.line == line && last.end == start)
+		{
+			if(strcmp(last.name, name) == 0 || end - start < MIN_STEP_NS)
+			{
+				last.end = end;
+				return;
+			}
+			if(last.end - last.start < MIN_STEP_NS)
+			{
+				last.end = end;
+				strcpy(last.name, name);
+
+				// The previous step may now have the same name
+				if(m_path.nb_steps > 1)
+				{
+					Step&	prev = m_path.steps[m_path.nb_steps-2];
+					if(prev.line == line && prev.end == last.start && strcmp(prev.name, name) == 0)
+					{
+						prev.end = end;
+						m_path.nb_steps--;
+					}
+				}
+				return;
+			}
+		}
+	}
+
+	if(m_path.nb_steps == NB_MAX_STEPS)
+	{
+		m_path.truncated = true;
+		return;
+	}
+
+	Step&	step = m_path.steps[m_path.nb_steps++];
+	step.line = line;
+	step.start = start;
+	step.end = end;
+	strcpy(step.name, name);
+}
+
+//-----------------------------------------------------------------------------
+void CriticalPathAnalyzer::run()
+{
+	while(!atomicLoadRelaxed(&m_shut))
+	{
+		eventWait(&m_frame_event);
+
+		mutexLock(&m_mutex);
+		bool busy = m_busy;
+		if(!busy)
+			eventReset(&m_frame_event);
+		mutexUnlock(&m_mutex);
+
+		if(!busy)
+			continue;
+
+		// The main thread does not touch the frame while m_busy is set
+		analyze();
+
+		mutexLock(&m_mutex);
+		m_paths[m_next_path] = m_path;
+		m_next_path = (m_next_path + 1) % NB_PATHS;
+		m_busy = false;
+		eventReset(&m_frame_event);
+		mutexUnlock(&m_mutex);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void* CriticalPathAnalyzer::runWrapper(void* user_data)
+{
+	CriticalPathAnalyzer*	analyzer = (CriticalPathAnalyzer*)user_data;
+	analyzer->run();
+	return NULL;
+}
@@ -0,0 +1,144 @@
+// critical_path.h
+// Critical path of the profiled frames: the chain of CPU markers, across the threads, that bounded each frame.
+// The main thread copies the markers and the flow points of each complete frame, a thread of its own analyzes them.
+//
+// The analysis walks back from the end of the frame on the main thread. At the end of a flow that comes from
+// another thread, it jumps to the begin of the flow if the thread was waiting for it, i.e. if the thread finished
+// no marker but waits between the begin and the end of the flow. Each step of the path is the innermost marker
+// of its thread during that time. It costs O(markers + flow points) per frame.
+
+#ifndef CRITICAL_PATH_H
+#define CRITICAL_PATH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread.h"
+
+class CriticalPathAnalyzer
+{
+public:
+	static const size_t	NAME_MAX_LENGTH = 32;
+	static const size_t	NB_MAX_LINES = 64;
+	static const size_t	NB_MAX_STEPS = 64;		// Per path: the following steps are dropped
+	static const size_t	NB_PATHS = 16;			// Paths of the most recent frames, kept for the exports
+	static const uint64_t	MIN_STEP_NS = 10000;	// Shorter steps are merged with the previous step on the same line
+
+	struct Step
+	{
+		size_t		line;
+		uint64_t	start;
+		uint64_t	end;
+		char		name[NAME_MAX_LENGTH];	// Innermost marker, "" when the thread had no open marker
+	};
+
+	struct Path
+	{
+		int		frame;
+		size_t	nb_steps;
+		Step	steps[NB_MAX_STEPS];	// In time order
+		bool	truncated;				// More than NB_MAX_STEPS steps
+
+		Path() : frame(-1), nb_steps(0), truncated(false) {}
+	};
+
+private:
+	static const size_t	NB_MAX_MARKERS = 4096;		// Per frame, all the lines
+	static const size_t	NB_MAX_FLOW_POINTS = 2048;	// Per frame, all the lines
+	static const size_t	NB_FLOW_SLOTS = 4096;		// Hash table of the begins, a power of 2
+
+	struct Marker
+	{
+		size_t		line;
+		uint64_t	start;
+		uint64_t	end;
+		bool		wait;
+		char		name[NAME_MAX_LENGTH];
+	};
+
+	struct FlowPoint
+	{
+		size_t		line;
+		uint64_t	time;
+		uint32_t	id;
+		bool		begin;
+	};
+
+	struct Flow
+	{
+		size_t		begin_line;
+		uint64_t	begin_time;
+		uint64_t	end_time;
+	};
+
+	struct Segment
+	{
+		size_t		line;
+		uint64_t	start;
+		uint64_t	end;
+	};
+
+	// --- Frame built by the main thread, then read by the analyzer thread while m_busy is set ---
+	int			m_frame;
+	uint64_t	m_frame_start;
+	uint64_t	m_frame_end;
+	size_t		m_main_line;
+	Marker		m_markers[NB_MAX_MARKERS];		// Grouped by line, in start order
+	size_t		m_nb_markers;
+	FlowPoint	m_flow_points[NB_MAX_FLOW_POINTS];
+	size_t		m_nb_flow_points;
+	bool		m_in_frame;						// Main thread only
+
+	// --- Analyzer thread only ---
+	size_t		m_line_first_marker[NB_MAX_LINES+1];	// Markers of line L: [m_line_first_marker[L], m_line_first_marker[L+1])
+	uint64_t	m_work_ends[NB_MAX_MARKERS];			// Same ranges: end times of the markers but the waits, sorted
+	size_t		m_line_nb_work_ends[NB_MAX_LINES];		// Decreases during the walk, which goes back in time
+	size_t		m_stacks[NB_MAX_MARKERS];				// Same ranges: markers open during a sweep
+	size_t		m_nb_open[NB_MAX_LINES];
+	size_t		m_next_marker[NB_MAX_LINES];
+	size_t		m_flow_slots[NB_FLOW_SLOTS];			// Index+1 of the most recent begin of each id, 0 if none
+	size_t		m_line_first_flow[NB_MAX_LINES+1];
+	Flow		m_flows[NB_MAX_FLOW_POINTS];			// Grouped by end line, in end order
+	size_t		m_line_nb_flows[NB_MAX_LINES];			// Decreases during the walk, like m_line_nb_work_ends
+	Segment		m_segments[NB_MAX_FLOW_POINTS+1];
+	Path		m_path;
+
+	// --- Shared, protected by m_mutex ---
+	bool		m_busy;					// A frame waits for its analysis or is being analyzed
+	Path		m_paths[NB_PATHS];
+	size_t		m_next_path;
+	Mutex		m_mutex;
+	Event		m_frame_event;
+
+	ThreadHandle	m_thread_handle;
+	bool			m_shut;				// Written by the main thread, polled by the analyzer thread
+
+public:
+	CriticalPathAnalyzer();
+
+	void	start();
+	void	stop();
+
+	// Main thread. When beginFrame() returns false, the previous frame is still being analyzed:
+	// nothing else must be called for this one. The markers must be added by ascending line, each line in start order,
+	// and the flow points of each line in time order. main_line is the line of the thread that ends the frames.
+	bool	beginFrame(int frame, uint64_t start, uint64_t end, size_t main_line);
+	void	addMarker(size_t line, const char* name, uint64_t start, uint64_t end, bool wait);
+	void	addFlowPoint(size_t line, bool begin, uint32_t id, uint64_t time);
+	void	endFrame();
+
+	// Any thread: copy the path of a recently analyzed frame, false if there is none
+	bool	getPath(int frame, Path* path);
+
+private:
+	void	analyze();
+	void	matchFlows();
+	void	sortWorkEnds(size_t line);
+	bool	workedBetween(size_t line, uint64_t start, uint64_t end);
+	void	addSteps(const Segment& segment);
+	void	addStep(size_t line, uint64_t start, uint64_t end, const char* name);
+
+	void	run();
+	static void*	runWrapper(void* user_data);
+};
+
+#endif // CRITICAL_PATH_H
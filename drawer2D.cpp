@@ -81,12 +81,44 @@ void Drawer2D::drawRect(const Rect& rect, const Color& color, float alpha)
 	glUniform4fv(m_id_uniform_color, 1, color_array);
 
 	glDrawArrays(GL_TRIANGLES, 0, 6);
+	m_nb_draw_calls++;
+	m_nb_uploaded_bytes += sizeof(vertices);
 
 	glDisableVertexAttribArray(ATTRIB_VERTEX);
 }
 
 //-----------------------------------------------------------------------------
-void Drawer2D::drawString(const char* str, float x, float y, const Color& color)
+void Drawer2D::drawLine(float x1, float y1, float x2, float y2, const Color& color)
+{
+	glEnableVertexAttribArray(ATTRIB_VERTEX);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_id_vbo);
+
+	GLfloat vertices[] = {
+		x1, y1,
+		x2, y2
+	};
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), (const GLvoid*)vertices, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(ATTRIB_VERTEX, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+
+	glUseProgram(m_id_prog_color);
+
+	float color_array[] = {(float)(color.r) / 255.0f,
+						   (float)(color.g) / 255.0f,
+						   (float)(color.b) / 255.0f,
+						   1.0f
+						  };
+	glUniform4fv(m_id_uniform_color, 1, color_array);
+
+	glDrawArrays(GL_LINES, 0, 2);
+	m_nb_draw_calls++;
+	m_nb_uploaded_bytes += sizeof(vertices);
+
+	glDisableVertexAttribArray(ATTRIB_VERTEX);
+}
+
+//-----------------------------------------------------------------------------
+void Drawer2D::drawString(const char* str, float x, float y, const Color& color, float scale)
 {
 	glEnableVertexAttribArray(ATTRIB_VERTEX);
 	glEnableVertexAttribArray(ATTRIB_UV);
@@ -99,8 +131,8 @@ void Drawer2D::drawString(const char* str, float x, float y, const Color& color)
 	const float uv_stride = 1.0f / (float)nb_chars_side;	// 0.0625: how much we need to add to the UV
 															// coordinates to go to the next character
 
-	const float screen_char_width	= (float)char_size / (float)m_win_w;	// size of one character in the
-	const float screen_char_height	= (float)char_size / (float)m_win_h;	// [0;1]x[0;1] screen-space basis
+	const float screen_char_width	= scale * (float)char_size / (float)m_win_w;	// size of one character in the
+	const float screen_char_height	= scale * (float)char_size / (float)m_win_h;	// [0;1]x[0;1] screen-space basis
 
 	glUseProgram(m_id_prog_font);
 
@@ -162,6 +194,8 @@ void Drawer2D::drawString(const char* str, float x, float y, const Color& color)
 			glVertexAttribPointer(ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, 0, (void*)(6*2*sizeof(GLfloat)) );
 
 			glDrawArrays(GL_TRIANGLES, 0, 6);
+			m_nb_draw_calls++;
+			m_nb_uploaded_bytes += sizeof(vertices);
 
 			//cur_x += screen_char_width;
 			cur_x += 0.9f*screen_char_width;	// HACK
@@ -32,8 +32,12 @@ private:
 	int		m_win_w;
 	int		m_win_h;
 
+	// Statistics, until the next call to resetStats()
+	size_t	m_nb_draw_calls;
+	size_t	m_nb_uploaded_bytes;
+
 public:
-	Drawer2D() {}
+	Drawer2D() : m_nb_draw_calls(0), m_nb_uploaded_bytes(0) {}
 
 	bool	init(int win_w, int win_h);
 	void	shut();
@@ -41,7 +45,12 @@ public:
 	void	onResize(int win_w, int win_h)	{m_win_w = win_w;	m_win_h = win_h;	}
 
 	void	drawRect(const Rect& rect, const Color& color=COLOR_WHITE, float alpha=1.0f);
-	void	drawString(const char* str, float x, float y, const Color& color=COLOR_WHITE);
+	void	drawLine(float x1, float y1, float x2, float y2, const Color& color=COLOR_WHITE);
+	void	drawString(const char* str, float x, float y, const Color& color=COLOR_WHITE, float scale=1.0f);	// scale 1: 16x16 pixels
+
+	size_t	getNbDrawCalls() const		{return m_nb_draw_calls;}
+	size_t	getNbUploadedBytes() const	{return m_nb_uploaded_bytes;}
+	void	resetStats()				{m_nb_draw_calls = m_nb_uploaded_bytes = 0;}
 
 private:
 	bool	initFont();
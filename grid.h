@@ -1,66 +1,49 @@
 // grid.h
+// Simulation of one animated grid. All the grids are drawn with the same GridMesh.
 
 #ifndef GRID_H
 #define GRID_H
 
-#include <GL/glew.h>
-
 #include "camera.h"
 #include "utils.h"
 
+struct GridWaveParams;
+
 class Grid
 {
-private:
+public:
 	static const int	GRID_WIDTH;
 	static const int	GRID_HEIGHT;
 
-	static const int	GRID_NB_INDICES;
-
 	static const float	GRID_WORLD_SIZE;
 
+private:
 	static const float	GRID_Y_FLOOR;
 	static const float	GRID_Y_DISTO;
 
-	struct Vertex
-	{
-		GLfloat pos[3];
-		GLfloat col[3];
-	};
-
-	Vertex*	m_grid_vertices;
-	GLuint*	m_grid_indices;
-	float*	m_grid_temp_buffer;
+	float*	m_heights;		// GRID_WIDTH*GRID_HEIGHT, part of the array of all the grids, uploaded at once
 
 	float	m_time_offset;
 
-	// Shader IDs
-	GLuint	m_id_vert_grid;
-	GLuint	m_id_frag_grid;
-	GLuint	m_id_prog_grid;
-
-	// Shader uniforms
-	GLint	m_id_uniform_mvp;
-
-	// VBO/IBO
-	GLuint	m_id_ibo_grid;
-	GLuint	m_id_vbo_grid;
-
 	Camera	m_camera;
 
 	Color	m_color;
 
 public:
 	Grid();
-	bool	init(float time_offset, const Color& color);
-	void	shut();
+	void	init(float time_offset, const Color& color, float* heights);
 
 	const	Color&	getColor() const	{return m_color;}
+			int		getNbRows() const	{return GRID_HEIGHT;}
 
 	const	Camera&	getCamera() const	{return m_camera;}
 			Camera&	getCamera()			{return m_camera;}
 
 	void	update(double elapsed, double t);
-	void	draw(const float mvp_matrix[16]);
+	void	updateRows(double t, int first_row, int end_row);	// Rows [first_row, end_row), can run in parallel
+
+	// Parameters of the wave at time t, also used by the vertex shader in GPU mode
+	void	getWaveParams(double t, GridWaveParams& params) const;
 };
 
 #endif // GRID_H
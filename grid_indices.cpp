@@ -0,0 +1,149 @@
+// grid_indices.cpp
+
+#include "grid_indices.h"
+#include <assert.h>
+
+const char* gridGetIndexLayoutName(GridIndexLayout layout)
+{
+	static const char* const	names[NB_GRID_INDEX_LAYOUTS] = {"triangles 32-bit", "strips 32-bit", "strips 16-bit"};
+	return (layout >= 0 && layout < NB_GRID_INDEX_LAYOUTS) ? names[layout] : "unknown";
+}
+
+//-----------------------------------------------------------------------------
+void gridBuildTriangles(int width, int height, std::vector<uint32_t>& indices)
+{
+	indices.clear();
+	indices.reserve(6 * (size_t)(width-1) * (size_t)(height-1));
+
+	for(uint32_t x=0 ; x < (uint32_t)(width-1) ; x++)
+	{
+		for(uint32_t y=0 ; y < (uint32_t)(height-1) ; y++)
+		{
+			uint32_t bottom_left	= x     + y    *(uint32_t)width;
+			uint32_t bottom_right	= (x+1) + y    *(uint32_t)width;
+			uint32_t top_right		= (x+1) + (y+1)*(uint32_t)width;
+			uint32_t top_left		= x     + (y+1)*(uint32_t)width;
+
+			indices.push_back(bottom_left);
+			indices.push_back(bottom_right);
+			indices.push_back(top_right);
+
+			indices.push_back(bottom_left);
+			indices.push_back(top_right);
+			indices.push_back(top_left);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void gridBuildStrips(int width, int height, int block_width, uint32_t restart_index, std::vector<uint32_t>& indices)
+{
+	int nb_quads_x = width-1;
+	if(block_width <= 0 || block_width > nb_quads_x)
+		block_width = nb_quads_x;
+
+	indices.clear();
+
+	// Block by block, each block from the first row to the last one
+	for(int first_x=0 ; first_x < nb_quads_x ; first_x += block_width)
+	{
+		int end_x = first_x + block_width;
+		if(end_x > nb_quads_x)
+			end_x = nb_quads_x;
+
+		for(int y=0 ; y < height-1 ; y++)
+		{
+			if(!indices.empty())
+				indices.push_back(restart_index);
+
+			// top_left, bottom_left, top_right, bottom_right...: same winding as the triangles
+			for(int x=first_x ; x <= end_x ; x++)
+			{
+				indices.push_back((uint32_t)(x + (y+1)*width));
+				indices.push_back((uint32_t)(x + y*width));
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void appendStrips16(int width, int height, int block_width, std::vector<uint16_t>& indices)
+{
+	std::vector<uint32_t>	indices32;
+	gridBuildStrips(width, height, block_width, GRID_RESTART_INDEX_16, indices32);
+	for(size_t i=0 ; i < indices32.size() ; i++)
+	{
+		assert(indices32[i] <= GRID_RESTART_INDEX_16);
+		indices.push_back((uint16_t)indices32[i]);
+	}
+}
+
+void gridBuildStrips16(int width, int height, int block_width, GridBands16& bands)
+{
+	// Vertex indices go up to 0xFFFE: 0xFFFF is the restart index
+	int max_rows = (int)(GRID_RESTART_INDEX_16 / (uint32_t)width);
+	assert(max_rows >= 2 && "grid too wide for 16-bit indices");
+
+	bands.band_rows = (height < max_rows ? height : max_rows);
+	bands.nb_bands = (height-1 + bands.band_rows-2) / (bands.band_rows-1);
+
+	bands.indices.clear();
+	appendStrips16(width, bands.band_rows, block_width, bands.indices);
+	bands.nb_band_indices = bands.indices.size();
+
+	int last_band_rows = height - bands.getFirstRow(bands.nb_bands-1);
+	if(last_band_rows == bands.band_rows)
+	{
+		bands.last_band_offset = 0;
+		bands.nb_last_band_indices = bands.nb_band_indices;
+	}
+	else
+	{
+		bands.last_band_offset = bands.indices.size();
+		appendStrips16(width, last_band_rows, block_width, bands.indices);
+		bands.nb_last_band_indices = bands.indices.size() - bands.last_band_offset;
+	}
+}
+
+//-----------------------------------------------------------------------------
+float gridComputeACMR(const uint32_t* indices, size_t nb_indices, bool strips, uint32_t restart_index, int cache_size)
+{
+	assert(cache_size > 0);
+	std::vector<uint32_t>	cache(cache_size, restart_index);	// FIFO
+	size_t	next_entry = 0;
+	size_t	nb_transformed = 0;
+	size_t	nb_triangles = 0;
+	size_t	nb_strip_vertices = 0;
+
+	for(size_t i=0 ; i < nb_indices ; i++)
+	{
+		uint32_t index = indices[i];
+		if(strips && index == restart_index)
+		{
+			nb_strip_vertices = 0;
+			continue;
+		}
+
+		bool hit = false;
+		for(int j=0 ; j < cache_size && !hit ; j++)
+			hit = (cache[j] == index);
+		if(!hit)
+		{
+			cache[next_entry] = index;
+			next_entry = (next_entry+1) % (size_t)cache_size;
+			nb_transformed++;
+		}
+
+		if(strips)
+		{
+			if(++nb_strip_vertices >= 3)
+				nb_triangles++;
+		}
+		else if(i % 3 == 2)
+		{
+			nb_triangles++;
+		}
+	}
+
+	return nb_triangles ? float(nb_transformed) / float(nb_triangles) : 0.0f;
+}
@@ -0,0 +1,57 @@
+// grid_indices.h
+// Index buffers for a grid of width x height vertices, in several layouts, and a model of the
+// post-transform vertex cache to compare them. No OpenGL in here, so that the benchmarks can use it.
+
+#ifndef GRID_INDICES_H
+#define GRID_INDICES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+enum GridIndexLayout
+{
+	GRID_INDICES_TRIANGLES = 0,	// Independent triangles, 32-bit, column by column
+	GRID_INDICES_STRIPS,		// Strips + primitive restart, 32-bit
+	GRID_INDICES_STRIPS_16,		// Strips + primitive restart, 16-bit, in bands of rows drawn with a base vertex
+	NB_GRID_INDEX_LAYOUTS
+};
+
+static const uint32_t	GRID_RESTART_INDEX_32 = 0xFFFFFFFF;
+static const uint32_t	GRID_RESTART_INDEX_16 = 0xFFFF;
+
+const char*	gridGetIndexLayoutName(GridIndexLayout layout);
+
+// Two triangles per quad, 6 indices per quad
+void	gridBuildTriangles(int width, int height, std::vector<uint32_t>& indices);
+
+// One strip per row of quads, cut into blocks of block_width quads: the vertices of the previous row
+// of the block are still in the vertex cache when the next row uses them. block_width <= 0 means whole rows.
+// The strips are separated by restart_index.
+void	gridBuildStrips(int width, int height, int block_width, uint32_t restart_index, std::vector<uint32_t>& indices);
+
+// Strips with 16-bit indices: the grid is cut into bands of rows that 16-bit indices can address.
+// All the bands have the same indices, relative to their first vertex, except maybe the last one
+// which has fewer rows: it gets its own indices after those of a full band.
+struct GridBands16
+{
+	std::vector<uint16_t>	indices;
+	int						band_rows;				// Rows of vertices per band: consecutive bands share a row
+	int						nb_bands;
+	size_t					nb_band_indices;
+	size_t					last_band_offset;		// In indices
+	size_t					nb_last_band_indices;
+
+	int		getFirstRow(int band) const				{return band * (band_rows-1);}
+	size_t	getOffset(int band) const				{return band == nb_bands-1 ? last_band_offset : 0;}
+	size_t	getNbIndices(int band) const			{return band == nb_bands-1 ? nb_last_band_indices : nb_band_indices;}
+};
+
+void	gridBuildStrips16(int width, int height, int block_width, GridBands16& bands);
+
+// Average number of vertices transformed per triangle (ACMR) with a FIFO cache of cache_size entries:
+// 0.5 is the minimum for a large grid, 3 means no reuse at all.
+// strips: the indices are triangle strips separated by restart_index, otherwise a triangle list.
+float	gridComputeACMR(const uint32_t* indices, size_t nb_indices, bool strips, uint32_t restart_index, int cache_size);
+
+#endif // GRID_INDICES_H
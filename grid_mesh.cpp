@@ -0,0 +1,255 @@
+// grid_mesh.cpp
+
+#include "grid_mesh.h"
+#include "grid_simd.h"
+#include "utils.h"
+#include <stdio.h>
+#include <vector>
+
+const int	GridMesh::STRIP_BLOCK_WIDTH = 6;
+
+// Attribute locations, see grid.vert and grid_gpu.vert
+enum
+{
+	ATTRIB_POSITION_XZ = 0,
+	ATTRIB_SHADE,
+	ATTRIB_INSTANCE_OFFSET_PHASES,
+	ATTRIB_INSTANCE_COLOR,
+	NB_ATTRIBS
+};
+
+// Release the shaders of a mode, when init() fails after loading them
+static void deleteShaders(GLuint id_vert, GLuint id_frag, GLuint id_prog)
+{
+	glDeleteProgram(id_prog);
+	glDeleteShader(id_frag);
+	glDeleteShader(id_vert);
+}
+
+GridMesh::GridMesh()
+{
+	m_width = 0;
+	m_height = 0;
+	m_max_instances = 0;
+	m_index_layout = GRID_INDICES_STRIPS_16;
+}
+
+bool GridMesh::init(int width, int height, float world_size, int max_instances)
+{
+	m_width = width;
+	m_height = height;
+	m_max_instances = max_instances;
+
+	// The heights of all the instances must fit in the buffer texture
+	GLint max_texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	if((double)width * (double)height * (double)max_instances > (double)max_texels)
+	{
+		fprintf(stderr, "*** GridMesh::init: %d grids of %dx%d do not fit in a buffer texture (%d texels max)\n",
+				max_instances, width, height, max_texels);
+		return false;
+	}
+
+	// Load the shaders
+	if(!loadShaders("media/grid.vert", "media/grid.frag", m_id_vert_cpu, m_id_frag_cpu, m_id_prog_cpu))
+	{
+		fprintf(stderr, "*** GridMesh::init: FAILED loading the shaders for the grid\n");
+		return false;
+	}
+	if(!loadShaders("media/grid_gpu.vert", "media/grid.frag", m_id_vert_gpu, m_id_frag_gpu, m_id_prog_gpu))
+	{
+		fprintf(stderr, "*** GridMesh::init: FAILED loading the GPU height shaders for the grid\n");
+		deleteShaders(m_id_vert_cpu, m_id_frag_cpu, m_id_prog_cpu);
+		return false;
+	}
+
+	// Get the uniforms
+	m_id_uniform_cpu_view_proj = glGetUniformLocation(m_id_prog_cpu, "view_proj");
+	m_id_uniform_cpu_nb_vertices = glGetUniformLocation(m_id_prog_cpu, "nb_vertices");
+	m_id_uniform_cpu_heights = glGetUniformLocation(m_id_prog_cpu, "heights");
+
+	m_id_uniform_gpu_view_proj = glGetUniformLocation(m_id_prog_gpu, "view_proj");
+	m_id_uniform_gpu_grid_width = glGetUniformLocation(m_id_prog_gpu, "grid_width");
+	m_id_uniform_gpu_wave = glGetUniformLocation(m_id_prog_gpu, "wave");
+
+	if(	m_id_uniform_cpu_view_proj < 0 || m_id_uniform_cpu_nb_vertices < 0 || m_id_uniform_cpu_heights < 0 ||
+		m_id_uniform_gpu_view_proj < 0 || m_id_uniform_gpu_grid_width < 0 || m_id_uniform_gpu_wave < 0)
+	{
+		fprintf(stderr, "*** GridMesh::init: FAILED retrieving uniform locations\n");
+		deleteShaders(m_id_vert_gpu, m_id_frag_gpu, m_id_prog_gpu);
+		deleteShaders(m_id_vert_cpu, m_id_frag_cpu, m_id_prog_cpu);
+		return false;
+	}
+
+	// Initialize the positions and shades
+	std::vector<StaticVertex>	vertices(width * height);
+	for(int x=0 ; x < width ; x++)
+	{
+		for(int y=0 ; y < height ; y++)
+		{
+			int i = x + y*width;
+			vertices[i].pos_xz[0] = world_size * (float(x-width/2) / float(width));
+			vertices[i].pos_xz[1] = world_size * (float(y-height/2) / float(height));
+			vertices[i].shade = float(y) / float(height);
+		}
+	}
+
+	// Initialize the indices: see bench/grid_index_bench for the comparison of the layouts
+	std::vector<uint32_t>	triangle_indices;
+	gridBuildTriangles(width, height, triangle_indices);
+	m_nb_triangle_indices = (GLsizei)triangle_indices.size();
+
+	std::vector<uint32_t>	strip_indices;
+	gridBuildStrips(width, height, STRIP_BLOCK_WIDTH, GRID_RESTART_INDEX_32, strip_indices);
+	m_nb_strip_indices = (GLsizei)strip_indices.size();
+
+	gridBuildStrips16(width, height, STRIP_BLOCK_WIDTH, m_bands16);
+
+	// IBOs/VBOs: the static data is uploaded once
+	glGenBuffers(1, &m_id_ibo_triangles);
+	glGenBuffers(1, &m_id_ibo_strips);
+	glGenBuffers(1, &m_id_ibo_strips16);
+	glGenBuffers(1, &m_id_vbo_static);
+	glGenBuffers(1, &m_id_vbo_instances);
+	glGenBuffers(1, &m_id_tbo_heights);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_triangles);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*triangle_indices.size(), (const GLvoid*)&triangle_indices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_strips);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*strip_indices.size(), (const GLvoid*)&strip_indices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_strips16);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*m_bands16.indices.size(), (const GLvoid*)&m_bands16.indices[0], GL_STATIC_DRAW);
+	std::vector<uint16_t>().swap(m_bands16.indices);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_id_vbo_static);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(StaticVertex) * vertices.size(), (const GLvoid*)&vertices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_id_vbo_instances);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * max_instances, NULL, GL_STREAM_DRAW);
+
+	// Heights: one float per vertex and per instance, read with texelFetch()
+	glBindBuffer(GL_TEXTURE_BUFFER, m_id_tbo_heights);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * width * height * max_instances, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &m_id_tex_heights);
+	glBindTexture(GL_TEXTURE_BUFFER, m_id_tex_heights);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, m_id_tbo_heights);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	return true;
+}
+
+void GridMesh::shut()
+{
+	glDeleteTextures(1, &m_id_tex_heights);
+	glDeleteBuffers(1, &m_id_tbo_heights);
+	glDeleteBuffers(1, &m_id_vbo_instances);
+	glDeleteBuffers(1, &m_id_vbo_static);
+	glDeleteBuffers(1, &m_id_ibo_strips16);
+	glDeleteBuffers(1, &m_id_ibo_strips);
+	glDeleteBuffers(1, &m_id_ibo_triangles);
+
+	glDeleteProgram(m_id_prog_gpu);
+	glDeleteShader(m_id_frag_gpu);
+	glDeleteShader(m_id_vert_gpu);
+	glDeleteProgram(m_id_prog_cpu);
+	glDeleteShader(m_id_frag_cpu);
+	glDeleteShader(m_id_vert_cpu);
+}
+
+size_t GridMesh::draw(const float view_proj_matrix[16], const Instance* instances, int nb_instances,
+					  const float* heights, const GridWaveParams& wave)
+{
+	if(nb_instances > m_max_instances)
+		nb_instances = m_max_instances;
+
+	size_t	nb_uploaded_bytes = 0;
+
+	// Setup shader
+	bool gpu_heights = (heights == NULL);
+	if(gpu_heights)
+	{
+		glUseProgram(m_id_prog_gpu);
+		glUniformMatrix4fv(m_id_uniform_gpu_view_proj, 1, GL_FALSE, view_proj_matrix);
+		glUniform1i(m_id_uniform_gpu_grid_width, m_width);
+		glUniform4f(m_id_uniform_gpu_wave, wave.x_freq, wave.y_freq, wave.floor, wave.amplitude);
+	}
+	else
+	{
+		glUseProgram(m_id_prog_cpu);
+		glUniformMatrix4fv(m_id_uniform_cpu_view_proj, 1, GL_FALSE, view_proj_matrix);
+		glUniform1i(m_id_uniform_cpu_nb_vertices, m_width * m_height);
+		glUniform1i(m_id_uniform_cpu_heights, 0);
+
+		// The heights of all the instances at once. glBufferData() with the full size lets the driver
+		// give us a new buffer while the GPU draws the previous one.
+		glBindBuffer(GL_TEXTURE_BUFFER, m_id_tbo_heights);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * m_width * m_height * nb_instances, (const GLvoid*)heights, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		nb_uploaded_bytes += sizeof(float) * m_width * m_height * nb_instances;
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_BUFFER, m_id_tex_heights);
+	}
+
+	// Setup VBOs
+	for(int i=0 ; i < NB_ATTRIBS ; i++)
+		glEnableVertexAttribArray(i);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_id_vbo_static);
+	glVertexAttribPointer(ATTRIB_POSITION_XZ, 2, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)0);
+	glVertexAttribPointer(ATTRIB_SHADE, 1, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)(2*sizeof(GLfloat)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_id_vbo_instances);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * nb_instances, (const GLvoid*)instances, GL_STREAM_DRAW);
+	nb_uploaded_bytes += sizeof(Instance) * nb_instances;
+	glVertexAttribPointer(ATTRIB_INSTANCE_OFFSET_PHASES, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)0);
+	glVertexAttribPointer(ATTRIB_INSTANCE_COLOR, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(4*sizeof(GLfloat)));
+	glVertexAttribDivisor(ATTRIB_INSTANCE_OFFSET_PHASES, 1);
+	glVertexAttribDivisor(ATTRIB_INSTANCE_COLOR, 1);
+
+	// Setup IBO and draw
+	switch(m_index_layout)
+	{
+	case GRID_INDICES_TRIANGLES:
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_triangles);
+		glDrawElementsInstanced(GL_TRIANGLES, m_nb_triangle_indices, GL_UNSIGNED_INT, (const GLvoid*)0, nb_instances);
+		break;
+
+	case GRID_INDICES_STRIPS:
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_strips);
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(GRID_RESTART_INDEX_32);
+		glDrawElementsInstanced(GL_TRIANGLE_STRIP, m_nb_strip_indices, GL_UNSIGNED_INT, (const GLvoid*)0, nb_instances);
+		glDisable(GL_PRIMITIVE_RESTART);
+		break;
+
+	case GRID_INDICES_STRIPS_16:
+	default:
+		// The bands share their indices: the base vertex moves them to their rows (gl_VertexID includes it)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_id_ibo_strips16);
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(GRID_RESTART_INDEX_16);
+		for(int band=0 ; band < m_bands16.nb_bands ; band++)
+		{
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLE_STRIP, (GLsizei)m_bands16.getNbIndices(band), GL_UNSIGNED_SHORT,
+											  (GLvoid*)(m_bands16.getOffset(band) * sizeof(GLushort)), nb_instances,
+											  m_bands16.getFirstRow(band) * m_width);
+		}
+		glDisable(GL_PRIMITIVE_RESTART);
+		break;
+	}
+
+	// Restore the state
+	glVertexAttribDivisor(ATTRIB_INSTANCE_OFFSET_PHASES, 0);
+	glVertexAttribDivisor(ATTRIB_INSTANCE_COLOR, 0);
+	for(int i=0 ; i < NB_ATTRIBS ; i++)
+		glDisableVertexAttribArray(i);
+	if(!gpu_heights)
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	return nb_uploaded_bytes;
+}
@@ -0,0 +1,85 @@
+// grid_mesh.h
+// GPU resources shared by all the grids: static vertices, index buffers, shaders.
+// The grids are instances of the mesh: all of them can be drawn with a single instanced draw call.
+
+#ifndef GRID_MESH_H
+#define GRID_MESH_H
+
+#include <GL/glew.h>
+
+#include "grid_indices.h"
+
+struct GridWaveParams;
+
+class GridMesh
+{
+public:
+	// Per-instance attributes, streamed every frame
+	struct Instance
+	{
+		GLfloat	offset_xz[2];	// Translation of the grid
+		GLfloat	phases[2];		// x_phase, y_phase of the wave: only used in GPU mode
+		GLfloat	color[3];
+	};
+
+private:
+	static const int	STRIP_BLOCK_WIDTH;	// Quads: the two rows of a block must fit in a 16-entry vertex cache
+
+	// The shade goes from 0 to 1 along the grid, the instance color is multiplied by it
+	struct StaticVertex
+	{
+		GLfloat	pos_xz[2];
+		GLfloat	shade;
+	};
+
+	int		m_width;
+	int		m_height;
+	int		m_max_instances;
+
+	// Programs: heights read from a buffer texture (CPU mode) or computed in the vertex shader (GPU mode)
+	GLuint	m_id_vert_cpu;
+	GLuint	m_id_frag_cpu;
+	GLuint	m_id_prog_cpu;
+	GLint	m_id_uniform_cpu_view_proj;
+	GLint	m_id_uniform_cpu_nb_vertices;
+	GLint	m_id_uniform_cpu_heights;
+
+	GLuint	m_id_vert_gpu;
+	GLuint	m_id_frag_gpu;
+	GLuint	m_id_prog_gpu;
+	GLint	m_id_uniform_gpu_view_proj;
+	GLint	m_id_uniform_gpu_grid_width;
+	GLint	m_id_uniform_gpu_wave;			// x_freq, y_freq, floor, amplitude
+
+	// VBOs
+	GLuint	m_id_vbo_static;		// StaticVertex
+	GLuint	m_id_vbo_instances;		// Instance, streamed
+	GLuint	m_id_tbo_heights;		// Heights of all the instances, streamed in CPU mode
+	GLuint	m_id_tex_heights;
+
+	// IBOs: one per index layout, to compare them at runtime
+	GridIndexLayout	m_index_layout;
+	GLuint			m_id_ibo_triangles;
+	GLuint			m_id_ibo_strips;
+	GLuint			m_id_ibo_strips16;
+	GLsizei			m_nb_triangle_indices;
+	GLsizei			m_nb_strip_indices;
+	GridBands16		m_bands16;		// Only the layout of the bands, the indices are in the IBO
+
+public:
+	GridMesh();
+	bool	init(int width, int height, float world_size, int max_instances);
+	void	shut();
+
+	void			setIndexLayout(GridIndexLayout layout)	{m_index_layout = layout;}
+	GridIndexLayout	getIndexLayout() const					{return m_index_layout;}
+
+	// Draw the instances with one instanced draw call (one per band with 16-bit indices).
+	// heights: width*height floats per instance, one instance after the other.
+	// NULL for the GPU mode, where the heights are computed from wave and the phases of the instances.
+	// Returns the number of bytes uploaded to the GPU.
+	size_t	draw(const float view_proj_matrix[16], const Instance* instances, int nb_instances,
+				 const float* heights, const GridWaveParams& wave);
+};
+
+#endif // GRID_MESH_H
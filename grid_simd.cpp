@@ -0,0 +1,415 @@
+// grid_simd.cpp
+
+#include "grid_simd.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define GRID_SIMD_X86
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define GRID_SIMD_HAS_SSE2
+		#include <emmintrin.h>
+	#endif
+	// The AVX2 code is compiled with a target attribute so that the rest of the program
+	// does not need -mavx2. Visual Studio knows the intrinsics since VS2012.
+	#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+		#define GRID_SIMD_HAS_AVX2
+		#define GRID_SIMD_AVX2_FUNC	__attribute__((target("avx2,fma")))
+		#include <immintrin.h>
+		#include <cpuid.h>
+	#elif defined(_MSC_VER) && _MSC_VER >= 1700
+		#define GRID_SIMD_HAS_AVX2
+		#define GRID_SIMD_AVX2_FUNC
+		#include <immintrin.h>
+		#include <intrin.h>
+	#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define GRID_SIMD_HAS_NEON
+	#include <arm_neon.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Polynomial sine
+//-----------------------------------------------------------------------------
+// sin(x) = (-1)^k * sin(r) with k = round(x/pi) and r = x - k*pi in [-pi/2, pi/2].
+// pi is split in two floats so that k*pi is subtracted without losing the low bits of r.
+// Odd minimax polynomial of degree 9 for sin(r): maximum error 1.5e-7.
+static const float	SIN_INV_PI	= 0.318309886f;
+static const float	SIN_PI_HI	= 3.14159274f;
+static const float	SIN_PI_LO	= -8.74227801e-08f;
+static const float	SIN_C3		= -0.166666478f;
+static const float	SIN_C5		= 0.00833289884f;
+static const float	SIN_C7		= -0.000198008653f;
+static const float	SIN_C9		= 2.590431e-06f;
+
+static const float	HALF_PI		= 1.57079633f;
+
+static inline float sinPolyScalar(float x)
+{
+	float k = floorf(x * SIN_INV_PI + 0.5f);
+	float r = x - k*SIN_PI_HI;
+	r = r - k*SIN_PI_LO;
+
+	float r2 = r*r;
+	float p = SIN_C9;
+	p = p*r2 + SIN_C7;
+	p = p*r2 + SIN_C5;
+	p = p*r2 + SIN_C3;
+	p = r + r*r2*p;
+
+	return ((int)k & 1) ? -p : p;
+}
+
+//-----------------------------------------------------------------------------
+// Scalar
+//-----------------------------------------------------------------------------
+static void sinLinearScalar(float* dst, size_t begin, size_t n, float a, float b, float scale, float offset)
+{
+	for(size_t i=begin ; i < n ; i++)
+		dst[i] = offset + scale*sinPolyScalar(a*float(i) + b);
+}
+
+static void addScalarScalar(float* dst, size_t dst_stride, const float* src, size_t begin, size_t n, float c)
+{
+	for(size_t i=begin ; i < n ; i++)
+		dst[i*dst_stride] = src[i] + c;
+}
+
+//-----------------------------------------------------------------------------
+// SSE2: 4 floats, no FMA
+//-----------------------------------------------------------------------------
+#ifdef GRID_SIMD_HAS_SSE2
+static inline __m128 sinPolySSE2(__m128 x)
+{
+	// cvtps rounds to the nearest integer
+	__m128i	k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(SIN_INV_PI)));
+	__m128	fk = _mm_cvtepi32_ps(k);
+	__m128	r = _mm_sub_ps(x, _mm_mul_ps(fk, _mm_set1_ps(SIN_PI_HI)));
+	r = _mm_sub_ps(r, _mm_mul_ps(fk, _mm_set1_ps(SIN_PI_LO)));
+
+	__m128	r2 = _mm_mul_ps(r, r);
+	__m128	p = _mm_set1_ps(SIN_C9);
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(SIN_C7));
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(SIN_C5));
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(SIN_C3));
+	p = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+
+	// Odd k: flip the sign bit
+	__m128	sign = _mm_castsi128_ps(_mm_slli_epi32(k, 31));
+	return _mm_xor_ps(p, sign);
+}
+
+static size_t sinLinearSSE2(float* dst, size_t n, float a, float b, float scale, float offset)
+{
+	__m128	va = _mm_set1_ps(a);
+	__m128	vb = _mm_set1_ps(b);
+	__m128	vscale = _mm_set1_ps(scale);
+	__m128	voffset = _mm_set1_ps(offset);
+	__m128	vi = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128	vstep = _mm_set1_ps(4.0f);
+
+	size_t i = 0;
+	for( ; i+4 <= n ; i += 4)
+	{
+		__m128 s = sinPolySSE2(_mm_add_ps(_mm_mul_ps(va, vi), vb));
+		_mm_storeu_ps(dst+i, _mm_add_ps(voffset, _mm_mul_ps(vscale, s)));
+		vi = _mm_add_ps(vi, vstep);
+	}
+	return i;
+}
+
+static size_t addScalarSSE2(float* dst, const float* src, size_t n, float c)
+{
+	__m128	vc = _mm_set1_ps(c);
+	size_t i = 0;
+	for( ; i+4 <= n ; i += 4)
+		_mm_storeu_ps(dst+i, _mm_add_ps(_mm_loadu_ps(src+i), vc));
+	return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// AVX2 + FMA: 8 floats
+//-----------------------------------------------------------------------------
+#ifdef GRID_SIMD_HAS_AVX2
+GRID_SIMD_AVX2_FUNC static inline __m256 sinPolyAVX2(__m256 x)
+{
+	__m256i	k = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(SIN_INV_PI)));
+	__m256	fk = _mm256_cvtepi32_ps(k);
+	__m256	r = _mm256_fnmadd_ps(fk, _mm256_set1_ps(SIN_PI_HI), x);
+	r = _mm256_fnmadd_ps(fk, _mm256_set1_ps(SIN_PI_LO), r);
+
+	__m256	r2 = _mm256_mul_ps(r, r);
+	__m256	p = _mm256_set1_ps(SIN_C9);
+	p = _mm256_fmadd_ps(p, r2, _mm256_set1_ps(SIN_C7));
+	p = _mm256_fmadd_ps(p, r2, _mm256_set1_ps(SIN_C5));
+	p = _mm256_fmadd_ps(p, r2, _mm256_set1_ps(SIN_C3));
+	p = _mm256_fmadd_ps(_mm256_mul_ps(r, r2), p, r);
+
+	__m256	sign = _mm256_castsi256_ps(_mm256_slli_epi32(k, 31));
+	return _mm256_xor_ps(p, sign);
+}
+
+GRID_SIMD_AVX2_FUNC static size_t sinLinearAVX2(float* dst, size_t n, float a, float b, float scale, float offset)
+{
+	__m256	va = _mm256_set1_ps(a);
+	__m256	vb = _mm256_set1_ps(b);
+	__m256	vscale = _mm256_set1_ps(scale);
+	__m256	voffset = _mm256_set1_ps(offset);
+	__m256	vi = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	__m256	vstep = _mm256_set1_ps(8.0f);
+
+	size_t i = 0;
+	for( ; i+8 <= n ; i += 8)
+	{
+		__m256 s = sinPolyAVX2(_mm256_fmadd_ps(va, vi, vb));
+		_mm256_storeu_ps(dst+i, _mm256_fmadd_ps(vscale, s, voffset));
+		vi = _mm256_add_ps(vi, vstep);
+	}
+	return i;
+}
+
+GRID_SIMD_AVX2_FUNC static size_t addScalarAVX2(float* dst, const float* src, size_t n, float c)
+{
+	__m256	vc = _mm256_set1_ps(c);
+	size_t i = 0;
+	for( ; i+8 <= n ; i += 8)
+		_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_loadu_ps(src+i), vc));
+	return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// NEON: 4 floats with FMA
+//-----------------------------------------------------------------------------
+#ifdef GRID_SIMD_HAS_NEON
+static inline float32x4_t sinPolyNEON(float32x4_t x)
+{
+	int32x4_t	k = vcvtnq_s32_f32(vmulq_n_f32(x, SIN_INV_PI));
+	float32x4_t	fk = vcvtq_f32_s32(k);
+	float32x4_t	r = vfmsq_f32(x, fk, vdupq_n_f32(SIN_PI_HI));
+	r = vfmsq_f32(r, fk, vdupq_n_f32(SIN_PI_LO));
+
+	float32x4_t	r2 = vmulq_f32(r, r);
+	float32x4_t	p = vdupq_n_f32(SIN_C9);
+	p = vfmaq_f32(vdupq_n_f32(SIN_C7), p, r2);
+	p = vfmaq_f32(vdupq_n_f32(SIN_C5), p, r2);
+	p = vfmaq_f32(vdupq_n_f32(SIN_C3), p, r2);
+	p = vfmaq_f32(r, vmulq_f32(r, r2), p);
+
+	uint32x4_t	sign = vreinterpretq_u32_s32(vshlq_n_s32(k, 31));
+	return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(p), sign));
+}
+
+static size_t sinLinearNEON(float* dst, size_t n, float a, float b, float scale, float offset)
+{
+	static const float	first_indices[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+	float32x4_t	va = vdupq_n_f32(a);
+	float32x4_t	vb = vdupq_n_f32(b);
+	float32x4_t	vscale = vdupq_n_f32(scale);
+	float32x4_t	voffset = vdupq_n_f32(offset);
+	float32x4_t	vi = vld1q_f32(first_indices);
+	float32x4_t	vstep = vdupq_n_f32(4.0f);
+
+	size_t i = 0;
+	for( ; i+4 <= n ; i += 4)
+	{
+		float32x4_t s = sinPolyNEON(vfmaq_f32(vb, va, vi));
+		vst1q_f32(dst+i, vfmaq_f32(voffset, vscale, s));
+		vi = vaddq_f32(vi, vstep);
+	}
+	return i;
+}
+
+static size_t addScalarNEON(float* dst, const float* src, size_t n, float c)
+{
+	float32x4_t	vc = vdupq_n_f32(c);
+	size_t i = 0;
+	for( ; i+4 <= n ; i += 4)
+		vst1q_f32(dst+i, vaddq_f32(vld1q_f32(src+i), vc));
+	return i;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// CPU detection
+//-----------------------------------------------------------------------------
+#ifdef GRID_SIMD_HAS_AVX2
+static bool cpuHasAVX2()
+{
+	unsigned int	regs1[4] = {0, 0, 0, 0};	// eax, ebx, ecx, edx
+	unsigned int	regs7[4] = {0, 0, 0, 0};
+#ifdef _MSC_VER
+	int	info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	for(int i=0 ; i < 4 ; i++)
+		regs1[i] = (unsigned int)info[i];
+	__cpuidex(info, 7, 0);
+	for(int i=0 ; i < 4 ; i++)
+		regs7[i] = (unsigned int)info[i];
+#else
+	if(__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+	__cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+
+	bool	fma		= (regs1[2] & (1u << 12)) != 0;
+	bool	osxsave	= (regs1[2] & (1u << 27)) != 0;
+	bool	avx2	= (regs7[1] & (1u << 5)) != 0;
+	if(!fma || !osxsave || !avx2)
+		return false;
+
+	// The OS must save the YMM registers: XCR0 bits 1 (SSE) and 2 (AVX)
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int	xcr0_lo, xcr0_hi;
+	__asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	unsigned long long xcr0 = xcr0_lo;
+#endif
+	return (xcr0 & 6) == 6;
+}
+#endif
+
+bool simdIsPathSupported(SimdPath path)
+{
+	switch(path)
+	{
+	case SIMD_PATH_SCALAR:
+		return true;
+#ifdef GRID_SIMD_HAS_SSE2
+	case SIMD_PATH_SSE2:
+		return true;	// always there on the CPUs this is compiled for
+#endif
+#ifdef GRID_SIMD_HAS_AVX2
+	case SIMD_PATH_AVX2:
+		{
+			static const bool supported = cpuHasAVX2();
+			return supported;
+		}
+#endif
+#ifdef GRID_SIMD_HAS_NEON
+	case SIMD_PATH_NEON:
+		return true;	// mandatory on AArch64
+#endif
+	default:
+		return false;
+	}
+}
+
+SimdPath simdGetBestPath()
+{
+	for(int path = NB_SIMD_PATHS-1 ; path > SIMD_PATH_SCALAR ; path--)
+	{
+		if(simdIsPathSupported((SimdPath)path))
+			return (SimdPath)path;
+	}
+	return SIMD_PATH_SCALAR;
+}
+
+const char* simdGetPathName(SimdPath path)
+{
+	static const char* const	names[NB_SIMD_PATHS] = {"scalar", "SSE2", "AVX2", "NEON"};
+	return (path >= 0 && path < NB_SIMD_PATHS) ? names[path] : "unknown";
+}
+
+// Chosen before main(): the jobs read it without synchronization
+static SimdPath	s_simd_path = simdGetBestPath();
+
+SimdPath simdGetPath()
+{
+	return s_simd_path;
+}
+
+bool simdSetPath(SimdPath path)
+{
+	if(!simdIsPathSupported(path))
+		return false;
+	s_simd_path = path;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Kernels
+//-----------------------------------------------------------------------------
+void simdSinLinear(float* dst, size_t n, float a, float b, float scale, float offset)
+{
+	size_t done = 0;
+	switch(s_simd_path)
+	{
+#ifdef GRID_SIMD_HAS_SSE2
+	case SIMD_PATH_SSE2:	done = sinLinearSSE2(dst, n, a, b, scale, offset);	break;
+#endif
+#ifdef GRID_SIMD_HAS_AVX2
+	case SIMD_PATH_AVX2:	done = sinLinearAVX2(dst, n, a, b, scale, offset);	break;
+#endif
+#ifdef GRID_SIMD_HAS_NEON
+	case SIMD_PATH_NEON:	done = sinLinearNEON(dst, n, a, b, scale, offset);	break;
+#endif
+	default:				break;
+	}
+	sinLinearScalar(dst, done, n, a, b, scale, offset);
+}
+
+void simdAddScalar(float* dst, size_t dst_stride, const float* src, size_t n, float c)
+{
+	size_t done = 0;
+	if(dst_stride == 1)
+	{
+		switch(s_simd_path)
+		{
+#ifdef GRID_SIMD_HAS_SSE2
+		case SIMD_PATH_SSE2:	done = addScalarSSE2(dst, src, n, c);	break;
+#endif
+#ifdef GRID_SIMD_HAS_AVX2
+		case SIMD_PATH_AVX2:	done = addScalarAVX2(dst, src, n, c);	break;
+#endif
+#ifdef GRID_SIMD_HAS_NEON
+		case SIMD_PATH_NEON:	done = addScalarNEON(dst, src, n, c);	break;
+#endif
+		default:				break;
+		}
+	}
+	addScalarScalar(dst, dst_stride, src, done, n, c);
+}
+
+//-----------------------------------------------------------------------------
+void gridWaveUpdateRows(const GridWaveParams& params, int first_row, int end_row,
+						float* heights, size_t stride)
+{
+	static const int	NB_ROWS_PER_BLOCK = 64;
+
+	// Wider rows are processed GRID_WAVE_MAX_WIDTH columns at a time
+	float	row_terms[GRID_WAVE_MAX_WIDTH];
+	float	col_terms[NB_ROWS_PER_BLOCK];
+	for(int first_col=0 ; first_col < params.width ; first_col += GRID_WAVE_MAX_WIDTH)
+	{
+		int width = params.width - first_col;
+		if(width > GRID_WAVE_MAX_WIDTH)
+			width = GRID_WAVE_MAX_WIDTH;
+
+		// Row vector: floor + amplitude*cos(x_freq*x + x_phase), the same for all the rows
+		simdSinLinear(row_terms, width, params.x_freq, params.x_freq*float(first_col) + params.x_phase + HALF_PI,
+					  params.amplitude, params.floor);
+
+		// Column vector, by blocks: amplitude*sin(y_freq*y + y_phase)
+		for(int block=first_row ; block < end_row ; block += NB_ROWS_PER_BLOCK)
+		{
+			int nb_rows = end_row - block;
+			if(nb_rows > NB_ROWS_PER_BLOCK)
+				nb_rows = NB_ROWS_PER_BLOCK;
+			simdSinLinear(col_terms, nb_rows, params.y_freq, params.y_freq*float(block) + params.y_phase,
+						  params.amplitude, 0.0f);
+
+			// Outer sum
+			for(int i=0 ; i < nb_rows ; i++)
+			{
+				float* row = heights + ((size_t)(block+i) * (size_t)params.width + (size_t)first_col) * stride;
+				simdAddScalar(row, stride, row_terms, width, col_terms[i]);
+			}
+		}
+	}
+}
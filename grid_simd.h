@@ -0,0 +1,57 @@
+// grid_simd.h
+// Vectorized kernels for the grid animation: SSE2, AVX2 or NEON, with a scalar fallback.
+// The path is chosen at runtime from what the CPU and the build support. No OpenGL in here,
+// so that the benchmarks can use it.
+
+#ifndef GRID_SIMD_H
+#define GRID_SIMD_H
+
+#include <stddef.h>
+
+enum SimdPath
+{
+	SIMD_PATH_SCALAR = 0,
+	SIMD_PATH_SSE2,
+	SIMD_PATH_AVX2,		// AVX2 + FMA
+	SIMD_PATH_NEON,		// AArch64
+	NB_SIMD_PATHS
+};
+
+bool		simdIsPathSupported(SimdPath path);
+SimdPath	simdGetBestPath();					// Widest supported path
+const char*	simdGetPathName(SimdPath path);
+
+// The kernels use the best path unless another one is forced, e.g. by a benchmark
+SimdPath	simdGetPath();
+bool		simdSetPath(SimdPath path);			// Returns false if the path is not supported
+
+// dst[i] = offset + scale*sin(a*i + b), with a polynomial sine accurate to about 2e-7.
+// Keep a*n + b small: reduce the phase modulo 2*pi beforehand.
+void		simdSinLinear(float* dst, size_t n, float a, float b, float scale, float offset);
+
+// dst[i*dst_stride] = src[i] + c. Vector stores are only used when dst_stride == 1.
+void		simdAddScalar(float* dst, size_t dst_stride, const float* src, size_t n, float c);
+
+// Heights of the animated grid, which are separable:
+// height(x, y) = floor + amplitude * (cos(x_freq*x + x_phase) + sin(y_freq*y + y_phase))
+// A row of cosines and a column of sines are computed, then each row is an addition.
+struct GridWaveParams
+{
+	int		width;
+	int		height;
+	float	x_freq;
+	float	x_phase;
+	float	y_freq;
+	float	y_phase;
+	float	floor;
+	float	amplitude;
+};
+
+static const int	GRID_WAVE_MAX_WIDTH = 4096;	// Columns computed at once: wider rows take several chunks
+
+// Write the heights of the rows [first_row, end_row). The height of the vertex (x, y) is
+// heights[(x + y*width) * stride]: stride lets it write into interleaved vertices.
+void		gridWaveUpdateRows(const GridWaveParams& params, int first_row, int end_row,
+							   float* heights, size_t stride);
+
+#endif // GRID_SIMD_H
@@ -15,7 +15,7 @@ public:
 private:
 	T					m_elements[MAX_SIZE];
 	std::vector<bool>	m_used;	// vector<bool> is optimized for space
-	volatile size_t		m_size;
+	size_t				m_size;	// Not thread-safe: the owner serializes add() and remove()
 public:
 
 	HoleArray() : m_used(MAX_SIZE, false), m_size(0)
@@ -36,9 +36,11 @@ public:
 
 	bool		isUsed(size_t i) const	{return m_used[i];}
 
+	// Returns MAX_SIZE when the array is full
 	size_t	add()
 	{
-		assert(m_size+1 < MAX_SIZE);
+		if(m_size == MAX_SIZE)
+			return MAX_SIZE;
 
 		size_t i = 0;
 		while(m_used[i])
@@ -0,0 +1,352 @@
+// job_system.cpp
+
+#include "job_system.h"
+#include "atomic.h"
+#include "profiler.h"
+#include <assert.h>
+#include <stdio.h>
+
+THREAD_LOCAL JobSystem::Worker*	JobSystem::s_current_worker = NULL;
+
+//-----------------------------------------------------------------------------
+// Deque
+//-----------------------------------------------------------------------------
+void JobSystem::Deque::init()
+{
+	m_top = 0;
+	m_bottom = 0;
+	for(size_t i=0 ; i < NB_MAX_JOBS_PER_WORKER ; i++)
+		m_jobs[i] = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/// Returns false if the deque is full
+bool JobSystem::Deque::push(Job* job)
+{
+	uint32_t b = atomicLoadRelaxed(&m_bottom);
+	uint32_t t = atomicLoadAcquire(&m_top);
+	if(b - t >= NB_MAX_JOBS_PER_WORKER)
+		return false;
+
+	atomicStoreRelaxed(&m_jobs[b & (NB_MAX_JOBS_PER_WORKER-1)], job);
+	atomicStoreRelease(&m_bottom, b+1);	// publishes the job to the thieves
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Take the most recent job. Returns NULL if the deque is empty.
+JobSystem::Job* JobSystem::Deque::pop()
+{
+	// Release stores of bottom keep the jobs published even when a thief reads one of these values
+	uint32_t b = atomicLoadRelaxed(&m_bottom) - 1;
+	atomicStoreRelease(&m_bottom, b);
+	atomicFenceSeqCst();	// the thieves must see the new bottom before we read top
+	uint32_t t = atomicLoadRelaxed(&m_top);
+
+	int32_t size = (int32_t)(b - t);
+	if(size < 0)
+	{
+		// Empty
+		atomicStoreRelease(&m_bottom, b+1);
+		return NULL;
+	}
+
+	Job* job = atomicLoadRelaxed(&m_jobs[b & (NB_MAX_JOBS_PER_WORKER-1)]);
+	if(size > 0)
+		return job;
+
+	// Last job: race against the thieves for it
+	if(!atomicCompareExchange(&m_top, t, t+1))
+		job = NULL;
+	atomicStoreRelease(&m_bottom, b+1);
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+/// Take the oldest job. Returns NULL if the deque is empty or if another thread won the race.
+JobSystem::Job* JobSystem::Deque::steal()
+{
+	uint32_t t = atomicLoadAcquire(&m_top);
+	atomicFenceSeqCst();	// pairs with the fence in pop()
+	uint32_t b = atomicLoadAcquire(&m_bottom);
+
+	if((int32_t)(b - t) <= 0)
+		return NULL;
+
+	Job* job = atomicLoadRelaxed(&m_jobs[t & (NB_MAX_JOBS_PER_WORKER-1)]);
+	if(!atomicCompareExchange(&m_top, t, t+1))
+		return NULL;
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+// JobSystem
+//-----------------------------------------------------------------------------
+JobSystem::JobSystem()
+{
+	m_workers = NULL;
+	m_nb_workers = 0;
+	m_nb_queued_jobs = 0;
+	m_shut = true;
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::init(int nb_workers)
+{
+	assert(m_workers == NULL && "already initialized");
+
+	if(nb_workers < 1)
+		nb_workers = 1;
+	if(nb_workers > NB_MAX_WORKERS)
+		nb_workers = NB_MAX_WORKERS;
+
+	m_nb_workers = nb_workers;
+	m_nb_queued_jobs = 0;
+	m_shut = false;
+	mutexCreate(&m_sleep_mutex);
+	eventCreate(&m_wake_event);
+	PROFILER_NAME_WAIT_OBJECT(&m_sleep_mutex, "Job system sleep");
+	PROFILER_NAME_WAIT_OBJECT(&m_wake_event, "Job system wake");
+
+	m_workers = new Worker[nb_workers];
+	for(int i=0 ; i < nb_workers ; i++)
+	{
+		Worker&	worker = m_workers[i];
+		worker.p_job_system = this;
+		worker.index = i;
+		worker.deque.init();
+		for(size_t j=0 ; j < NB_MAX_JOBS_PER_WORKER ; j++)
+			worker.jobs[j].in_use = 0;
+		worker.next_job = 0;
+		worker.random_state = 0x9E3779B9u * (uint32_t)(i+1);
+	}
+
+	// The calling thread is worker 0, the others get their own thread.
+	// When there is a core for each of them, pin them: a migrating worker shows up as jitter in its jobs.
+	// The cores are the ones the process may run on, which are not always the first ones.
+	int		cores[NB_MAX_WORKERS];
+	int		nb_cores = threadGetProcessCores(cores, NB_MAX_WORKERS);
+	bool	pin = (nb_workers <= nb_cores && cores[nb_workers-1] < 64);
+
+	s_current_worker = &m_workers[0];
+	for(int i=1 ; i < nb_workers ; i++)
+	{
+		char	name[THREAD_NAME_MAX_LENGTH];
+		sprintf(name, "Worker %d", i);
+
+		ThreadOptions	options;
+		options.name = name;
+		if(pin)
+			options.affinity_mask = (uint64_t)1 << cores[i];
+		m_workers[i].thread_handle = threadCreate(&runWrapper, &m_workers[i], options);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::shut()
+{
+	if(!m_workers)
+		return;
+
+	atomicStoreRelaxed(&m_shut, true);
+	wakeWorkers();
+	for(int i=1 ; i < m_nb_workers ; i++)
+		threadJoin(m_workers[i].thread_handle);
+
+	eventDestroy(&m_wake_event);
+	mutexDestroy(&m_sleep_mutex);
+
+	delete [] m_workers;
+	m_workers = NULL;
+	m_nb_workers = 0;
+	s_current_worker = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::submit(const char* name, const Color& color, size_t nb_items, size_t nb_items_per_job,
+					   JobFunc func, void* user_data, JobCounter& counter)
+{
+	Worker* worker = s_current_worker;
+	assert(worker && worker->p_job_system == this && "jobs can only be submitted by the workers");
+	assert(nb_items_per_job > 0);
+
+	size_t nb_jobs = (nb_items + nb_items_per_job-1) / nb_items_per_job;
+	if(nb_jobs == 0)
+		return;
+	atomicFetchAdd(&counter.nb_pending, (int32_t)nb_jobs);
+
+	// One flow per job, and one for the end of the group
+	uint32_t flow_id = PROFILER_NEW_FLOW_IDS((uint32_t)nb_jobs + 1);
+	if(counter.flow_id == 0)
+		counter.flow_id = flow_id + (uint32_t)nb_jobs;
+
+	for(size_t begin=0 ; begin < nb_items ; begin += nb_items_per_job)
+	{
+		size_t end = begin + nb_items_per_job;
+		if(end > nb_items)
+			end = nb_items;
+
+		Job	inline_job;
+		Job* job = allocJob(*worker);
+		if(!job)
+			job = &inline_job;	// too many jobs in flight: run it now
+
+		job->func = func;
+		job->user_data = user_data;
+		job->begin = begin;
+		job->end = end;
+		job->counter = &counter;
+		job->name = name;
+		job->color = color;
+		job->flow_id = flow_id++;
+		job->in_use = 1;
+
+		PROFILER_FLOW_BEGIN(job->flow_id);
+
+		atomicFetchAdd(&m_nb_queued_jobs, 1);
+		if(job == &inline_job || !worker->deque.push(job))
+		{
+			atomicFetchAdd(&m_nb_queued_jobs, -1);
+			execute(job);
+		}
+	}
+
+	wakeWorkers();
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::wait(JobCounter& counter)
+{
+	Worker* worker = s_current_worker;
+	assert(worker && worker->p_job_system == this && "only the workers can wait for jobs");
+
+	// Help instead of blocking: the acquire load makes the results of the jobs visible
+	while(atomicLoadAcquire(&counter.nb_pending) != 0)
+	{
+		if(!runOneJob(*worker))
+			threadYield();
+	}
+	PROFILER_FLOW_END(counter.flow_id);
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::parallelFor(const char* name, const Color& color, size_t nb_items, size_t nb_items_per_job,
+							JobFunc func, void* user_data)
+{
+	JobCounter	counter;
+	submit(name, color, nb_items, nb_items_per_job, func, user_data, counter);
+	wait(counter);
+}
+
+//-----------------------------------------------------------------------------
+/// Get a free slot in the ring of the worker, or NULL if the next one still holds a pending job
+JobSystem::Job* JobSystem::allocJob(Worker& worker)
+{
+	Job* job = &worker.jobs[worker.next_job];
+	if(atomicLoadAcquire(&job->in_use))
+		return NULL;
+
+	worker.next_job = (worker.next_job + 1) % NB_MAX_JOBS_PER_WORKER;
+	return job;
+}
+
+//-----------------------------------------------------------------------------
+/// Run a job from the worker's deque, or stolen from another worker. Returns false if none was found.
+bool JobSystem::runOneJob(Worker& worker)
+{
+	Job* job = worker.deque.pop();
+
+	if(!job && m_nb_workers > 1)
+	{
+		// xorshift: start from a random victim so that the thieves spread
+		uint32_t r = worker.random_state;
+		r ^= r << 13;
+		r ^= r >> 17;
+		r ^= r << 5;
+		worker.random_state = r;
+
+		int first = (int)(r % (uint32_t)m_nb_workers);
+		for(int i=0 ; i < m_nb_workers && !job ; i++)
+		{
+			int victim = (first + i) % m_nb_workers;
+			if(victim != worker.index)
+				job = m_workers[victim].deque.steal();
+		}
+	}
+
+	if(!job)
+		return false;
+
+	atomicFetchAdd(&m_nb_queued_jobs, -1);
+	execute(job);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::execute(Job* job)
+{
+	JobCounter* counter = job->counter;
+	uint32_t	done_flow_id = counter->flow_id;	// the counter must not be touched after the decrement either
+
+	// The marker also covers the decrement, so that the flow to the waiter starts inside it
+	PROFILER_CPU_MARKER(PROFILER_CATEGORY_JOBS, PROFILER_LEVEL_DETAILED, job->name, job->color);
+	PROFILER_FLOW_END(job->flow_id);
+	job->func(job->user_data, job->begin, job->end);
+
+	atomicStoreRelease(&job->in_use, 0);
+	if(atomicFetchAdd(&counter->nb_pending, -1) == 1)	// the job must not be touched after this
+	{
+		PROFILER_FLOW_BEGIN(done_flow_id);	// last job of the group
+	}
+	(void)done_flow_id;	// Unused when the profiler is disabled
+}
+
+//-----------------------------------------------------------------------------
+void JobSystem::wakeWorkers()
+{
+	mutexLock(&m_sleep_mutex);
+	eventTrigger(&m_wake_event);
+	mutexUnlock(&m_sleep_mutex);
+}
+
+//-----------------------------------------------------------------------------
+/// Worker thread: run jobs, sleep when there is nothing left to steal
+void JobSystem::run(Worker& worker)
+{
+	s_current_worker = &worker;
+
+	int nb_failed = 0;
+	while(!atomicLoadRelaxed(&m_shut))
+	{
+		if(runOneJob(worker))
+		{
+			nb_failed = 0;
+			continue;
+		}
+
+		if(++nb_failed < NB_SPINS_BEFORE_SLEEP)
+		{
+			threadYield();
+			continue;
+		}
+		nb_failed = 0;
+
+		// Sleep, unless jobs were queued in the meantime: submit() triggers the event under the same mutex
+		mutexLock(&m_sleep_mutex);
+		if(atomicLoadRelaxed(&m_nb_queued_jobs) <= 0 && !atomicLoadRelaxed(&m_shut))
+			eventReset(&m_wake_event);
+		mutexUnlock(&m_sleep_mutex);
+
+		eventWait(&m_wake_event);
+	}
+
+	s_current_worker = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void* JobSystem::runWrapper(void* user_data)
+{
+	Worker* worker = (Worker*)user_data;
+	worker->p_job_system->run(*worker);
+	return NULL;
+}
@@ -0,0 +1,118 @@
+// job_system.h
+// Work-stealing thread pool: one worker per core, each owning a Chase-Lev deque of jobs.
+// The thread that calls init() is worker 0: it runs jobs while it waits for them to finish.
+// Jobs are profiled automatically: each one is a CPU marker on the thread that runs it, with a flow
+// from where it was submitted, and a flow goes from the job that finishes a group to the thread waiting for it.
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread.h"
+#include "utils.h"
+
+// Process the items [begin, end)
+typedef void	(*JobFunc)(void* user_data, size_t begin, size_t end);
+
+// Number of unfinished jobs of a group, wait() returns when it drops to 0
+struct JobCounter
+{
+	int32_t		nb_pending;
+	uint32_t	flow_id;	// Profiler flow from the job that brings nb_pending to 0 to wait()
+
+	JobCounter() : nb_pending(0), flow_id(0)	{}
+};
+
+class JobSystem
+{
+public:
+	static const int	NB_MAX_WORKERS = 32;
+	static const size_t	NB_MAX_JOBS_PER_WORKER = 1024;	// Jobs submitted by a worker and not finished yet
+private:
+	static const size_t	CACHE_LINE_SIZE = 64;
+	static const int	NB_SPINS_BEFORE_SLEEP = 64;		// Failed steal rounds before an idle worker sleeps
+
+	struct Job
+	{
+		JobFunc		func;
+		void*		user_data;
+		size_t		begin;
+		size_t		end;
+		JobCounter*	counter;
+		const char*	name;	// Marker name: must outlive the job
+		Color		color;
+		uint32_t	flow_id;	// Profiler flow from submit() to the thread that runs the job
+		int32_t		in_use;	// Cleared with a release store once the job is done
+	};
+
+	// Chase-Lev deque with a fixed capacity: the owner pushes and pops at the bottom, the other
+	// workers steal at the top. The indices wrap around, only their difference matters.
+	class Deque
+	{
+		uint32_t	m_top;
+		char		m_pad_top[CACHE_LINE_SIZE - sizeof(uint32_t)];
+		uint32_t	m_bottom;
+		char		m_pad_bottom[CACHE_LINE_SIZE - sizeof(uint32_t)];
+		Job*		m_jobs[NB_MAX_JOBS_PER_WORKER];
+	public:
+		void	init();
+		bool	push(Job* job);		// Owner only
+		Job*	pop();				// Owner only
+		Job*	steal();			// Any thread
+	};
+
+	struct Worker
+	{
+		JobSystem*		p_job_system;
+		int				index;
+		ThreadHandle	thread_handle;
+		Deque			deque;
+		Job				jobs[NB_MAX_JOBS_PER_WORKER];	// Storage for the jobs submitted by this worker, used as a ring
+		size_t			next_job;
+		uint32_t		random_state;					// Picks the victims
+	};
+
+	Worker*		m_workers;
+	int			m_nb_workers;
+
+	// Idle workers sleep on m_wake_event until jobs are queued
+	int32_t		m_nb_queued_jobs;
+	Mutex		m_sleep_mutex;
+	Event		m_wake_event;
+	bool		m_shut;
+
+	static THREAD_LOCAL Worker*	s_current_worker;
+
+public:
+	JobSystem();
+
+	// nb_workers includes the calling thread. Call it from the thread that will submit jobs.
+	void	init(int nb_workers);
+	void	shut();
+
+	int		getNbWorkers() const	{return m_nb_workers;}
+
+	// Split [0, nb_items) into jobs of nb_items_per_job items, queue them and return.
+	// Only workers can submit jobs: the thread that called init() or a running job.
+	void	submit(const char* name, const Color& color, size_t nb_items, size_t nb_items_per_job,
+				   JobFunc func, void* user_data, JobCounter& counter);
+
+	// Run jobs until all the jobs of the counter are done
+	void	wait(JobCounter& counter);
+
+	// submit() + wait()
+	void	parallelFor(const char* name, const Color& color, size_t nb_items, size_t nb_items_per_job,
+						JobFunc func, void* user_data);
+
+private:
+	Job*	allocJob(Worker& worker);
+	bool	runOneJob(Worker& worker);
+	void	execute(Job* job);
+	void	wakeWorkers();
+
+	void	run(Worker& worker);
+	static void*	runWrapper(void* user_data);
+};
+
+#endif // JOB_SYSTEM_H
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include "scene.h"
+#include "stress_workload.h"
 
 #include <GL/glew.h>
 
@@ -15,9 +16,13 @@
 
 #include <GL/glfw.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include "alloc_tracker.h"
 #include "hp_timer.h"
+#include "perf_counters.h"
 #include "profiler.h"
+#include "profiler_protocol.h"
 #include "drawer2D.h"
 #include "thread.h"
 #include "math_utils.h"
@@ -32,6 +37,7 @@
 
 static volatile bool	done = false;
 Scene					scene;
+StressWorkload			stress_workload;
 bool					help_visible = true;
 
 void GLFWCALL onMouseClick(int x, int y);
@@ -70,7 +76,7 @@ void fpsCount(const char* base_title)
 	frames++;
 }
 
-int main()
+int main(int argc, char** argv)
 {
 	int win_w, win_h;
 	int prev_win_w, prev_win_h;
@@ -78,6 +84,7 @@ int main()
 	int prev_mouse_x, prev_mouse_y;
 
 	initTimer();
+	threadSetName("Main");
 
 	// Initialize GLFW
 	if( !glfwInit() )
@@ -190,13 +197,107 @@ int main()
 	// Initialize the profiler
 	PROFILER_INIT(win_w, win_h, mouse_x, mouse_y);
 
+	// Command line
+	int nb_grids_x = 2;
+	int nb_grids_y = 2;
+	bool			stress = false;
+	StressConfig	stress_config;
+	for(int i=1 ; i < argc ; i++)
+	{
+		if(strcmp(argv[i], "--server") == 0)
+		{
+			// Stream the frames to a remote viewer such as tools/profiler_dump
+			int port = PROFILER_SERVER_DEFAULT_PORT;
+			if(i+1 < argc && argv[i+1][0] != '-')
+				port = atoi(argv[++i]);
+			PROFILER_START_SERVER((unsigned short)port);
+		}
+		else if(strcmp(argv[i], "--waits") == 0)
+		{
+			// Markers for the waits on the thread.h primitives longer than the threshold
+			double threshold_us = 50.0;
+			if(i+1 < argc && argv[i+1][0] != '-')
+				threshold_us = atof(argv[++i]);
+			PROFILER_START_WAIT_TRACKING(threshold_us);
+			(void)threshold_us;	// Unused when the profiler is disabled
+		}
+		else if(strcmp(argv[i], "--capture") == 0)
+		{
+			// Capture the frames around hitches into capture_XXX.json (chrome://tracing format)
+			double threshold_ms = 50.0;
+			if(i+1 < argc && argv[i+1][0] != '-')
+				threshold_ms = atof(argv[++i]);
+			PROFILER_ADD_TRIGGER(Profiler::TRIGGER_FRAME_TIME, threshold_ms, NULL);
+			(void)threshold_ms;	// Unused when the profiler is disabled
+		}
+		else if(strcmp(argv[i], "--allocs") == 0)
+		{
+			// Allocations of each marker, with the hooks of alloc_tracker.cpp
+			if(allocTrackerIsAvailable())
+				allocTrackerSetEnabled(true);
+			else
+				fprintf(stderr, "*** --allocs: the demo is built without TRACK_ALLOCATIONS\n");
+		}
+		else if(strcmp(argv[i], "--perf") == 0)
+		{
+			// Hardware counters of each marker, see perf_counters.h. perf_counters.cpp explains why it failed.
+			if(!perfCountersSetEnabled(true))
+				fprintf(stderr, "*** --perf: the hardware counters are unavailable\n");
+		}
+		else if(strcmp(argv[i], "--grids") == 0 && i+1 < argc)
+		{
+			// Stress test: up to 16x16 grids
+			if(sscanf(argv[++i], "%dx%d", &nb_grids_x, &nb_grids_y) != 2)
+			{
+				fprintf(stderr, "*** --grids expects WxH, e.g. --grids 16x16\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if(strcmp(argv[i], "--stress") == 0)
+		{
+			// Synthetic marker load, see StressConfig::parse() for the options
+			stress = true;
+			if(i+1 < argc && argv[i+1][0] != '-' && !stress_config.parse(argv[++i]))
+				return EXIT_FAILURE;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--server [port]] [--waits [threshold_us]] [--capture [threshold_ms]] [--allocs] [--perf] [--grids WxH] [--stress [key=value,...]]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
 	// Initialize the example scene
-	if(!scene.init())
+	if(!scene.init(nb_grids_x, nb_grids_y))
 	{
 		fprintf(stderr, "*** FAILED initializing the scene\n");
 		return EXIT_FAILURE;
 	}
 	printf("Multithreaded update: %s\n", scene.isMultithreaded() ? "yes" : "no");
+	printf("%d grids, instanced draw: %s\n", scene.getNbGrids(), scene.isInstanced() ? "yes" : "no");
+
+#ifdef ENABLE_PROFILER
+	// The profiler records a limited number of threads: the workers of the scene, the main thread among them,
+	// register with their first jobs. The stress threads get the slots left.
+	int nb_free_threads = (int)profiler.getMaxCpuThreads() - scene.getNbWorkers();
+	if(stress && stress_config.nb_threads > nb_free_threads)
+	{
+		if(nb_free_threads < 1)
+		{
+			fprintf(stderr, "*** --stress: the %d workers of the scene take all the threads of the profiler\n", scene.getNbWorkers());
+			return EXIT_FAILURE;
+		}
+		fprintf(stderr, "*** --stress: %d threads instead of %d, the profiler records %d threads and the scene has %d workers\n",
+				nb_free_threads, stress_config.nb_threads, (int)profiler.getMaxCpuThreads(), scene.getNbWorkers());
+		stress_config.nb_threads = nb_free_threads;
+	}
+#endif
+
+	if(stress && !stress_workload.init(stress_config))
+	{
+		fprintf(stderr, "*** FAILED initializing the stress workload\n");
+		return EXIT_FAILURE;
+	}
 
 	// Enable vertical sync
 	glfwSwapInterval( 1 );
@@ -250,6 +351,12 @@ int main()
 		scene.draw(win_w, win_h);
 		PROFILER_POP_CPU_MARKER();
 
+		if(stress_workload.isRunning())
+		{
+			stress_workload.drawGpuMarkers();
+			stress_workload.update();
+		}
+
 		glDisable(GL_DEPTH_TEST);
 
 		PROFILER_PUSH_GPU_MARKER("Draw profiler", COLOR_DARK_BLUE);
@@ -263,6 +370,10 @@ int main()
 			PROFILER_POP_CPU_MARKER();
 		}
 
+		PROFILER_COUNTER("Drawer2D draw calls", drawer2D.getNbDrawCalls());
+		PROFILER_COUNTER("Drawer2D upload (bytes)", drawer2D.getNbUploadedBytes());
+		drawer2D.resetStats();
+
 		checkGLError();
 
 		fpsCount(BASE_TITLE);
@@ -277,6 +388,7 @@ int main()
 
 	done = true;
 
+	stress_workload.shut();
 	scene.shut();
 
 	PROFILER_SHUT();
@@ -308,13 +420,65 @@ void GLFWCALL onKey(int key, int action)
 		case 'H':
 			help_visible = !help_visible;
 			break;
-		case 'P':
-			profiler.setVisible(!profiler.isVisible());
-			break;
 		case 'M':
 			scene.setMultithreaded(!scene.isMultithreaded());
 			printf("Multithreaded update: %s\n", scene.isMultithreaded() ? "yes" : "no");
 			break;
+		case 'G':
+			scene.setGpuHeights(!scene.hasGpuHeights());
+			printf("Grid heights: %s\n", scene.hasGpuHeights() ? "GPU" : "CPU");
+			break;
+		case 'D':
+			scene.setInstanced(!scene.isInstanced());
+			printf("Instanced draw: %s\n", scene.isInstanced() ? "yes" : "no");
+			break;
+		case 'I':
+			scene.setIndexLayout((GridIndexLayout)((scene.getIndexLayout() + 1) % NB_GRID_INDEX_LAYOUTS));
+			printf("Grid indices: %s\n", gridGetIndexLayoutName(scene.getIndexLayout()));
+			break;
+#ifdef ENABLE_PROFILER
+		case 'P':
+			profiler.setVisible(!profiler.isVisible());
+			break;
+		case 'O':
+			profiler.setOverheadCompensation(!profiler.hasOverheadCompensation());
+			printf("Profiler overhead subtracted from the exported markers: %s\n", profiler.hasOverheadCompensation() ? "yes" : "no");
+			break;
+		case 'J':
+			profiler.setCategoryMask(profiler.getCategoryMask() ^ PROFILER_CATEGORY_JOBS);
+			printf("Job markers: %s\n", profiler.isCategoryEnabled(PROFILER_CATEGORY_JOBS) ? "yes" : "no");
+			break;
+		case 'R':
+			profiler.setRecording(!profiler.isRecording());
+			printf("Profiler recording: %s\n", profiler.isRecording() ? "yes" : "no");
+			break;
+		case 'W':
+			if(profiler.isTrackingWaits())
+			{
+				profiler.stopWaitTracking();
+				profiler.printWaitStats();
+			}
+			else
+			{
+				profiler.startWaitTracking(profiler.getWaitThresholdUs());
+			}
+			break;
+		case 'A':
+			if(!allocTrackerIsAvailable())
+			{
+				printf("Allocation tracking: not built in, define TRACK_ALLOCATIONS\n");
+				break;
+			}
+			allocTrackerSetEnabled(!allocTrackerIsEnabled());
+			printf("Allocation tracking: %s\n", allocTrackerIsEnabled() ? "yes" : "no");
+			break;
+		case 'C':
+			if(perfCountersSetEnabled(!perfCountersIsEnabled()))
+				printf("Hardware counters: %s\n", perfCountersIsEnabled() ? "yes" : "no");
+			else
+				printf("Hardware counters: unavailable\n");
+			break;
+#endif
 		}
 	}
 }
@@ -327,6 +491,15 @@ void drawHelp()
 		"[H]: display this help message\n"
 		"[P]: profiler visiblity\n"
 		"[M]: mono/multi threaded update\n"
+		"[G]: grid heights computed on the CPU/GPU\n"
+		"[I]: next grid index layout\n"
+		"[D]: one instanced draw/one draw per grid\n"
+		"[O]: subtract the profiler overhead in the captures\n"
+		"[J]: show/hide the markers of the jobs\n"
+		"[R]: stop/resume the recording of the markers\n"
+		"[W]: track the waits on mutexes and events\n"
+		"[A]: count the allocations of the markers\n"
+		"[C]: read the hardware counters of the markers\n"
 		"[ESC]: quit\n"
 		"click on the profiler to freeze it\n",
 		0.12f, 1.0f-0.15f, COLOR_WHITE);
@@ -9,6 +9,10 @@
 #define PI_FLOAT	3.14159265358979323846f
 #endif
 
+#ifndef PI_DOUBLE
+#define PI_DOUBLE	3.14159265358979323846
+#endif
+
 // -----------------------------------------
 // Vectors
 inline float vecLength(const float v[3])
@@ -1,4 +1,5 @@
 // grid.vert
+// Heights computed on the CPU, read from a buffer texture: one float per vertex and per instance
 
 #version 330 core
 
@@ -7,18 +8,26 @@
 //precision highp float;
 //precision highp int;
 
-uniform mat4 MVP;
+uniform mat4 view_proj;
+
+uniform samplerBuffer	heights;
+uniform int				nb_vertices;		// Per instance
 
 // ---------------------------------------------------------------------
-layout(location = 0) in vec3 vertex_position;
-layout(location = 1) in vec3 vertex_color;
+layout(location = 0) in vec2 vertex_position_xz;
+layout(location = 1) in float vertex_shade;
+layout(location = 2) in vec4 instance_offset_phases;	// offset x, offset z, unused, unused
+layout(location = 3) in vec3 instance_color;
 
 out vec3 var_color;
 
 // ---------------------------------------------------------------------
 void main()
 {
-	var_color = vertex_color;
+	var_color = vertex_shade * instance_color;
+
+	float height = texelFetch(heights, gl_InstanceID*nb_vertices + gl_VertexID).r;
 
-	gl_Position = MVP * vec4(vertex_position, 1.0);
+	vec2 xz = vertex_position_xz + instance_offset_phases.xy;
+	gl_Position = view_proj * vec4(xz.x, height, xz.y, 1.0);
 }
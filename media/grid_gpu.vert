@@ -0,0 +1,37 @@
+// grid_gpu.vert
+// Same as grid.vert, but the heights are computed here instead of being uploaded
+
+#version 330 core
+
+// ---------------------------------------------------------------------
+// Default precision
+//precision highp float;
+//precision highp int;
+
+uniform mat4 view_proj;
+
+uniform int		grid_width;			// Vertices per row
+uniform vec4	wave;				// x_freq, y_freq, floor, amplitude
+
+// ---------------------------------------------------------------------
+layout(location = 0) in vec2 vertex_position_xz;
+layout(location = 1) in float vertex_shade;
+layout(location = 2) in vec4 instance_offset_phases;	// offset x, offset z, x_phase, y_phase: phases reduced modulo 2*pi on the CPU
+layout(location = 3) in vec3 instance_color;
+
+out vec3 var_color;
+
+// ---------------------------------------------------------------------
+void main()
+{
+	var_color = vertex_shade * instance_color;
+
+	// Grid coordinates of the vertex
+	float x = float(gl_VertexID % grid_width);
+	float y = float(gl_VertexID / grid_width);
+
+	float height = wave.z + wave.w * (cos(wave.x*x + instance_offset_phases.z) + sin(wave.y*y + instance_offset_phases.w));
+
+	vec2 xz = vertex_position_xz + instance_offset_phases.xy;
+	gl_Position = view_proj * vec4(xz.x, height, xz.y, 1.0);
+}
@@ -0,0 +1,214 @@
+// perf_counters.cpp
+
+#include "perf_counters.h"
+#include <stdio.h>
+
+static const char* const	counter_names[NB_PERF_COUNTERS] =
+{
+	"cycles",
+	"instructions",
+	"llc_misses",
+	"branch_misses",
+};
+
+//-----------------------------------------------------------------------------
+const char* perfCounterGetName(PerfCounter counter)
+{
+	return counter_names[counter];
+}
+
+#ifdef PERF_COUNTERS_SUPPORTED
+
+#include "thread.h"
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define PERF_COUNTERS_RDPMC
+#endif
+
+enum ThreadCountersState
+{
+	THREAD_COUNTERS_CLOSED = 0,	// Opened at the first read
+	THREAD_COUNTERS_OPEN,
+	THREAD_COUNTERS_FAILED
+};
+
+// Counters of a thread, kept open until the end of the program
+struct ThreadCounters
+{
+	ThreadCountersState		state;
+	int						fds[NB_PERF_COUNTERS];		// fds[0] is the leader of the group
+	perf_event_mmap_page*	pages[NB_PERF_COUNTERS];
+	bool					rdpmc;						// All the pages allow reading the counters with rdpmc
+};
+
+bool						perf_counters_enabled = false;
+static bool					s_unavailable = false;
+static THREAD_LOCAL ThreadCounters	s_thread_counters;	// Zero-initialized: THREAD_COUNTERS_CLOSED
+
+//-----------------------------------------------------------------------------
+/// Open the counters of the calling thread as one group, so that they are scheduled together.
+/// The first failure disables them for all the threads.
+static bool openThreadCounters(ThreadCounters& tc)
+{
+	static const uint64_t	configs[NB_PERF_COUNTERS] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,	// Usually the last level cache
+		PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	size_t	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	tc.rdpmc = true;
+	for(size_t i=0 ; i < NB_PERF_COUNTERS ; i++)
+	{
+		perf_event_attr	attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;	// Allowed with perf_event_paranoid <= 2
+		attr.exclude_hv = 1;
+
+		int	group_fd = (i == 0 ? -1 : tc.fds[0]);
+		int	fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);	// This thread, on any CPU
+		if(fd < 0)
+		{
+			int	error = errno;
+			if(!atomicExchange(&s_unavailable, true))
+			{
+				fprintf(stderr, "*** perf_event_open(%s) failed: %s, the hardware counters are disabled\n",
+						counter_names[i], strerror(error));
+			}
+			atomicStoreRelaxed(&perf_counters_enabled, false);
+
+			for(size_t j=0 ; j < i ; j++)
+			{
+				if(tc.pages[j])
+					munmap(tc.pages[j], page_size);
+				close(tc.fds[j]);
+			}
+			return false;
+		}
+		tc.fds[i] = fd;
+
+		void*	page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+		tc.pages[i] = (page == MAP_FAILED ? NULL : (perf_event_mmap_page*)page);
+		if(!tc.pages[i] || !tc.pages[i]->cap_user_rdpmc)
+			tc.rdpmc = false;
+	}
+#ifndef PERF_COUNTERS_RDPMC
+	tc.rdpmc = false;
+#endif
+	return true;
+}
+
+#ifdef PERF_COUNTERS_RDPMC
+//-----------------------------------------------------------------------------
+static inline uint64_t rdpmc(uint32_t counter)
+{
+	uint32_t	low, high;
+	__asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+	return (uint64_t)low | ((uint64_t)high << 32);
+}
+
+//-----------------------------------------------------------------------------
+/// Value of a counter from its page, as documented in linux/perf_event.h: the kernel updates the page
+/// under a sequence lock when it schedules the counter, rdpmc adds what the counter got since.
+static inline uint64_t readMappedCounter(const volatile perf_event_mmap_page* page)
+{
+	uint32_t	seq;
+	uint64_t	count;
+	do
+	{
+		seq = page->lock;
+		__asm__ volatile("" ::: "memory");
+
+		count = page->offset;
+		uint32_t	index = page->index;	// 0 while the counter is not scheduled
+		if(index)
+		{
+			int64_t	pmc = (int64_t)rdpmc(index - 1);
+			uint16_t	shift = (uint16_t)(64 - page->pmc_width);
+			count += (uint64_t)((pmc << shift) >> shift);	// sign-extended to 64 bits
+		}
+
+		__asm__ volatile("" ::: "memory");
+	} while(page->lock != seq);
+
+	return count;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+/// Enabling opens the counters of the calling thread, to report at once when the kernel refuses them
+bool perfCountersSetEnabled(bool enabled)
+{
+	if(enabled)
+	{
+		ThreadCounters&	tc = s_thread_counters;
+		if(tc.state == THREAD_COUNTERS_CLOSED)
+			tc.state = openThreadCounters(tc) ? THREAD_COUNTERS_OPEN : THREAD_COUNTERS_FAILED;
+		if(tc.state != THREAD_COUNTERS_OPEN || atomicLoadRelaxed(&s_unavailable))
+			return false;
+	}
+
+	atomicStoreRelaxed(&perf_counters_enabled, enabled);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool perfCountersIsEnabled()
+{
+	return atomicLoadRelaxed(&perf_counters_enabled);
+}
+
+//-----------------------------------------------------------------------------
+bool perfCountersIsAvailable()
+{
+	return !atomicLoadRelaxed(&s_unavailable);
+}
+
+//-----------------------------------------------------------------------------
+/// rdpmc costs a few tens of cycles per counter, the read() syscall of the fallback about a microsecond
+void perfCountersReadThread(PerfCounterValues* values)
+{
+	ThreadCounters&	tc = s_thread_counters;
+	if(tc.state == THREAD_COUNTERS_CLOSED)
+		tc.state = openThreadCounters(tc) ? THREAD_COUNTERS_OPEN : THREAD_COUNTERS_FAILED;
+	if(tc.state != THREAD_COUNTERS_OPEN)
+	{
+		values->valid = false;
+		return;
+	}
+
+#ifdef PERF_COUNTERS_RDPMC
+	if(tc.rdpmc)
+	{
+		for(size_t i=0 ; i < NB_PERF_COUNTERS ; i++)
+			values->values[i] = readMappedCounter(tc.pages[i]);
+		values->valid = true;
+		return;
+	}
+#endif
+
+	// PERF_FORMAT_GROUP: the number of counters, then their values in the order they were opened
+	uint64_t	buffer[1 + NB_PERF_COUNTERS];
+	if(read(tc.fds[0], buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer))
+	{
+		values->valid = false;
+		return;
+	}
+	for(size_t i=0 ; i < NB_PERF_COUNTERS ; i++)
+		values->values[i] = buffer[1+i];
+	values->valid = true;
+}
+
+#endif // PERF_COUNTERS_SUPPORTED
@@ -0,0 +1,63 @@
+// perf_counters.h
+// Hardware counters of the calling thread, for the profiler: cycles, instructions, last level cache misses and
+// branch misses. On Linux, each thread opens a group of perf_event_open() counters the first time it reads them,
+// and maps their pages to read them in user space with rdpmc on x86, or with a read() syscall elsewhere.
+// They are unavailable on the other platforms, and when the kernel refuses them (containers, virtual machines
+// without a virtual PMU, perf_event_paranoid): the profiler then shows no counters.
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include "atomic.h"
+
+#ifdef __linux__
+	#define PERF_COUNTERS_SUPPORTED
+#endif
+
+enum PerfCounter
+{
+	PERF_COUNTER_CYCLES = 0,
+	PERF_COUNTER_INSTRUCTIONS,
+	PERF_COUNTER_LLC_MISSES,
+	PERF_COUNTER_BRANCH_MISSES,
+
+	NB_PERF_COUNTERS
+};
+
+struct PerfCounterValues
+{
+	bool		valid;	// false when the counters were off, or could not be opened on the thread
+	uint64_t	values[NB_PERF_COUNTERS];
+};
+
+const char*	perfCounterGetName(PerfCounter counter);	// "cycles", "instructions", "llc_misses", "branch_misses"
+
+#ifdef PERF_COUNTERS_SUPPORTED
+	extern bool	perf_counters_enabled;
+
+	// Any thread. Enabling opens the counters of the calling thread: it fails, and the counters stay off,
+	// when the kernel refuses them.
+	bool	perfCountersSetEnabled(bool enabled);
+	bool	perfCountersIsEnabled();
+	bool	perfCountersIsAvailable();	// false once the kernel refused to open them
+
+	void	perfCountersReadThread(PerfCounterValues* values);
+
+	// Counters of the calling thread since they were opened. While they are off, it costs a relaxed load.
+	inline void	perfCountersRead(PerfCounterValues* values)
+	{
+		if(atomicLoadRelaxed(&perf_counters_enabled))
+			perfCountersReadThread(values);
+		else
+			values->valid = false;
+	}
+#else
+	inline bool	perfCountersSetEnabled(bool enabled)	{return !enabled;}
+	inline bool	perfCountersIsEnabled()				{return false;}
+	inline bool	perfCountersIsAvailable()			{return false;}
+
+	inline void	perfCountersRead(PerfCounterValues* values)	{values->valid = false;}
+#endif
+
+#endif // PERF_COUNTERS_H
@@ -7,15 +7,30 @@
 #include "hp_timer.h"
 #include "drawer2D.h"
 #include "thread.h"
+#include "profiler_server.h"
+#include "capture_writer.h"
 #include <limits.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 
 Profiler profiler;
 
+THREAD_LOCAL Profiler::CpuThreadInfo*	Profiler::s_thread_info = NULL;
+THREAD_LOCAL bool						Profiler::s_thread_rejected = false;
+
+// Clock of the CPU markers and of the frames
+#ifdef PROFILER_FAKE_CLOCK
+	#define PROFILER_TIME_NS()	profilerFakeTimeNs()
+#else
+	#define PROFILER_TIME_NS()	getTimeNs()
+#endif
+
 // Unit: percentage of the screen dimensions
 #define MARGIN_X	0.02f	// left and right margin
 #define MARGIN_Y	0.02f	// bottom margin
 #define LINE_HEIGHT 0.01f   // height of a line representing a thread
+#define LABEL_WIDTH	0.08f	// column of the names of the lines, left of the markers
 
 //#define TIME_DRAWN_MS 30.0 // the width of the profiler corresponds to TIME_DRAWN_MS milliseconds
 //#define TIME_DRAWN_MS 60.0 // the width of the profiler corresponds to TIME_DRAWN_MS milliseconds
@@ -24,8 +39,8 @@ Profiler profiler;
 #define GPU_COUNT	1	// TODO: multiple GPUs are not supported
 
 // -----
-#define	PROFILER_WIDTH		(1.0f - 2.0f*MARGIN_X)
-#define	X_OFFSET			MARGIN_X
+#define	PROFILER_WIDTH		(1.0f - 2.0f*MARGIN_X - LABEL_WIDTH)
+#define	X_OFFSET			(MARGIN_X + LABEL_WIDTH)
 #define	Y_OFFSET			(MARGIN_Y + LINE_HEIGHT)
 #define	X_FACTOR			( (float)(PROFILER_WIDTH / (TIME_DRAWN_MS * 1000000.0)) )
 
@@ -37,13 +52,36 @@ Profiler profiler;
 
 #define COLOR_FROZEN		Color(0xD0, 0xD0, 0xD0)
 
+#define COUNTER_MIN_HEIGHT	0.1f	// Fraction of the line height for the lowest value of a counter, so that it stays visible
+
+#define FLOW_ARROW_SIZE		6.0f	// Length of the sides of the arrow heads, in pixels
+
+#define COLOR_LOCK_WAIT		Color(0xA0, 0x00, 0x00)	// contended mutexes
+#define COLOR_IDLE_WAIT		Color(0xB0, 0xB0, 0xB0)	// events and barriers
+
+static const char* const	wait_type_names[] = {"mutex", "event", "barrier"};
+
+#define COLOR_CRITICAL_PATH	Color(0xFF, 0x80, 0x00)
+
 //-----------------------------------------------------------------------------
 void Profiler::init(int win_w, int win_h, int mouse_x, int mouse_y)
 {
 	m_cur_frame = 0;
-	m_freeze_state = UNFROZEN;
+	m_category_mask = PROFILER_ALL_CATEGORIES;
+	m_recording = true;
+	m_next_flow_id = 1;
+	m_wait_tracking = false;
+	m_wait_threshold_us = 50.0;
+	m_nb_wait_objects = 0;
+	m_nb_counter_lines = 0;
+	m_frozen = false;
 	m_visible = true;
 
+	m_nb_registered_threads = 0;
+	m_nb_rejected_threads = 0;
+	m_nb_cpu_threads = 0;
+	m_main_thread_id = threadGetCurrentId();
+
 	updateBackgroundRect();
 
 	m_win_w = win_w;
@@ -58,7 +96,35 @@ void Profiler::init(int win_w, int win_h, int mouse_x, int mouse_y)
 		m_frame_info[i].frame = -1;
 		m_frame_info[i].time_sync_start = INVALID_TIME;
 		m_frame_info[i].time_sync_end = INVALID_TIME;
+		m_frame_info[i].gpu_time_sync_end = INVALID_TIME;
 	}
+
+	m_nb_triggers = 0;
+	m_gpu_late_frame = -1;
+
+	m_capture.active = false;
+	m_capture.nb_captures = 0;
+	m_capture_writer = new CaptureWriter();
+	m_capture_writer->start();
+	setCaptureFrames(4, 4);
+
+	m_server = NULL;
+
+	m_critical_path = new CriticalPathAnalyzer();
+	m_critical_path->start();
+	m_drawn_path.frame = -1;
+
+	// Timer queries of the current context
+	m_gl.gen_queries = glGenQueries;
+	m_gl.delete_queries = glDeleteQueries;
+	m_gl.query_counter = glQueryCounter;
+	m_gl.get_query_objectiv = glGetQueryObjectiv;
+	m_gl.get_query_objectui64v = glGetQueryObjectui64v;
+	m_gl.get_integer64v = glGetInteger64v;
+
+	m_marker_overhead_ns = 0.0;
+	m_compensate_overhead = false;
+	calibrateOverhead();
 }
 
 //-----------------------------------------------------------------------------
@@ -70,83 +136,272 @@ void Profiler::shut()
 		GpuMarker&	marker = m_gpu_thread_info.markers[i];
 		if(marker.id_query_start != INVALID_QUERY)
 		{
-			glDeleteQueries(1, &marker.id_query_start);
+			m_gl.delete_queries(1, &marker.id_query_start);
 			marker.id_query_start = INVALID_QUERY;
 		}
 		if(marker.id_query_end != INVALID_QUERY)
 		{
-			glDeleteQueries(1, &marker.id_query_end);
+			m_gl.delete_queries(1, &marker.id_query_end);
 			marker.id_query_end = INVALID_QUERY;
 		}
 	}
 
+	stopCapture();
+	m_capture_writer->stop();
+	delete m_capture_writer;
+	m_capture_writer = NULL;
+
+	stopServer();
+
+	m_critical_path->stop();
+	delete m_critical_path;
+	m_critical_path = NULL;
+
+	if(m_wait_tracking)
+	{
+		stopWaitTracking();
+		printWaitStats();
+	}
+
 	mutexDestroy(&m_cpu_mutex);
 }
 
 //-----------------------------------------------------------------------------
-/// Push a new marker that starts now
-void Profiler::pushCpuMarker(const char* name, const Color& color)
+/// Measure what a push/pop pair costs to the marker that encloses it.
+/// The calling thread gets registered: the markers are recorded normally, then their events are dropped.
+void Profiler::calibrateOverhead()
 {
-	// Don't do anything when frozen
-	if(isFrozen())
-		return;
+	CpuThreadInfo*	p_ti = getOrAddCpuThreadInfo();
+	if(!p_ti)
+		return;	// Too many threads before init(): m_marker_overhead_ns stays 0
+	CpuThreadInfo&	ti = *p_ti;
 
-	CpuThreadInfo& ti = getOrAddCpuThreadInfo();
+	uint64_t	best_time = INVALID_TIME;
+	for(size_t batch=0 ; batch < NB_CALIBRATION_BATCHES ; batch++)
+	{
+		uint64_t	start = PROFILER_TIME_NS();
+		for(size_t i=0 ; i < NB_CALIBRATION_MARKERS ; i++)
+		{
+			pushCpuMarker("Profiler calibration", COLOR_BLACK);
+			popCpuMarker();
+		}
+		uint64_t	time = PROFILER_TIME_NS() - start;
+		if(time < best_time)
+			best_time = time;
+
+		// This thread is the consumer too until init() returns
+		CpuEvent	event;
+		while(ti.events.pop(event))
+			;
+		ti.nb_frame_markers = 0;
+	}
 
-	Marker& marker = ti.markers[ti.cur_write_id];
-	assert(marker.frame != m_cur_frame && "looping: too many markers, no free slots available");
+	m_marker_overhead_ns = double(best_time) / double(NB_CALIBRATION_MARKERS);
+}
 
-	marker.start = getTimeNs();
-	marker.end = INVALID_TIME;
-	marker.layer = ti.nb_pushed_markers;
-	strncpy(marker.name, name, MARKER_NAME_MAX_LENGTH);
-	marker.color = color;
-	marker.frame = m_cur_frame;
+//-----------------------------------------------------------------------------
+/// Push a new marker that starts now.
+/// Only the calling thread's queue is touched: the marker is created by synchronizeFrame().
+void Profiler::recordCpuPush(const char* name, const Color& color)
+{
+	CpuThreadInfo* p_ti = getOrAddCpuThreadInfo();
+	if(!p_ti)
+		return;	// Too many threads
+	CpuThreadInfo& ti = *p_ti;
+
+	// Deeper markers are dropped, and their pops ignored
+	if(ti.nb_pushed_markers >= NB_MAX_CPU_MARKER_LAYERS)
+	{
+		atomicStoreRelaxed(&ti.nb_dropped_markers, ti.nb_dropped_markers+1);	// only written by this thread
+		ti.nb_pushed_markers++;
+		return;
+	}
+
+	// So are the markers beyond the ones the ring keeps per frame
+	int frame = atomicLoadRelaxed(&m_cur_frame);	// only a hint: the events are ordered by the queue
+	if(!reserveFrameMarker(ti, frame))
+	{
+		ti.dropped_markers[ti.nb_pushed_markers] = true;
+		ti.nb_pushed_markers++;
+		return;
+	}
+
+	CpuEvent	event;
+	event.time = PROFILER_TIME_NS();
+	event.frame = frame;
+	event.type = CPU_EVENT_PUSH;
+	strncpy(event.name, name, MARKER_NAME_MAX_LENGTH-1);
+	event.name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+	event.color = color;
+	event.allocs = allocTrackerGetCounters();
+	perfCountersRead(&event.perf);	// Last, to leave the push out of the counters of the marker
+
+	// Keep room for the pop events of the markers that are already in the queue
+	bool ok = ti.events.push(event, ti.nb_queued_markers+1);
+	ti.dropped_markers[ti.nb_pushed_markers] = !ok;
+	if(ok)
+		ti.nb_queued_markers++;
+	else
+		atomicStoreRelaxed(&ti.nb_dropped_markers, ti.nb_dropped_markers+1);	// only written by this thread
 
-	incrementCycle(&ti.cur_write_id, NB_MARKERS_PER_CPU_THREAD);
 	ti.nb_pushed_markers++;
 }
 
 //-----------------------------------------------------------------------------
 /// Stop the last pushed marker
-void Profiler::popCpuMarker()
+void Profiler::recordCpuPop()
 {
-	// Don't do anything when frozen
-	if(isFrozen())
-		return;
-
-	CpuThreadInfo& ti = getOrAddCpuThreadInfo();
+	CpuThreadInfo* p_ti = getOrAddCpuThreadInfo();
+	if(!p_ti)
+		return;	// Too many threads
+	CpuThreadInfo& ti = *p_ti;
 	assert(ti.nb_pushed_markers != 0);
 
-	// Get the most recent marker that has not been closed yet
-	int index = ti.cur_write_id-1;
-	while(ti.markers[index].end != INVALID_TIME)	// skip closed markers
-		decrementCycle(&index, NB_MARKERS_PER_CPU_THREAD);
+	ti.nb_pushed_markers--;
+	if(ti.nb_pushed_markers >= NB_MAX_CPU_MARKER_LAYERS || ti.dropped_markers[ti.nb_pushed_markers])
+		return;	// too deep, or the queue was full when the marker was pushed
+
+	CpuEvent	event;
+	perfCountersRead(&event.perf);	// First, to leave the pop out of the counters of the marker
+	event.time = PROFILER_TIME_NS();
+	event.frame = atomicLoadRelaxed(&m_cur_frame);
+	event.type = CPU_EVENT_POP;
+	event.allocs = allocTrackerGetCounters();
+
+	bool ok = ti.events.push(event);	// always succeeds: push() kept room for it
+	assert(ok);
+	(void)ok;
+	ti.nb_queued_markers--;
+}
 
-	Marker& marker = ti.markers[index];
-	assert(marker.end == INVALID_TIME);
-	marker.end = getTimeNs();
+//-----------------------------------------------------------------------------
+/// The ring keeps NB_MAX_CPU_MARKERS_PER_FRAME markers per frame and per thread: a marker beyond them would
+/// overwrite the history of the previous frames. Keep the first ones of the frame, and count the others as dropped.
+bool Profiler::reserveFrameMarker(CpuThreadInfo& ti, int frame)
+{
+	if(frame != ti.marker_frame)
+	{
+		ti.marker_frame = frame;
+		ti.nb_frame_markers = 0;
+	}
+	if(ti.nb_frame_markers == NB_MAX_CPU_MARKERS_PER_FRAME)
+	{
+		atomicStoreRelaxed(&ti.nb_dropped_markers, ti.nb_dropped_markers+1);	// only written by this thread
+		return false;
+	}
+	ti.nb_frame_markers++;
+	return true;
+}
 
-	ti.nb_pushed_markers--;
+//-----------------------------------------------------------------------------
+/// Queue an event that is neither a push nor a pop, or count it as dropped if it does not fit.
+/// Room is kept for the pop events of the markers that are already in the queue.
+void Profiler::queueEvent(CpuThreadInfo& ti, const CpuEvent& event)
+{
+	if(!ti.events.push(event, ti.nb_queued_markers))
+		atomicStoreRelaxed(&ti.nb_dropped_markers, ti.nb_dropped_markers+1);	// only written by this thread
 }
 
 //-----------------------------------------------------------------------------
-/// Push a new GPU marker that starts when the previously issued commands are processed
-void Profiler::pushGpuMarker(const char* name, const Color& color)
+/// Record a sample of a counter in the calling thread's queue, like a marker
+void Profiler::recordCounterSample(const char* name, double value)
+{
+	CpuThreadInfo* p_ti = getOrAddCpuThreadInfo();
+	if(!p_ti)
+		return;	// Too many threads
+	CpuThreadInfo& ti = *p_ti;
+
+	CpuEvent	event;
+	event.time = PROFILER_TIME_NS();
+	event.frame = atomicLoadRelaxed(&m_cur_frame);
+	event.type = CPU_EVENT_COUNTER;
+	strncpy(event.name, name, MARKER_NAME_MAX_LENGTH-1);
+	event.name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+	event.value = value;
+
+	// The ring keeps NB_MAX_COUNTER_SAMPLES_PER_FRAME samples per frame: keep the first ones of the frame
+	if(event.frame != ti.counter_frame)
+	{
+		ti.counter_frame = event.frame;
+		ti.nb_frame_counter_samples = 0;
+	}
+	if(ti.nb_frame_counter_samples == NB_MAX_COUNTER_SAMPLES_PER_FRAME)
+		return;
+	ti.nb_frame_counter_samples++;
+
+	queueEvent(ti, event);
+}
+
+//-----------------------------------------------------------------------------
+/// Record the begin or the end of a flow in the calling thread's queue, like a counter sample
+void Profiler::recordFlowPoint(uint32_t id, CpuEventType type)
+{
+	CpuThreadInfo* p_ti = getOrAddCpuThreadInfo();
+	if(!p_ti)
+		return;	// Too many threads
+	CpuThreadInfo& ti = *p_ti;
+
+	CpuEvent	event;
+	event.time = PROFILER_TIME_NS();
+	event.frame = atomicLoadRelaxed(&m_cur_frame);
+	event.type = type;
+	event.flow_id = id;
+
+	// Many small jobs would fill the queue with flows and drop markers: keep the first ones of the frame
+	if(event.frame != ti.flow_frame)
+	{
+		ti.flow_frame = event.frame;
+		ti.nb_frame_flow_points = 0;
+	}
+	if(ti.nb_frame_flow_points == NB_MAX_FLOW_POINTS_PER_FRAME)
+		return;
+	ti.nb_frame_flow_points++;
+
+	queueEvent(ti, event);
+}
+
+//-----------------------------------------------------------------------------
+/// Record a wait that just ended as a complete marker. The threads are not registered here:
+/// registering locks a mutex, which would call the hook again.
+void Profiler::recordWait(ThreadWaitType type, const void* object, uint64_t wait_ns)
 {
-	// Don't do anything when frozen
-	if(isFrozen())
+	if(!isRecording() || !s_thread_info)
 		return;
+	CpuThreadInfo& ti = *s_thread_info;
+
+	CpuEvent	event;
+	event.time = PROFILER_TIME_NS() - wait_ns;
+	event.frame = atomicLoadRelaxed(&m_cur_frame);
+	if(!reserveFrameMarker(ti, event.frame))
+		return;	// a wait is recorded as a marker
+	event.type = CPU_EVENT_WAIT;
+	event.wait_type = type;
+	event.wait_object = object;
+	event.wait_ns = wait_ns;
+
+	queueEvent(ti, event);
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::onThreadWait(ThreadWaitType type, const void* object, uint64_t wait_ns)
+{
+	profiler.recordWait(type, object, wait_ns);
+}
 
+//-----------------------------------------------------------------------------
+/// Push a new GPU marker that starts when the previously issued commands are processed
+void Profiler::recordGpuPush(const char* name, const Color& color)
+{
 	GpuThreadInfo&	ti = m_gpu_thread_info;
 	GpuMarker& marker = ti.markers[ti.cur_write_id];
 
 	assert(marker.frame != m_cur_frame && "looping: too many markers, no free slots available");
+	assert(ti.nb_pushed_markers < NB_MAX_GPU_MARKERS_PER_FRAME);
 
 	// Issue timer query
 	if(marker.id_query_start == INVALID_QUERY)
-		glGenQueries(1, &marker.id_query_start);
-	glQueryCounter(marker.id_query_start, GL_TIMESTAMP);
+		m_gl.gen_queries(1, &marker.id_query_start);
+	m_gl.query_counter(marker.id_query_start, GL_TIMESTAMP);
 
 	// Fill in marker
 	marker.start = INVALID_TIME;
@@ -156,66 +411,67 @@ void Profiler::pushGpuMarker(const char* name, const Color& color)
 	marker.color = color;
 	marker.frame = m_cur_frame;
 
+	ti.pushed_markers[ti.nb_pushed_markers++] = ti.cur_write_id;
 	incrementCycle(&ti.cur_write_id, NB_GPU_MARKERS);
-	ti.nb_pushed_markers++;
 }
 
 //-----------------------------------------------------------------------------
 /// Stop the last pushed GPU marker when the previously issued commands are processed
-void Profiler::popGpuMarker()
+void Profiler::recordGpuPop()
 {
-	// Don't do anything when frozen
-	if(isFrozen())
-		return;
-
 	GpuThreadInfo& ti = m_gpu_thread_info;
 
-	// Get the most recent marker that has not been closed yet
-	int index = ti.cur_write_id-1;
-	while(ti.markers[index].end != INVALID_TIME)	// skip closed markers
-		decrementCycle(&index, NB_GPU_MARKERS);
-
-	GpuMarker&	marker = ti.markers[index];
+	// The end time is only known once the queries are read: the open markers are kept on a stack
+	GpuMarker&	marker = ti.markers[ti.pushed_markers[--ti.nb_pushed_markers]];
 
 	// Issue timer query
 	if(marker.id_query_end == INVALID_QUERY)
-		glGenQueries(1, &marker.id_query_end);
-	glQueryCounter(marker.id_query_end, GL_TIMESTAMP);
-
-	ti.nb_pushed_markers--;
+		m_gl.gen_queries(1, &marker.id_query_end);
+	m_gl.query_counter(marker.id_query_end, GL_TIMESTAMP);
 }
 
 //-----------------------------------------------------------------------------
 /// Update frame information and frame counter
 void Profiler::synchronizeFrame()
 {
-	// Freeze/unfreeze as needed
-	if(m_freeze_state == WAITING_FOR_FREEZE)
-		m_freeze_state = FROZEN;
-	else if(m_freeze_state == WAITING_FOR_UNFREEZE)
-		m_freeze_state = UNFROZEN;
+	// New threads
+	size_t nb_registered_threads = atomicLoadAcquire(&m_nb_registered_threads);
+	if(nb_registered_threads != m_nb_cpu_threads)
+	{
+		m_nb_cpu_threads = nb_registered_threads;
+		updateBackgroundRect();
+	}
 
-	// Don't do anything when frozen
-	if(isFrozen())
-		return;
+	// Get what the threads recorded since the last call
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
+		collectCpuEvents(getCpuThreadInfo(i));
 
-	// Next frame
-	m_cur_frame++;
+	// Next frame. The main thread is the only writer, so its own reads need no atomic load.
+	atomicStoreRelaxed(&m_cur_frame, m_cur_frame+1);
 
 	// Copy: cur_read_id <- next_read_id
 	// -> GPU:
 	m_gpu_thread_info.cur_read_id = m_gpu_thread_info.next_read_id;
 	// -> CPUs:
-	for(size_t i=m_cpu_thread_infos.begin() ;
-		i != m_cpu_thread_infos.getMaxSize() ;
-		i = m_cpu_thread_infos.next(i))
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
 	{
-		CpuThreadInfo	&ti = m_cpu_thread_infos.get(i);
+		CpuThreadInfo	&ti = getCpuThreadInfo(i);
 		ti.cur_read_id = ti.next_read_id;
 	}
 
-	// Frame time information
-	uint64_t	now = getTimeNs();
+	// Frame time information. When the frame that ends has GPU markers, the GPU clock is read along:
+	// getCriticalPath() converts their times to CPU times with it.
+	uint64_t	now = PROFILER_TIME_NS();
+	uint64_t	gpu_now = INVALID_TIME;
+
+	int last_gpu_id = m_gpu_thread_info.cur_write_id;
+	decrementCycle(&last_gpu_id, NB_GPU_MARKERS);
+	if(m_gpu_thread_info.markers[last_gpu_id].frame == m_cur_frame-1)
+	{
+		GLint64	timestamp;
+		m_gl.get_integer64v(GL_TIMESTAMP, &timestamp);
+		gpu_now = (uint64_t)timestamp;
+	}
 
 	size_t	index_oldest = 0;
 	for(size_t i=0 ; i < NB_RECORDED_FRAMES ; i++)
@@ -223,13 +479,77 @@ void Profiler::synchronizeFrame()
 		if(m_frame_info[i].frame < m_frame_info[index_oldest].frame)
 			index_oldest = i;
 		if(m_frame_info[i].frame == m_cur_frame-1)
+		{
 			m_frame_info[i].time_sync_end = now;
+			m_frame_info[i].gpu_time_sync_end = gpu_now;
+		}
 	}
 
 	FrameInfo	&new_frame = m_frame_info[index_oldest];
 	new_frame.time_sync_start = now;
 	new_frame.time_sync_end = INVALID_TIME;
+	new_frame.gpu_time_sync_end = INVALID_TIME;
 	new_frame.frame = m_cur_frame;
+
+	// The critical path of the frame draw() displays next is analyzed in the meantime
+	int next_displayed_frame = m_cur_frame - int(NB_FRAMES_LATENCY);
+	if(next_displayed_frame >= 0)
+		submitFrameToCriticalPath(next_displayed_frame);
+
+	// Triggers, captures and the server work on the last frame draw() went through,
+	// for which the GPU times are known
+	int drawn_frame = m_cur_frame - int(NB_FRAMES_LATENCY) - 1;
+	if(drawn_frame >= 0)
+	{
+		if(!m_capture.active)
+		{
+			int trigger_frame = evaluateTriggers(drawn_frame);
+			if(trigger_frame >= 0)
+				startCapture(trigger_frame);
+		}
+
+		if(m_capture.active)
+		{
+			while(m_capture.next_frame <= drawn_frame && m_capture.next_frame <= m_capture.last_frame)
+				writeCapturedFrame(m_capture.next_frame++);
+
+			if(m_capture.next_frame > m_capture.last_frame)
+				stopCapture();
+		}
+
+		if(m_server)
+			sendFrameToServer(drawn_frame);
+	}
+
+	// The commands of the client, read by the server thread at the previous frame
+	if(m_server)
+	{
+		bool	recording;
+		if(m_server->popRecordingRequest(&recording))
+			setRecording(recording);
+		m_server->pollCommands();
+	}
+}
+
+//-----------------------------------------------------------------------------
+size_t Profiler::getNbDroppedCpuMarkers()
+{
+	size_t	nb_dropped = 0;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
+		nb_dropped += atomicLoadRelaxed(&getCpuThreadInfo(i).nb_dropped_markers);
+	return nb_dropped;
+}
+
+//-----------------------------------------------------------------------------
+/// Return the FrameInfo of a frame that is still recorded, NULL if there is none
+Profiler::FrameInfo* Profiler::findFrameInfo(int frame)
+{
+	for(size_t i=0 ; i < NB_RECORDED_FRAMES ; i++)
+	{
+		if(m_frame_info[i].frame == frame)
+			return &m_frame_info[i];
+	}
+	return NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -239,28 +559,21 @@ void Profiler::draw()
 	if(m_visible)
 		drawBackground();
 
-	int displayed_frame = m_cur_frame - int(NB_RECORDED_FRAMES-1);
-	if(displayed_frame < 0)	// don't draw anything during the first frames
-		return;
-
-	// Used when drawing information on the markers hovered by the mouse
-	int		read_indices[GPU_COUNT + NB_MAX_CPU_THREADS];	// indices of the first drawn markers, per thread
-	int		thread_index = 0;								// read_indices[thread_index]
+	// Always read the rings, even when frozen: this keeps the read positions and the GPU queries up to date
+	collectFrameView(m_live_view);
 
-	// --- Find the FrameInfo (start and end times) for the frame we want to display ---
-	FrameInfo* frame_info = NULL;
-	for(int index_frame_info = 0 ; index_frame_info < int(NB_RECORDED_FRAMES) ; index_frame_info++)
+	if(m_live_view.nb_counters > m_nb_counter_lines)
 	{
-		if(m_frame_info[index_frame_info].frame == displayed_frame)
-		{
-			frame_info = &m_frame_info[index_frame_info];
-			break;
-		}
+		m_nb_counter_lines = m_live_view.nb_counters;
+		updateBackgroundRect();
 	}
-	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+
+	const FrameView&	view = m_frozen ? m_frozen_view : m_live_view;
+	if(!view.valid || !m_visible)
 		return;
 
-	const uint64_t	frame_delta_time = frame_info->time_sync_end - frame_info->time_sync_start;
+	const FrameInfo&	frame_info = view.frame_info;
+	const uint64_t		frame_delta_time = frame_info.time_sync_end - frame_info.time_sync_start;
 
 	// --- Draw the end of the frame ---
 	{
@@ -270,20 +583,91 @@ void Profiler::draw()
 		rect_end.w = 0.003f;
 		rect_end.h = m_back_rect.h;
 
-		if(m_visible)
-			drawer2D.drawRect(rect_end, COLOR_BLACK);
+		drawer2D.drawRect(rect_end, COLOR_BLACK);
 	}
 
 	// ---- Draw the GPU markers ----
+	drawLineLabel("GPU", 0);
+	drawMarkers(view.gpu_markers, view.nb_gpu_markers, 0, frame_info, false);
+
+	// ---- Draw the CPU markers ----
+	for(size_t i=0 ; i < view.nb_cpu_threads ; i++)
+	{
+		const ThreadView&	tv = view.cpu_threads[i];
+		drawLineLabel(tv.name, i+GPU_COUNT);
+		drawMarkers(tv.markers, tv.nb_markers, i+GPU_COUNT, frame_info, true);
+	}
+
+	// ---- Draw the profiler overhead ----
+	drawLineLabel("Overhead", view.nb_cpu_threads+GPU_COUNT);
+	drawMarkers(view.overhead_markers, view.nb_cpu_threads, view.nb_cpu_threads+GPU_COUNT, frame_info, false);
+
+	// ---- Draw the counters ----
+	for(size_t c=0 ; c < view.nb_counters ; c++)
+	{
+		drawLineLabel(view.counters[c].name, view.nb_cpu_threads+GPU_COUNT+1+c);
+		drawCounter(view.counters[c], view.nb_cpu_threads+GPU_COUNT+1+c, frame_info);
+	}
+
+	// ---- Draw the flows, over the markers ----
+	for(size_t f=0 ; f < view.nb_flows ; f++)
+		drawFlow(view.flows[f], frame_info);
+
+	// ---- Draw the critical path, once analyzed ----
+	if(m_drawn_path.frame != frame_info.frame &&
+	   !getCriticalPath(frame_info.frame, frame_info, &m_drawn_path))
+		m_drawn_path.frame = -1;
+	if(m_drawn_path.frame == frame_info.frame)
+		drawCriticalPath(m_drawn_path, frame_info);
+
+	drawHoveredMarkersText(view);
+}
+
+//-----------------------------------------------------------------------------
+/// Index of the oldest marker (or counter sample) of the given frame (or of a more recent frame) in a ring.
+/// The markers are sorted by frame, starting at write_id which is the oldest one.
+template<class MarkerType>
+static int findFirstMarkerOfFrame(const MarkerType* markers, size_t nb_markers, int write_id, int frame)
+{
+	int index = write_id;
+	for(size_t n=0 ; n < nb_markers ; n++)
+	{
+		int prev = index;
+		decrementCycle(&prev, nb_markers);
+		if(markers[prev].frame < frame)	// also stops on unused markers
+			break;
+		index = prev;
+	}
+	return index;
+}
+
+//-----------------------------------------------------------------------------
+/// Copy the markers of the displayed frame from the rings into the given view
+void Profiler::collectFrameView(FrameView& view)
+{
+	view.valid = false;
+
+	int displayed_frame = m_cur_frame - int(NB_FRAMES_LATENCY);
+	if(displayed_frame < 0)	// don't draw anything during the first frames
+		return;
+
+	// --- Find the FrameInfo (start and end times) for the frame we want to display ---
+	FrameInfo* frame_info = findFrameInfo(displayed_frame);
+	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+		return;
+
+	view.frame_info = *frame_info;
+
+	// ---- Collect the GPU markers ----
 	{
 		GpuThreadInfo&	ti = m_gpu_thread_info;
 		int read_id = ti.cur_read_id;
 
-		read_indices[thread_index++] = read_id;
-
-		// Get the times and draw the markers
+		// Get the times of the markers
 		uint64_t	first_start = INVALID_TIME;
 
+		view.nb_gpu_markers = 0;
+
 		// Select only the markers that belong to this frame.
 		// As GPU times are not synchronized with CPU times, we can't cleanly handle markers that started
 		// in the previous frame and finish in this one, so we just display the GPU markers that belong
@@ -301,39 +685,26 @@ void Profiler::draw()
 			{
 				GLint	start_ok = 0;
 				GLint	end_ok = 0;
-				glGetQueryObjectiv(marker.id_query_start, GL_QUERY_RESULT_AVAILABLE, &start_ok);
-				glGetQueryObjectiv(marker.id_query_end, GL_QUERY_RESULT_AVAILABLE, &end_ok);
+				m_gl.get_query_objectiv(marker.id_query_start, GL_QUERY_RESULT_AVAILABLE, &start_ok);
+				m_gl.get_query_objectiv(marker.id_query_end, GL_QUERY_RESULT_AVAILABLE, &end_ok);
 				ok = (bool)(start_ok && end_ok);
+				if(!ok)
+					m_gpu_late_frame = displayed_frame;
 			}
 
 			if(ok)
 			{
-				uint64_t	start, end;
-
-				glGetQueryObjectui64v(marker.id_query_start, GL_QUERY_RESULT, &marker.start);
-				glGetQueryObjectui64v(marker.id_query_end, GL_QUERY_RESULT, &marker.end);
-
-				start = marker.start;
-				end = marker.end;
+				m_gl.get_query_objectui64v(marker.id_query_start, GL_QUERY_RESULT, &marker.start);
+				m_gl.get_query_objectui64v(marker.id_query_end, GL_QUERY_RESULT, &marker.end);
 
 				if(first_start == INVALID_TIME)
-					first_start = start;
-
-				start -= first_start;
-				end -= first_start;
-
-				Rect	rect;
-				rect.x = X_OFFSET + X_FACTOR * (float)(start);
-				rect.y = Y_OFFSET;
-				rect.w = X_FACTOR * (float)(end - start);
-				rect.h = LINE_HEIGHT;
+					first_start = marker.start;
 
-				// Reduce vertically the size of the markers according to their layer
-				rect.y += Y_SCALE_OFFSET		*marker.layer;
-				rect.h -= (2.0f*Y_SCALE_OFFSET)	*marker.layer;
-
-				if(m_visible)
-					drawer2D.drawRect(rect, marker.color);
+				// Rebase the GPU times on the CPU time of the start of the frame
+				Marker&	dst = view.gpu_markers[view.nb_gpu_markers++];
+				dst = marker;
+				dst.start	= marker.start	- first_start + frame_info->time_sync_start;
+				dst.end		= marker.end	- first_start + frame_info->time_sync_start;
 			}
 
 			incrementCycle(&read_id, NB_GPU_MARKERS);
@@ -342,13 +713,14 @@ void Profiler::draw()
 		ti.next_read_id = read_id;
 	}
 
-	// ---- Draw the CPU markers ----
+	// ---- Collect the CPU markers ----
 	// For each thread:
-	for(size_t i=m_cpu_thread_infos.begin() ;
-		i != m_cpu_thread_infos.getMaxSize() ;
-		i = m_cpu_thread_infos.next(i))
+	view.nb_cpu_threads = 0;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
 	{
-		CpuThreadInfo	&ti = m_cpu_thread_infos.get(i);
+		CpuThreadInfo	&ti = getCpuThreadInfo(i);
+		ThreadView		&tv = view.cpu_threads[view.nb_cpu_threads++];
+		tv.name = ti.name;
 
 		// Jump back to the last marker that ends after the start of this frame.
 		// Avoid going to a frame older than displayed_frame-1.
@@ -372,42 +744,215 @@ void Profiler::draw()
 		// In the worst case, we try to draw a marker that is out of this frame:
 		// it just gets clamped and nothing is visible
 
-		read_indices[thread_index++] = read_id;
+		// Copy the markers, count the ones of the displayed frame for the overhead
+		tv.nb_markers = 0;
+		tv.nb_frame_markers = 0;
+		for(size_t n=0 ; n < NB_MARKERS_PER_CPU_THREAD ; n++)
+		{
+			const CpuMarker&	marker = ti.markers[read_id];
+			if(marker.frame < displayed_frame-1 ||	// - for markers that started in the previous frame and finished
+													// in this frame
+			   marker.frame > displayed_frame)		// - for "regular" markers, that started in this frame
+				break;
+
+			if(tv.nb_markers < NB_MAX_VIEW_MARKERS_PER_THREAD)
+				tv.markers[tv.nb_markers++] = marker;
+			if(marker.frame == displayed_frame)
+				tv.nb_frame_markers++;
+			incrementCycle(&read_id, NB_MARKERS_PER_CPU_THREAD);
+		}
+
+		ti.next_read_id = read_id;
+	}
+
+	// ---- Collect the counter samples: one graph per name, sorted by time ----
+	view.nb_counters = 0;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
+	{
+		const CpuThreadInfo	&ti = getCpuThreadInfo(i);
 
-		// Draw the markers
-		while(ti.markers[read_id].frame >= displayed_frame-1 &&	// - for markers that started in the previous frame and finished
-																// in this frame
-			  ti.markers[read_id].frame <= displayed_frame)		// - for "regular" markers, that started in this frame
+		int index = findFirstMarkerOfFrame(ti.counter_samples, NB_COUNTER_SAMPLES_PER_CPU_THREAD, ti.cur_counter_write_id, displayed_frame);
+		for(size_t n=0 ; n < NB_COUNTER_SAMPLES_PER_CPU_THREAD && ti.counter_samples[index].frame == displayed_frame ;
+			n++, incrementCycle(&index, NB_COUNTER_SAMPLES_PER_CPU_THREAD))
 		{
-			CpuMarker	&marker = ti.markers[read_id];
+			const CounterSample&	sample = ti.counter_samples[index];
 
-			uint64_t	start, end;
-			start	= clamp(marker.start,	frame_info->time_sync_start, frame_info->time_sync_end);
-			end		= clamp(marker.end,		frame_info->time_sync_start, frame_info->time_sync_end);
+			size_t	c = 0;
+			while(c < view.nb_counters && strcmp(view.counters[c].name, sample.name) != 0)
+				c++;
+			if(c == view.nb_counters)
+			{
+				if(view.nb_counters == NB_MAX_COUNTERS)
+					continue;
+				strcpy(view.counters[c].name, sample.name);
+				view.counters[c].nb_samples = 0;
+				view.nb_counters++;
+			}
 
-			start	-= frame_info->time_sync_start;
-			end		-= frame_info->time_sync_start;
+			CounterView&	counter = view.counters[c];
+			if(counter.nb_samples == NB_MAX_VIEW_SAMPLES_PER_COUNTER)
+				continue;
 
-			Rect	rect;
-			rect.x = X_OFFSET + X_FACTOR * (float)(start);
-			rect.y = Y_OFFSET + (i+GPU_COUNT)*LINE_HEIGHT;
-			rect.w = X_FACTOR * (float)(end - start);
-			rect.h = LINE_HEIGHT;
+			// Insertion sort: the samples of different threads are interleaved
+			size_t	s = counter.nb_samples++;
+			for( ; s > 0 && counter.steps[s-1].start > sample.time ; s--)
+			{
+				counter.steps[s].start = counter.steps[s-1].start;
+				counter.values[s] = counter.values[s-1];
+			}
+			counter.steps[s].start = sample.time;
+			counter.values[s] = sample.value;
+		}
+	}
 
-			// Reduce vertically the size of the markers according to their layer
-			rect.y += Y_SCALE_OFFSET*marker.layer;
-			rect.h -= (2.0f*Y_SCALE_OFFSET)*marker.layer;
+	for(size_t c=0 ; c < view.nb_counters ; c++)
+	{
+		CounterView&	counter = view.counters[c];
+		Color			color = (c & 1) ? COLOR_DARK_BLUE : COLOR_LIGHT_BLUE;
 
-			if(m_visible)
-				drawer2D.drawRect(rect, marker.color);
-			incrementCycle(&read_id, NB_MARKERS_PER_CPU_THREAD);
+		counter.min_value = counter.max_value = counter.values[0];
+		for(size_t s=0 ; s < counter.nb_samples ; s++)
+		{
+			Marker&	step = counter.steps[s];
+			step.end = (s+1 < counter.nb_samples) ? counter.steps[s+1].start : frame_info->time_sync_end;
+			step.layer = 0;
+			step.frame = displayed_frame;
+			step.color = color;
+
+			char	name[64];
+			sprintf(name, "%.15g", counter.values[s]);
+			name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+			strcpy(step.name, name);
+
+			if(counter.values[s] < counter.min_value)
+				counter.min_value = counter.values[s];
+			if(counter.values[s] > counter.max_value)
+				counter.max_value = counter.values[s];
 		}
+	}
 
-		ti.next_read_id = read_id;
+	// ---- Collect the flows that end in the displayed frame on another thread than their begin ----
+	// The begin is the most recent one with the same id, in the displayed frame or in the previous one.
+	view.nb_flows = 0;
+	for(size_t i=0 ; i < m_nb_cpu_threads && view.nb_flows < NB_MAX_VIEW_FLOWS ; i++)
+	{
+		const CpuThreadInfo	&ti = getCpuThreadInfo(i);
+
+		int index = findFirstMarkerOfFrame(ti.flow_points, NB_FLOW_POINTS_PER_CPU_THREAD, ti.cur_flow_write_id, displayed_frame);
+		for(size_t n=0 ; n < NB_FLOW_POINTS_PER_CPU_THREAD && ti.flow_points[index].frame == displayed_frame && view.nb_flows < NB_MAX_VIEW_FLOWS ;
+			n++, incrementCycle(&index, NB_FLOW_POINTS_PER_CPU_THREAD))
+		{
+			const FlowPoint&	end = ti.flow_points[index];
+			if(end.begin)
+				continue;
+
+			size_t		begin_thread = 0;
+			uint64_t	begin_time = INVALID_TIME;
+			for(size_t j=0 ; j < m_nb_cpu_threads ; j++)
+			{
+				const CpuThreadInfo	&tj = getCpuThreadInfo(j);
+
+				int begin_index = tj.cur_flow_write_id;
+				for(size_t m=0 ; m < NB_FLOW_POINTS_PER_CPU_THREAD ; m++)
+				{
+					decrementCycle(&begin_index, NB_FLOW_POINTS_PER_CPU_THREAD);
+					const FlowPoint&	begin = tj.flow_points[begin_index];
+					if(begin.frame < displayed_frame-1)	// also stops on unused points
+						break;
+					if(begin.begin && begin.id == end.id && begin.time <= end.time)
+					{
+						if(begin_time == INVALID_TIME || begin.time > begin_time)
+						{
+							begin_thread = j;
+							begin_time = begin.time;
+						}
+						break;	// the points of a thread are sorted by time
+					}
+				}
+			}
+
+			if(begin_time == INVALID_TIME || begin_thread == i)
+				continue;
+
+			FlowView&	flow = view.flows[view.nb_flows++];
+			flow.begin_time = begin_time;
+			flow.end_time = end.time;
+			flow.begin_line = begin_thread + GPU_COUNT;
+			flow.end_line = i + GPU_COUNT;
+		}
 	}
 
-	if(m_visible)
-		drawHoveredMarkersText(read_indices, frame_info);
+	// ---- Profiler overhead: the cost of the markers of each thread, one after the other ----
+	uint64_t	overhead_start = frame_info->time_sync_start;
+	for(size_t i=0 ; i < view.nb_cpu_threads ; i++)
+	{
+		const ThreadView&	tv = view.cpu_threads[i];
+		double				overhead_ns = double(tv.nb_frame_markers) * m_marker_overhead_ns;
+
+		Marker&	marker = view.overhead_markers[i];
+		marker.start = overhead_start;
+		marker.end = overhead_start + (uint64_t)overhead_ns;
+		marker.layer = 0;
+		marker.frame = displayed_frame;
+		marker.color = (i & 1) ? COLOR_DARK_RED : COLOR_LIGHT_RED;
+
+		char	name[64];
+		sprintf(name, "%.1lfus %s", overhead_ns / 1000.0, tv.name);
+		name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+		strcpy(marker.name, name);
+
+		overhead_start = marker.end;
+	}
+
+	view.valid = true;
+}
+
+//-----------------------------------------------------------------------------
+/// Copy only the used part of a view (a full FrameView is several hundreds of kilobytes)
+void Profiler::copyFrameView(FrameView& dst, const FrameView& src) const
+{
+	dst.valid = src.valid;
+	dst.frame_info = src.frame_info;
+
+	dst.nb_gpu_markers = src.nb_gpu_markers;
+	for(size_t i=0 ; i < src.nb_gpu_markers ; i++)
+		dst.gpu_markers[i] = src.gpu_markers[i];
+
+	dst.nb_cpu_threads = src.nb_cpu_threads;
+	for(size_t i=0 ; i < src.nb_cpu_threads ; i++)
+	{
+		const ThreadView&	src_tv = src.cpu_threads[i];
+		ThreadView&			dst_tv = dst.cpu_threads[i];
+
+		dst_tv.name = src_tv.name;
+		dst_tv.nb_markers = src_tv.nb_markers;
+		dst_tv.nb_frame_markers = src_tv.nb_frame_markers;
+		for(size_t j=0 ; j < src_tv.nb_markers ; j++)
+			dst_tv.markers[j] = src_tv.markers[j];
+
+		dst.overhead_markers[i] = src.overhead_markers[i];
+	}
+
+	dst.nb_counters = src.nb_counters;
+	for(size_t c=0 ; c < src.nb_counters ; c++)
+	{
+		const CounterView&	src_counter = src.counters[c];
+		CounterView&		dst_counter = dst.counters[c];
+
+		strcpy(dst_counter.name, src_counter.name);
+		dst_counter.min_value = src_counter.min_value;
+		dst_counter.max_value = src_counter.max_value;
+		dst_counter.nb_samples = src_counter.nb_samples;
+		for(size_t s=0 ; s < src_counter.nb_samples ; s++)
+		{
+			dst_counter.steps[s] = src_counter.steps[s];
+			dst_counter.values[s] = src_counter.values[s];
+		}
+	}
+
+	dst.nb_flows = src.nb_flows;
+	for(size_t f=0 ; f < src.nb_flows ; f++)
+		dst.flows[f] = src.flows[f];
 }
 
 //-----------------------------------------------------------------------------
@@ -422,142 +967,1118 @@ void Profiler::onLeftClick()
 
 	if(m_back_rect.isPointInside(fx, fy))
 	{
-		switch(m_freeze_state)
-		{
-		case UNFROZEN:
-			m_freeze_state = WAITING_FOR_FREEZE;
-			break;
-
-		case FROZEN:
-			m_freeze_state = WAITING_FOR_UNFREEZE;
-			break;
-
-		case WAITING_FOR_FREEZE:
-		case WAITING_FOR_UNFREEZE:
-			assert(false && "should not happen - synchronizeFrame() should be called between 2 calls to onLeftClick()");
-			break;
-		}
+		// Freezing takes a snapshot of what is currently displayed, unfreezing drops it:
+		// the recording itself is never interrupted.
+		if(!m_frozen)
+			copyFrameView(m_frozen_view, m_live_view);
+		m_frozen = !m_frozen;
 	}
 }
 
 //-----------------------------------------------------------------------------
-// Get the CpuThreadInfo corresponding to the calling thread
-Profiler::CpuThreadInfo& Profiler::getOrAddCpuThreadInfo()
+/// Number of markers nested in each marker of a frame, from the one at first_index: nb_nested[n] is for the n-th
+/// marker of the frame. The nested markers of a marker follow it, up to the next one with a layer that is not
+/// greater, so one pass with a stack of the enclosing markers counts them all.
+void Profiler::countNestedMarkers(const CpuThreadInfo& ti, int first_index, size_t* nb_nested) const
 {
-	ThreadId	thread_id = threadGetCurrentId();
+	const int	frame = ti.markers[first_index].frame;
 
-	for(size_t i = m_cpu_thread_infos.begin();
-		i != m_cpu_thread_infos.getMaxSize() ;
-		i = m_cpu_thread_infos.next(i))
+	size_t	parents[NB_MAX_CPU_MARKER_LAYERS];	// Position in the frame of the enclosing markers, innermost last
+	size_t	nb_parents = 0;
+
+	int		index = first_index;
+	size_t	n = 0;
+	for( ; n < NB_MARKERS_PER_CPU_THREAD ; n++, incrementCycle(&index, NB_MARKERS_PER_CPU_THREAD))
 	{
-		if(m_cpu_thread_infos.isUsed(i) &&
-		   m_cpu_thread_infos.get(i).thread_id == thread_id)
+		const CpuMarker&	marker = ti.markers[index];
+		if((n > 0 && index == ti.cur_write_id) || marker.frame < frame)
+			break;
+
+		while(nb_parents && ti.markers[(first_index + parents[nb_parents-1]) % NB_MARKERS_PER_CPU_THREAD].layer >= marker.layer)
 		{
-			return m_cpu_thread_infos.get(i);
+			nb_parents--;
+			nb_nested[parents[nb_parents]] = n - parents[nb_parents] - 1;
 		}
-	}
-
-	mutexLock(&m_cpu_mutex);
-	size_t	i = m_cpu_thread_infos.add();
-	mutexUnlock(&m_cpu_mutex);
 
-	CpuThreadInfo	&ti = m_cpu_thread_infos.get(i);
-	ti.init(thread_id);
+		// The markers of the next frames only count for the ones that enclose them
+		if(marker.frame != frame)
+		{
+			if(!nb_parents)
+				break;
+			continue;
+		}
 
-	updateBackgroundRect();
+		if(nb_parents < NB_MAX_CPU_MARKER_LAYERS)	// Deeper markers are dropped when recorded
+			parents[nb_parents++] = n;
+		else
+			nb_nested[n] = 0;
+	}
 
-	return ti;
+	while(nb_parents)
+	{
+		nb_parents--;
+		nb_nested[parents[nb_parents]] = n - parents[nb_parents] - 1;
+	}
 }
 
 //-----------------------------------------------------------------------------
-void Profiler::drawBackground()
+/// End of a closed CPU marker for the captures and the server, without the cost of its nested markers
+uint64_t Profiler::getExportedEnd(const CpuMarker& marker, size_t nb_nested) const
 {
-	drawer2D.drawRect(m_back_rect, isFrozen() ? COLOR_FROZEN : COLOR_WHITE);
+	uint64_t	overhead = (uint64_t)(double(nb_nested) * m_marker_overhead_ns);
+	return marker.end - marker.start > overhead ? marker.end - overhead : marker.start;
 }
 
-/// Draw text information for the markers that are hovered by the mouse pointer
-void Profiler::drawHoveredMarkersText(const int *read_indices, const FrameInfo* frame_info)
+//-----------------------------------------------------------------------------
+/// Add a condition that starts a capture. marker_name is only used by TRIGGER_MARKER_TIME.
+bool Profiler::addTrigger(TriggerType type, double threshold_ms, const char* marker_name)
 {
-	// Compute some values for drawing
-	float fx = float(m_mouse_x) / float(m_win_w);
-	float fy = float(m_win_h-1 - m_mouse_y) / float(m_win_h);
+	if(m_nb_triggers >= NB_MAX_TRIGGERS)
+	{
+		fprintf(stderr, "*** Profiler: too many triggers\n");
+		return false;
+	}
 
-	size_t			nb_max_markers = 0;
-	const Marker	*markers = NULL;
-	int				read_id = -1;
-	uint64_t		start_time = 0;
-	size_t			sizeof_marker = 0;
+	Trigger&	trigger = m_triggers[m_nb_triggers++];
+	trigger.type = type;
+	trigger.threshold = (uint64_t)(threshold_ms * 1000000.0);
+	strncpy(trigger.marker_name, marker_name ? marker_name : "", MARKER_NAME_MAX_LENGTH);
+	trigger.marker_name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+	return true;
+}
 
-#define GET_MARKER(__i)	(const Marker*)(((const uint8_t*)markers) + (__i)*sizeof_marker)
+//-----------------------------------------------------------------------------
+/// Set how many frames are written before and after the one that fired a trigger
+void Profiler::setCaptureFrames(int nb_before, int nb_after)
+{
+	m_nb_capture_frames_before	= clamp(nb_before, 0, int(NB_MAX_CAPTURED_FRAMES_BEFORE));
+	m_nb_capture_frames_after	= nb_after > 0 ? nb_after : 0;
+}
 
-	Rect	rect;
-	rect.x = X_OFFSET;
-	rect.y = Y_OFFSET;
-	rect.w = PROFILER_WIDTH;
-	rect.h = LINE_HEIGHT;
+//-----------------------------------------------------------------------------
+/// Return the frame on which a trigger fired, or -1
+int Profiler::evaluateTriggers(int frame)
+{
+	const FrameInfo*	frame_info = findFrameInfo(frame);
+	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+		return -1;
 
-	// --- Which list of markers is hovered by the mouse pointer? ---
-	if(rect.isPointInside(fx, fy))
-	{
-		// Hovering the GPU line
-		nb_max_markers	= NB_GPU_MARKERS;
-		markers			= &m_gpu_thread_info.markers[0];
-		read_id			= read_indices[0];
-		start_time		= m_gpu_thread_info.markers[read_id].start;
-		sizeof_marker	= sizeof(GpuMarker);
-	}
-	else
+	for(size_t i=0 ; i < m_nb_triggers ; i++)
 	{
-		// CPUs
-		for(size_t i=m_cpu_thread_infos.begin() ;
-			i != m_cpu_thread_infos.getMaxSize() ;
-			i = m_cpu_thread_infos.next(i))
+		const Trigger&	trigger = m_triggers[i];
+		switch(trigger.type)
 		{
-			rect.y += LINE_HEIGHT;
+		case TRIGGER_FRAME_TIME:
+			if(frame_info->time_sync_end - frame_info->time_sync_start > trigger.threshold)
+			{
+				printf("Profiler: frame %d took more than %.1lfms\n", frame, double(trigger.threshold) / 1000000.0);
+				return frame;
+			}
+			break;
 
-			if(rect.isPointInside(fx, fy))
+		case TRIGGER_MARKER_TIME:
+			for(size_t j=0 ; j < m_nb_cpu_threads ; j++)
 			{
-				// Hovering a CPU line
-				nb_max_markers	= NB_MARKERS_PER_CPU_THREAD;
-				markers			= &m_cpu_thread_infos[i].markers[0];
-				read_id			= read_indices[i+GPU_COUNT];
-				start_time		= frame_info->time_sync_start;
-				sizeof_marker	= sizeof(CpuMarker);
-				break;
+				const CpuThreadInfo	&ti = getCpuThreadInfo(j);
+
+				// Go back from the most recent marker until we leave the frame
+				int index = ti.cur_write_id;
+				for(size_t n=0 ; n < NB_MARKERS_PER_CPU_THREAD ; n++)
+				{
+					decrementCycle(&index, NB_MARKERS_PER_CPU_THREAD);
+					const CpuMarker&	marker = ti.markers[index];
+					if(marker.frame < frame)
+						break;
+
+					if(marker.frame == frame &&
+					   marker.end != INVALID_TIME &&
+					   marker.end - marker.start > trigger.threshold &&
+					   strcmp(marker.name, trigger.marker_name) == 0)
+					{
+						printf("Profiler: marker \"%s\" took more than %.1lfms in frame %d\n",
+							   marker.name, double(trigger.threshold) / 1000000.0, frame);
+						return frame;
+					}
+				}
 			}
+			break;
+
+		case TRIGGER_GPU_LATE:
+			if(m_gpu_late_frame == frame)
+			{
+				printf("Profiler: GPU timer queries were late in frame %d\n", frame);
+				return frame;
+			}
+			break;
 		}
 	}
+	return -1;
+}
 
-	if(!markers)
-		return;	// mouse pointer doesn't hover any line
+//-----------------------------------------------------------------------------
+/// Append formatted text to a capture buffer. The strings of the events are written with appendJsonString(),
+/// the formats only get numbers and short constant strings.
+static void appendFormat(std::string& out, const char* format, ...)
+{
+	char	buffer[256];
+	va_list	args;
+	va_start(args, format);
+	int len = vsprintf(buffer, format, args);
+	va_end(args);
+	out.append(buffer, len > 0 ? (size_t)len : 0);
+}
 
-	// --- Choose the markers that are to be displayed ---
-	const Marker	*chosen_markers[NB_MAX_TEXT_LINES];
-	int				nb_chosen_markers = 0;
+//-----------------------------------------------------------------------------
+static void appendJsonString(std::string& out, const char* str)
+{
+	out += '"';
+	for(const char* p = str ; *p ; p++)
+	{
+		if(*p == '"' || *p == '\\')
+			out += '\\';
+		if((unsigned char)(*p) >= 0x20)
+			out += *p;
+	}
+	out += '"';
+}
+
+// Write a complete event in the Chrome trace event format. Times are in nanoseconds.
+// The allocations and the hardware counters of the CPU markers are written in the args when there are some.
+static void writeCaptureEvent(std::string& out, bool* first_event, const char* name, int tid, uint64_t start, uint64_t end, int frame,
+							  uint32_t alloc_calls=0, uint64_t alloc_bytes=0, const PerfCounterValues* perf=NULL)
+{
+	out += (*first_event ? "" : ",\n");
+	*first_event = false;
+
+	out += "{\"name\":";
+	appendJsonString(out, name);
+	appendFormat(out, ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"frame\":%d",
+				 tid, double(start) / 1000.0, double(end - start) / 1000.0, frame);
+	if(alloc_calls)
+		appendFormat(out, ",\"alloc_calls\":%u,\"alloc_bytes\":%.0lf", alloc_calls, double(alloc_bytes));
+	if(perf && perf->valid)
+	{
+		for(size_t i=0 ; i < NB_PERF_COUNTERS ; i++)
+			appendFormat(out, ",\"%s\":%.0lf", perfCounterGetName((PerfCounter)i), double(perf->values[i]));
+	}
+	out += "}}";
+}
+
+// Write a sample of a counter in the Chrome trace event format
+static void writeCaptureCounter(std::string& out, bool* first_event, const char* name, int tid, uint64_t time, double value)
+{
+	out += (*first_event ? "" : ",\n");
+	*first_event = false;
+
+	out += "{\"name\":";
+	appendJsonString(out, name);
+	appendFormat(out, ",\"ph\":\"C\",\"pid\":0,\"tid\":%d,\"ts\":%.3lf,\"args\":{\"value\":%.15g}}",
+				 tid, double(time) / 1000.0, value);
+}
+
+/// Flow event, bound to the enclosing marker of its thread (its begin, or its end for the end of the flow)
+static void writeCaptureFlow(std::string& out, bool* first_event, bool begin, uint32_t id, int tid, uint64_t time)
+{
+	out += (*first_event ? "" : ",\n");
+	*first_event = false;
+
+	appendFormat(out, "{\"name\":\"Flow\",\"cat\":\"flow\",\"ph\":%s,\"id\":%u,\"pid\":0,\"tid\":%d,\"ts\":%.3lf}",
+				 begin ? "\"s\"" : "\"f\",\"bp\":\"e\"", id, tid, double(time) / 1000.0);
+}
+
+static void writeCaptureThreadName(std::string& out, bool* first_event, int tid, const char* name)
+{
+	out += (*first_event ? "" : ",\n");
+	*first_event = false;
+
+	appendFormat(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":", tid);
+	appendJsonString(out, name);
+	out += "}}";
+}
+
+// Lines in the capture files
+#define CAPTURE_TID_FRAMES			0
+#define CAPTURE_TID_GPU				1
+#define CAPTURE_TID_CRITICAL_PATH	2
+#define CAPTURE_TID_FIRST_CPU		3
+
+//-----------------------------------------------------------------------------
+/// Open a new capture file around the given frame and write the frames that are already recorded.
+/// The events are formatted here, the writer thread does the file I/O.
+void Profiler::startCapture(int frame)
+{
+	char	filename[64];
+	sprintf(filename, "capture_%03d.json", m_capture.nb_captures);
+
+	m_capture_writer->openFile(filename);
+	m_capture.active = true;
+	m_capture.nb_captures++;
+
+	// The oldest frame still available in the rings
+	int oldest_frame = m_cur_frame - int(NB_RECORDED_FRAMES-1);
+
+	m_capture.next_frame = frame - m_nb_capture_frames_before;
+	if(m_capture.next_frame < oldest_frame)
+		m_capture.next_frame = oldest_frame;
+	if(m_capture.next_frame < 0)
+		m_capture.next_frame = 0;
+	m_capture.last_frame = frame + m_nb_capture_frames_after;
+	m_capture.first_event = true;
+
+	printf("Profiler: capturing frames %d to %d in %s\n", m_capture.next_frame, m_capture.last_frame, filename);
+
+	std::string&	out = m_capture.buffer;
+	out += "{\"traceEvents\":[\n";
+
+	writeCaptureThreadName(out, &m_capture.first_event, CAPTURE_TID_FRAMES, "Frames");
+	writeCaptureThreadName(out, &m_capture.first_event, CAPTURE_TID_GPU, "GPU");
+	writeCaptureThreadName(out, &m_capture.first_event, CAPTURE_TID_CRITICAL_PATH, "Critical path");
+
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
+		writeCaptureThreadName(out, &m_capture.first_event, CAPTURE_TID_FIRST_CPU + (int)i, getCpuThreadInfo(i).name);
+
+	m_capture_writer->write(&out);
+}
+
+//-----------------------------------------------------------------------------
+/// Format the markers of a complete frame and queue them for the capture file
+void Profiler::writeCapturedFrame(int frame)
+{
+	const FrameInfo*	frame_info = findFrameInfo(frame);
+	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+		return;
+
+	std::string&	out = m_capture.buffer;
+	bool*	first_event = &m_capture.first_event;
+	char	frame_name[32];
+	sprintf(frame_name, "Frame %d", frame);
+	writeCaptureEvent(out, first_event, frame_name, CAPTURE_TID_FRAMES,
+					  frame_info->time_sync_start, frame_info->time_sync_end, frame);
+
+	// GPU markers: only the ones draw() got the times for
+	Marker	gpu_markers[NB_MAX_GPU_MARKERS_PER_FRAME];
+	size_t	nb_gpu_markers = getGpuMarkers(frame, *frame_info, gpu_markers);
+	for(size_t i=0 ; i < nb_gpu_markers ; i++)
+		writeCaptureEvent(out, first_event, gpu_markers[i].name, CAPTURE_TID_GPU, gpu_markers[i].start, gpu_markers[i].end, frame);
+
+	// Critical path: one event per step, named after the thread and the marker
+	CriticalPathAnalyzer::Path	path;
+	if(getCriticalPath(frame, *frame_info, &path))
+	{
+		for(size_t s=0 ; s < path.nb_steps ; s++)
+		{
+			const CriticalPathAnalyzer::Step&	step = path.steps[s];
+
+			char	step_name[THREAD_NAME_MAX_LENGTH + 2 + CriticalPathAnalyzer::NAME_MAX_LENGTH];
+			sprintf(step_name, "%s: %s", getLineName(step.line), step.name[0] ? step.name : "(no marker)");
+			writeCaptureEvent(out, first_event, step_name, CAPTURE_TID_CRITICAL_PATH, step.start, step.end, frame);
+		}
+	}
+
+	// CPU markers that are closed
+	size_t	nb_frame_markers[NB_MAX_CPU_THREADS];
+	size_t	nb_nested[NB_MARKERS_PER_CPU_THREAD];	// Only counted when the overhead is compensated
+	bool	compensate = m_compensate_overhead;
+	int line = 0;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++, line++)
+	{
+		const CpuThreadInfo	&ti = getCpuThreadInfo(i);
+		nb_frame_markers[i] = 0;
+
+		int index = findFirstMarkerOfFrame(ti.markers, NB_MARKERS_PER_CPU_THREAD, ti.cur_write_id, frame);
+		if(compensate && ti.markers[index].frame == frame)
+			countNestedMarkers(ti, index, nb_nested);
+		for(size_t n=0 ; n < NB_MARKERS_PER_CPU_THREAD && ti.markers[index].frame == frame ; n++, incrementCycle(&index, NB_MARKERS_PER_CPU_THREAD))
+		{
+			const CpuMarker&	marker = ti.markers[index];
+			nb_frame_markers[i]++;
+			if(marker.end == INVALID_TIME)
+				continue;
+
+			writeCaptureEvent(out, first_event, marker.name, CAPTURE_TID_FIRST_CPU + line,
+							  marker.start, getExportedEnd(marker, compensate ? nb_nested[n] : 0), frame, marker.alloc_calls, marker.alloc_bytes, &marker.perf);
+		}
+
+		index = findFirstMarkerOfFrame(ti.counter_samples, NB_COUNTER_SAMPLES_PER_CPU_THREAD, ti.cur_counter_write_id, frame);
+		for(size_t n=0 ; n < NB_COUNTER_SAMPLES_PER_CPU_THREAD && ti.counter_samples[index].frame == frame ; n++, incrementCycle(&index, NB_COUNTER_SAMPLES_PER_CPU_THREAD))
+		{
+			const CounterSample&	sample = ti.counter_samples[index];
+			writeCaptureCounter(out, first_event, sample.name, CAPTURE_TID_FIRST_CPU + line, sample.time, sample.value);
+		}
+
+		index = findFirstMarkerOfFrame(ti.flow_points, NB_FLOW_POINTS_PER_CPU_THREAD, ti.cur_flow_write_id, frame);
+		for(size_t n=0 ; n < NB_FLOW_POINTS_PER_CPU_THREAD && ti.flow_points[index].frame == frame ; n++, incrementCycle(&index, NB_FLOW_POINTS_PER_CPU_THREAD))
+		{
+			const FlowPoint&	point = ti.flow_points[index];
+			writeCaptureFlow(out, first_event, point.begin, point.id, CAPTURE_TID_FIRST_CPU + line, point.time);
+		}
+	}
+
+	// Counter with the time the markers cost to each thread during the frame
+	out += (*first_event ? "" : ",\n");
+	*first_event = false;
+
+	appendFormat(out, "{\"name\":\"Profiler overhead (us)\",\"ph\":\"C\",\"pid\":0,\"tid\":%d,\"ts\":%.3lf,\"args\":{",
+				 CAPTURE_TID_FRAMES, double(frame_info->time_sync_start) / 1000.0);
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++)
+	{
+		if(i != 0)
+			out += ',';
+		appendJsonString(out, getCpuThreadInfo(i).name);
+		appendFormat(out, ":%.3lf", double(nb_frame_markers[i]) * m_marker_overhead_ns / 1000.0);
+	}
+	out += "}}";
+
+	m_capture_writer->write(&out);
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::stopCapture()
+{
+	if(!m_capture.active)
+		return;
+
+	m_capture.buffer += "\n]}\n";
+	m_capture_writer->write(&m_capture.buffer);
+	m_capture_writer->closeFile();
+	m_capture.active = false;
+}
+
+//-----------------------------------------------------------------------------
+/// Start streaming the frames on the given TCP port
+bool Profiler::startServer(unsigned short port)
+{
+	if(m_server)
+		return true;
+
+	m_server = new ProfilerServer();
+	if(!m_server->start(port))
+	{
+		delete m_server;
+		m_server = NULL;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::stopServer()
+{
+	if(!m_server)
+		return;
+
+	m_server->stop();
+	delete m_server;
+	m_server = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::startWaitTracking(double threshold_us)
+{
+	if(threshold_us < 0.001)
+		threshold_us = 0.001;
+	if(threshold_us > 1000000.0)
+		threshold_us = 1000000.0;
+
+	m_wait_threshold_us = threshold_us;
+	m_wait_tracking = true;
+	threadSetWaitHook(&onThreadWait, (uint32_t)(threshold_us * 1000.0));
+	printf("Profiler: tracking the waits longer than %.1lfus\n", threshold_us);
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::stopWaitTracking()
+{
+	threadSetWaitHook(NULL, 0);
+	m_wait_tracking = false;
+}
+
+//-----------------------------------------------------------------------------
+/// Statistics of a primitive, created on first use. Returns NULL when there are too many primitives.
+Profiler::WaitStats* Profiler::findWaitStats(const void* object)
+{
+	for(size_t i=0 ; i < m_nb_wait_objects ; i++)
+	{
+		if(m_wait_stats[i].object == object)
+			return &m_wait_stats[i];
+	}
+
+	if(m_nb_wait_objects == NB_MAX_WAIT_OBJECTS)
+		return NULL;
+
+	WaitStats&	stats = m_wait_stats[m_nb_wait_objects++];
+	stats.object = object;
+	stats.type = THREAD_WAIT_MUTEX;
+	sprintf(stats.name, "%p", object);
+	stats.nb_waits = 0;
+	stats.total_ns = 0;
+	stats.max_ns = 0;
+	return &stats;
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::setWaitObjectName(const void* object, const char* name)
+{
+	WaitStats*	stats = findWaitStats(object);
+	if(!stats)
+	{
+		fprintf(stderr, "*** Profiler: too many named primitives, %s is not named\n", name);
+		return;
+	}
+	strncpy(stats->name, name, MARKER_NAME_MAX_LENGTH);
+	stats->name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::printWaitStats()
+{
+	// Selection sort by total wait time: there are at most NB_MAX_WAIT_OBJECTS
+	size_t	order[NB_MAX_WAIT_OBJECTS];
+	size_t	nb_waited = 0;
+	for(size_t i=0 ; i < m_nb_wait_objects ; i++)
 	{
-		int				counter = 0;
-		const Marker*	m = GET_MARKER(read_id);
-		while(	m->frame >= frame_info->frame-1 &&
-				m->frame <= frame_info->frame &&
-				nb_chosen_markers < NB_MAX_TEXT_LINES)
+		if(m_wait_stats[i].nb_waits != 0)
+			order[nb_waited++] = i;
+	}
+	for(size_t i=0 ; i < nb_waited ; i++)
+	{
+		size_t	best = i;
+		for(size_t j=i+1 ; j < nb_waited ; j++)
 		{
-			// Get the relative start and end of the marker
-			uint64_t	start	= m->start - start_time;
-			uint64_t	end		= m->end - start_time;
+			if(m_wait_stats[order[j]].total_ns > m_wait_stats[order[best]].total_ns)
+				best = j;
+		}
+		size_t	tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+	}
+
+	printf("Profiler: waits longer than %.1lfus\n", m_wait_threshold_us);
+	if(nb_waited == 0)
+		printf("  none\n");
+	for(size_t i=0 ; i < nb_waited ; i++)
+	{
+		const WaitStats&	stats = m_wait_stats[order[i]];
+		printf("  %-7s %-32s %8u waits, total %10.3lfms, mean %9.1lfus, max %9.1lfus\n",
+			   wait_type_names[stats.type], stats.name, (unsigned)stats.nb_waits, double(stats.total_ns) / 1000000.0,
+			   double(stats.total_ns) / 1000.0 / double(stats.nb_waits), double(stats.max_ns) / 1000.0);
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Send the markers of a complete frame to the connected client, if any.
+/// Each marker is sent once, with the frame it started in.
+void Profiler::sendFrameToServer(int frame)
+{
+	const FrameInfo*	frame_info = findFrameInfo(frame);
+	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+		return;
+
+	if(!m_server->beginFrame(frame, frame_info->time_sync_start, frame_info->time_sync_end))
+		return;	// no client, or the client is too slow
+
+	// GPU markers
+	Marker	gpu_markers[NB_MAX_GPU_MARKERS_PER_FRAME];
+	size_t	nb_gpu_markers = getGpuMarkers(frame, *frame_info, gpu_markers);
+
+	m_server->addThread(0, "GPU");
+	for(size_t i=0 ; i < nb_gpu_markers ; i++)
+	{
+		const Marker&	marker = gpu_markers[i];
+		m_server->addMarker(0, marker.layer, marker.name, marker.color, frame_info->time_sync_start, marker.start, marker.end);
+	}
+
+	// CPU markers that are closed
+	size_t	nb_nested[NB_MARKERS_PER_CPU_THREAD];	// Only counted when the overhead is compensated
+	bool	compensate = m_compensate_overhead;
+	size_t line = GPU_COUNT;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++, line++)
+	{
+		const CpuThreadInfo	&ti = getCpuThreadInfo(i);
+		m_server->addThread(line, ti.name);
+
+		int index = findFirstMarkerOfFrame(ti.markers, NB_MARKERS_PER_CPU_THREAD, ti.cur_write_id, frame);
+		if(compensate && ti.markers[index].frame == frame)
+			countNestedMarkers(ti, index, nb_nested);
+		for(size_t n=0 ; n < NB_MARKERS_PER_CPU_THREAD && ti.markers[index].frame == frame ; n++, incrementCycle(&index, NB_MARKERS_PER_CPU_THREAD))
+		{
+			const CpuMarker&	marker = ti.markers[index];
+			if(marker.end == INVALID_TIME)
+				continue;
 
-			rect.x = X_OFFSET + X_FACTOR * (float)(start);
-			rect.w = X_FACTOR * (float)(end - start);
-			if(rect.isPointInside(fx, fy))
+			m_server->addMarker(line, marker.layer, marker.name, marker.color, frame_info->time_sync_start,
+								marker.start, getExportedEnd(marker, compensate ? nb_nested[n] : 0));
+			if(marker.alloc_calls)
+				m_server->addAllocations(line, marker.alloc_calls, marker.alloc_bytes);
+			if(marker.perf.valid)
+				m_server->addPerfCounters(line, marker.perf.values, NB_PERF_COUNTERS);
+		}
+
+		index = findFirstMarkerOfFrame(ti.counter_samples, NB_COUNTER_SAMPLES_PER_CPU_THREAD, ti.cur_counter_write_id, frame);
+		for(size_t n=0 ; n < NB_COUNTER_SAMPLES_PER_CPU_THREAD && ti.counter_samples[index].frame == frame ; n++, incrementCycle(&index, NB_COUNTER_SAMPLES_PER_CPU_THREAD))
+		{
+			const CounterSample&	sample = ti.counter_samples[index];
+			m_server->addCounter(line, sample.name, frame_info->time_sync_start, sample.time, sample.value);
+		}
+
+		index = findFirstMarkerOfFrame(ti.flow_points, NB_FLOW_POINTS_PER_CPU_THREAD, ti.cur_flow_write_id, frame);
+		for(size_t n=0 ; n < NB_FLOW_POINTS_PER_CPU_THREAD && ti.flow_points[index].frame == frame ; n++, incrementCycle(&index, NB_FLOW_POINTS_PER_CPU_THREAD))
+		{
+			const FlowPoint&	point = ti.flow_points[index];
+			m_server->addFlowPoint(line, point.begin, point.id, frame_info->time_sync_start, point.time);
+		}
+	}
+
+	CriticalPathAnalyzer::Path	path;
+	if(getCriticalPath(frame, *frame_info, &path))
+	{
+		for(size_t s=0 ; s < path.nb_steps ; s++)
+		{
+			const CriticalPathAnalyzer::Step&	step = path.steps[s];
+			m_server->addCriticalStep(step.line, step.name[0] ? step.name : "(no marker)",
+									  frame_info->time_sync_start, step.start, step.end);
+		}
+	}
+
+	m_server->endFrame();
+}
+
+//-----------------------------------------------------------------------------
+/// Copy the CPU markers and the flow points of a complete frame to the analyzer of the critical path.
+/// The markers started in the previous frame may overlap this one, and the flows may begin there.
+void Profiler::submitFrameToCriticalPath(int frame)
+{
+	const FrameInfo*	frame_info = findFrameInfo(frame);
+	if(!frame_info || frame_info->time_sync_end == INVALID_TIME)
+		return;
+
+	// The main thread ends the frames: no path without its markers
+	size_t main_line = GPU_COUNT;
+	while(main_line < GPU_COUNT + m_nb_cpu_threads && getCpuThreadInfo(main_line - GPU_COUNT).thread_id != m_main_thread_id)
+		main_line++;
+	if(main_line == GPU_COUNT + m_nb_cpu_threads)
+		return;
+
+	if(!m_critical_path->beginFrame(frame, frame_info->time_sync_start, frame_info->time_sync_end, main_line))
+		return;	// the previous frame is still being analyzed
+
+	size_t line = GPU_COUNT;
+	for(size_t i=0 ; i < m_nb_cpu_threads ; i++, line++)
+	{
+		const CpuThreadInfo	&ti = getCpuThreadInfo(i);
+
+		int index = findFirstMarkerOfFrame(ti.markers, NB_MARKERS_PER_CPU_THREAD, ti.cur_write_id, frame-1);
+		for(size_t n=0 ; n < NB_MARKERS_PER_CPU_THREAD && ti.markers[index].frame >= frame-1 && ti.markers[index].frame <= frame ;
+			n++, incrementCycle(&index, NB_MARKERS_PER_CPU_THREAD))
+		{
+			const CpuMarker&	marker = ti.markers[index];
+			m_critical_path->addMarker(line, marker.name, marker.start, marker.end, marker.wait);	// open markers end with the frame
+		}
+
+		index = findFirstMarkerOfFrame(ti.flow_points, NB_FLOW_POINTS_PER_CPU_THREAD, ti.cur_flow_write_id, frame-1);
+		for(size_t n=0 ; n < NB_FLOW_POINTS_PER_CPU_THREAD && ti.flow_points[index].frame >= frame-1 && ti.flow_points[index].frame <= frame ;
+			n++, incrementCycle(&index, NB_FLOW_POINTS_PER_CPU_THREAD))
+		{
+			const FlowPoint&	point = ti.flow_points[index];
+			m_critical_path->addFlowPoint(line, point.begin, point.id, point.time);
+		}
+	}
+
+	m_critical_path->endFrame();
+}
+
+//-----------------------------------------------------------------------------
+/// Append a GPU marker to a path, with its times converted to CPU times
+void Profiler::addGpuStep(CriticalPathAnalyzer::Path* path, const Marker& marker, const FrameInfo& frame_info)
+{
+	if(path->nb_steps == CriticalPathAnalyzer::NB_MAX_STEPS)
+	{
+		path->truncated = true;
+		return;
+	}
+
+	// Unsigned arithmetic: the markers may end before the GPU clock was read
+	CriticalPathAnalyzer::Step&	step = path->steps[path->nb_steps++];
+	step.line = 0;
+	step.start = marker.start - frame_info.gpu_time_sync_end + frame_info.time_sync_end;
+	step.end = marker.end - frame_info.gpu_time_sync_end + frame_info.time_sync_end;
+	strncpy(step.name, marker.name, CriticalPathAnalyzer::NAME_MAX_LENGTH);
+	step.name[CriticalPathAnalyzer::NAME_MAX_LENGTH-1] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+/// Critical path of a recently analyzed frame. When the GPU ends after the frame, the GPU is the bottleneck:
+/// its innermost markers are appended to the CPU steps. Their times are converted to CPU times with the GPU clock
+/// read at the end of the frame, so draw() must have got them: otherwise, the path has no GPU steps.
+bool Profiler::getCriticalPath(int frame, const FrameInfo& frame_info, CriticalPathAnalyzer::Path* path)
+{
+	if(!m_critical_path->getPath(frame, path))
+		return false;
+	if(frame_info.gpu_time_sync_end == INVALID_TIME)
+		return true;
+
+	const GpuThreadInfo&	ti = m_gpu_thread_info;
+	const int				first_index = findFirstMarkerOfFrame(ti.markers, NB_GPU_MARKERS, ti.cur_write_id, frame);
+
+	uint64_t	gpu_end = 0;
+	int			index = first_index;
+	for(size_t n=0 ; n < NB_GPU_MARKERS && ti.markers[index].frame == frame ; n++, incrementCycle(&index, NB_GPU_MARKERS))
+	{
+		const GpuMarker&	marker = ti.markers[index];
+		if(marker.start != INVALID_TIME && marker.end != INVALID_TIME && marker.end > gpu_end)
+			gpu_end = marker.end;
+	}
+	if(gpu_end <= frame_info.gpu_time_sync_end)
+		return true;
+
+	// A marker is a leaf when the next one is not nested in it
+	const GpuMarker*	prev = NULL;
+	index = first_index;
+	for(size_t n=0 ; n < NB_GPU_MARKERS && ti.markers[index].frame == frame ; n++, incrementCycle(&index, NB_GPU_MARKERS))
+	{
+		const GpuMarker&	marker = ti.markers[index];
+		if(marker.start == INVALID_TIME || marker.end == INVALID_TIME)
+			continue;
+
+		if(prev && marker.layer <= prev->layer)
+			addGpuStep(path, *prev, frame_info);
+		prev = &marker;
+	}
+	if(prev)
+		addGpuStep(path, *prev, frame_info);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Name of a line of the overlay: the GPU or a CPU thread
+const char* Profiler::getLineName(size_t line)
+{
+	if(line < GPU_COUNT)
+		return "GPU";
+	if(line - GPU_COUNT < m_nb_cpu_threads)
+		return getCpuThreadInfo(line - GPU_COUNT).name;
+	return "?";
+}
+
+//-----------------------------------------------------------------------------
+/// Returns the number of markers written, at most NB_MAX_GPU_MARKERS_PER_FRAME
+size_t Profiler::getGpuMarkers(int frame, const FrameInfo& frame_info, Marker* markers) const
+{
+	const GpuThreadInfo&	ti = m_gpu_thread_info;
+	uint64_t				first_start = INVALID_TIME;
+	size_t					nb_markers = 0;
+
+	int index = findFirstMarkerOfFrame(ti.markers, NB_GPU_MARKERS, ti.cur_write_id, frame);
+	for(size_t n=0 ; n < NB_GPU_MARKERS && ti.markers[index].frame == frame && nb_markers < NB_MAX_GPU_MARKERS_PER_FRAME ;
+		n++, incrementCycle(&index, NB_GPU_MARKERS))
+	{
+		const GpuMarker&	marker = ti.markers[index];
+		if(marker.start == INVALID_TIME || marker.end == INVALID_TIME)
+			continue;
+
+		if(first_start == INVALID_TIME)
+			first_start = marker.start;
+
+		Marker&	dst = markers[nb_markers++];
+		dst = marker;
+		dst.start	= marker.start	- first_start + frame_info.time_sync_start;
+		dst.end		= marker.end	- first_start + frame_info.time_sync_start;
+	}
+	return nb_markers;
+}
+
+//-----------------------------------------------------------------------------
+/// Get the CpuThreadInfo corresponding to the calling thread.
+/// Returns NULL when all the slots were taken before the thread registered: its markers are not recorded.
+Profiler::CpuThreadInfo* Profiler::getOrAddCpuThreadInfo()
+{
+	if(s_thread_info)
+		return s_thread_info;
+	if(s_thread_rejected)
+		return NULL;
+
+	// First marker of this thread: register it
+	mutexLock(&m_cpu_mutex);
+
+	size_t	i = m_cpu_thread_infos.add();
+	if(i == m_cpu_thread_infos.getMaxSize())
+	{
+		size_t nb_rejected = m_nb_rejected_threads + 1;
+		atomicStoreRelaxed(&m_nb_rejected_threads, nb_rejected);	// only written under m_cpu_mutex
+		mutexUnlock(&m_cpu_mutex);
+
+		fprintf(stderr, "*** Profiler: more than %d threads, the markers of \"%s\" are not recorded (%d threads rejected)\n",
+				(int)NB_MAX_CPU_THREADS, threadGetName(), (int)nb_rejected);
+		s_thread_rejected = true;
+		return NULL;
+	}
+
+	CpuThreadInfo	&ti = m_cpu_thread_infos.get(i);
+	ti.init(threadGetCurrentId());
+
+	// Label for the row, the captures and the server
+	const char* name = threadGetName();
+	if(name[0])
+		strncpy(ti.name, name, THREAD_NAME_MAX_LENGTH);
+	else
+		sprintf(ti.name, "CPU thread %d", (int)i);
+	ti.name[THREAD_NAME_MAX_LENGTH-1] = '\0';
+
+	// The slots are never freed, so the threads are registered in order
+	assert(i == atomicLoadRelaxed(&m_nb_registered_threads));
+	atomicStoreRelease(&m_nb_registered_threads, i+1);
+
+	mutexUnlock(&m_cpu_mutex);
+
+	s_thread_info = &ti;
+	return &ti;
+}
+
+//-----------------------------------------------------------------------------
+/// Turn the events recorded by a thread into markers.
+/// Markers are created at their push event, so they are sorted by start time, and the ones
+/// that are still open have end == INVALID_TIME.
+void Profiler::collectCpuEvents(CpuThreadInfo& ti)
+{
+	CpuEvent	event;
+	while(ti.events.pop(event))
+	{
+		if(event.type == CPU_EVENT_PUSH)
+		{
+			CpuMarker&	marker = ti.markers[ti.cur_write_id];
+			assert((marker.frame < 0 || marker.end != INVALID_TIME) && "looping: too many markers, overwriting an open marker");
+
+			marker.start = event.time;
+			marker.end = INVALID_TIME;
+			marker.layer = ti.nb_open_markers;
+			strncpy(marker.name, event.name, MARKER_NAME_MAX_LENGTH);
+			marker.color = event.color;
+			marker.frame = event.frame;
+			marker.wait = false;
+			marker.alloc_calls = 0;
+			marker.alloc_bytes = 0;
+			marker.perf.valid = false;
+
+			assert(ti.nb_open_markers < NB_MAX_CPU_MARKER_LAYERS);
+			ti.open_allocs[ti.nb_open_markers] = event.allocs;
+			ti.open_perf[ti.nb_open_markers] = event.perf;
+			ti.open_markers[ti.nb_open_markers++] = ti.cur_write_id;
+
+			incrementCycle(&ti.cur_write_id, NB_MARKERS_PER_CPU_THREAD);
+		}
+		else if(event.type == CPU_EVENT_POP)
+		{
+			assert(ti.nb_open_markers != 0);
+			--ti.nb_open_markers;
+			CpuMarker&				marker = ti.markers[ti.open_markers[ti.nb_open_markers]];
+			const AllocCounters&	push_allocs = ti.open_allocs[ti.nb_open_markers];
+			marker.end = event.time;
+			marker.alloc_calls = (uint32_t)(event.allocs.calls - push_allocs.calls);	// Inclusive of the nested markers
+			marker.alloc_bytes = event.allocs.bytes - push_allocs.bytes;
+
+			// The counters may have been switched on or off while the marker was open
+			const PerfCounterValues&	push_perf = ti.open_perf[ti.nb_open_markers];
+			marker.perf.valid = push_perf.valid && event.perf.valid;
+			if(marker.perf.valid)
 			{
-				chosen_markers[nb_chosen_markers++] = m;
-				counter++;
+				for(size_t i=0 ; i < NB_PERF_COUNTERS ; i++)
+					marker.perf.values[i] = event.perf.values[i] - push_perf.values[i];
 			}
+		}
+		else if(event.type == CPU_EVENT_COUNTER)
+		{
+			// Counter samples: the oldest ones are overwritten
+			CounterSample&	sample = ti.counter_samples[ti.cur_counter_write_id];
+			sample.time = event.time;
+			sample.frame = event.frame;
+			sample.value = event.value;
+			strncpy(sample.name, event.name, MARKER_NAME_MAX_LENGTH);
+
+			incrementCycle(&ti.cur_counter_write_id, NB_COUNTER_SAMPLES_PER_CPU_THREAD);
+		}
+		else if(event.type == CPU_EVENT_WAIT)
+		{
+			// Complete marker: the thread could not push anything while it waited, so the markers stay sorted
+			CpuMarker&	marker = ti.markers[ti.cur_write_id];
+			assert((marker.frame < 0 || marker.end != INVALID_TIME) && "looping: too many markers, overwriting an open marker");
+
+			marker.start = event.time;
+			marker.end = event.time + event.wait_ns;
+			marker.layer = ti.nb_open_markers;
+			marker.color = (event.wait_type == THREAD_WAIT_MUTEX) ? COLOR_LOCK_WAIT : COLOR_IDLE_WAIT;
+			marker.frame = event.frame;
+			marker.wait = true;
+			marker.alloc_calls = 0;
+			marker.alloc_bytes = 0;
+			marker.perf.valid = false;
+
+			char		name[64];
+			WaitStats*	stats = findWaitStats(event.wait_object);
+			if(stats)
+			{
+				stats->type = event.wait_type;
+				stats->nb_waits++;
+				stats->total_ns += event.wait_ns;
+				if(event.wait_ns > stats->max_ns)
+					stats->max_ns = event.wait_ns;
+				sprintf(name, "[%s] %.40s", wait_type_names[event.wait_type], stats->name);
+			}
+			else
+			{
+				sprintf(name, "[%s] %p", wait_type_names[event.wait_type], event.wait_object);
+			}
+			name[MARKER_NAME_MAX_LENGTH-1] = '\0';
+			strcpy(marker.name, name);
 
-			// Next
-			incrementCycle(&read_id, nb_max_markers);
-			m = GET_MARKER(read_id);
+			incrementCycle(&ti.cur_write_id, NB_MARKERS_PER_CPU_THREAD);
+		}
+		else
+		{
+			// Flow points: the oldest ones are overwritten
+			FlowPoint&	point = ti.flow_points[ti.cur_flow_write_id];
+			point.time = event.time;
+			point.frame = event.frame;
+			point.id = event.flow_id;
+			point.begin = (event.type == CPU_EVENT_FLOW_BEGIN);
+
+			incrementCycle(&ti.cur_flow_write_id, NB_FLOW_POINTS_PER_CPU_THREAD);
 		}
 	}
+}
+
+//-----------------------------------------------------------------------------
+void Profiler::drawBackground()
+{
+	drawer2D.drawRect(m_back_rect, isFrozen() ? COLOR_FROZEN : COLOR_WHITE);
+}
+
+//-----------------------------------------------------------------------------
+/// Name of a line in the column left of the markers, as high as the line and cut to the width of the column
+void Profiler::drawLineLabel(const char* name, size_t line)
+{
+	const float	char_size = 16.0f;	// Pixels, at the scale 1 of drawString()
+	float	scale = LINE_HEIGHT * float(m_win_h) / char_size;
+	int		max_chars = int(LABEL_WIDTH * float(m_win_w) / (0.9f * char_size * scale)) - 1;	// drawString() advances by 0.9 characters
+	if(max_chars <= 0)
+		return;
+
+	char	label[MARKER_NAME_MAX_LENGTH];
+	if(max_chars > int(sizeof(label)) - 1)
+		max_chars = int(sizeof(label)) - 1;
+	strncpy(label, name, (size_t)max_chars);
+	label[max_chars] = '\0';
+
+	drawer2D.drawString(label, MARGIN_X, Y_OFFSET + float(line)*LINE_HEIGHT, COLOR_BLACK, scale);
+}
+
+//-----------------------------------------------------------------------------
+/// Draw a line of markers. Times are relative to the start of the frame.
+void Profiler::drawMarkers(const Marker* markers, size_t nb_markers, size_t line, const FrameInfo& frame_info, bool clamp_to_frame)
+{
+	for(size_t i=0 ; i < nb_markers ; i++)
+	{
+		const Marker&	marker = markers[i];
+
+		uint64_t	start = marker.start;
+		uint64_t	end = marker.end;
+		if(clamp_to_frame)
+		{
+			start	= clamp(start,	frame_info.time_sync_start, frame_info.time_sync_end);
+			end		= clamp(end,	frame_info.time_sync_start, frame_info.time_sync_end);
+		}
+
+		start	-= frame_info.time_sync_start;
+		end		-= frame_info.time_sync_start;
+
+		Rect	rect;
+		rect.x = X_OFFSET + X_FACTOR * (float)(start);
+		rect.y = Y_OFFSET + line*LINE_HEIGHT;
+		rect.w = X_FACTOR * (float)(end - start);
+		rect.h = LINE_HEIGHT;
+
+		// Reduce vertically the size of the markers according to their layer
+		rect.y += Y_SCALE_OFFSET*marker.layer;
+		rect.h -= (2.0f*Y_SCALE_OFFSET)*marker.layer;
+
+		drawer2D.drawRect(rect, marker.color);
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Draw the graph of a counter as steps: their height goes from the lowest value of the frame (or 0) to the highest
+void Profiler::drawCounter(const CounterView& counter, size_t line, const FrameInfo& frame_info)
+{
+	double	base = counter.min_value < 0.0 ? counter.min_value : 0.0;
+	double	range = counter.max_value - base;
+
+	for(size_t s=0 ; s < counter.nb_samples ; s++)
+	{
+		const Marker&	step = counter.steps[s];
+		float			ratio = range > 0.0 ? float((counter.values[s] - base) / range) : 1.0f;
+
+		Rect	rect;
+		rect.x = X_OFFSET + X_FACTOR * (float)(step.start - frame_info.time_sync_start);
+		rect.y = Y_OFFSET + line*LINE_HEIGHT;
+		rect.w = X_FACTOR * (float)(step.end - step.start);
+		rect.h = LINE_HEIGHT * (COUNTER_MIN_HEIGHT + (1.0f - COUNTER_MIN_HEIGHT)*ratio);
+
+		drawer2D.drawRect(rect, step.color);
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Draw a flow as an arrow between the middles of two lines. A begin in the previous frame is clamped to the frame.
+void Profiler::drawFlow(const FlowView& flow, const FrameInfo& frame_info)
+{
+	uint64_t	begin_time	= clamp(flow.begin_time,	frame_info.time_sync_start, frame_info.time_sync_end);
+	uint64_t	end_time	= clamp(flow.end_time,		frame_info.time_sync_start, frame_info.time_sync_end);
+
+	float	x1 = X_OFFSET + X_FACTOR * (float)(begin_time - frame_info.time_sync_start);
+	float	y1 = Y_OFFSET + (float(flow.begin_line) + 0.5f)*LINE_HEIGHT;
+	float	x2 = X_OFFSET + X_FACTOR * (float)(end_time - frame_info.time_sync_start);
+	float	y2 = Y_OFFSET + (float(flow.end_line) + 0.5f)*LINE_HEIGHT;
+
+	drawer2D.drawLine(x1, y1, x2, y2, COLOR_BLACK);
+
+	// Arrow head, computed in pixels so that its angle does not depend on the window's aspect ratio
+	float	dx = (x2 - x1) * float(m_win_w);
+	float	dy = (y2 - y1) * float(m_win_h);
+	float	length = sqrtf(dx*dx + dy*dy);
+	if(length == 0.0f)
+		return;
+	dx /= length;
+	dy /= length;
+
+	const float	c = 0.866f;	// cos(30 degrees)
+	const float	s = 0.5f;	// sin(30 degrees)
+	for(int side=-1 ; side <= 1 ; side += 2)
+	{
+		float	hx = -(dx*c - side*dy*s) * FLOW_ARROW_SIZE;
+		float	hy = -(dy*c + side*dx*s) * FLOW_ARROW_SIZE;
+		drawer2D.drawLine(x2, y2, x2 + hx / float(m_win_w), y2 + hy / float(m_win_h), COLOR_BLACK);
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Draw the critical path over the markers: along the middle of the lines, and from line to line
+void Profiler::drawCriticalPath(const CriticalPathAnalyzer::Path& path, const FrameInfo& frame_info)
+{
+	uint64_t	frame_start = frame_info.time_sync_start;
+	uint64_t	frame_end = frame_info.time_sync_end;
+
+	for(size_t s=0 ; s < path.nb_steps ; s++)
+	{
+		const CriticalPathAnalyzer::Step&	step = path.steps[s];
+
+		float	x1 = X_OFFSET + X_FACTOR * (float)(clamp(step.start, frame_start, frame_end) - frame_start);
+		float	x2 = X_OFFSET + X_FACTOR * (float)(clamp(step.end, frame_start, frame_end) - frame_start);
+		float	y = Y_OFFSET + (float(step.line) + 0.5f)*LINE_HEIGHT;
+		drawer2D.drawLine(x1, y, x2, y, COLOR_CRITICAL_PATH);
+
+		// Jump from the previous step, unless it goes back in time: the GPU steps may start before the last CPU step ends
+		if(s == 0)
+			continue;
+
+		const CriticalPathAnalyzer::Step&	prev = path.steps[s-1];
+		if(prev.line != step.line && prev.end <= step.start)
+		{
+			float	prev_x = X_OFFSET + X_FACTOR * (float)(clamp(prev.end, frame_start, frame_end) - frame_start);
+			float	prev_y = Y_OFFSET + (float(prev.line) + 0.5f)*LINE_HEIGHT;
+			drawer2D.drawLine(prev_x, prev_y, x1, y, COLOR_CRITICAL_PATH);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Find the markers under the point (fx, fy), in fractions of the window, with y going up.
+/// Returns the number of markers written to chosen_markers, and the name of the hovered line.
+size_t Profiler::pickMarkers(const FrameView& view, float fx, float fy,
+							 const Marker** chosen_markers, size_t max_markers, const char** line_name) const
+{
+	const FrameInfo&	frame_info = view.frame_info;
+
+	// --- Which list of markers is hovered by the mouse pointer? ---
+	const Marker	*markers = NULL;
+	size_t			nb_markers = 0;
+	bool			clamp_to_frame = false;
+	*line_name = NULL;
+
+	float	line_y = fy - Y_OFFSET;
+	if(fx >= X_OFFSET && fx < X_OFFSET + PROFILER_WIDTH && line_y >= 0.0f)
+	{
+		size_t	line = (size_t)(line_y / LINE_HEIGHT);
+		if(line < GPU_COUNT)
+		{
+			// Hovering the GPU line
+			markers			= view.gpu_markers;
+			nb_markers		= view.nb_gpu_markers;
+			*line_name		= "GPU";
+		}
+		else if(line < GPU_COUNT + view.nb_cpu_threads)
+		{
+			// Hovering a CPU line
+			const ThreadView&	tv = view.cpu_threads[line - GPU_COUNT];
+			markers			= tv.markers;
+			nb_markers		= tv.nb_markers;
+			clamp_to_frame	= true;
+			*line_name		= tv.name;
+		}
+		else if(line == GPU_COUNT + view.nb_cpu_threads)
+		{
+			// Hovering the profiler overhead line
+			markers			= view.overhead_markers;
+			nb_markers		= view.nb_cpu_threads;
+			*line_name		= "Profiler overhead";
+		}
+		else if(line < GPU_COUNT + view.nb_cpu_threads + 1 + view.nb_counters)
+		{
+			// Hovering a counter: its steps are named after their value
+			const CounterView&	counter = view.counters[line - (GPU_COUNT + view.nb_cpu_threads + 1)];
+			markers			= counter.steps;
+			nb_markers		= counter.nb_samples;
+			*line_name		= counter.name;
+		}
+	}
+
+	// --- Choose the markers that are to be displayed ---
+	size_t	nb_chosen_markers = 0;
+	for(size_t i=0 ; i < nb_markers && nb_chosen_markers < max_markers ; i++)
+	{
+		const Marker*	m = &markers[i];
+
+		// Get the relative start and end of the marker
+		uint64_t	start	= m->start;
+		uint64_t	end		= m->end;
+		if(clamp_to_frame)
+		{
+			start	= clamp(start,	frame_info.time_sync_start, frame_info.time_sync_end);
+			end		= clamp(end,	frame_info.time_sync_start, frame_info.time_sync_end);
+		}
+		start	-= frame_info.time_sync_start;
+		end		-= frame_info.time_sync_start;
+
+		float	x = X_OFFSET + X_FACTOR * (float)(start);
+		float	w = X_FACTOR * (float)(end - start);
+		if(fx >= x && fx < x+w)
+			chosen_markers[nb_chosen_markers++] = m;
+	}
+	return nb_chosen_markers;
+}
+
+//-----------------------------------------------------------------------------
+/// Draw text information for the markers that are hovered by the mouse pointer
+void Profiler::drawHoveredMarkersText(const FrameView& view)
+{
+	// Compute some values for drawing
+	float fx = float(m_mouse_x) / float(m_win_w);
+	float fy = float(m_win_h-1 - m_mouse_y) / float(m_win_h);
+
+	const Marker	*chosen_markers[NB_MAX_TEXT_LINES];
+	const char*		line_name = NULL;
+	int nb_chosen_markers = (int)pickMarkers(view, fx, fy, chosen_markers, NB_MAX_TEXT_LINES, &line_name);
+
+	if(!line_name)
+		return;	// mouse pointer doesn't hover any line
 
 	// --- Draw information on the chosen markers ---
 	{
@@ -576,18 +2097,36 @@ void Profiler::drawHoveredMarkersText(const int *read_indices, const FrameInfo*
 				str[len++] = '+';
 			str[len] = '\0';
 			strcat(str, m->name);
+			if(m->alloc_calls)
+			{
+				len = strlen(str);
+				sprintf(str+len, " (%u allocs, %.1lf KB)", m->alloc_calls, double(m->alloc_bytes) / 1024.0);
+			}
+			if(m->perf.valid)
+			{
+				double	cycles = double(m->perf.values[PERF_COUNTER_CYCLES]);
+				double	instructions = double(m->perf.values[PERF_COUNTER_INSTRUCTIONS]);
+				len = strlen(str);
+				sprintf(str+len, " (%.2lfM cycles, IPC %.2lf, %.0lf LLC misses, %.0lf branch misses)",
+						cycles / 1000000.0, cycles > 0.0 ? instructions / cycles : 0.0,
+						double(m->perf.values[PERF_COUNTER_LLC_MISSES]), double(m->perf.values[PERF_COUNTER_BRANCH_MISSES]));
+			}
 
 			drawer2D.drawString(str, 0.01f, y_text, m->color);
 			y_text += Y_TEXT_MARGIN;
 		}
+
+		// Name of the hovered line, above its markers
+		drawer2D.drawString(line_name, 0.01f, y_text);
 	}
-#undef GET_MARKER
 }
 
 void Profiler::updateBackgroundRect()
 {
-	size_t nb_threads = m_cpu_thread_infos.getSize();
+	size_t nb_threads = m_nb_cpu_threads;
 	nb_threads += GPU_COUNT;
+	nb_threads += 1;	// profiler overhead
+	nb_threads += m_nb_counter_lines;
 
 	m_back_rect.x = MARGIN_X;
 	m_back_rect.y = MARGIN_Y;
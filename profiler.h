@@ -7,15 +7,64 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "alloc_tracker.h"
+#include "critical_path.h"
 #include "hole_array.h"
+#include "perf_counters.h"
+#include "spsc_queue.h"
 #include "thread.h"
 #include "utils.h"
 
-#define ENABLE_PROFILER	// comment this to disable the profiler
+#ifndef PROFILER_DISABLE
+	#define ENABLE_PROFILER	// define PROFILER_DISABLE on the command line, or comment this, to disable the profiler
+#endif
+
+// Headless builds can script the CPU times: with PROFILER_FAKE_CLOCK defined, the profiler calls
+// profilerFakeTimeNs() instead of getTimeNs(). The GPU times can be scripted with Profiler::setGpuQueries().
+// tests/profiler_tests.cpp does both.
+//#define PROFILER_FAKE_CLOCK
+#ifdef PROFILER_FAKE_CLOCK
+	uint64_t	profilerFakeTimeNs();
+#endif
 
 #define INVALID_TIME	((uint64_t)(-1))
 #define INVALID_QUERY	((GLuint)0)
 
+// Categories and levels of the filtered markers (PROFILER_CPU_MARKER and PROFILER_GPU_MARKER).
+// The categories are bits of the compile-time and runtime masks.
+enum ProfilerCategory
+{
+	PROFILER_CATEGORY_RENDER	= 1 << 0,
+	PROFILER_CATEGORY_UPDATE	= 1 << 1,	// simulation, physics
+	PROFILER_CATEGORY_JOBS		= 1 << 2,
+	PROFILER_CATEGORY_STREAMING	= 1 << 3,
+	PROFILER_CATEGORY_STRESS	= 1 << 4
+};
+
+#define PROFILER_ALL_CATEGORIES	0xFFFFFFFFu
+
+enum ProfilerLevel
+{
+	PROFILER_LEVEL_COARSE = 0,	// A few markers per frame, cheap enough for production builds
+	PROFILER_LEVEL_DETAILED,
+	PROFILER_LEVEL_VERBOSE
+};
+
+// Compile-time filter: the markers of the other categories, or more detailed than this level, compile to nothing.
+// Define them on the command line, e.g. -DPROFILER_COMPILED_LEVEL=PROFILER_LEVEL_COARSE for a production build.
+#ifndef PROFILER_COMPILED_CATEGORIES
+	#define PROFILER_COMPILED_CATEGORIES	PROFILER_ALL_CATEGORIES
+#endif
+#ifndef PROFILER_COMPILED_LEVEL
+	#define PROFILER_COMPILED_LEVEL			PROFILER_LEVEL_VERBOSE
+#endif
+#define PROFILER_IS_COMPILED(category, level)	(((category) & PROFILER_COMPILED_CATEGORIES) != 0 && (level) <= PROFILER_COMPILED_LEVEL)
+
+#define PROFILER_CONCAT_IMPL(a, b)	a##b
+#define PROFILER_CONCAT(a, b)		PROFILER_CONCAT_IMPL(a, b)
+
 #ifndef ENABLE_PROFILER
 	#define PROFILER_INIT(win_w, win_h, mouse_x, mouse_y)
 	#define PROFILER_SHUT()
@@ -29,9 +78,29 @@
 	#define PROFILER_PUSH_GPU_MARKER(name, color)
 	#define PROFILER_POP_GPU_MARKER()
 
+	#define PROFILER_CPU_MARKER(category, level, name, color)
+	#define PROFILER_GPU_MARKER(category, level, name, color)
+	#define PROFILER_IS_ENABLED(category, level)	false
+
+	#define PROFILER_COUNTER(name, value)
+
+	#define PROFILER_NEW_FLOW_IDS(nb_ids)	0
+	#define PROFILER_FLOW_BEGIN(id)
+	#define PROFILER_FLOW_END(id)
+
 	#define PROFILER_DRAW()
 	#define PROFILER_SYNC_FRAME()
 
+	#define PROFILER_ADD_TRIGGER(type, threshold_ms, marker_name)
+	#define PROFILER_SET_CAPTURE_FRAMES(nb_before, nb_after)
+
+	#define PROFILER_START_SERVER(port)
+
+	#define PROFILER_SET_RECORDING(recording)
+
+	#define PROFILER_START_WAIT_TRACKING(threshold_us)
+	#define PROFILER_NAME_WAIT_OBJECT(object, name)
+
 #else
 	class Profiler;
 	extern Profiler profiler;
@@ -48,13 +117,74 @@
 	#define PROFILER_PUSH_GPU_MARKER(name, color)			profiler.pushGpuMarker(name, color)
 	#define PROFILER_POP_GPU_MARKER()						profiler.popGpuMarker()
 
+	// Marker filtered by category and level, popped at the end of the enclosing scope.
+	// The name and the color of the markers compiled out are not evaluated.
+	#define PROFILER_CPU_MARKER(category, level, name, color)	\
+		ProfilerScopedCpuMarker<category, level>	PROFILER_CONCAT(profiler_cpu_marker_, __LINE__)(	\
+			PROFILER_IS_COMPILED(category, level) ? (name) : NULL, PROFILER_IS_COMPILED(category, level) ? (color) : COLOR_BLACK)
+	#define PROFILER_GPU_MARKER(category, level, name, color)	\
+		ProfilerScopedGpuMarker<category, level>	PROFILER_CONCAT(profiler_gpu_marker_, __LINE__)(	\
+			PROFILER_IS_COMPILED(category, level) ? (name) : NULL, PROFILER_IS_COMPILED(category, level) ? (color) : COLOR_BLACK)
+
+	// Whether the filters let the markers of a category and a level through, e.g. to format their names only then
+	#define PROFILER_IS_ENABLED(category, level)	(PROFILER_IS_COMPILED(category, level) && profiler.isCategoryEnabled(category))
+
+	// Timestamped value of a counter (draw calls, bytes uploaded, queue depth...), drawn as a graph under the threads
+	#define PROFILER_COUNTER(name, value)					profiler.addCounterSample(name, double(value))
+
+	// Link between two threads, e.g. a job submitted on one thread and run on another: the end is linked
+	// to the most recent begin with the same id. PROFILER_NEW_FLOW_IDS(n) returns the first of n unique ids.
+	#define PROFILER_NEW_FLOW_IDS(nb_ids)					profiler.newFlowIds(nb_ids)
+	#define PROFILER_FLOW_BEGIN(id)							profiler.beginFlow(id)
+	#define PROFILER_FLOW_END(id)							profiler.endFlow(id)
+
 	#define PROFILER_DRAW()									profiler.draw()
 	#define PROFILER_SYNC_FRAME()							profiler.synchronizeFrame()
 
+	#define PROFILER_ADD_TRIGGER(type, threshold_ms, marker_name)	profiler.addTrigger(type, threshold_ms, marker_name)
+	#define PROFILER_SET_CAPTURE_FRAMES(nb_before, nb_after)		profiler.setCaptureFrames(nb_before, nb_after)
+
+	#define PROFILER_START_SERVER(port)						profiler.startServer(port)
+
+	#define PROFILER_SET_RECORDING(recording)				profiler.setRecording(recording)
+
+	// Markers for the waits on the thread.h primitives that take longer than threshold_us, see Profiler::startWaitTracking()
+	#define PROFILER_START_WAIT_TRACKING(threshold_us)		profiler.startWaitTracking(threshold_us)
+	#define PROFILER_NAME_WAIT_OBJECT(object, name)			profiler.setWaitObjectName(object, name)
+
+class CaptureWriter;
+class ProfilerServer;
+
+// The OpenGL timer query functions used by the profiler
+struct ProfilerGpuQueries
+{
+	PFNGLGENQUERIESPROC				gen_queries;
+	PFNGLDELETEQUERIESPROC			delete_queries;
+	PFNGLQUERYCOUNTERPROC			query_counter;
+	PFNGLGETQUERYOBJECTIVPROC		get_query_objectiv;
+	PFNGLGETQUERYOBJECTUI64VPROC	get_query_objectui64v;
+	PFNGLGETINTEGER64VPROC			get_integer64v;		// GL_TIMESTAMP: the GPU clock, to convert the GPU times to CPU times
+};
+
 class Profiler
 {
+	friend class ProfilerBench;	// bench/profiler_bench.cpp times the internals
+
+public:
+	// Conditions that automatically start a capture, evaluated in synchronizeFrame()
+	enum TriggerType
+	{
+		TRIGGER_FRAME_TIME,		// the frame took more than threshold_ms
+		TRIGGER_MARKER_TIME,	// a CPU marker called marker_name took more than threshold_ms
+		TRIGGER_GPU_LATE,		// the GPU timer queries were not available when drawing
+	};
+
 private:
-	static const size_t	NB_RECORDED_FRAMES = 3;
+	static const size_t	NB_FRAMES_LATENCY = 2;				// The displayed frame is m_cur_frame-NB_FRAMES_LATENCY
+	static const size_t	NB_MAX_CAPTURED_FRAMES_BEFORE = 8;	// History kept for the captures
+
+	// The frame being recorded, the ones waiting to be displayed, the displayed one, and the history
+	static const size_t	NB_RECORDED_FRAMES = 1 + NB_FRAMES_LATENCY + 1 + NB_MAX_CAPTURED_FRAMES_BEFORE;
 
 	static const size_t	NB_MAX_CPU_MARKERS_PER_FRAME = 100;
 	static const size_t	NB_MARKERS_PER_CPU_THREAD = NB_RECORDED_FRAMES * NB_MAX_CPU_MARKERS_PER_FRAME;
@@ -62,11 +192,25 @@ private:
 	static const size_t	NB_MAX_GPU_MARKERS_PER_FRAME = 10;
 	static const size_t	NB_GPU_MARKERS = NB_RECORDED_FRAMES * NB_MAX_GPU_MARKERS_PER_FRAME;
 
+	static const size_t	NB_MAX_COUNTER_SAMPLES_PER_FRAME = 32;	// Per thread
+	static const size_t	NB_COUNTER_SAMPLES_PER_CPU_THREAD = NB_RECORDED_FRAMES * NB_MAX_COUNTER_SAMPLES_PER_FRAME;
+	static const size_t	NB_MAX_COUNTERS = 8;	// Counter names, each one gets a graph
+
+	static const size_t	NB_MAX_FLOW_POINTS_PER_FRAME = 128;	// Per thread, begins and ends
+	static const size_t	NB_FLOW_POINTS_PER_CPU_THREAD = NB_RECORDED_FRAMES * NB_MAX_FLOW_POINTS_PER_FRAME;
+	static const size_t	NB_MAX_VIEW_FLOWS = 128;
+
+	static const size_t	NB_MAX_WAIT_OBJECTS = 32;	// Mutexes, events and barriers with statistics
+
 	static const size_t	NB_MAX_CPU_THREADS = 32;
 	//static const size_t	NB_FRAMES_BEFORE_KICK_CPU_THREAD = 4;	// TODO: remove threads that are not used anymore
 
 	static const size_t	MARKER_NAME_MAX_LENGTH = 32;
 
+	// Calibration of the cost of the markers: the minimum over the batches is kept
+	static const size_t	NB_CALIBRATION_MARKERS = NB_MAX_CPU_MARKERS_PER_FRAME;	// Per batch, all recorded: none is dropped
+	static const size_t	NB_CALIBRATION_BATCHES = 16;
+
 	struct Marker
 	{
 		uint64_t	start;  // Times of start and end, in nanoseconds,
@@ -78,12 +222,38 @@ private:
 		char		name[MARKER_NAME_MAX_LENGTH];
 		Color		color;
 
-		Marker() : start(INVALID_TIME), end(INVALID_TIME), frame(-1) {}	// unused by default
+		// CPU markers only. They are in the base struct because the CPU markers are drawn and picked as Marker arrays.
+		bool		wait;			// Wait in a thread.h primitive, see startWaitTracking()
+		uint32_t	alloc_calls;	// Allocations between the push and the pop, see alloc_tracker.h
+		uint64_t	alloc_bytes;
+		PerfCounterValues	perf;	// Hardware counters between the push and the pop, see perf_counters.h
+
+		Marker() : start(INVALID_TIME), end(INVALID_TIME), frame(-1), wait(false), alloc_calls(0), alloc_bytes(0), perf() {}	// unused by default
 	};
 
 	// --- Device-specific markers ---
 	typedef Marker CpuMarker;
 
+	struct CounterSample
+	{
+		uint64_t	time;
+		int			frame;	// Frame at which the sample was taken
+		double		value;
+		char		name[MARKER_NAME_MAX_LENGTH];
+
+		CounterSample() : time(INVALID_TIME), frame(-1), value(0.0) {}	// unused by default
+	};
+
+	struct FlowPoint
+	{
+		uint64_t	time;
+		int			frame;
+		uint32_t	id;
+		bool		begin;
+
+		FlowPoint() : time(INVALID_TIME), frame(-1), id(0), begin(false) {}	// unused by default
+	};
+
 	struct GpuMarker : public Marker
 	{
 		GLuint		id_query_start;
@@ -92,21 +262,95 @@ private:
 		GpuMarker() : Marker(), id_query_start(INVALID_QUERY), id_query_end(INVALID_QUERY) {}
 	};
 
+	// What a CPU thread records: synchronizeFrame() turns these events into markers
+	static const size_t	NB_CPU_EVENTS_PER_THREAD = 1024;	// Events that can be recorded between 2 calls to synchronizeFrame()
+	static const size_t	NB_MAX_CPU_MARKER_LAYERS = 32;
+
+	enum CpuEventType
+	{
+		CPU_EVENT_PUSH,
+		CPU_EVENT_POP,
+		CPU_EVENT_COUNTER,
+		CPU_EVENT_FLOW_BEGIN,
+		CPU_EVENT_FLOW_END,
+		CPU_EVENT_WAIT,		// A complete marker: its time is the start of the wait
+	};
+
+	struct CpuEvent
+	{
+		uint64_t		time;
+		int				frame;
+		CpuEventType	type;
+		char			name[MARKER_NAME_MAX_LENGTH];	// CPU_EVENT_PUSH and CPU_EVENT_COUNTER
+		Color			color;							// CPU_EVENT_PUSH only
+		double			value;							// CPU_EVENT_COUNTER only
+		uint32_t		flow_id;						// CPU_EVENT_FLOW_BEGIN and CPU_EVENT_FLOW_END
+		ThreadWaitType	wait_type;						// CPU_EVENT_WAIT only
+		const void*		wait_object;					// CPU_EVENT_WAIT only
+		uint64_t		wait_ns;						// CPU_EVENT_WAIT only
+		AllocCounters	allocs;							// CPU_EVENT_PUSH and CPU_EVENT_POP: allocations of the thread so far
+		PerfCounterValues	perf;						// CPU_EVENT_PUSH and CPU_EVENT_POP: hardware counters of the thread
+	};
+
 	// Markers for a CPU thread
 	struct CpuThreadInfo
 	{
 		ThreadId	thread_id;
+		char		name[THREAD_NAME_MAX_LENGTH];	// From threadGetName() when the thread registered
+
+		// --- Recording side, only accessed by the thread itself ---
+		size_t		nb_pushed_markers;
+		size_t		nb_queued_markers;	// Pushed markers whose push event is in the queue: their pop event must fit too
+		bool		dropped_markers[NB_MAX_CPU_MARKER_LAYERS];	// For each layer: the push event was not queued, its pop is ignored
+		size_t		nb_dropped_markers;	// Markers and counter samples, since the registration, read by the main thread
+
+		SpscQueue<CpuEvent, NB_CPU_EVENTS_PER_THREAD>	events;
+
+		// --- Collected markers, only accessed by the main thread ---
 		CpuMarker	markers[NB_MARKERS_PER_CPU_THREAD];
 
 		int			cur_read_id;	// Index of the last pushed marker in the previous frame
 		int			cur_write_id;	// Index of the next cell we will write to
 
 		int			next_read_id;	// draw() writes next_read_id, synchronizeFrame() copies cur_read_id <- next_read_id
-									// This deferring is needed for handling freeze/unfreeze.
-
-		size_t		nb_pushed_markers;
-
-		void	init(ThreadId id)	{cur_read_id=cur_write_id=next_read_id=0; thread_id = id; nb_pushed_markers=0;}
+									// This deferring keeps the read position stable during a frame.
+
+		int				open_markers[NB_MAX_CPU_MARKER_LAYERS];	// Indices of the markers waiting for their pop event
+		AllocCounters	open_allocs[NB_MAX_CPU_MARKER_LAYERS];	// Allocation counters of the thread at their push event
+		PerfCounterValues	open_perf[NB_MAX_CPU_MARKER_LAYERS];	// Hardware counters of the thread at their push event
+		size_t			nb_open_markers;
+
+		CounterSample	counter_samples[NB_COUNTER_SAMPLES_PER_CPU_THREAD];	// Sorted by frame, overwritten when full
+		int				cur_counter_write_id;
+
+		FlowPoint		flow_points[NB_FLOW_POINTS_PER_CPU_THREAD];			// Sorted by frame, overwritten when full
+		int				cur_flow_write_id;
+
+		// Only accessed by the thread itself: the markers and waits beyond NB_MAX_CPU_MARKERS_PER_FRAME, the counter
+		// samples beyond NB_MAX_COUNTER_SAMPLES_PER_FRAME and the flow points beyond NB_MAX_FLOW_POINTS_PER_FRAME are not queued
+		int				marker_frame;
+		size_t			nb_frame_markers;
+		int				counter_frame;
+		size_t			nb_frame_counter_samples;
+		int				flow_frame;
+		size_t			nb_frame_flow_points;
+
+		void	init(ThreadId id)
+		{
+			thread_id = id;
+			nb_pushed_markers = nb_queued_markers = 0;
+			nb_dropped_markers = 0;
+			cur_read_id=cur_write_id=next_read_id=0;
+			nb_open_markers = 0;
+			cur_counter_write_id = 0;
+			cur_flow_write_id = 0;
+			marker_frame = -1;
+			nb_frame_markers = 0;
+			counter_frame = -1;
+			nb_frame_counter_samples = 0;
+			flow_frame = -1;
+			nb_frame_flow_points = 0;
+		}
 	};
 
 	// Markers for the GPU
@@ -118,9 +362,10 @@ private:
 		int			cur_write_id;	// Index of the next cell we will write to
 
 		int			next_read_id;	// draw() writes next_read_id, synchronizeFrame() copies cur_read_id <- next_read_id.
-									// This deferring is needed for handling freeze/unfreeze.
+									// This deferring keeps the read position stable during a frame.
 
 		size_t		nb_pushed_markers;
+		int			pushed_markers[NB_MAX_GPU_MARKERS_PER_FRAME];	// Indices of the markers waiting for their end query
 
 		void	init()	{cur_read_id=cur_write_id=next_read_id=0; nb_pushed_markers=0;}
 	};
@@ -128,11 +373,38 @@ private:
 	typedef	HoleArray<CpuThreadInfo, NB_MAX_CPU_THREADS>	CpuThreadInfoList;
 
 	CpuThreadInfoList	m_cpu_thread_infos;
-	Mutex				m_cpu_mutex;
+	Mutex				m_cpu_mutex;				// Protects the registration of new threads
+	size_t				m_nb_registered_threads;	// Published with a release store once a new CpuThreadInfo is ready
+	size_t				m_nb_rejected_threads;		// Threads that wanted to record markers when all the slots were taken
+	size_t				m_nb_cpu_threads;			// Threads known by the main thread
+	ThreadId			m_main_thread_id;			// The thread that called init(), which ends the frames
 
 	GpuThreadInfo		m_gpu_thread_info;
+	ProfilerGpuQueries	m_gl;	// Taken from the current context by init()
+
+	int					m_cur_frame;		// Global frame counter, only written by the main thread
+	uint32_t			m_category_mask;	// Read by all the threads when they push filtered markers
+	bool				m_recording;		// Read by all the threads when they push markers
+	uint32_t			m_next_flow_id;
+
+	// Waits on the thread.h primitives, statistics gathered by collectCpuEvents()
+	struct WaitStats
+	{
+		const void*		object;
+		ThreadWaitType	type;
+		char			name[MARKER_NAME_MAX_LENGTH];	// Given by setWaitObjectName(), or the address
+		size_t			nb_waits;
+		uint64_t		total_ns;
+		uint64_t		max_ns;
+	};
 
-	volatile int		m_cur_frame;		// Global frame counter
+	bool		m_wait_tracking;
+	double		m_wait_threshold_us;
+	WaitStats	m_wait_stats[NB_MAX_WAIT_OBJECTS];	// Main thread only
+	size_t		m_nb_wait_objects;
+
+	static THREAD_LOCAL CpuThreadInfo*	s_thread_info;	// NULL until the calling thread pushes its first marker
+	static THREAD_LOCAL bool			s_thread_rejected;	// The calling thread found no slot left: it records nothing
 
 	// Frame time information
 	struct FrameInfo
@@ -140,22 +412,122 @@ private:
 		int			frame;
 		uint64_t	time_sync_start;
 		uint64_t	time_sync_end;
+		uint64_t	gpu_time_sync_end;	// GL_TIMESTAMP read with time_sync_end, INVALID_TIME when the frame has no GPU marker
 	};
 	FrameInfo			m_frame_info[NB_RECORDED_FRAMES];
 
+	// Copy of the markers displayed for one frame.
+	// draw() refreshes m_live_view every frame from the rings. Freezing copies it to m_frozen_view,
+	// which is drawn instead while the recording goes on: unfreezing just drops the snapshot.
+	static const size_t	NB_MAX_VIEW_MARKERS_PER_THREAD = 2*NB_MAX_CPU_MARKERS_PER_FRAME;	// previous + displayed frame
+
+	struct ThreadView
+	{
+		const char*	name;	// Points to CpuThreadInfo::name, which is never freed
+		size_t		nb_markers;
+		size_t		nb_frame_markers;	// Markers started in the frame, including the ones that did not fit in the view
+		CpuMarker	markers[NB_MAX_VIEW_MARKERS_PER_THREAD];
+	};
+
+	// Graph of a counter: one step per sample of the displayed frame, up to the next sample.
+	// The steps are named after their value for the hover text.
+	static const size_t	NB_MAX_VIEW_SAMPLES_PER_COUNTER = NB_MAX_COUNTER_SAMPLES_PER_FRAME;
+
+	struct CounterView
+	{
+		char		name[MARKER_NAME_MAX_LENGTH];
+		double		min_value;
+		double		max_value;
+		size_t		nb_samples;
+		Marker		steps[NB_MAX_VIEW_SAMPLES_PER_COUNTER];
+		double		values[NB_MAX_VIEW_SAMPLES_PER_COUNTER];
+	};
+
+	// Arrow between the lines of two threads. The flows that stay on one thread are not drawn.
+	struct FlowView
+	{
+		uint64_t	begin_time;
+		uint64_t	end_time;
+		size_t		begin_line;
+		size_t		end_line;
+	};
+
+	struct FrameView
+	{
+		bool		valid;
+		FrameInfo	frame_info;
+
+		size_t		nb_gpu_markers;
+		Marker		gpu_markers[NB_MAX_GPU_MARKERS_PER_FRAME];	// Times are rebased on frame_info.time_sync_start
+
+		size_t		nb_cpu_threads;
+		ThreadView	cpu_threads[NB_MAX_CPU_THREADS];
+
+		// "Profiler overhead" line: one marker per thread, as long as the time its markers cost, end to end
+		Marker		overhead_markers[NB_MAX_CPU_THREADS];
+
+		size_t		nb_counters;
+		CounterView	counters[NB_MAX_COUNTERS];	// In the order their names were first seen in the frame
+
+		size_t		nb_flows;
+		FlowView	flows[NB_MAX_VIEW_FLOWS];	// Flows that end in the displayed frame
+
+		FrameView() : valid(false), nb_gpu_markers(0), nb_cpu_threads(0), nb_counters(0), nb_flows(0) {}
+	};
+
+	FrameView	m_live_view;
+	FrameView	m_frozen_view;
+
 	// Handling freeze/unfreeze by clicking on the displayed profiler
-	enum FreezeState
+	bool	m_frozen;
+
+	// Triggers and captures: when a trigger fires, the NB_MAX_CAPTURED_FRAMES_BEFORE preceding frames
+	// are still in the rings and get written immediately, the following frames are written as they complete.
+	static const size_t	NB_MAX_TRIGGERS = 8;
+
+	struct Trigger
 	{
-		UNFROZEN,
-		WAITING_FOR_FREEZE,
-		FROZEN,
-		WAITING_FOR_UNFREEZE,
+		TriggerType	type;
+		uint64_t	threshold;	// in nanoseconds
+		char		marker_name[MARKER_NAME_MAX_LENGTH];
 	};
 
-	FreezeState	 m_freeze_state;
+	Trigger		m_triggers[NB_MAX_TRIGGERS];
+	size_t		m_nb_triggers;
+
+	int			m_gpu_late_frame;	// Last frame for which draw() found unavailable GPU timer queries
+
+	// The events are formatted by the main thread, the writer thread writes them to the file
+	struct Capture
+	{
+		bool		active;
+		int			next_frame;	// Next frame to write
+		int			last_frame;	// Last frame to write
+		bool		first_event;
+		int			nb_captures;
+		std::string	buffer;		// Formatted events, handed to the writer after each frame
+	};
+
+	Capture			m_capture;
+	CaptureWriter*	m_capture_writer;
+	int			m_nb_capture_frames_before;
+	int			m_nb_capture_frames_after;
+
+	// Self-overhead: cost of a push/pop pair as seen by the enclosing marker, measured in init()
+	double	m_marker_overhead_ns;
+	bool	m_compensate_overhead;	// Captures and server: subtract the cost of the nested markers from their parents
+
+	// Live streaming of the complete frames to a remote viewer, NULL when not started
+	ProfilerServer*	m_server;
+
+	// Critical path of each frame, found by the thread of the analyzer. The GPU steps are appended by getCriticalPath().
+	CriticalPathAnalyzer*		m_critical_path;
+	CriticalPathAnalyzer::Path	m_drawn_path;	// Path of the displayed frame, frame == -1 until it is analyzed
 
 	bool	m_visible;
 
+	size_t	m_nb_counter_lines;	// Most counters drawn so far: the background only grows
+
 	// Handling interaction with the mouse
 	int		m_mouse_x, m_mouse_y;
 	int		m_win_w, m_win_h;
@@ -169,11 +541,21 @@ public:
 	void	init(int win_w, int win_h, int mouse_x, int mouse_y);
 	void	shut();
 
-	void	pushCpuMarker(const char* name, const Color& color);
-	void	popCpuMarker();
+	// When the recording is stopped, a push costs one relaxed load and a branch. A thread that is inside
+	// recorded markers goes on recording until it pops the outermost one, so that the pops match the pushes.
+	inline void	pushCpuMarker(const char* name, const Color& color);
+	inline void	popCpuMarker();
+
+	inline void	pushGpuMarker(const char* name, const Color& color);
+	inline void	popGpuMarker();
+
+	// Any thread: sample of a counter, at most NB_MAX_COUNTER_SAMPLES_PER_FRAME per thread and per frame are kept
+	inline void	addCounterSample(const char* name, double value);
 
-	void	pushGpuMarker(const char* name, const Color& color);
-	void	popGpuMarker();
+	// Any thread: flows, at most NB_MAX_FLOW_POINTS_PER_FRAME begins and ends per thread and per frame are kept
+	uint32_t	newFlowIds(uint32_t nb_ids)	{return atomicFetchAdd(&m_next_flow_id, nb_ids);}
+	inline void	beginFlow(uint32_t id);
+	inline void	endFlow(uint32_t id);
 
 	void	synchronizeFrame();
 
@@ -182,22 +564,223 @@ public:
 	void	setVisible(bool visible)	{m_visible=visible;}
 	bool	isVisible() const			{return m_visible;}
 
-	bool	isFrozen() const			{return m_freeze_state == FROZEN || m_freeze_state == WAITING_FOR_UNFREEZE;}
+	bool	isFrozen() const			{return m_frozen;}
+
+	// Any thread, and the clients of the server: stop and resume the recording of all the markers
+	void	setRecording(bool recording)	{atomicStoreRelaxed(&m_recording, recording);}
+	bool	isRecording() const				{return atomicLoadRelaxed(&m_recording);}
+
+	// Runtime filter of PROFILER_CPU_MARKER and PROFILER_GPU_MARKER: a marker whose category is not in the mask
+	// when it is pushed is not recorded. The plain push/pop markers are never filtered.
+	void		setCategoryMask(uint32_t mask)				{atomicStoreRelaxed(&m_category_mask, mask);}
+	uint32_t	getCategoryMask() const						{return atomicLoadRelaxed(&m_category_mask);}
+	bool		isCategoryEnabled(uint32_t category) const	{return (atomicLoadRelaxed(&m_category_mask) & category) != 0;}
+
+	// Main thread: CPU markers and counter samples that did not fit in the event queues of their thread, since the start
+	size_t	getNbDroppedCpuMarkers();
+
+	// Threads are recorded in the order of their first marker. The ones that come after the first
+	// NB_MAX_CPU_THREADS are rejected: their markers are ignored.
+	size_t	getMaxCpuThreads() const		{return NB_MAX_CPU_THREADS;}
+	size_t	getNbRejectedThreads() const	{return atomicLoadRelaxed(&m_nb_rejected_threads);}
+
+	// Replace the timer queries taken by init(), e.g. by a fake that scripts the GPU times.
+	// Call it before the first GPU marker.
+	void	setGpuQueries(const ProfilerGpuQueries& queries)	{m_gl = queries;}
+
+	// Self-overhead
+	double	getMarkerOverheadNs() const				{return m_marker_overhead_ns;}
+	void	setOverheadCompensation(bool compensate)	{m_compensate_overhead=compensate;}
+	bool	hasOverheadCompensation() const			{return m_compensate_overhead;}
 
 	// Input handling
 	void	onMousePos(int x, int y)	{m_mouse_x=x;	m_mouse_y=y;}
 	void	onLeftClick();
 	void	onResize(int w, int h)		{m_win_w=w;	m_win_h=h;}
 
+	// Automatic captures
+	bool	addTrigger(TriggerType type, double threshold_ms, const char* marker_name=NULL);
+	void	setCaptureFrames(int nb_before, int nb_after);
+	bool	isCapturing() const			{return m_capture.active;}
+
+	// Live server
+	bool	startServer(unsigned short port);
+	void	stopServer();
+
+	// Main thread: record the waits of the profiled threads in mutexLock(), eventWait() and barrierWait() that take
+	// longer than threshold_us, as markers named after the primitive, and sum them per primitive.
+	// While it is on, a contended mutexLock() and every wait read the clock twice.
+	void	startWaitTracking(double threshold_us);
+	void	stopWaitTracking();
+	bool	isTrackingWaits() const		{return m_wait_tracking;}
+	double	getWaitThresholdUs() const	{return m_wait_threshold_us;}
+	void	setWaitObjectName(const void* object, const char* name);
+	void	printWaitStats();	// Sorted by total wait time
+
 protected:
-	// Get the CpuThreadInfo corresponding to the calling thread
-	CpuThreadInfo&	getOrAddCpuThreadInfo();
+	// Get the CpuThreadInfo corresponding to the calling thread, NULL if there was no slot left for it
+	CpuThreadInfo*	getOrAddCpuThreadInfo();
+
+	// Main thread: CpuThreadInfo of the i-th thread, i < m_nb_cpu_threads
+	CpuThreadInfo&	getCpuThreadInfo(size_t i)	{return m_cpu_thread_infos.getPtr()[i];}
+
+	// Out-of-line part of the push/pop functions, when the marker is recorded
+	void	recordCpuPush(const char* name, const Color& color);
+	void	recordCpuPop();
+	void	recordGpuPush(const char* name, const Color& color);
+	void	recordGpuPop();
+	bool	reserveFrameMarker(CpuThreadInfo& ti, int frame);
+	void	queueEvent(CpuThreadInfo& ti, const CpuEvent& event);	// Counter samples, flow points and waits
+	void	recordCounterSample(const char* name, double value);
+	void	recordFlowPoint(uint32_t id, CpuEventType type);
+	void	recordWait(ThreadWaitType type, const void* object, uint64_t wait_ns);
+	static void	onThreadWait(ThreadWaitType type, const void* object, uint64_t wait_ns);	// ThreadWaitHook
+	WaitStats*	findWaitStats(const void* object);
+
+	// Turn the events recorded by a thread into markers
+	void	collectCpuEvents(CpuThreadInfo& ti);
+
+	// Self-overhead
+	void		calibrateOverhead();
+	void		countNestedMarkers(const CpuThreadInfo& ti, int first_index, size_t* nb_nested) const;
+	uint64_t	getExportedEnd(const CpuMarker& marker, size_t nb_nested) const;
+
+	FrameInfo*	findFrameInfo(int frame);
+
+	// Triggers and captures
+	int		evaluateTriggers(int frame);
+	void	startCapture(int frame);
+	void	writeCapturedFrame(int frame);
+	void	stopCapture();
+
+	void	sendFrameToServer(int frame);
+
+	// Critical path
+	void		submitFrameToCriticalPath(int frame);
+	bool		getCriticalPath(int frame, const FrameInfo& frame_info, CriticalPathAnalyzer::Path* path);
+	static void	addGpuStep(CriticalPathAnalyzer::Path* path, const Marker& marker, const FrameInfo& frame_info);
+	const char*	getLineName(size_t line);
+
+	// GPU markers of a frame that draw() got the times for, rebased like in collectFrameView()
+	size_t	getGpuMarkers(int frame, const FrameInfo& frame_info, Marker* markers) const;
+
+	// Copy the markers of the displayed frame into the given view
+	void	collectFrameView(FrameView& view);
+	void	copyFrameView(FrameView& dst, const FrameView& src) const;
 
 	void	drawBackground();
-	void	drawHoveredMarkersText(const int *read_indices, const FrameInfo* frame_info);
+	void	drawLineLabel(const char* name, size_t line);
+	void	drawMarkers(const Marker* markers, size_t nb_markers, size_t line, const FrameInfo& frame_info, bool clamp_to_frame);
+	void	drawCounter(const CounterView& counter, size_t line, const FrameInfo& frame_info);
+	void	drawFlow(const FlowView& flow, const FrameInfo& frame_info);
+	void	drawCriticalPath(const CriticalPathAnalyzer::Path& path, const FrameInfo& frame_info);
+	size_t	pickMarkers(const FrameView& view, float fx, float fy,
+						const Marker** chosen_markers, size_t max_markers, const char** line_name) const;
+	void	drawHoveredMarkersText(const FrameView& view);
 	void	updateBackgroundRect();
 };
 
+//-----------------------------------------------------------------------------
+inline void Profiler::pushCpuMarker(const char* name, const Color& color)
+{
+	if(atomicLoadRelaxed(&m_recording) || (s_thread_info && s_thread_info->nb_pushed_markers != 0))
+		recordCpuPush(name, color);
+}
+
+//-----------------------------------------------------------------------------
+/// Without pushed markers, the push happened while the recording was stopped
+inline void Profiler::popCpuMarker()
+{
+	if(s_thread_info && s_thread_info->nb_pushed_markers != 0)
+		recordCpuPop();
+}
+
+//-----------------------------------------------------------------------------
+inline void Profiler::pushGpuMarker(const char* name, const Color& color)
+{
+	if(atomicLoadRelaxed(&m_recording) || m_gpu_thread_info.nb_pushed_markers != 0)
+		recordGpuPush(name, color);
+}
+
+//-----------------------------------------------------------------------------
+inline void Profiler::popGpuMarker()
+{
+	if(m_gpu_thread_info.nb_pushed_markers != 0)
+		recordGpuPop();
+}
+
+//-----------------------------------------------------------------------------
+inline void Profiler::addCounterSample(const char* name, double value)
+{
+	if(atomicLoadRelaxed(&m_recording))
+		recordCounterSample(name, value);
+}
+
+//-----------------------------------------------------------------------------
+inline void Profiler::beginFlow(uint32_t id)
+{
+	if(atomicLoadRelaxed(&m_recording))
+		recordFlowPoint(id, CPU_EVENT_FLOW_BEGIN);
+}
+
+//-----------------------------------------------------------------------------
+inline void Profiler::endFlow(uint32_t id)
+{
+	if(atomicLoadRelaxed(&m_recording))
+		recordFlowPoint(id, CPU_EVENT_FLOW_END);
+}
+
+// Filtered markers, see PROFILER_CPU_MARKER and PROFILER_GPU_MARKER.
+// The compile-time filter selects the specialization: the markers it removes are empty objects.
+// The runtime mask is read once, when the marker is pushed: the pop matches even if the mask changes meanwhile.
+template<uint32_t category, int level, bool compiled = PROFILER_IS_COMPILED(category, level)>
+class ProfilerScopedCpuMarker
+{
+	bool	m_pushed;
+public:
+	ProfilerScopedCpuMarker(const char* name, const Color& color) : m_pushed(profiler.isCategoryEnabled(category))
+	{
+		if(m_pushed)
+			profiler.pushCpuMarker(name, color);
+	}
+	~ProfilerScopedCpuMarker()
+	{
+		if(m_pushed)
+			profiler.popCpuMarker();
+	}
+};
+
+template<uint32_t category, int level>
+class ProfilerScopedCpuMarker<category, level, false>
+{
+public:
+	ProfilerScopedCpuMarker(const char* name, const Color& color)	{}
+};
+
+template<uint32_t category, int level, bool compiled = PROFILER_IS_COMPILED(category, level)>
+class ProfilerScopedGpuMarker
+{
+	bool	m_pushed;
+public:
+	ProfilerScopedGpuMarker(const char* name, const Color& color) : m_pushed(profiler.isCategoryEnabled(category))
+	{
+		if(m_pushed)
+			profiler.pushGpuMarker(name, color);
+	}
+	~ProfilerScopedGpuMarker()
+	{
+		if(m_pushed)
+			profiler.popGpuMarker();
+	}
+};
+
+template<uint32_t category, int level>
+class ProfilerScopedGpuMarker<category, level, false>
+{
+public:
+	ProfilerScopedGpuMarker(const char* name, const Color& color)	{}
+};
+
 #endif	// defined(ENABLE_PROFILER)
 
 #endif // PROFILER_H
@@ -0,0 +1,73 @@
+// profiler_protocol.h
+// Binary stream sent by the profiler server to its clients.
+//
+// The stream is a sequence of packets, one per frame: a little-endian uint32 giving the size of
+// the payload, followed by the payload, which is a sequence of records. Each record starts with
+// a uint8 record type. All integers are little-endian.
+//
+// Names and threads are only sent the first time a client sees them, markers refer to them by id.
+// When the client is too slow, whole frames are dropped and the number of dropped frames is
+// reported by the next RECORD_FRAME.
+//
+// The clients can send commands: a uint8 command type followed by its arguments, without framing.
+// The server applies them at the next frame.
+
+#ifndef PROFILER_PROTOCOL_H
+#define PROFILER_PROTOCOL_H
+
+#include <stdint.h>
+
+#define PROFILER_SERVER_DEFAULT_PORT	5555
+
+enum ProfilerRecordType
+{
+	// int32 frame, uint32 nb_dropped_frames, uint64 start_ns, uint32 duration_ns
+	RECORD_FRAME	= 1,
+
+	// uint8 line, uint8 name_length, char name[name_length]
+	// Line 0 is the GPU, the following lines are the CPU threads.
+	RECORD_THREAD	= 2,
+
+	// uint16 name_id, uint8 name_length, char name[name_length]
+	// A name id can be redefined: the new name applies to the following markers.
+	RECORD_NAME		= 3,
+
+	// uint8 line, uint8 layer, uint16 name_id, uint8 r, uint8 g, uint8 b,
+	// int32 start_ns (relative to the start of the frame), uint32 duration_ns
+	RECORD_MARKER	= 4,
+
+	// uint8 line, uint16 name_id, int32 time_ns (relative to the start of the frame), uint64 value (bits of a double)
+	RECORD_COUNTER	= 5,
+
+	// uint8 line, uint8 begin (1: begin, 0: end), uint32 id, int32 time_ns (relative to the start of the frame)
+	// The end of a flow is linked to the most recent begin with the same id.
+	RECORD_FLOW		= 6,
+
+	// uint8 line, uint16 name_id, int32 start_ns (relative to the start of the frame), uint32 duration_ns
+	// A step of the critical path of the frame, in path order. The name is the innermost marker of the line.
+	// The steps of the GPU come last, when the GPU is the bottleneck: their times are converted to CPU
+	// times with the GPU clock read at the end of the frame, unlike the times of the GPU markers, which are rebased.
+	RECORD_CRITICAL_STEP	= 7,
+
+	// uint8 line, uint32 nb_calls, uint64 bytes
+	// Heap allocations of the previous RECORD_MARKER of the line, nested markers included. Only sent for the markers
+	// that allocated, when the demo is built with TRACK_ALLOCATIONS (see alloc_tracker.h).
+	RECORD_ALLOCATIONS		= 8,
+
+	// uint8 line, uint8 nb_counters, uint64 values[nb_counters]
+	// Hardware counters of the previous RECORD_MARKER of the line, nested markers included, in this order: cycles,
+	// instructions, last level cache misses, branch misses. Only sent when they are on (see perf_counters.h).
+	RECORD_PERF_COUNTERS	= 9,
+};
+
+enum ProfilerCommandType
+{
+	// uint8 recording: 0 stops recording the markers, 1 resumes
+	COMMAND_SET_RECORDING	= 1,
+};
+
+#define PROFILER_COMMAND_MAX_SIZE	2
+
+#define PROFILER_PACKET_MAX_SIZE	(16*1024*1024)	// Sanity check for the clients
+
+#endif // PROFILER_PROTOCOL_H
@@ -0,0 +1,604 @@
+// profiler_server.cpp
+
+#ifdef WIN32
+	#include <winsock2.h>	// before windows.h
+#endif
+#include "profiler_server.h"
+#include <stdio.h>
+#include <string.h>
+
+// ------------------------- Sockets: Windows / BSD --------------------------
+#ifdef WIN32
+	#define INVALID_SOCKET_VALUE	((Socket)INVALID_SOCKET)
+	typedef	int		socklen_t;
+
+	static bool	socketInit()
+	{
+		WSADATA	wsa_data;
+		return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+	}
+	static void	socketShut()				{WSACleanup();}
+	static void	socketClose(Socket s)		{closesocket((SOCKET)s);}
+	static void	socketShutdown(Socket s)	{shutdown((SOCKET)s, SD_BOTH);}
+	static bool	socketSendTimedOut()		{return false;}	// No SO_SNDTIMEO: the socket is unusable after a timeout
+	#define SEND_FLAGS	0
+#else
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <sys/select.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <arpa/inet.h>
+	#include <unistd.h>
+	#include <errno.h>
+
+	#define INVALID_SOCKET_VALUE	(-1)
+
+	static bool	socketInit()				{return true;}
+	static void	socketShut()				{}
+	static void	socketClose(Socket s)		{close(s);}
+	static void	socketShutdown(Socket s)	{shutdown(s, SHUT_RDWR);}
+	static bool	socketSendTimedOut()		{return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;}
+
+	// Don't get killed by SIGPIPE when the client goes away
+	#ifdef MSG_NOSIGNAL
+		#define SEND_FLAGS	MSG_NOSIGNAL
+	#else
+		#define SEND_FLAGS	0
+	#endif
+#endif
+
+#define ACCEPT_TIMEOUT_MS	100	// How often the server thread checks whether it must stop, also while send() blocks
+
+// ------------------------- Serialization -----------------------------------
+static inline void	writeU8(std::vector<uint8_t>& packet, uint32_t val)
+{
+	packet.push_back((uint8_t)(val));
+}
+
+static inline void	writeU16(std::vector<uint8_t>& packet, uint32_t val)
+{
+	packet.push_back((uint8_t)(val));
+	packet.push_back((uint8_t)(val >> 8));
+}
+
+static inline void	writeU32(std::vector<uint8_t>& packet, uint32_t val)
+{
+	packet.push_back((uint8_t)(val));
+	packet.push_back((uint8_t)(val >> 8));
+	packet.push_back((uint8_t)(val >> 16));
+	packet.push_back((uint8_t)(val >> 24));
+}
+
+static inline void	writeU64(std::vector<uint8_t>& packet, uint64_t val)
+{
+	writeU32(packet, (uint32_t)(val));
+	writeU32(packet, (uint32_t)(val >> 32));
+}
+
+static inline void	writeString(std::vector<uint8_t>& packet, const char* str, size_t max_length)
+{
+	size_t len = strlen(str);
+	if(len > max_length)
+		len = max_length;
+	writeU8(packet, (uint32_t)len);
+	packet.insert(packet.end(), (const uint8_t*)str, (const uint8_t*)str + len);
+}
+
+// FNV-1a
+static inline uint32_t	hashString(const char* str)
+{
+	uint32_t hash = 2166136261u;
+	for(const char* p = str ; *p ; p++)
+	{
+		hash ^= (uint8_t)(*p);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+ProfilerServer::ProfilerServer()
+{
+	m_listen_socket = INVALID_SOCKET_VALUE;
+	m_client_socket = INVALID_SOCKET_VALUE;
+	m_shut = true;
+	m_client_connected = false;
+	m_client_generation = 0;
+	m_known_generation = 0;
+	m_read_packet = 0;
+	m_write_packet = 0;
+	m_nb_queued_packets = 0;
+	m_nb_dropped_frames = 0;
+	m_in_frame = false;
+	m_command_size = 0;
+	m_recording_request = -1;
+	m_nb_names = 0;
+}
+
+//-----------------------------------------------------------------------------
+/// Listen on the given port on the loopback interface and launch the server thread
+bool ProfilerServer::start(unsigned short port)
+{
+	if(!socketInit())
+	{
+		fprintf(stderr, "*** ProfilerServer: FAILED initializing the sockets\n");
+		return false;
+	}
+
+	m_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(m_listen_socket == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "*** ProfilerServer: FAILED creating the socket\n");
+		socketShut();
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(m_listen_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	struct sockaddr_in	addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if(bind(m_listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	   listen(m_listen_socket, 1) != 0)
+	{
+		fprintf(stderr, "*** ProfilerServer: FAILED listening on port %d\n", (int)port);
+		socketClose(m_listen_socket);
+		m_listen_socket = INVALID_SOCKET_VALUE;
+		socketShut();
+		return false;
+	}
+
+	mutexCreate(&m_mutex);
+	eventCreate(&m_packet_event);
+
+	m_shut = false;
+	ThreadOptions	options;
+	options.name = "Profiler server";
+	m_thread_handle = threadCreate(&runWrapper, this, options);
+
+	printf("Profiler server listening on port %d\n", (int)port);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::stop()
+{
+	if(m_shut)
+		return;
+
+	atomicStoreRelaxed(&m_shut, true);
+	eventTrigger(&m_packet_event);	// wake up the server thread if it waits for a packet
+
+	// Wake it up if it is blocked in send(), when the client stopped reading
+	mutexLock(&m_mutex);
+	if(m_client_socket != INVALID_SOCKET_VALUE)
+		socketShutdown(m_client_socket);
+	mutexUnlock(&m_mutex);
+
+	threadJoin(m_thread_handle);
+
+	closeClient();
+	socketClose(m_listen_socket);
+	m_listen_socket = INVALID_SOCKET_VALUE;
+
+	eventDestroy(&m_packet_event);
+	mutexDestroy(&m_mutex);
+
+	socketShut();
+}
+
+//-----------------------------------------------------------------------------
+/// Start writing the packet for a frame. Returns false if the frame is dropped.
+bool ProfilerServer::beginFrame(int frame, uint64_t start, uint64_t end)
+{
+	if(!atomicLoadAcquire(&m_client_connected))
+		return false;
+
+	// Backpressure: all packets are waiting to be sent, the client is too slow
+	mutexLock(&m_mutex);
+	bool full = (m_nb_queued_packets == NB_PACKETS);
+	mutexUnlock(&m_mutex);
+
+	if(full)
+	{
+		m_nb_dropped_frames++;
+		return false;
+	}
+
+	// New client: it knows nothing yet
+	int generation = atomicLoadRelaxed(&m_client_generation);	// ordered by the acquire of m_client_connected
+	if(generation != m_known_generation)
+	{
+		m_known_generation = generation;
+		resetKnownNames();
+		for(size_t i=0 ; i < NB_MAX_LINES ; i++)
+			m_known_lines[i] = false;
+		m_nb_dropped_frames = 0;
+	}
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	packet.clear();
+	m_packet_generations[m_write_packet] = generation;
+
+	writeU32(packet, 0);	// size, filled in endFrame()
+
+	writeU8(packet, RECORD_FRAME);
+	writeU32(packet, (uint32_t)frame);
+	writeU32(packet, (uint32_t)m_nb_dropped_frames);
+	writeU64(packet, start);
+	writeU32(packet, (uint32_t)(end - start));
+
+	m_nb_dropped_frames = 0;
+	m_in_frame = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Announce a line if the client does not know it yet
+void ProfilerServer::addThread(size_t line, const char* name)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES || m_known_lines[line])
+		return;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_THREAD);
+	writeU8(packet, (uint32_t)line);
+	writeString(packet, name, 255);
+
+	m_known_lines[line] = true;
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addMarker(size_t line, size_t layer, const char* name, const Color& color,
+							   uint64_t frame_start, uint64_t start, uint64_t end)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	size_t	name_id = getNameId(name);	// may write a RECORD_NAME
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_MARKER);
+	writeU8(packet, (uint32_t)line);
+	writeU8(packet, (uint32_t)(layer < 255 ? layer : 255));
+	writeU16(packet, (uint32_t)name_id);
+	writeU8(packet, color.r);
+	writeU8(packet, color.g);
+	writeU8(packet, color.b);
+	writeU32(packet, (uint32_t)(int32_t)(int64_t)(start - frame_start));
+	writeU32(packet, (uint32_t)(end - start));
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addAllocations(size_t line, uint32_t nb_calls, uint64_t bytes)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_ALLOCATIONS);
+	writeU8(packet, (uint32_t)line);
+	writeU32(packet, nb_calls);
+	writeU64(packet, bytes);
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addPerfCounters(size_t line, const uint64_t* values, size_t nb_values)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_PERF_COUNTERS);
+	writeU8(packet, (uint32_t)line);
+	writeU8(packet, (uint32_t)nb_values);
+	for(size_t i=0 ; i < nb_values ; i++)
+		writeU64(packet, values[i]);
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addCounter(size_t line, const char* name, uint64_t frame_start, uint64_t time, double value)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	size_t	name_id = getNameId(name);	// may write a RECORD_NAME
+
+	uint64_t	value_bits;
+	memcpy(&value_bits, &value, sizeof(value_bits));
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_COUNTER);
+	writeU8(packet, (uint32_t)line);
+	writeU16(packet, (uint32_t)name_id);
+	writeU32(packet, (uint32_t)(int32_t)(int64_t)(time - frame_start));
+	writeU64(packet, value_bits);
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addFlowPoint(size_t line, bool begin, uint32_t id, uint64_t frame_start, uint64_t time)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_FLOW);
+	writeU8(packet, (uint32_t)line);
+	writeU8(packet, begin ? 1 : 0);
+	writeU32(packet, id);
+	writeU32(packet, (uint32_t)(int32_t)(int64_t)(time - frame_start));
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::addCriticalStep(size_t line, const char* name, uint64_t frame_start, uint64_t start, uint64_t end)
+{
+	if(!m_in_frame || line >= NB_MAX_LINES)
+		return;
+
+	size_t	name_id = getNameId(name);	// may write a RECORD_NAME
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_CRITICAL_STEP);
+	writeU8(packet, (uint32_t)line);
+	writeU16(packet, (uint32_t)name_id);
+	writeU32(packet, (uint32_t)(int32_t)(int64_t)(start - frame_start));
+	writeU32(packet, (uint32_t)(end - start));
+}
+
+//-----------------------------------------------------------------------------
+/// Queue the packet for the server thread
+void ProfilerServer::endFrame()
+{
+	if(!m_in_frame)
+		return;
+	m_in_frame = false;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	uint32_t	size = (uint32_t)(packet.size() - 4);
+	packet[0] = (uint8_t)(size);
+	packet[1] = (uint8_t)(size >> 8);
+	packet[2] = (uint8_t)(size >> 16);
+	packet[3] = (uint8_t)(size >> 24);
+
+	m_write_packet = (m_write_packet + 1) % NB_PACKETS;
+
+	mutexLock(&m_mutex);
+	m_nb_queued_packets++;
+	mutexUnlock(&m_mutex);
+
+	eventTrigger(&m_packet_event);
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::resetKnownNames()
+{
+	for(size_t i=0 ; i < NB_MAX_NAMES ; i++)
+		m_names[i].used = false;
+	m_nb_names = 0;
+}
+
+//-----------------------------------------------------------------------------
+/// Get the id of a name, and send it to the client the first time it is seen
+size_t ProfilerServer::getNameId(const char* name)
+{
+	uint32_t	hash = hashString(name);
+
+	// Keep the table sparse: when it is too full, forget everything and redefine the names
+	if(m_nb_names >= NB_MAX_NAMES*3/4)
+		resetKnownNames();
+
+	size_t index = hash % NB_MAX_NAMES;
+	while(m_names[index].used)
+	{
+		if(m_names[index].hash == hash && strncmp(m_names[index].str, name, NAME_MAX_LENGTH) == 0)
+			return index;
+		index = (index + 1) % NB_MAX_NAMES;
+	}
+
+	Name&	new_name = m_names[index];
+	strncpy(new_name.str, name, NAME_MAX_LENGTH);
+	new_name.str[NAME_MAX_LENGTH-1] = '\0';
+	new_name.hash = hash;
+	new_name.used = true;
+	m_nb_names++;
+
+	std::vector<uint8_t>&	packet = m_packets[m_write_packet];
+	writeU8(packet, RECORD_NAME);
+	writeU16(packet, (uint32_t)index);
+	writeString(packet, new_name.str, NAME_MAX_LENGTH);
+
+	return index;
+}
+
+//-----------------------------------------------------------------------------
+/// Server thread: wait for a client, then send the queued packets until it disconnects
+void ProfilerServer::run()
+{
+	while(!atomicLoadRelaxed(&m_shut))
+	{
+		if(!m_client_connected)
+		{
+			acceptClient();
+			continue;
+		}
+
+		eventWait(&m_packet_event);
+
+		mutexLock(&m_mutex);
+		bool empty = (m_nb_queued_packets == 0);
+		if(empty)
+			eventReset(&m_packet_event);
+		mutexUnlock(&m_mutex);
+
+		// The main thread does not touch a queued packet
+		bool ok = true;
+		if(!empty)
+		{
+			if(m_packet_generations[m_read_packet] == m_client_generation)
+				ok = sendPacket(m_packets[m_read_packet]);
+
+			m_read_packet = (m_read_packet + 1) % NB_PACKETS;
+			mutexLock(&m_mutex);
+			m_nb_queued_packets--;
+			mutexUnlock(&m_mutex);
+		}
+
+		// The commands are polled at each wake-up: at least once per frame, see pollCommands()
+		if(ok)
+			ok = receiveCommands();
+
+		if(!ok)
+			closeClient();
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool ProfilerServer::acceptClient()
+{
+	fd_set	read_set;
+	FD_ZERO(&read_set);
+	FD_SET(m_listen_socket, &read_set);
+
+	struct timeval	timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = ACCEPT_TIMEOUT_MS * 1000;
+
+	if(select((int)m_listen_socket + 1, &read_set, NULL, NULL, &timeout) <= 0)
+		return false;
+
+	struct sockaddr_in	addr;
+	socklen_t			addr_len = sizeof(addr);
+	Socket	client = accept(m_listen_socket, (struct sockaddr*)&addr, &addr_len);
+	if(client == INVALID_SOCKET_VALUE)
+		return false;
+
+	int no_delay = 1;
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+#ifdef SO_NOSIGPIPE
+	int no_sigpipe = 1;
+	setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&no_sigpipe, sizeof(no_sigpipe));
+#endif
+#ifndef WIN32
+	// send() returns when the client stops reading for a while, to check whether the server must stop
+	struct timeval	send_timeout;
+	send_timeout.tv_sec = 0;
+	send_timeout.tv_usec = ACCEPT_TIMEOUT_MS * 1000;
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&send_timeout, sizeof(send_timeout));
+#endif
+
+	// stop() may shut the socket down from the main thread
+	mutexLock(&m_mutex);
+	m_client_socket = client;
+	mutexUnlock(&m_mutex);
+	m_command_size = 0;
+	atomicStoreRelaxed(&m_client_generation, m_client_generation+1);
+	atomicStoreRelease(&m_client_connected, true);
+
+	printf("Profiler server: client connected\n");
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void ProfilerServer::closeClient()
+{
+	if(m_client_socket == INVALID_SOCKET_VALUE)
+		return;
+
+	atomicStoreRelaxed(&m_client_connected, false);
+	mutexLock(&m_mutex);
+	socketClose(m_client_socket);
+	m_client_socket = INVALID_SOCKET_VALUE;
+	mutexUnlock(&m_mutex);
+
+	printf("Profiler server: client disconnected\n");
+}
+
+//-----------------------------------------------------------------------------
+bool ProfilerServer::sendPacket(const std::vector<uint8_t>& packet)
+{
+	const char*	data = (const char*)&packet[0];
+	size_t		size = packet.size();
+
+	while(size > 0)
+	{
+		int nb_sent = (int)send(m_client_socket, data, (int)size, SEND_FLAGS);
+		if(nb_sent < 0 && socketSendTimedOut() && !atomicLoadRelaxed(&m_shut))
+			continue;	// the client does not read: wait for it until the server stops
+		if(nb_sent <= 0)
+			return false;
+		data += nb_sent;
+		size -= (size_t)nb_sent;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+/// Read the commands the client sent without blocking. Returns false if the client went away or sent garbage.
+bool ProfilerServer::receiveCommands()
+{
+	while(true)
+	{
+		fd_set	read_set;
+		FD_ZERO(&read_set);
+		FD_SET(m_client_socket, &read_set);
+
+		struct timeval	timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+
+		if(select((int)m_client_socket + 1, &read_set, NULL, NULL, &timeout) <= 0)
+			return true;
+
+		// One byte at a time: the commands are rare and tiny
+		uint8_t	byte;
+		if(recv(m_client_socket, (char*)&byte, 1, 0) != 1)
+			return false;
+		m_command[m_command_size++] = byte;
+
+		switch(m_command[0])
+		{
+		case COMMAND_SET_RECORDING:
+			if(m_command_size == 2)
+			{
+				atomicStoreRelaxed(&m_recording_request, m_command[1] ? 1 : 0);
+				m_command_size = 0;
+			}
+			break;
+
+		default:
+			fprintf(stderr, "*** ProfilerServer: unknown command %u\n", (unsigned)m_command[0]);
+			return false;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Wake the server thread up even if no packet is queued: the frames may be dropped, or the recording stopped
+void ProfilerServer::pollCommands()
+{
+	if(atomicLoadAcquire(&m_client_connected))
+		eventTrigger(&m_packet_event);
+}
+
+//-----------------------------------------------------------------------------
+bool ProfilerServer::popRecordingRequest(bool* recording)
+{
+	int request = atomicExchange(&m_recording_request, -1);
+	if(request < 0)
+		return false;
+	*recording = (request != 0);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void* ProfilerServer::runWrapper(void* user_data)
+{
+	ProfilerServer*	server = (ProfilerServer*)user_data;
+	server->run();
+	return NULL;
+}
@@ -0,0 +1,110 @@
+// profiler_server.h
+// Streams the profiled frames to a remote viewer over TCP (see profiler_protocol.h).
+// The main thread serializes the frames into a small queue of packets, a server thread sends them.
+
+#ifndef PROFILER_SERVER_H
+#define PROFILER_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "atomic.h"
+#include "profiler_protocol.h"
+#include "thread.h"
+#include "utils.h"
+
+#ifdef WIN32
+	typedef	uintptr_t	Socket;	// SOCKET, without including winsock2.h after windows.h
+#else
+	typedef	int		Socket;
+#endif
+
+class ProfilerServer
+{
+private:
+	static const size_t	NB_PACKETS = 4;		// Frames waiting to be sent: above that, frames are dropped
+	static const size_t	NB_MAX_NAMES = 4096;
+	static const size_t	NB_MAX_LINES = 256;
+
+	// --- Network ---
+	Socket			m_listen_socket;
+	Socket			m_client_socket;		// Written by the server thread under m_mutex, shut down by stop()
+	ThreadHandle	m_thread_handle;
+	bool			m_shut;					// Written by the main thread, polled by the server thread
+	bool			m_client_connected;		// Written by the server thread, released after m_client_generation
+	int				m_client_generation;	// Incremented for each new client, which knows no names and threads yet
+
+	// --- Packet queue, written by the main thread, read by the server thread ---
+	std::vector<uint8_t>	m_packets[NB_PACKETS];
+	int						m_packet_generations[NB_PACKETS];	// Packets built for a previous client are not sent
+	size_t					m_read_packet;
+	size_t					m_write_packet;
+	size_t					m_nb_queued_packets;
+	Mutex					m_mutex;
+	Event					m_packet_event;
+
+	size_t			m_nb_dropped_frames;
+	bool			m_in_frame;
+
+	// --- Commands of the client, parsed by the server thread ---
+	uint8_t			m_command[PROFILER_COMMAND_MAX_SIZE];	// Received so far, the commands may be split across recv() calls
+	size_t			m_command_size;
+	int				m_recording_request;	// -1: none, 0 or 1: the client asked to stop or resume the recording
+
+	// --- Names and threads already known by the client, only used by the main thread ---
+	static const size_t	NAME_MAX_LENGTH = 32;
+
+	struct Name
+	{
+		char		str[NAME_MAX_LENGTH];
+		uint32_t	hash;
+		bool		used;
+	};
+	Name			m_names[NB_MAX_NAMES];	// Open addressing hash table, the index is the name id
+	size_t			m_nb_names;
+
+	bool			m_known_lines[NB_MAX_LINES];
+	int				m_known_generation;
+
+public:
+	ProfilerServer();
+
+	bool	start(unsigned short port);
+	void	stop();
+
+	bool	isClientConnected() const	{return atomicLoadAcquire(&m_client_connected);}
+	size_t	getNbDroppedFrames() const	{return m_nb_dropped_frames;}
+
+	// Main thread, once per frame: have the server thread read the commands of the client
+	void	pollCommands();
+
+	// Main thread: the last recording state asked by the client since the previous call, if any
+	bool	popRecordingRequest(bool* recording);
+
+	// Packet building, main thread only. When beginFrame() returns false, the frame is dropped
+	// and nothing else must be called for it.
+	bool	beginFrame(int frame, uint64_t start, uint64_t end);
+	void	addThread(size_t line, const char* name);
+	void	addMarker(size_t line, size_t layer, const char* name, const Color& color,
+					  uint64_t frame_start, uint64_t start, uint64_t end);
+	void	addAllocations(size_t line, uint32_t nb_calls, uint64_t bytes);	// Of the previous marker of the line
+	void	addPerfCounters(size_t line, const uint64_t* values, size_t nb_values);	// Same
+	void	addCounter(size_t line, const char* name, uint64_t frame_start, uint64_t time, double value);
+	void	addFlowPoint(size_t line, bool begin, uint32_t id, uint64_t frame_start, uint64_t time);
+	void	addCriticalStep(size_t line, const char* name, uint64_t frame_start, uint64_t start, uint64_t end);
+	void	endFrame();
+
+private:
+	void	resetKnownNames();
+	size_t	getNameId(const char* name);
+
+	void	run();
+	bool	acceptClient();
+	void	closeClient();
+	bool	sendPacket(const std::vector<uint8_t>& packet);
+	bool	receiveCommands();
+
+	static void*	runWrapper(void* user_data);
+};
+
+#endif // PROFILER_SERVER_H
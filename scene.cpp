@@ -5,6 +5,7 @@
 #include "profiler.h"
 
 #include "scene.h"
+#include "grid_simd.h"
 #include "math_utils.h"
 
 //#define _DEBUG_PRINTF
@@ -15,110 +16,168 @@
 	#define DbgPrintf(...)
 #endif
 
-bool Scene::init()
+Scene::Scene()
 {
+	m_nb_grids_x = 0;
+	m_nb_grids_y = 0;
+	m_nb_grids = 0;
+	m_grids = NULL;
+	m_grid_heights = NULL;
+	m_grid_instances = NULL;
+	m_grid_job_data = NULL;
+	m_nb_grid_batches = 0;
+	m_grid_update_tile_rows = GRID_UPDATE_TILE_ROWS;
 	m_multithread = false;
-	m_shut = false;
-	m_elapsed_time = 0.0;
-	m_update_time = 0.0;
+	m_gpu_heights = false;
+	m_instanced = true;
+	m_t = 0.0;
+}
+
+bool Scene::init(int nb_grids_x, int nb_grids_y)
+{
+	if(nb_grids_x < 1 || nb_grids_x > NB_MAX_GRIDS_X || nb_grids_y < 1 || nb_grids_y > NB_MAX_GRIDS_Y)
+	{
+		fprintf(stderr, "*** Scene::init: %dx%d grids, the maximum is %dx%d\n", nb_grids_x, nb_grids_y,
+				NB_MAX_GRIDS_X, NB_MAX_GRIDS_Y);
+		return false;
+	}
+
+	m_nb_grids_x = nb_grids_x;
+	m_nb_grids_y = nb_grids_y;
+	m_nb_grids = nb_grids_x * nb_grids_y;
 
 	m_colors[0] = COLOR_DARK_RED;
 	m_colors[1] = COLOR_DARK_GREEN;
 	m_colors[2] = COLOR_DARK_BLUE;
 	m_colors[3] = COLOR_GRAY;
 
-	bool ok = true;
+	if(!m_grid_mesh.init(Grid::GRID_WIDTH, Grid::GRID_HEIGHT, Grid::GRID_WORLD_SIZE, m_nb_grids))
+		return false;
 
-	// Launch the threads
-	for(int i=0 ; i < NB_THREADS ; i++)
-	{
-		m_thread_data[i].p_scene = this;
-		ok = ok && m_thread_data[i].grid.init((float)i, m_colors[i]);
-		if(!ok)
-			return false;
-
-		eventCreate(&m_thread_data[i].update_event);
-		eventCreate(&m_thread_data[i].main_event);
-		m_thread_data[i].index = i;
-		m_thread_data[i].thread_handle = threadCreate(&threadUpdateWrapper, &m_thread_data[i]);
-	}
+	size_t nb_vertices = (size_t)Grid::GRID_WIDTH * (size_t)Grid::GRID_HEIGHT;
+	m_grids = new Grid[m_nb_grids];
+	m_grid_heights = new float[nb_vertices * m_nb_grids];
+	m_grid_instances = new GridMesh::Instance[m_nb_grids];
 
-	return ok;
-}
+	const float start_x = -6.0f * float(m_nb_grids_x-1);
+	const float start_y = -6.0f;
+	const float step_x = 12.0f;
+	const float step_y = -12.0f;
 
-void Scene::shut()
-{
-	DbgPrintf("[main] shut\n");
-	m_shut = true;
-	for(int i=0 ; i < NB_THREADS ; i++)
+	for(int i=0 ; i < m_nb_grids ; i++)
 	{
-		DbgPrintf("[main] trigger update %d\n", i);
-		eventTrigger(&m_thread_data[i].update_event);
+		const Color& color = m_colors[i % NB_COLORS];
+		m_grids[i].init((float)i, color, m_grid_heights + nb_vertices*i);
+
+		int x = i % m_nb_grids_x;
+		int y = i / m_nb_grids_x;
+		GridMesh::Instance& instance = m_grid_instances[i];
+		instance.offset_xz[0] = start_x + float(x)*step_x;
+		instance.offset_xz[1] = start_y + float(y)*step_y;
+		instance.phases[0] = 0.0f;
+		instance.phases[1] = 0.0f;
+		instance.color[0] = float(color.r) / 255.0f;
+		instance.color[1] = float(color.g) / 255.0f;
+		instance.color[2] = float(color.b) / 255.0f;
+	}
 
-		DbgPrintf("[main] join %d\n", i);
+	// Batches of grids, each one split into at most NB_MAX_UPDATE_JOBS/m_nb_grid_batches tiles of rows
+	int nb_grids_per_batch = (m_nb_grids + NB_MAX_UPDATE_JOBS-1) / NB_MAX_UPDATE_JOBS;
+	m_nb_grid_batches = (m_nb_grids + nb_grids_per_batch-1) / nb_grids_per_batch;
+	m_grid_job_data = new GridJobData[m_nb_grid_batches];
 
-		threadJoin(m_thread_data[i].thread_handle);
+	int nb_batch_rows = nb_grids_per_batch * Grid::GRID_HEIGHT;
+	int nb_jobs_per_batch = NB_MAX_UPDATE_JOBS / m_nb_grid_batches;
+	m_grid_update_tile_rows = (nb_batch_rows + nb_jobs_per_batch-1) / nb_jobs_per_batch;
+	if(m_grid_update_tile_rows < GRID_UPDATE_TILE_ROWS)
+		m_grid_update_tile_rows = GRID_UPDATE_TILE_ROWS;
 
-		DbgPrintf("[main] destroy update event %d\n", i);
-		eventDestroy(&m_thread_data[i].update_event);
+	for(int b=0 ; b < m_nb_grid_batches ; b++)
+	{
+		GridJobData& data = m_grid_job_data[b];
+		int first_grid = b * nb_grids_per_batch;
+		data.p_grids = &m_grids[first_grid];
+		data.nb_grids = (m_nb_grids - first_grid < nb_grids_per_batch ? m_nb_grids - first_grid : nb_grids_per_batch);
+		data.t = 0.0;
+		if(data.nb_grids == 1)
+			snprintf(data.name, sizeof(data.name), "Update grid %d", first_grid);
+		else
+			snprintf(data.name, sizeof(data.name), "Update grids %d-%d", first_grid, first_grid + data.nb_grids-1);
+	}
 
-		DbgPrintf("[main] destroy main event %d\n", i);
-		eventDestroy(&m_thread_data[i].main_event);
+	// One worker per core, the main thread included
+	m_job_system.init(threadGetNbCores());
+	DbgPrintf("[main] %d workers\n", m_job_system.getNbWorkers());
 
-		m_thread_data[i].grid.shut();
-	}
+	return true;
+}
+
+void Scene::shut()
+{
+	DbgPrintf("[main] shut\n");
+	m_job_system.shut();
+
+	m_grid_mesh.shut();
+
+	delete [] m_grid_job_data;
+	delete [] m_grid_instances;
+	delete [] m_grid_heights;
+	delete [] m_grids;
+	m_grid_job_data = NULL;
+	m_grid_instances = NULL;
+	m_grid_heights = NULL;
+	m_grids = NULL;
 }
 
 void Scene::update(double elapsed, double t)
 {
-	if(m_multithread)
+	m_t = t;
+
+	if(m_gpu_heights)
 	{
-		// Trigger update on multiple threads and wait for completion
+		// Nothing to compute: the vertex shader only needs the time
+	}
+	else if(m_multithread)
+	{
+		// Split the batches of grids into tiles of rows, the workers steal them from each other
 		PROFILER_PUSH_CPU_MARKER("Multithread update", COLOR_CYAN);
 
-		DbgPrintf("--- [main] begin update ---\n");
-		m_elapsed_time = elapsed;
-		m_update_time = t;
-		for(int i=0 ; i < NB_THREADS ; i++)
+		JobCounter	counter;
+		for(int b=0 ; b < m_nb_grid_batches ; b++)
 		{
-			DbgPrintf("[main] trigger update event %d\n", i);
-			eventTrigger(&m_thread_data[i].update_event);
+			GridJobData& data = m_grid_job_data[b];
+			data.t = t;
+			m_job_system.submit(data.name, data.p_grids[0].getColor(), (size_t)(data.nb_grids * Grid::GRID_HEIGHT),
+								(size_t)m_grid_update_tile_rows, &updateGridRowsJob, &data, counter);
 		}
 
 		PROFILER_POP_CPU_MARKER();
 
+		// The main thread runs jobs too while it waits
 		PROFILER_PUSH_CPU_MARKER("Wait for update", COLOR_YELLOW);
-		DbgPrintf("[main] wait and reset all main events...\n");
-		for(int i=0 ; i < NB_THREADS ; i++)
-		{
-			DbgPrintf("[main] wait for main event %d\n", i);
-			eventWait(&m_thread_data[i].main_event);
-
-			DbgPrintf("[main] reset main event %d\n", i);
-			eventReset(&m_thread_data[i].main_event);
-		}
-
-		DbgPrintf("--- [main] end update ---\n");
+		m_job_system.wait(counter);
 		PROFILER_POP_CPU_MARKER();
 	}
 	else
 	{
 		// Sequential update
-		for(int i=0 ; i < NB_THREADS ; i++)
+		for(int i=0 ; i < m_nb_grids ; i++)
 		{
-			char str_marker[32];
-			sprintf(str_marker, "Multithread update %d", i);
-			PROFILER_PUSH_CPU_MARKER(str_marker, m_colors[i]);
-			m_thread_data[i].grid.update(elapsed, t);
-			PROFILER_POP_CPU_MARKER();
+			char str_marker[32] = "Multithread update";
+			if(PROFILER_IS_ENABLED(PROFILER_CATEGORY_UPDATE, PROFILER_LEVEL_DETAILED))
+				snprintf(str_marker, sizeof(str_marker), "Multithread update %d", i);
+			PROFILER_CPU_MARKER(PROFILER_CATEGORY_UPDATE, PROFILER_LEVEL_DETAILED, str_marker, m_grids[i].getColor());
+			m_grids[i].update(elapsed, t);
 		}
 	}
 }
 
 void Scene::draw(int win_w, int win_h)
 {
-	// Select and setup the projection matrix
-	m_camera.setPerspective(65.0f, (float)win_w/(float)win_h, 1.0f, 100.0f);
+	// Select and setup the projection matrix: far enough to see the last row of grids
+	int nb_grids_max = (m_nb_grids_x > m_nb_grids_y ? m_nb_grids_x : m_nb_grids_y);
+	float far_plane = 100.0f + 12.0f * float(nb_grids_max - 2);
+	m_camera.setPerspective(65.0f, (float)win_w/(float)win_h, 1.0f, far_plane > 100.0f ? far_plane : 100.0f);
 
 	// Select and setup the modelview matrix
 	float eye[3]	= { 0.0f, 5.0f, 4.0f };
@@ -129,73 +188,72 @@ void Scene::draw(int win_w, int win_h)
 	float proj_view_matrix[16];
 	matrixMult(proj_view_matrix, m_camera.proj_matrix, m_camera.view_matrix);
 
-	const float start_x = -6.0f;
-	const float start_y = -6.0f;
-	const float step_x = 12.0f;
-	const float step_y = -12.0f;
-
-	float mvp_matrix[16];
-	float trans_matrix[16];
-	float trans_vec[3];
+	// Phases of the waves for the GPU mode, the same for all the grids but the time offset
+	GridWaveParams	wave;
+	for(int i=0 ; i < m_nb_grids ; i++)
+	{
+		m_grids[i].getWaveParams(m_t, wave);
+		m_grid_instances[i].phases[0] = wave.x_phase;
+		m_grid_instances[i].phases[1] = wave.y_phase;
+	}
 
-	for(int x=0 ; x < NB_GRIDS_X ; x++)
+	size_t nb_vertices = (size_t)Grid::GRID_WIDTH * (size_t)Grid::GRID_HEIGHT;
+	size_t nb_uploaded_bytes = 0;
+	if(m_instanced)
+	{
+		// All the grids with one draw call
+		PROFILER_PUSH_GPU_MARKER("[GPU] draw grids instanced", COLOR_DARK_GREEN);
+		nb_uploaded_bytes += m_grid_mesh.draw(proj_view_matrix, m_grid_instances, m_nb_grids,
+											  m_gpu_heights ? NULL : m_grid_heights, wave);
+		PROFILER_POP_GPU_MARKER();
+	}
+	else
 	{
-		for(int y=0 ; y < NB_GRIDS_Y ; y++)
+		// One draw call per grid, with its own state changes and upload
+		bool marker_per_grid = (m_nb_grids <= NB_MAX_GRID_GPU_MARKERS);
+		if(!marker_per_grid)
 		{
-			Color debug_color = COLOR_DARK_RED;
-			if(x == 0 && y == 1)
-				debug_color = COLOR_DARK_GREEN;
-			else if(x == 1 && y == 0)
-				debug_color = COLOR_DARK_BLUE;
-			else if(x == 1 && y == 1)
-				debug_color = COLOR_GRAY;
-
-			trans_vec[0] = start_x + float(x)*step_x;
-			trans_vec[1] = 0;
-			trans_vec[2] = start_y + float(y)*step_y;
-			matrixTranslate(trans_matrix, trans_vec);
-			matrixMult(mvp_matrix, proj_view_matrix, trans_matrix);
-
-			Grid&	grid = m_thread_data[x + y*NB_GRIDS_X].grid;
-			char	str_marker[32];
-			sprintf(str_marker, "[GPU] draw grid %d,%d", x, y);
-
-			Color	color = grid.getColor();
-
-			PROFILER_PUSH_GPU_MARKER(str_marker, color);
-			grid.draw(mvp_matrix);
-			PROFILER_POP_GPU_MARKER();
+			PROFILER_PUSH_GPU_MARKER("[GPU] draw grids one by one", COLOR_DARK_GREEN);
+		}
+
+		for(int i=0 ; i < m_nb_grids ; i++)
+		{
+			if(marker_per_grid)
+			{
+				char	str_marker[40];
+				snprintf(str_marker, sizeof(str_marker), "[GPU] draw grid %d,%d", i % m_nb_grids_x, i / m_nb_grids_x);
+				PROFILER_PUSH_GPU_MARKER(str_marker, m_grids[i].getColor());
+			}
+
+			nb_uploaded_bytes += m_grid_mesh.draw(proj_view_matrix, &m_grid_instances[i], 1,
+												  m_gpu_heights ? NULL : m_grid_heights + nb_vertices*i, wave);
+
+			if(marker_per_grid)
+			{
+				PROFILER_POP_GPU_MARKER();
+			}
 		}
 
+		if(!marker_per_grid)
+		{
+			PROFILER_POP_GPU_MARKER();
+		}
 	}
+
+	PROFILER_COUNTER("Grid upload (bytes)", nb_uploaded_bytes);
 }
 
-void Scene::threadUpdate(ThreadData *data)
+void Scene::updateGridRowsJob(void* user_data, size_t begin, size_t end)
 {
-	while(!m_shut)
+	// The rows of the batch are the rows of its grids, one grid after the other
+	GridJobData* data = (GridJobData*)user_data;
+	int row = (int)begin;
+	while(row < (int)end)
 	{
-		DbgPrintf("(%d) wait update event %d\n", data->index, data->index);
-		eventWait(&data->update_event);
-
-		DbgPrintf("(%d) reset update event %d\n", data->index, data->index);
-		eventReset(&data->update_event);
-
-		PROFILER_PUSH_CPU_MARKER("Thread update", data->grid.getColor());
-
-		DbgPrintf("(%d) update\n", data->index);
-		data->grid.update(m_elapsed_time, m_update_time);
-
-		PROFILER_POP_CPU_MARKER();
-
-		DbgPrintf("(%d) trigger main event %d\n", data->index, data->index);
-		eventTrigger(&data->main_event);
+		int grid = row / Grid::GRID_HEIGHT;
+		int grid_first_row = grid * Grid::GRID_HEIGHT;
+		int grid_end_row = ((int)end < grid_first_row + Grid::GRID_HEIGHT ? (int)end : grid_first_row + Grid::GRID_HEIGHT);
+		data->p_grids[grid].updateRows(data->t, row - grid_first_row, grid_end_row - grid_first_row);
+		row = grid_end_row;
 	}
-	DbgPrintf("(%d): done\n", data->index);
-}
-
-void* Scene::threadUpdateWrapper(void* user_data)
-{
-	ThreadData* data = (ThreadData*)user_data;
-	data->p_scene->threadUpdate(data);
-	return NULL;
 }
@@ -5,50 +5,79 @@
 
 #include "camera.h"
 #include "grid.h"
-#include "thread.h"
+#include "grid_mesh.h"
+#include "job_system.h"
 #include "utils.h"
 
 class Scene
 {
+public:
+	static const int	NB_MAX_GRIDS_X = 16;
+	static const int	NB_MAX_GRIDS_Y = 16;
 private:
-	static const int	NB_GRIDS_X = 2;
-	static const int	NB_GRIDS_Y = 2;
-	static const int	NB_THREADS = NB_GRIDS_X * NB_GRIDS_Y;
-	
+	static const int	NB_COLORS = 4;
+	static const int	NB_MAX_GRID_GPU_MARKERS = 4;	// One GPU marker per grid up to this, the profiler has few of them
+	static const int	GRID_UPDATE_TILE_ROWS = 20;	// 20 rows of 300 vertices: 24 KB of heights, fits in a L1/L2 cache
+	static const int	NB_MAX_UPDATE_JOBS = 64;	// Per frame: each job is a marker and a flow, which the profiler keeps
+													// up to 100 and 128 per thread and per frame
+
 	Camera	m_camera;
 
-	// Multithread update
-	struct	ThreadData
+	int				m_nb_grids_x;
+	int				m_nb_grids_y;
+	int				m_nb_grids;
+
+	Color			m_colors[NB_COLORS];
+	Grid*			m_grids;
+	float*			m_grid_heights;		// The heights of all the grids, one grid after the other
+	GridMesh		m_grid_mesh;
+	GridMesh::Instance*	m_grid_instances;
+
+	// Multithread update: the grids are split into batches of consecutive grids, and the batches into tiles of rows,
+	// updated by the job system. Many grids make larger tiles, up to whole batches, to keep NB_MAX_UPDATE_JOBS jobs.
+	struct	GridJobData
 	{
-		Scene*			p_scene;
-		Grid			grid;
-		ThreadHandle	thread_handle;
-		Event			update_event;
-		Event			main_event;
-		int				index;
+		Grid*	p_grids;	// First grid of the batch
+		int		nb_grids;
+		double	t;
+		char	name[32];	// Marker of the jobs
 	};
 
-	Color			m_colors[NB_THREADS];
-
 	bool			m_multithread;
-	ThreadData		m_thread_data[NB_THREADS];
-	volatile bool	m_shut;
-	volatile double	m_elapsed_time;
-	volatile double	m_update_time;
+	bool			m_gpu_heights;	// The grids compute their heights in the vertex shader
+	bool			m_instanced;	// One draw call for all the grids
+	double			m_t;			// Time of the last update
+	JobSystem		m_job_system;
+	GridJobData*	m_grid_job_data;	// One per batch
+	int				m_nb_grid_batches;
+	int				m_grid_update_tile_rows;
 
 public:
-	bool	init();
+	Scene();
+
+	// nb_grids_x*nb_grids_y grids, up to NB_MAX_GRIDS_X*NB_MAX_GRIDS_Y
+	bool	init(int nb_grids_x=2, int nb_grids_y=2);
 	void	shut();
 	void	update(double elapsed, double t);
 	void	draw(int win_w, int win_h);
 
+	int		getNbGrids() const		{return m_nb_grids;}
+	int		getNbWorkers() const	{return m_job_system.getNbWorkers();}	// Threads that run the jobs, the calling thread of init() included
+
 	void	setMultithreaded(bool multithread) {m_multithread = multithread;}
 	bool	isMultithreaded() const	{return m_multithread;}
 
-private:
-	void	threadUpdate(ThreadData* data);
+	void	setGpuHeights(bool gpu_heights)	{m_gpu_heights = gpu_heights;}
+	bool	hasGpuHeights() const			{return m_gpu_heights;}
+
+	void	setInstanced(bool instanced)	{m_instanced = instanced;}
+	bool	isInstanced() const				{return m_instanced;}
 
-	static void* threadUpdateWrapper(void* user_data);
+	void			setIndexLayout(GridIndexLayout layout)	{m_grid_mesh.setIndexLayout(layout);}
+	GridIndexLayout	getIndexLayout() const					{return m_grid_mesh.getIndexLayout();}
+
+private:
+	static void	updateGridRowsJob(void* user_data, size_t begin, size_t end);
 };
 
 #endif // SCENE_H
@@ -0,0 +1,73 @@
+// spsc_queue.h
+// Wait-free single-producer single-consumer queue.
+// The producer only writes m_tail and the consumer only writes m_head: each side publishes its
+// index with a release store and reads the other side's index with an acquire load.
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include "atomic.h"
+
+template<class T, const size_t capacity>
+class SpscQueue
+{
+public:
+	static const size_t	CAPACITY = capacity;
+private:
+	static const size_t	CACHE_LINE_SIZE = 64;
+
+	typedef char	capacity_must_be_a_power_of_2[(CAPACITY & (CAPACITY-1)) == 0 ? 1 : -1];
+
+	// Consumer side
+	size_t			m_head;			// Next element to read
+	size_t			m_cached_tail;	// Last value of m_tail seen by the consumer
+	char			m_pad_consumer[CACHE_LINE_SIZE - 2*sizeof(size_t)];
+
+	// Producer side
+	size_t			m_tail;			// Next element to write
+	size_t			m_cached_head;	// Last value of m_head seen by the producer
+	char			m_pad_producer[CACHE_LINE_SIZE - 2*sizeof(size_t)];
+
+	T				m_elements[CAPACITY];
+
+public:
+	SpscQueue() : m_head(0), m_cached_tail(0), m_tail(0), m_cached_head(0)
+	{
+	}
+
+	// Producer: add an element if more than nb_reserved slots are free, which lets the producer
+	// keep room for elements that must not be dropped.
+	bool	push(const T& element, size_t nb_reserved=0)
+	{
+		size_t tail = atomicLoadRelaxed(&m_tail);
+		if(tail - m_cached_head + nb_reserved >= CAPACITY)
+		{
+			m_cached_head = atomicLoadAcquire(&m_head);
+			if(tail - m_cached_head + nb_reserved >= CAPACITY)
+				return false;
+		}
+
+		m_elements[tail & (CAPACITY-1)] = element;
+		atomicStoreRelease(&m_tail, tail+1);
+		return true;
+	}
+
+	// Consumer: get the oldest element, if any
+	bool	pop(T& element)
+	{
+		size_t head = atomicLoadRelaxed(&m_head);
+		if(head == m_cached_tail)
+		{
+			m_cached_tail = atomicLoadAcquire(&m_tail);
+			if(head == m_cached_tail)
+				return false;
+		}
+
+		element = m_elements[head & (CAPACITY-1)];
+		atomicStoreRelease(&m_head, head+1);
+		return true;
+	}
+};
+
+#endif // SPSC_QUEUE_H
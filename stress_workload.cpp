@@ -0,0 +1,316 @@
+// stress_workload.cpp
+
+#include "stress_workload.h"
+#include "atomic.h"
+#include "hp_timer.h"
+#include "profiler.h"
+#include "utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Colors of the markers, by level
+static const Color* const	level_colors[] = {&COLOR_RED, &COLOR_GREEN, &COLOR_BLUE, &COLOR_YELLOW, &COLOR_CYAN, &COLOR_MAGENTA};
+static const int			NB_LEVEL_COLORS = sizeof(level_colors) / sizeof(level_colors[0]);
+
+//-----------------------------------------------------------------------------
+// StressConfig
+//-----------------------------------------------------------------------------
+static bool parseInt(const char* key, const char* value, int min_value, int max_value, int* result)
+{
+	char	end;
+	int		i;
+	if(sscanf(value, "%d%c", &i, &end) != 1 || i < min_value || i > max_value)
+	{
+		fprintf(stderr, "*** --stress: %s must be between %d and %d (%s)\n", key, min_value, max_value, value);
+		return false;
+	}
+	*result = i;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool StressConfig::parse(const char* options)
+{
+	char	buffer[256];
+	strncpy(buffer, options, sizeof(buffer));
+	buffer[sizeof(buffer)-1] = '\0';
+
+	for(char* option = strtok(buffer, ",") ; option ; option = strtok(NULL, ","))
+	{
+		char	key[32];
+		char	value[32];
+		if(sscanf(option, "%31[^=]=%31s", key, value) != 2)
+		{
+			fprintf(stderr, "*** --stress: expected key=value (%s)\n", option);
+			return false;
+		}
+
+		int	i = 0;
+		bool ok = true;
+		if(strcmp(key, "threads") == 0)
+		{
+			ok = parseInt(key, value, 1, StressWorkload::NB_MAX_THREADS, &nb_threads);
+		}
+		else if(strcmp(key, "depth") == 0)
+		{
+			ok = parseInt(key, value, 1, StressWorkload::NB_MAX_DEPTH, &depth);
+		}
+		else if(strcmp(key, "fanout") == 0)
+		{
+			ok = parseInt(key, value, 1, StressWorkload::NB_MAX_FAN_OUT, &fan_out);
+		}
+		else if(strcmp(key, "leaf_ns") == 0)
+		{
+			ok = parseInt(key, value, 0, 100000000, &i);
+			leaf_ns = (uint32_t)i;
+		}
+		else if(strcmp(key, "rate") == 0)
+		{
+			ok = parseInt(key, value, 0, 100000000, &i);
+			rate = (uint32_t)i;
+		}
+		else if(strcmp(key, "gpu") == 0)
+		{
+			ok = parseInt(key, value, 0, StressWorkload::NB_MAX_GPU_MARKERS, &nb_gpu_markers);
+		}
+		else if(strcmp(key, "names") == 0)
+		{
+			ok = (strcmp(value, "static") == 0 || strcmp(value, "dynamic") == 0);
+			if(ok)
+				dynamic_names = (strcmp(value, "dynamic") == 0);
+			else
+				fprintf(stderr, "*** --stress: names must be static or dynamic (%s)\n", value);
+		}
+		else
+		{
+			fprintf(stderr, "*** --stress: unknown option %s\n", key);
+			ok = false;
+		}
+
+		if(!ok)
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// StressWorkload
+//-----------------------------------------------------------------------------
+StressWorkload::StressWorkload()
+{
+	m_workers = NULL;
+	m_stop = true;
+}
+
+//-----------------------------------------------------------------------------
+bool StressWorkload::init(const StressConfig& config)
+{
+	assert(m_workers == NULL && "already initialized");
+
+	if(	config.nb_threads < 1 || config.nb_threads > NB_MAX_THREADS ||
+		config.depth < 1 || config.depth > NB_MAX_DEPTH ||
+		config.fan_out < 1 || config.fan_out > NB_MAX_FAN_OUT ||
+		config.nb_gpu_markers < 0 || config.nb_gpu_markers > NB_MAX_GPU_MARKERS)
+	{
+		fprintf(stderr, "*** Invalid stress workload configuration\n");
+		return false;
+	}
+	m_config = config;
+
+	for(int i=0 ; i < NB_MAX_DEPTH ; i++)
+		sprintf(m_static_names[i], "Stress level %d", i);
+
+	m_stats_start_time = getTimeNs();
+	m_stats_nb_emitted = 0;
+	m_stats_nb_dropped = 0;
+#ifdef ENABLE_PROFILER
+	m_stats_nb_dropped = profiler.getNbDroppedCpuMarkers();
+#endif
+
+	m_stop = false;
+	m_workers = new Worker[config.nb_threads];
+	for(int i=0 ; i < config.nb_threads ; i++)
+	{
+		Worker&	worker = m_workers[i];
+		worker.p_workload = this;
+		worker.index = i;
+		worker.nb_emitted_markers = 0;
+		worker.nb_names = 0;
+
+		char	name[THREAD_NAME_MAX_LENGTH];
+		sprintf(name, "Stress %d", i);
+
+		ThreadOptions	options;
+		options.name = name;
+		worker.thread_handle = threadCreate(&runWrapper, &worker, options);
+	}
+
+	// Markers of one tree: 1 + fan_out + fan_out^2 + ...
+	double	nb_markers_per_tree = 0.0;
+	double	nb_nodes = 1.0;
+	for(int i=0 ; i < config.depth ; i++)
+	{
+		nb_markers_per_tree += nb_nodes;
+		nb_nodes *= config.fan_out;
+	}
+
+	printf("Stress workload: %d threads, trees of %.0f markers (depth %d, fan-out %d), %s names, leaves of %u ns, %d GPU markers\n",
+		   config.nb_threads, nb_markers_per_tree, config.depth, config.fan_out,
+		   config.dynamic_names ? "dynamic" : "static", config.leaf_ns, config.nb_gpu_markers);
+	if(config.rate)
+		printf("Stress workload: target of %u markers/s\n", config.rate);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void StressWorkload::shut()
+{
+	if(!m_workers)
+		return;
+
+	atomicStoreRelaxed(&m_stop, true);
+	for(int i=0 ; i < m_config.nb_threads ; i++)
+		threadJoin(m_workers[i].thread_handle);
+
+	delete [] m_workers;
+	m_workers = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/// Print the rates of emitted and dropped markers every second
+void StressWorkload::update()
+{
+	if(!m_workers)
+		return;
+
+	uint64_t now = getTimeNs();
+	uint64_t elapsed = now - m_stats_start_time;
+	if(elapsed < 1000000000)
+		return;
+
+	uint32_t	nb_emitted = getNbEmittedMarkers();
+	size_t		nb_dropped = 0;
+	size_t		nb_rejected_threads = 0;
+#ifdef ENABLE_PROFILER
+	nb_dropped = profiler.getNbDroppedCpuMarkers();
+	nb_rejected_threads = profiler.getNbRejectedThreads();
+#endif
+
+	// The rates are what the threads emitted: only the ones that are not dropped show in the profiler
+	double	seconds = double(elapsed) * 1e-9;
+	printf("Stress workload: %.0f markers/s, %.0f dropped/s, %lu dropped since the start",
+		   double(nb_emitted - m_stats_nb_emitted) / seconds,
+		   double(nb_dropped - m_stats_nb_dropped) / seconds,
+		   (unsigned long)nb_dropped);
+	if(nb_rejected_threads)
+		printf(", %d threads not recorded", (int)nb_rejected_threads);
+	printf("\n");
+
+	m_stats_start_time = now;
+	m_stats_nb_emitted = nb_emitted;
+	m_stats_nb_dropped = nb_dropped;
+}
+
+//-----------------------------------------------------------------------------
+/// Nested GPU markers following the shape of the CPU trees, up to nb_gpu_markers
+void StressWorkload::drawGpuMarkers()
+{
+	if(m_workers && m_config.nb_gpu_markers > 0)
+		emitGpuTree(0, m_config.nb_gpu_markers);
+}
+
+//-----------------------------------------------------------------------------
+/// Returns the number of markers emitted, at most nb_remaining
+int StressWorkload::emitGpuTree(int level, int nb_remaining)
+{
+	char	name[NAME_MAX_LENGTH] = "[GPU] stress";
+	if(PROFILER_IS_ENABLED(PROFILER_CATEGORY_STRESS, PROFILER_LEVEL_DETAILED))
+		sprintf(name, "[GPU] stress level %d", level);
+
+	PROFILER_GPU_MARKER(PROFILER_CATEGORY_STRESS, PROFILER_LEVEL_DETAILED, name, *level_colors[level % NB_LEVEL_COLORS]);
+	int nb_emitted = 1;
+	if(level+1 < m_config.depth)
+	{
+		for(int i=0 ; i < m_config.fan_out && nb_emitted < nb_remaining ; i++)
+			nb_emitted += emitGpuTree(level+1, nb_remaining-nb_emitted);
+	}
+	return nb_emitted;
+}
+
+//-----------------------------------------------------------------------------
+/// Markers emitted by all the threads, wraps around
+uint32_t StressWorkload::getNbEmittedMarkers() const
+{
+	uint32_t	nb_emitted = 0;
+	for(int i=0 ; i < m_config.nb_threads ; i++)
+		nb_emitted += atomicLoadRelaxed(&m_workers[i].nb_emitted_markers);
+	return nb_emitted;
+}
+
+//-----------------------------------------------------------------------------
+void StressWorkload::run(Worker& worker)
+{
+	// Pacing: the trees start when the markers already emitted are due
+	double	ns_per_marker = 0.0;
+	if(m_config.rate)
+		ns_per_marker = 1e9 * double(m_config.nb_threads) / double(m_config.rate);
+
+	uint64_t	start_time = getTimeNs();
+	uint32_t	nb_markers = 0;
+	while(!atomicLoadRelaxed(&m_stop))
+	{
+		if(m_config.rate)
+		{
+			uint64_t	due_time = start_time + (uint64_t)(double(nb_markers) * ns_per_marker);
+			while(getTimeNs() < due_time && !atomicLoadRelaxed(&m_stop))
+				threadYield();
+		}
+
+		emitTree(worker, 0, nb_markers);
+		atomicStoreRelaxed(&worker.nb_emitted_markers, nb_markers);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void StressWorkload::emitTree(Worker& worker, int level, uint32_t& nb_markers)
+{
+	// The profiler copies the name: a buffer on the stack is enough.
+	// It is only formatted when the marker is compiled in and its category is enabled.
+	const char*	name = m_static_names[level];
+	char		dynamic_name[NAME_MAX_LENGTH];
+	if(m_config.dynamic_names && PROFILER_IS_ENABLED(PROFILER_CATEGORY_STRESS, PROFILER_LEVEL_DETAILED))
+	{
+		sprintf(dynamic_name, "T%d L%d #%u", worker.index, level, worker.nb_names++);
+		name = dynamic_name;
+	}
+	(void)name;	// Unused when the profiler is disabled
+
+	PROFILER_CPU_MARKER(PROFILER_CATEGORY_STRESS, PROFILER_LEVEL_DETAILED, name, *level_colors[level % NB_LEVEL_COLORS]);
+	nb_markers++;
+
+	// A deep tree with a large fan-out takes forever: stop in the middle of it, and publish the count meanwhile
+	if(level+1 < m_config.depth)
+	{
+		for(int i=0 ; i < m_config.fan_out && !atomicLoadRelaxed(&m_stop) ; i++)
+		{
+			emitTree(worker, level+1, nb_markers);
+			atomicStoreRelaxed(&worker.nb_emitted_markers, nb_markers);
+		}
+	}
+	else if(m_config.leaf_ns)
+	{
+		uint64_t	end_time = getTimeNs() + m_config.leaf_ns;
+		while(getTimeNs() < end_time)
+			;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void* StressWorkload::runWrapper(void* user_data)
+{
+	Worker* worker = (Worker*)user_data;
+	worker->p_workload->run(*worker);
+	return NULL;
+}
@@ -0,0 +1,85 @@
+// stress_workload.h
+// Synthetic load for the profiler: threads that emit trees of CPU markers as fast as asked,
+// and a matching pattern of GPU markers on the main thread.
+
+#ifndef STRESS_WORKLOAD_H
+#define STRESS_WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread.h"
+
+struct StressConfig
+{
+	int			nb_threads;
+	int			depth;			// Levels of the marker trees
+	int			fan_out;		// Children of each marker but the leaves
+	uint32_t	leaf_ns;		// Busy work in each leaf marker
+	uint32_t	rate;			// Markers per second for all the threads, 0: as fast as possible
+	int			nb_gpu_markers;	// Per frame, nested like the CPU trees
+	bool		dynamic_names;	// Names formatted for each marker instead of constant strings
+
+	StressConfig() : nb_threads(4), depth(3), fan_out(4), leaf_ns(1000), rate(0), nb_gpu_markers(0), dynamic_names(false) {}
+
+	// Comma-separated key=value list, e.g. "threads=8,depth=4,fanout=3,leaf_ns=0,rate=1000000,gpu=4,names=dynamic".
+	// Unknown keys and values out of range print an error and return false.
+	bool	parse(const char* options);
+};
+
+class StressWorkload
+{
+public:
+	static const int	NB_MAX_THREADS = 16;		// The profiler records at most 32 threads, with the workers and the main thread
+	static const int	NB_MAX_DEPTH = 16;			// The profiler records at most 32 nested markers
+	static const int	NB_MAX_FAN_OUT = 64;
+	static const int	NB_MAX_GPU_MARKERS = 4;		// What the scene and the profiler leave of the 10 GPU markers per frame
+private:
+	static const size_t	CACHE_LINE_SIZE = 64;
+	static const int	NAME_MAX_LENGTH = 32;
+
+	struct Worker
+	{
+		StressWorkload*	p_workload;
+		int				index;
+		ThreadHandle	thread_handle;
+		uint32_t		nb_emitted_markers;	// Published after each subtree, read by the main thread
+		uint32_t		nb_names;			// Dynamic names formatted so far
+		char			pad[CACHE_LINE_SIZE];
+	};
+
+	StressConfig	m_config;
+	Worker*			m_workers;
+	bool			m_stop;
+
+	char			m_static_names[NB_MAX_DEPTH][NAME_MAX_LENGTH];	// "Stress level N"
+
+	// Statistics, printed every second
+	uint64_t		m_stats_start_time;
+	uint32_t		m_stats_nb_emitted;
+	size_t			m_stats_nb_dropped;
+
+public:
+	StressWorkload();
+
+	bool	init(const StressConfig& config);
+	void	shut();
+	bool	isRunning() const	{return m_workers != NULL;}
+
+	const StressConfig&	getConfig() const	{return m_config;}
+
+	// Main thread, once per frame: print the marker rate every second
+	void	update();
+
+	// Main thread, when drawing: the GPU marker pattern
+	void	drawGpuMarkers();
+
+private:
+	uint32_t	getNbEmittedMarkers() const;
+
+	void	run(Worker& worker);
+	void	emitTree(Worker& worker, int level, uint32_t& nb_markers);
+	int		emitGpuTree(int level, int nb_remaining);
+	static void*	runWrapper(void* user_data);
+};
+
+#endif // STRESS_WORKLOAD_H
@@ -0,0 +1,178 @@
+// profiler_stress.cpp
+// Stress test of the recording side of the profiler, meant to run under ThreadSanitizer:
+// NB_MAX_CPU_THREADS-1 workers push nested markers, counter samples and flows as fast as they can,
+// while the main thread pushes its own markers, calls synchronizeFrame() and draw(), and toggles the recording.
+// Then one more thread pushes markers: the profiler has no slot left for it, and must ignore them.
+// Exits with EXIT_FAILURE if the collected markers are inconsistent; the data races are reported by TSan.
+// Usage: profiler_stress [nb_frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../profiler.h"
+#include "../hp_timer.h"
+#include "../thread.h"
+#include "../atomic.h"
+
+//-----------------------------------------------------------------------------
+// Access to the internals of the profiler
+//-----------------------------------------------------------------------------
+class ProfilerBench
+{
+public:
+	static const size_t	NB_MAX_THREADS = Profiler::NB_MAX_CPU_THREADS;
+	static const size_t	NB_RECORDED_FRAMES = Profiler::NB_RECORDED_FRAMES;
+
+	static size_t	getNbRecordedThreads()	{return profiler.m_nb_cpu_threads;}
+
+	/// Check the markers of a thread: the closed ones end after they start, and none is left open
+	static bool	checkThread(size_t i)
+	{
+		const Profiler::CpuThreadInfo&	ti = profiler.getCpuThreadInfo(i);
+		if(ti.nb_open_markers != 0)
+		{
+			fprintf(stderr, "*** %s: %d markers still open\n", ti.name, (int)ti.nb_open_markers);
+			return false;
+		}
+		for(size_t m=0 ; m < Profiler::NB_MARKERS_PER_CPU_THREAD ; m++)
+		{
+			const Profiler::CpuMarker&	marker = ti.markers[m];
+			if(marker.frame >= 0 && marker.end != INVALID_TIME && marker.end < marker.start)
+			{
+				fprintf(stderr, "*** %s: marker \"%s\" ends before it starts\n", ti.name, marker.name);
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static const int	NB_WORKERS = (int)ProfilerBench::NB_MAX_THREADS - 1;	// The main thread takes the last slot
+static const int	NB_LEVELS = 4;
+
+static bool		s_quit = false;
+static int32_t	s_nb_started = 0;
+
+//-----------------------------------------------------------------------------
+static void pushTree(int level, uint32_t flow_id)
+{
+	static const char* const	names[NB_LEVELS] = {"Level 0", "Level 1", "Level 2", "Level 3"};
+
+	PROFILER_PUSH_CPU_MARKER(names[level], COLOR_GREEN);
+	if(level == 0)
+		PROFILER_FLOW_END(flow_id);
+	if(level+1 < NB_LEVELS)
+	{
+		pushTree(level+1, flow_id);
+		pushTree(level+1, flow_id);
+	}
+	else
+	{
+		PROFILER_COUNTER("Stress leaves", level);
+	}
+	PROFILER_POP_CPU_MARKER();
+}
+
+//-----------------------------------------------------------------------------
+static void* workerThread(void* arg)
+{
+	uint32_t	flow_id = (uint32_t)(size_t)arg;
+	atomicFetchAdd(&s_nb_started, (int32_t)1);
+	while(!atomicLoadRelaxed(&s_quit))
+	{
+		pushTree(0, flow_id);
+		threadYield();
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/// Thread started when all the slots are taken
+static void* extraThread(void* arg)
+{
+	for(int i=0 ; i < 100 ; i++)
+		pushTree(0, (uint32_t)(size_t)arg);
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int nb_frames = argc > 1 ? atoi(argv[1]) : 200;
+	if(nb_frames < 1)
+	{
+		fprintf(stderr, "Usage: %s [nb_frames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	initTimer();
+	threadSetName("Main");
+
+	// No window: the profiler is not drawn, draw() only reads the frames
+	PROFILER_INIT(1280, 720, 0, 0);
+	profiler.setVisible(false);
+
+	uint32_t		first_flow_id = PROFILER_NEW_FLOW_IDS(NB_WORKERS);
+	ThreadHandle	handles[NB_WORKERS];
+	for(int i=0 ; i < NB_WORKERS ; i++)
+	{
+		char	name[THREAD_NAME_MAX_LENGTH];
+		sprintf(name, "Stress %d", i);
+
+		ThreadOptions	options;
+		options.name = name;
+		handles[i] = threadCreate(&workerThread, (void*)(size_t)(first_flow_id + i), options);
+	}
+	while(atomicLoadRelaxed(&s_nb_started) < NB_WORKERS)
+		threadYield();
+
+	for(int frame=0 ; frame < nb_frames ; frame++)
+	{
+		PROFILER_SYNC_FRAME();
+
+		PROFILER_PUSH_CPU_MARKER("Frame", COLOR_RED);
+		for(int i=0 ; i < NB_WORKERS ; i++)
+			PROFILER_FLOW_BEGIN(first_flow_id + i);
+		PROFILER_DRAW();
+		PROFILER_POP_CPU_MARKER();
+
+		// Stop and resume the recording while the workers have markers open
+		if(frame % 50 == 25)
+			PROFILER_SET_RECORDING(false);
+		else if(frame % 50 == 30)
+			PROFILER_SET_RECORDING(true);
+	}
+
+	atomicStoreRelaxed(&s_quit, true);
+	for(int i=0 ; i < NB_WORKERS ; i++)
+		threadJoin(handles[i]);
+
+	// Collect the last events of the workers
+	for(size_t i=0 ; i < ProfilerBench::NB_RECORDED_FRAMES ; i++)
+		PROFILER_SYNC_FRAME();
+
+	// No slot left for a new thread
+	ThreadOptions	options;
+	options.name = "Extra";
+	threadJoin(threadCreate(&extraThread, (void*)(size_t)first_flow_id, options));
+	PROFILER_SYNC_FRAME();
+
+	bool ok = true;
+	if(ProfilerBench::getNbRecordedThreads() != (size_t)NB_WORKERS + 1)
+	{
+		fprintf(stderr, "*** %d threads recorded instead of %d\n", (int)ProfilerBench::getNbRecordedThreads(), NB_WORKERS + 1);
+		ok = false;
+	}
+	if(profiler.getNbRejectedThreads() != 1)
+	{
+		fprintf(stderr, "*** %d threads rejected instead of 1\n", (int)profiler.getNbRejectedThreads());
+		ok = false;
+	}
+	for(size_t i=0 ; i < ProfilerBench::getNbRecordedThreads() ; i++)
+		ok = ProfilerBench::checkThread(i) && ok;
+
+	PROFILER_SHUT();
+	shutTimer();
+
+	printf("%s: %d frames, %d threads\n", ok ? "OK" : "FAILED", nb_frames, NB_WORKERS + 1);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
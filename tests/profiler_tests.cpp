@@ -0,0 +1,639 @@
+// profiler_tests.cpp
+// Deterministic tests of the profiler, without a window. Built with PROFILER_FAKE_CLOCK: each thread scripts
+// the times of its markers, a fake of the GL timer queries scripts the GPU timestamps and counts the queries,
+// and a fake Drawer2D records the rectangles that draw() outputs.
+// Scripted marker sequences on several threads are checked against the collected frames:
+// - a marker that overlaps synchronizeFrame() shows in both frames, with a nested marker in the second one,
+// - draw() clamps the markers of the CPU threads to the displayed frame,
+// - the rings of the CPU and GPU markers wrap around several times without losing or reordering markers,
+// - the markers of a thread beyond the ones kept per frame are dropped, without overwriting the history,
+// - the GPU markers that end after the frame end its critical path, with their times converted to CPU times.
+// Exits with EXIT_FAILURE and prints the failed checks if the collected frames differ from the scripts.
+// Usage: profiler_tests
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../profiler.h"
+#include "../drawer2D.h"
+#include "../thread.h"
+
+//-----------------------------------------------------------------------------
+// Fake clock: each thread sets the time of its next push or pop
+//-----------------------------------------------------------------------------
+static THREAD_LOCAL uint64_t	s_now = 0;
+
+uint64_t profilerFakeTimeNs()
+{
+	return s_now;
+}
+
+static const uint64_t	MS = 1000000;
+static const uint64_t	FRAME_NS = 10*MS;
+static const uint64_t	CPU_BASE_NS = 1000*MS;		// Time of frame 0
+static const uint64_t	GPU_BASE_NS = 7777*MS + 123;	// The GPU clock has an offset of its own
+
+/// Time of synchronizeFrame() at the start of a frame
+static uint64_t frameTime(int frame)
+{
+	return CPU_BASE_NS + uint64_t(frame) * FRAME_NS;
+}
+
+//-----------------------------------------------------------------------------
+// Fake timer queries: the timestamp of a query is the scripted GPU time when it was issued
+//-----------------------------------------------------------------------------
+static const size_t	NB_MAX_QUERIES = 1024;
+
+static uint64_t	s_gpu_now = 0;
+static uint64_t	s_query_times[NB_MAX_QUERIES];
+static bool		s_query_alive[NB_MAX_QUERIES];
+static size_t	s_nb_generated_queries = 0;
+static size_t	s_nb_deleted_queries = 0;
+static size_t	s_nb_issued_queries = 0;
+
+//-----------------------------------------------------------------------------
+static void GLAPIENTRY fakeGenQueries(GLsizei n, GLuint* ids)
+{
+	for(GLsizei i=0 ; i < n ; i++)
+	{
+		GLuint	id = (GLuint)(++s_nb_generated_queries);	// 0 is INVALID_QUERY
+		if(id >= NB_MAX_QUERIES)
+		{
+			fprintf(stderr, "*** more than %d timer queries\n", (int)NB_MAX_QUERIES);
+			exit(EXIT_FAILURE);
+		}
+		s_query_alive[id] = true;
+		s_query_times[id] = INVALID_TIME;
+		ids[i] = id;
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void GLAPIENTRY fakeDeleteQueries(GLsizei n, const GLuint* ids)
+{
+	for(GLsizei i=0 ; i < n ; i++)
+	{
+		if(ids[i] < NB_MAX_QUERIES && s_query_alive[ids[i]])
+		{
+			s_query_alive[ids[i]] = false;
+			s_nb_deleted_queries++;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void GLAPIENTRY fakeQueryCounter(GLuint id, GLenum target)
+{
+	if(id < NB_MAX_QUERIES && s_query_alive[id] && target == GL_TIMESTAMP)
+	{
+		s_query_times[id] = s_gpu_now;
+		s_nb_issued_queries++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// The queries of the displayed frame were issued 2 frames ago: they are always available
+static void GLAPIENTRY fakeGetQueryObjectiv(GLuint id, GLenum pname, GLint* params)
+{
+	*params = (pname == GL_QUERY_RESULT_AVAILABLE && id < NB_MAX_QUERIES && s_query_times[id] != INVALID_TIME);
+}
+
+//-----------------------------------------------------------------------------
+static void GLAPIENTRY fakeGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params)
+{
+	*params = (pname == GL_QUERY_RESULT && id < NB_MAX_QUERIES) ? s_query_times[id] : 0;
+}
+
+//-----------------------------------------------------------------------------
+/// The GPU clock, read by synchronizeFrame()
+static void GLAPIENTRY fakeGetInteger64v(GLenum pname, GLint64* params)
+{
+	*params = (pname == GL_TIMESTAMP) ? (GLint64)s_gpu_now : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Fake Drawer2D: only the rectangles are recorded, the strings and lines are ignored
+//-----------------------------------------------------------------------------
+Drawer2D	drawer2D;
+
+struct DrawnRect
+{
+	Rect	rect;
+	Color	color;
+};
+
+static const size_t	NB_MAX_DRAWN_RECTS = 4096;
+
+static DrawnRect	s_drawn_rects[NB_MAX_DRAWN_RECTS];
+static size_t		s_nb_drawn_rects = 0;
+
+bool Drawer2D::init(int win_w, int win_h)	{onResize(win_w, win_h); return true;}
+void Drawer2D::shut()						{}
+
+//-----------------------------------------------------------------------------
+void Drawer2D::drawRect(const Rect& rect, const Color& color, float alpha)
+{
+	if(s_nb_drawn_rects < NB_MAX_DRAWN_RECTS)
+	{
+		s_drawn_rects[s_nb_drawn_rects].rect = rect;
+		s_drawn_rects[s_nb_drawn_rects].color = color;
+		s_nb_drawn_rects++;
+	}
+}
+
+void Drawer2D::drawLine(float x1, float y1, float x2, float y2, const Color& color)			{}
+void Drawer2D::drawString(const char* str, float x, float y, const Color& color, float scale)	{}
+
+//-----------------------------------------------------------------------------
+// Access to the internals of the profiler
+//-----------------------------------------------------------------------------
+class ProfilerBench
+{
+public:
+	typedef Profiler::Marker		Marker;
+	typedef Profiler::ThreadView	ThreadView;
+	typedef Profiler::FrameView		FrameView;
+	typedef CriticalPathAnalyzer::Path	Path;
+
+	static const size_t	NB_MARKERS_PER_CPU_THREAD = Profiler::NB_MARKERS_PER_CPU_THREAD;
+	static const size_t	NB_GPU_MARKERS = Profiler::NB_GPU_MARKERS;
+	static const size_t	NB_MAX_CPU_MARKERS_PER_FRAME = Profiler::NB_MAX_CPU_MARKERS_PER_FRAME;
+	static const int	NB_MAX_CAPTURED_FRAMES_BEFORE = (int)Profiler::NB_MAX_CAPTURED_FRAMES_BEFORE;
+	static const int	NB_FRAMES_LATENCY = (int)Profiler::NB_FRAMES_LATENCY;
+
+	static int				getCurFrame()	{return profiler.m_cur_frame;}
+	static const FrameView&	getLiveView()	{return profiler.m_live_view;}
+	static const char*		getLineName(size_t line)	{return profiler.getLineName(line);}
+
+	/// Markers of a frame still in the ring of a thread
+	static size_t countRingMarkers(const char* thread_name, int frame)
+	{
+		const Profiler::CpuThreadInfo*	ti = findThreadInfo(thread_name);
+		size_t	nb_markers = 0;
+		for(size_t i=0 ; ti && i < NB_MARKERS_PER_CPU_THREAD ; i++)
+		{
+			if(ti->markers[i].frame == frame)
+				nb_markers++;
+		}
+		return nb_markers;
+	}
+
+	static size_t getNbDroppedMarkers(const char* thread_name)
+	{
+		const Profiler::CpuThreadInfo*	ti = findThreadInfo(thread_name);
+		return ti ? atomicLoadRelaxed(&ti->nb_dropped_markers) : 0;
+	}
+
+	static const Profiler::CpuThreadInfo* findThreadInfo(const char* thread_name)
+	{
+		for(size_t i=0 ; i < profiler.m_nb_cpu_threads ; i++)
+		{
+			if(strcmp(profiler.getCpuThreadInfo(i).name, thread_name) == 0)
+				return &profiler.getCpuThreadInfo(i);
+		}
+		return NULL;
+	}
+
+	/// The analyzer runs on its own thread: wait for the path of the frame
+	static bool getCriticalPath(int frame, Path* path)
+	{
+		const Profiler::FrameInfo*	frame_info = profiler.findFrameInfo(frame);
+		for(int i=0 ; frame_info && i < 10000000 ; i++)
+		{
+			if(profiler.getCriticalPath(frame, *frame_info, path))
+				return true;
+			threadYield();
+		}
+		return false;
+	}
+};
+
+typedef ProfilerBench::Marker		Marker;
+typedef ProfilerBench::ThreadView	ThreadView;
+typedef ProfilerBench::FrameView	FrameView;
+typedef ProfilerBench::Path			Path;
+
+//-----------------------------------------------------------------------------
+// Scripts: the markers of frame f, pushed right after synchronizeFrame() started it
+//-----------------------------------------------------------------------------
+static const int	NB_FRAMES = 60;
+static const int	NB_WORKERS = 3;
+static const int	NB_WRAP_MARKERS = 130;	// Per frame, to wrap the ring of the thread several times, beyond the ones kept
+static const int	NB_KEPT_WRAP_MARKERS = (int)ProfilerBench::NB_MAX_CPU_MARKERS_PER_FRAME;	// The first ones of the frame
+static const int	NB_GPU_MARKERS_PER_FRAME = 3;
+
+#define COLOR_REF		Color(0x10, 0x20, 0x30)
+#define COLOR_LONG		Color(0x11, 0x21, 0x31)
+#define COLOR_CHILD		Color(0x12, 0x22, 0x32)
+#define COLOR_SHORT		Color(0x13, 0x23, 0x33)
+#define COLOR_WRAP		Color(0x14, 0x24, 0x34)
+#define COLOR_GPU		Color(0x15, 0x25, 0x35)
+
+static const char* const	worker_names[NB_WORKERS] = {"Overlap", "Short", "Wrap"};
+
+//-----------------------------------------------------------------------------
+/// The last GPU marker of the frames 5k+2 ends 3ms after the frame: the GPU is the bottleneck
+static bool isGpuLate(int frame)
+{
+	return frame % 5 == 2;
+}
+
+//-----------------------------------------------------------------------------
+/// Duration of the GPU marker n, which starts 2n ms after the frame on the GPU clock
+static uint64_t gpuMarkerDuration(int frame, int n)
+{
+	return (isGpuLate(frame) && n == NB_GPU_MARKERS_PER_FRAME-1) ? 9*MS : 1*MS;
+}
+
+//-----------------------------------------------------------------------------
+/// Main thread: "Ref" starts with the frame, and GPU markers
+static void scriptMain(int frame)
+{
+	s_now = frameTime(frame);
+	PROFILER_PUSH_CPU_MARKER("Ref", COLOR_REF);
+	s_now += 1*MS;
+	PROFILER_POP_CPU_MARKER();
+
+	for(int n=0 ; n < NB_GPU_MARKERS_PER_FRAME ; n++)
+	{
+		char	name[16];
+		sprintf(name, "GPU %d", n);
+
+		s_gpu_now = GPU_BASE_NS + uint64_t(frame)*FRAME_NS + uint64_t(n)*2*MS;
+		PROFILER_PUSH_GPU_MARKER(name, COLOR_GPU);
+		s_gpu_now += gpuMarkerDuration(frame, n);
+		PROFILER_POP_GPU_MARKER();
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// "Long" starts in the frames 4k and ends in the frames 4k+1, where it encloses "Child"
+static void scriptOverlap(int frame)
+{
+	if(frame % 4 == 0)
+	{
+		s_now = frameTime(frame) + 6*MS;
+		PROFILER_PUSH_CPU_MARKER("Long", COLOR_LONG);
+	}
+	else if(frame % 4 == 1 && frame > 1)
+	{
+		s_now = frameTime(frame) + 1*MS;
+		PROFILER_PUSH_CPU_MARKER("Child", COLOR_CHILD);
+		s_now += 1*MS;
+		PROFILER_POP_CPU_MARKER();
+		s_now += 1*MS;
+		PROFILER_POP_CPU_MARKER();
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void scriptShort(int frame)
+{
+	s_now = frameTime(frame) + 1*MS;
+	PROFILER_PUSH_CPU_MARKER("Short", COLOR_SHORT);
+	s_now += MS/2;
+	PROFILER_POP_CPU_MARKER();
+}
+
+//-----------------------------------------------------------------------------
+static void scriptWrap(int frame)
+{
+	for(int n=0 ; n < NB_WRAP_MARKERS ; n++)
+	{
+		char	name[16];
+		sprintf(name, "Wrap %d", n);
+
+		s_now = frameTime(frame) + 1*MS + uint64_t(n)*20000;
+		PROFILER_PUSH_CPU_MARKER(name, COLOR_WRAP);
+		s_now += 10000;
+		PROFILER_POP_CPU_MARKER();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Workers: each frame, the main thread releases them with s_step_barrier, and waits for them with it
+//-----------------------------------------------------------------------------
+static Barrier	s_step_barrier;
+static int		s_step_frame = 0;	// Written by the main thread between the steps, -1 to quit
+
+//-----------------------------------------------------------------------------
+static void* workerThread(void* arg)
+{
+	int worker = (int)(size_t)arg;
+	while(true)
+	{
+		barrierWait(&s_step_barrier);
+		int frame = s_step_frame;
+		if(frame < 0)
+			break;
+
+		switch(worker)
+		{
+		case 0:	scriptOverlap(frame);	break;
+		case 1:	scriptShort(frame);		break;
+		case 2:	scriptWrap(frame);		break;
+		}
+		barrierWait(&s_step_barrier);
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Checks of the displayed frame
+//-----------------------------------------------------------------------------
+static int	s_nb_checks = 0;
+static int	s_nb_failures = 0;
+
+//-----------------------------------------------------------------------------
+static bool check(bool condition, int frame, const char* what)
+{
+	s_nb_checks++;
+	if(!condition)
+	{
+		fprintf(stderr, "*** frame %d: %s\n", frame, what);
+		s_nb_failures++;
+	}
+	return condition;
+}
+
+//-----------------------------------------------------------------------------
+static void checkMarker(const Marker& marker, int frame, const char* name, int marker_frame, size_t layer,
+						uint64_t start, uint64_t end)
+{
+	char	what[128];
+	sprintf(what, "marker \"%s\" instead of \"%s\"", marker.name, name);
+	if(!check(strcmp(marker.name, name) == 0, frame, what))
+		return;
+
+	sprintf(what, "\"%s\" of frame %d, layer %d, from %.3lfms to %.3lfms instead of frame %d, layer %d, from %.3lfms to %.3lfms",
+			name, marker.frame, (int)marker.layer, double(marker.start) / double(MS), double(marker.end) / double(MS),
+			marker_frame, (int)layer, double(start) / double(MS), double(end) / double(MS));
+	check(marker.frame == marker_frame && marker.layer == layer && marker.start == start && marker.end == end, frame, what);
+}
+
+//-----------------------------------------------------------------------------
+static const ThreadView* findThread(const FrameView& view, const char* name)
+{
+	for(size_t i=0 ; i < view.nb_cpu_threads ; i++)
+	{
+		if(strcmp(view.cpu_threads[i].name, name) == 0)
+			return &view.cpu_threads[i];
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+static const DrawnRect* findDrawnRect(const Color& color)
+{
+	for(size_t i=0 ; i < s_nb_drawn_rects ; i++)
+	{
+		const Color&	c = s_drawn_rects[i].color;
+		if(c.r == color.r && c.g == color.g && c.b == color.b)
+			return &s_drawn_rects[i];
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/// Markers collected for the displayed frame: the ones started in it, and the ones of the previous frame
+/// that end in it
+static void checkView(const FrameView& view, int frame)
+{
+	char	what[128];
+
+	if(!check(view.valid && view.frame_info.frame == frame, frame, "the view is not the one of the displayed frame"))
+		return;
+	check(view.frame_info.time_sync_start == frameTime(frame) && view.frame_info.time_sync_end == frameTime(frame+1),
+		  frame, "wrong frame times");
+
+	// Main thread
+	const ThreadView*	tv = findThread(view, "Main");
+	if(check(tv && tv->nb_markers == 1, frame, "\"Main\" should have 1 marker"))
+		checkMarker(tv->markers[0], frame, "Ref", frame, 0, frameTime(frame), frameTime(frame) + 1*MS);
+
+	// Overlap of synchronizeFrame()
+	tv = findThread(view, "Overlap");
+	if(check(tv != NULL, frame, "no thread \"Overlap\""))
+	{
+		if(frame % 4 == 0)
+		{
+			if(check(tv->nb_markers == 1 && tv->nb_frame_markers == 1, frame, "\"Overlap\" should have 1 marker"))
+				checkMarker(tv->markers[0], frame, "Long", frame, 0, frameTime(frame) + 6*MS, frameTime(frame+1) + 3*MS);
+		}
+		else if(frame % 4 == 1)
+		{
+			if(check(tv->nb_markers == 2 && tv->nb_frame_markers == 1, frame, "\"Overlap\" should have 2 markers, 1 of the frame"))
+			{
+				checkMarker(tv->markers[0], frame, "Long", frame-1, 0, frameTime(frame-1) + 6*MS, frameTime(frame) + 3*MS);
+				checkMarker(tv->markers[1], frame, "Child", frame, 1, frameTime(frame) + 1*MS, frameTime(frame) + 2*MS);
+			}
+		}
+		else
+		{
+			check(tv->nb_markers == 0, frame, "\"Overlap\" should have no marker");
+		}
+	}
+
+	tv = findThread(view, "Short");
+	if(check(tv && tv->nb_markers == 1, frame, "\"Short\" should have 1 marker"))
+		checkMarker(tv->markers[0], frame, "Short", frame, 0, frameTime(frame) + 1*MS, frameTime(frame) + 1*MS + MS/2);
+
+	// Wrap-around of the ring: the markers kept, in order
+	tv = findThread(view, "Wrap");
+	sprintf(what, "\"Wrap\" should have %d markers", NB_KEPT_WRAP_MARKERS);
+	if(check(tv && tv->nb_markers == (size_t)NB_KEPT_WRAP_MARKERS && tv->nb_frame_markers == (size_t)NB_KEPT_WRAP_MARKERS, frame, what))
+	{
+		for(int n=0 ; n < NB_KEPT_WRAP_MARKERS ; n++)
+		{
+			char	name[16];
+			sprintf(name, "Wrap %d", n);
+			uint64_t	start = frameTime(frame) + 1*MS + uint64_t(n)*20000;
+			checkMarker(tv->markers[n], frame, name, frame, 0, start, start + 10000);
+		}
+	}
+
+	// GPU: rebased on the start of the frame
+	sprintf(what, "%d GPU markers instead of %d", (int)view.nb_gpu_markers, NB_GPU_MARKERS_PER_FRAME);
+	if(check(view.nb_gpu_markers == (size_t)NB_GPU_MARKERS_PER_FRAME, frame, what))
+	{
+		for(int n=0 ; n < NB_GPU_MARKERS_PER_FRAME ; n++)
+		{
+			char	name[16];
+			sprintf(name, "GPU %d", n);
+			uint64_t	start = frameTime(frame) + uint64_t(n)*2*MS;
+			checkMarker(view.gpu_markers[n], frame, name, frame, 0, start, start + gpuMarkerDuration(frame, n));
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// "Wrap" pushes more markers than the ring keeps per frame: the ones beyond are dropped, and the ring still
+/// holds the history the captures need. frame is the last frame the workers recorded.
+static void checkHistory(int frame)
+{
+	char	what[128];
+
+	size_t	nb_dropped = ProfilerBench::getNbDroppedMarkers("Wrap");
+	size_t	nb_expected_dropped = size_t(frame) * size_t(NB_WRAP_MARKERS - NB_KEPT_WRAP_MARKERS);
+	sprintf(what, "\"Wrap\" dropped %d markers instead of %d", (int)nb_dropped, (int)nb_expected_dropped);
+	check(nb_dropped == nb_expected_dropped, frame, what);
+
+	// The markers of the frame are collected by the next synchronizeFrame()
+	int oldest_frame = frame - ProfilerBench::NB_FRAMES_LATENCY - ProfilerBench::NB_MAX_CAPTURED_FRAMES_BEFORE;
+	for(int f=oldest_frame > 1 ? oldest_frame : 1 ; f < frame ; f++)
+	{
+		size_t	nb_markers = ProfilerBench::countRingMarkers("Wrap", f);
+		sprintf(what, "the ring of \"Wrap\" has %d markers of frame %d instead of %d", (int)nb_markers, f, NB_KEPT_WRAP_MARKERS);
+		check(nb_markers == (size_t)NB_KEPT_WRAP_MARKERS, frame, what);
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// Rectangles of the displayed frame: "Ref" starts with the frame and lasts 1ms, which gives the scale
+static void checkDraw(int frame)
+{
+	const DrawnRect*	ref = findDrawnRect(COLOR_REF);
+	if(!check(ref && ref->rect.w > 0.0f, frame, "\"Ref\" is not drawn"))
+		return;
+	const float	x_per_ms = ref->rect.w;
+	const float	frame_end_x = ref->rect.x + x_per_ms * float(FRAME_NS / MS);
+	const float	epsilon = 1e-4f;
+
+	const DrawnRect*	marker = findDrawnRect(COLOR_LONG);
+	if(frame % 4 == 0)
+	{
+		// Starts 6ms after the frame, ends 3ms after it: clamped to the end of the frame
+		if(check(marker != NULL, frame, "\"Long\" is not drawn"))
+		{
+			check(fabsf(marker->rect.x - (ref->rect.x + 6.0f*x_per_ms)) < epsilon, frame, "\"Long\" does not start 6ms after the frame");
+			check(fabsf(marker->rect.x + marker->rect.w - frame_end_x) < epsilon, frame, "\"Long\" is not clamped to the end of the frame");
+		}
+	}
+	else if(frame % 4 == 1)
+	{
+		// Started in the previous frame: clamped to the start of the frame
+		if(check(marker != NULL, frame, "\"Long\" is not drawn"))
+		{
+			check(fabsf(marker->rect.x - ref->rect.x) < epsilon, frame, "\"Long\" is not clamped to the start of the frame");
+			check(fabsf(marker->rect.w - 3.0f*x_per_ms) < epsilon, frame, "\"Long\" does not end 3ms after the start of the frame");
+		}
+	}
+	else
+	{
+		check(marker == NULL, frame, "\"Long\" is drawn outside of its frames");
+	}
+}
+
+//-----------------------------------------------------------------------------
+/// The path ends on the main thread, then on the GPU when it ends after the frame. The GPU clock was read at the
+/// end of the frame, which gives the CPU times of the GPU markers.
+static void checkCriticalPath(int frame)
+{
+	char	what[128];
+
+	Path	path;
+	if(!check(ProfilerBench::getCriticalPath(frame, &path), frame, "the critical path is not analyzed"))
+		return;
+
+	size_t	first_gpu_step = path.nb_steps;
+	while(first_gpu_step > 0 && path.steps[first_gpu_step-1].line == 0)
+		first_gpu_step--;
+	size_t	nb_gpu_steps = path.nb_steps - first_gpu_step;
+
+	if(check(first_gpu_step > 0, frame, "the critical path has no CPU step"))
+	{
+		const char*	line_name = ProfilerBench::getLineName(path.steps[first_gpu_step-1].line);
+		sprintf(what, "the CPU steps end on \"%s\" instead of \"Main\"", line_name);
+		check(strcmp(line_name, "Main") == 0, frame, what);
+	}
+
+	size_t	nb_expected_steps = isGpuLate(frame) ? NB_GPU_MARKERS_PER_FRAME : 0;
+	sprintf(what, "%d GPU steps in the critical path instead of %d", (int)nb_gpu_steps, (int)nb_expected_steps);
+	if(!check(nb_gpu_steps == nb_expected_steps, frame, what))
+		return;
+
+	for(size_t n=0 ; n < nb_gpu_steps ; n++)
+	{
+		const CriticalPathAnalyzer::Step&	step = path.steps[first_gpu_step+n];
+		char		name[16];
+		sprintf(name, "GPU %d", (int)n);
+		uint64_t	start = frameTime(frame) + uint64_t(n)*2*MS;
+		uint64_t	end = start + gpuMarkerDuration(frame, (int)n);
+
+		sprintf(what, "GPU step \"%s\" from %.3lfms to %.3lfms instead of \"%s\" from %.3lfms to %.3lfms",
+				step.name, double(step.start) / double(MS), double(step.end) / double(MS),
+				name, double(start) / double(MS), double(end) / double(MS));
+		check(strcmp(step.name, name) == 0 && step.start == start && step.end == end, frame, what);
+	}
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+	threadSetName("Main");
+
+	PROFILER_INIT(1280, 720, 0, 0);
+
+	ProfilerGpuQueries	queries;
+	queries.gen_queries = &fakeGenQueries;
+	queries.delete_queries = &fakeDeleteQueries;
+	queries.query_counter = &fakeQueryCounter;
+	queries.get_query_objectiv = &fakeGetQueryObjectiv;
+	queries.get_query_objectui64v = &fakeGetQueryObjectui64v;
+	queries.get_integer64v = &fakeGetInteger64v;
+	profiler.setGpuQueries(queries);
+
+	barrierCreate(&s_step_barrier, NB_WORKERS+1);
+	ThreadHandle	handles[NB_WORKERS];
+	for(int i=0 ; i < NB_WORKERS ; i++)
+	{
+		ThreadOptions	options;
+		options.name = worker_names[i];
+		handles[i] = threadCreate(&workerThread, (void*)(size_t)i, options);
+	}
+
+	for(int i=0 ; i < NB_FRAMES ; i++)
+	{
+		int frame = ProfilerBench::getCurFrame() + 1;
+		s_now = frameTime(frame);
+		s_gpu_now = GPU_BASE_NS + uint64_t(frame)*FRAME_NS;	// The same time on the GPU clock
+		PROFILER_SYNC_FRAME();
+
+		// The workers record their markers while the main thread records its own
+		s_step_frame = frame;
+		barrierWait(&s_step_barrier);
+		scriptMain(frame);
+		barrierWait(&s_step_barrier);
+
+		s_nb_drawn_rects = 0;
+		PROFILER_DRAW();
+
+		// The first frames miss the threads that had not pushed their first marker yet: "Overlap" starts in frame 4
+		int displayed_frame = frame - ProfilerBench::NB_FRAMES_LATENCY;
+		if(displayed_frame >= 4)
+		{
+			checkView(ProfilerBench::getLiveView(), displayed_frame);
+			checkDraw(displayed_frame);
+			checkCriticalPath(displayed_frame);
+		}
+		if(frame > 1)
+			checkHistory(frame);	// "Wrap" is known from the synchronizeFrame() that follows its first marker
+	}
+
+	s_step_frame = -1;
+	barrierWait(&s_step_barrier);
+	for(int i=0 ; i < NB_WORKERS ; i++)
+		threadJoin(handles[i]);
+	barrierDestroy(&s_step_barrier);
+
+	check(ProfilerBench::NB_MARKERS_PER_CPU_THREAD < size_t(NB_FRAMES * NB_WRAP_MARKERS), -1, "the ring of the CPU markers did not wrap");
+	check(ProfilerBench::NB_GPU_MARKERS < size_t(NB_FRAMES * NB_GPU_MARKERS_PER_FRAME), -1, "the ring of the GPU markers did not wrap");
+	check(s_nb_generated_queries <= 2*ProfilerBench::NB_GPU_MARKERS, -1, "the timer queries are not reused when the ring wraps");
+	check(s_nb_issued_queries == size_t(2 * NB_FRAMES * NB_GPU_MARKERS_PER_FRAME), -1, "wrong number of issued timer queries");
+
+	PROFILER_SHUT();
+	check(s_nb_deleted_queries == s_nb_generated_queries, -1, "timer queries leaked by shut()");
+
+	printf("%s: %d frames, %d checks, %d failed\n", s_nb_failures ? "FAILED" : "OK", NB_FRAMES, s_nb_checks, s_nb_failures);
+	return s_nb_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,16 +1,124 @@
 // thread.cpp
 
 #include "thread.h"
+#include "atomic.h"
+#include "hp_timer.h"
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef WIN32
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+#ifdef __linux__
+	#include <limits.h>
+	#include <linux/futex.h>
+	#include <sys/resource.h>
+	#include <sys/syscall.h>
+#endif
+
+// ------------------------- Common to all the platforms ----------------------
+static THREAD_LOCAL char	s_thread_name[THREAD_NAME_MAX_LENGTH];
+
+// What the new thread needs before it calls its ThreadProc
+struct ThreadStartData
+{
+	ThreadProc		proc;
+	void*			arg;
+	char			name[THREAD_NAME_MAX_LENGTH];
+	uint64_t		affinity_mask;
+	ThreadPriority	priority;
+};
+
+static ThreadStartData* createThreadStartData(ThreadProc proc, void* arg, const ThreadOptions& options)
+{
+	ThreadStartData* data = new ThreadStartData;
+	data->proc = proc;
+	data->arg = arg;
+	data->name[0] = '\0';
+	if(options.name)
+	{
+		strncpy(data->name, options.name, THREAD_NAME_MAX_LENGTH);
+		data->name[THREAD_NAME_MAX_LENGTH-1] = '\0';
+	}
+	data->affinity_mask = options.affinity_mask;
+	data->priority = options.priority;
+	return data;
+}
+
+// Runs on the new thread
+static void* threadStart(ThreadStartData* data)
+{
+	ThreadProc	proc = data->proc;
+	void*		arg = data->arg;
+
+	if(data->name[0])
+		threadSetName(data->name);
+	if(data->affinity_mask && !threadSetAffinity(data->affinity_mask))
+		fprintf(stderr, "*** threadCreate: FAILED setting the affinity of thread \"%s\"\n", data->name);
+	if(data->priority != THREAD_PRIO_NORMAL && !threadSetPriority(data->priority))
+		fprintf(stderr, "*** threadCreate: FAILED setting the priority of thread \"%s\"\n", data->name);
+
+	delete data;
+	return proc(arg);
+}
+
+const char* threadGetName()
+{
+	return s_thread_name;
+}
+
+// --- Wait hook ---
+static ThreadWaitHook		s_wait_hook = NULL;
+static uint32_t				s_wait_threshold_ns = 0;
+static THREAD_LOCAL bool	s_in_wait_hook = false;
+
+void threadSetWaitHook(ThreadWaitHook hook, uint32_t threshold_ns)
+{
+	atomicStoreRelaxed(&s_wait_threshold_ns, threshold_ns);
+	atomicStoreRelease(&s_wait_hook, hook);
+}
+
+static inline bool isWaitHookSet()
+{
+	return atomicLoadRelaxed(&s_wait_hook) != NULL;
+}
+
+// Start time of a wait, 0 when there is no hook
+static inline uint64_t beginWait()
+{
+	return isWaitHookSet() ? getTimeNs() : 0;
+}
+
+static void endWait(ThreadWaitType type, const void* object, uint64_t start)
+{
+	if(start == 0 || s_in_wait_hook)
+		return;
+
+	uint64_t		wait_ns = getTimeNs() - start;
+	ThreadWaitHook	hook = atomicLoadAcquire(&s_wait_hook);
+	if(hook && wait_ns >= atomicLoadRelaxed(&s_wait_threshold_ns))
+	{
+		s_in_wait_hook = true;
+		hook(type, object, wait_ns);
+		s_in_wait_hook = false;
+	}
+}
 
 // ------------------------- Windows API implementation-----------------------
 // http://www.flipcode.com/archives/Simple_Win32_Thread_Class.shtml
 #ifdef WIN32
 
 // --- Thread ---
-ThreadHandle threadCreate(ThreadProc proc, void* arg)
+static DWORD WINAPI threadStartWrapper(LPVOID user_data)
 {
-	return (ThreadHandle)CreateThread(0, 0, (LPTHREAD_START_ROUTINE)proc, arg, 0, 0);
+	return (DWORD)(uintptr_t)threadStart((ThreadStartData*)user_data);
+}
+
+ThreadHandle threadCreate(ThreadProc proc, void* arg, const ThreadOptions& options)
+{
+	ThreadStartData* data = createThreadStartData(proc, arg, options);
+	return (ThreadHandle)CreateThread(0, 0, &threadStartWrapper, data, 0, 0);
 }
 
 ThreadId threadGetCurrentId()
@@ -24,6 +132,61 @@ void threadJoin(ThreadHandle thread_handle)
 	assert(dwWaitResult == WAIT_OBJECT_0);
 }
 
+void threadYield()
+{
+	SwitchToThread();
+}
+
+int threadGetNbCores()
+{
+	SYSTEM_INFO	info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+int threadGetProcessCores(int* cores, int max_cores)
+{
+	DWORD_PTR	process_mask, system_mask;
+	if(!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		return 0;
+
+	int nb_cores = 0;
+	for(int i=0 ; i < int(8*sizeof(process_mask)) && nb_cores < max_cores ; i++)
+	{
+		if(process_mask & ((DWORD_PTR)1 << i))
+			cores[nb_cores++] = i;
+	}
+	return nb_cores;
+}
+
+void threadSetName(const char* name)
+{
+	strncpy(s_thread_name, name, THREAD_NAME_MAX_LENGTH);
+	s_thread_name[THREAD_NAME_MAX_LENGTH-1] = '\0';
+
+	// SetThreadDescription() only exists since Windows 10 1607
+	typedef HRESULT (WINAPI *SetThreadDescriptionProc)(HANDLE, PCWSTR);
+	SetThreadDescriptionProc set_thread_description =
+		(SetThreadDescriptionProc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+	if(set_thread_description)
+	{
+		WCHAR	wide_name[THREAD_NAME_MAX_LENGTH];
+		MultiByteToWideChar(CP_UTF8, 0, s_thread_name, -1, wide_name, THREAD_NAME_MAX_LENGTH);
+		set_thread_description(GetCurrentThread(), wide_name);
+	}
+}
+
+bool threadSetAffinity(uint64_t affinity_mask)
+{
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)affinity_mask) != 0;
+}
+
+bool threadSetPriority(ThreadPriority priority)
+{
+	static const int	priorities[] = {THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL};
+	return SetThreadPriority(GetCurrentThread(), priorities[priority]) != 0;
+}
+
 // --- Mutex ---
 void mutexCreate(Mutex* mutex)
 {
@@ -37,6 +200,16 @@ void mutexDestroy(Mutex* mutex)
 
 void mutexLock(Mutex* mutex)
 {
+	// With a wait hook, only the contended locks are timed
+	if(isWaitHookSet())
+	{
+		if(TryEnterCriticalSection((LPCRITICAL_SECTION)mutex))
+			return;
+		uint64_t start = beginWait();
+		EnterCriticalSection((LPCRITICAL_SECTION)mutex);
+		endWait(THREAD_WAIT_MUTEX, mutex, start);
+		return;
+	}
 	EnterCriticalSection((LPCRITICAL_SECTION)mutex);
 }
 
@@ -70,19 +243,64 @@ void eventReset(Event *event)
 	ResetEvent(*event);
 }
 
-void eventWait(Event* event)
+static void eventWaitImpl(Event* event)
 {
 	DWORD	dwWaitResult = WaitForSingleObject(*event, INFINITE);
 	assert(dwWaitResult == WAIT_OBJECT_0);
 }
+
+// --- Barrier ---
+void barrierCreate(Barrier* barrier, int nb_threads)
+{
+	InitializeCriticalSection(&barrier->mutex);
+	barrier->events[0] = CreateEvent(NULL, TRUE, FALSE, NULL);
+	barrier->events[1] = CreateEvent(NULL, TRUE, FALSE, NULL);
+	barrier->nb_threads = nb_threads;
+	barrier->nb_remaining = nb_threads;
+	barrier->generation = 0;
+}
+
+void barrierDestroy(Barrier* barrier)
+{
+	CloseHandle(barrier->events[0]);
+	CloseHandle(barrier->events[1]);
+	DeleteCriticalSection(&barrier->mutex);
+}
+
+static bool barrierWaitImpl(Barrier* barrier)
+{
+	EnterCriticalSection(&barrier->mutex);
+	int generation = barrier->generation;
+	if(--barrier->nb_remaining == 0)
+	{
+		// All the threads have left the previous generation: its event can be reused
+		barrier->nb_remaining = barrier->nb_threads;
+		barrier->generation++;
+		ResetEvent(barrier->events[(generation+1) & 1]);
+		SetEvent(barrier->events[generation & 1]);
+		LeaveCriticalSection(&barrier->mutex);
+		return true;
+	}
+	LeaveCriticalSection(&barrier->mutex);
+
+	DWORD	dwWaitResult = WaitForSingleObject(barrier->events[generation & 1], INFINITE);
+	assert(dwWaitResult == WAIT_OBJECT_0);
+	return false;
+}
 // ---------------- pthread implementation: MacOS X, Linux, BSD... --------
 #else
 
 // --- Thread ---
-ThreadHandle threadCreate(ThreadProc proc, void* arg)
+static void* threadStartWrapper(void* user_data)
+{
+	return threadStart((ThreadStartData*)user_data);
+}
+
+ThreadHandle threadCreate(ThreadProc proc, void* arg, const ThreadOptions& options)
 {
+	ThreadStartData* data = createThreadStartData(proc, arg, options);
 	ThreadHandle	thread_handle;
-	pthread_create((pthread_t*)(&thread_handle), NULL, proc, arg);
+	pthread_create((pthread_t*)(&thread_handle), NULL, &threadStartWrapper, data);
 	return thread_handle;
 }
 
@@ -96,6 +314,95 @@ void threadJoin(ThreadHandle thread_handle)
 	pthread_join(thread_handle, NULL);
 }
 
+void threadYield()
+{
+	sched_yield();
+}
+
+int threadGetNbCores()
+{
+#ifdef __linux__
+	// The affinity of the process (taskset, cpusets of the containers) may exclude some of the online cores
+	cpu_set_t	cpu_set;
+	if(sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0 && CPU_COUNT(&cpu_set) > 0)
+		return CPU_COUNT(&cpu_set);
+#endif
+	long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return nb_cores > 0 ? (int)nb_cores : 1;
+}
+
+int threadGetProcessCores(int* cores, int max_cores)
+{
+	int nb_cores = 0;
+#ifdef __linux__
+	cpu_set_t	cpu_set;
+	if(sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+	{
+		for(int i=0 ; i < CPU_SETSIZE && nb_cores < max_cores ; i++)
+		{
+			if(CPU_ISSET(i, &cpu_set))
+				cores[nb_cores++] = i;
+		}
+		return nb_cores;
+	}
+#endif
+	int nb_online_cores = threadGetNbCores();
+	for(int i=0 ; i < nb_online_cores && nb_cores < max_cores ; i++)
+		cores[nb_cores++] = i;
+	return nb_cores;
+}
+
+void threadSetName(const char* name)
+{
+	strncpy(s_thread_name, name, THREAD_NAME_MAX_LENGTH);
+	s_thread_name[THREAD_NAME_MAX_LENGTH-1] = '\0';
+
+#if defined(__linux__)
+	char	short_name[16];	// the kernel limit, including the '\0'
+	strncpy(short_name, name, sizeof(short_name));
+	short_name[sizeof(short_name)-1] = '\0';
+	pthread_setname_np(pthread_self(), short_name);
+#elif defined(__APPLE__)
+	pthread_setname_np(s_thread_name);
+#endif
+}
+
+bool threadSetAffinity(uint64_t affinity_mask)
+{
+#ifdef __linux__
+	cpu_set_t	cpu_set;
+	CPU_ZERO(&cpu_set);
+	for(int i=0 ; i < 64 ; i++)
+	{
+		if(affinity_mask & ((uint64_t)1 << i))
+			CPU_SET(i, &cpu_set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+	return false;	// MacOS X only has affinity hints
+#endif
+}
+
+bool threadSetPriority(ThreadPriority priority)
+{
+#ifdef __linux__
+	// With SCHED_OTHER, the priority of a thread is its nice value
+	static const int	nice_values[] = {5, 0, -5};
+	return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice_values[priority]) == 0;
+#else
+	int					policy;
+	struct sched_param	param;
+	if(pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+		return false;
+
+	int prio_min = sched_get_priority_min(policy);
+	int prio_max = sched_get_priority_max(policy);
+	int priorities[] = {prio_min, (prio_min + prio_max) / 2, prio_max};
+	param.sched_priority = priorities[priority];
+	return pthread_setschedparam(pthread_self(), policy, &param) == 0;
+#endif
+}
+
 // --- Mutex ---
 void mutexCreate(Mutex* mutex)
 {
@@ -109,6 +416,16 @@ void mutexDestroy(Mutex* mutex)
 
 void mutexLock(Mutex* mutex)
 {
+	// With a wait hook, only the contended locks are timed
+	if(isWaitHookSet())
+	{
+		if(pthread_mutex_trylock((pthread_mutex_t*)mutex) == 0)
+			return;
+		uint64_t start = beginWait();
+		pthread_mutex_lock((pthread_mutex_t*)mutex);
+		endWait(THREAD_WAIT_MUTEX, mutex, start);
+		return;
+	}
 	pthread_mutex_lock((pthread_mutex_t*)mutex);
 }
 
@@ -117,6 +434,151 @@ void mutexUnlock(Mutex* mutex)
 	pthread_mutex_unlock((pthread_mutex_t*)mutex);
 }
 
+#ifdef __linux__
+// --- Spinning ---
+static const int32_t	NB_MIN_SPINS = 16;
+static const int32_t	NB_MAX_SPINS = 4096;
+static const int32_t	NB_INITIAL_SPINS = 1024;
+
+static inline void cpuPause()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Spinning only makes sense when the thread we wait for can run at the same time
+static int32_t getInitialNbSpins()
+{
+	static const int32_t	nb_spins = threadGetNbCores() > 1 ? NB_INITIAL_SPINS : 0;
+	return nb_spins;
+}
+
+// Adapt the spin phase: spin longer when it paid off, shorter when we had to sleep anyway
+static void adaptNbSpins(int32_t* p_nb_spins, int32_t nb_spins, bool success)
+{
+	if(success && nb_spins < NB_MAX_SPINS)
+		atomicStoreRelaxed(p_nb_spins, nb_spins*2);
+	else if(!success && nb_spins > NB_MIN_SPINS)
+		atomicStoreRelaxed(p_nb_spins, nb_spins/2);
+}
+
+// --- Futex ---
+static inline void futexWait(int32_t* addr, int32_t expected)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);	// returns at once if *addr != expected
+}
+
+static inline void futexWakeAll(int32_t* addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// --- Event ---
+enum
+{
+	EVENT_RESET = 0,
+	EVENT_TRIGGERED,
+	EVENT_RESET_WITH_WAITERS,	// Some threads sleep in futexWait(): the trigger must wake them
+};
+
+void eventCreate(Event* event)
+{
+	event->state = EVENT_RESET;
+	event->nb_spins = getInitialNbSpins();
+}
+
+void eventDestroy(Event* event)
+{
+}
+
+void eventTrigger(Event* event)
+{
+	if(atomicExchange(&event->state, (int32_t)EVENT_TRIGGERED) == EVENT_RESET_WITH_WAITERS)
+		futexWakeAll(&event->state);
+}
+
+void eventReset(Event *event)
+{
+	// If threads are waiting, the event is already reset
+	atomicCompareExchange(&event->state, (int32_t)EVENT_TRIGGERED, (int32_t)EVENT_RESET);
+}
+
+static void eventWaitImpl(Event* event)
+{
+	int32_t nb_spins = atomicLoadRelaxed(&event->nb_spins);
+	for(int32_t i=0 ; i < nb_spins ; i++)
+	{
+		if(atomicLoadAcquire(&event->state) == EVENT_TRIGGERED)
+		{
+			adaptNbSpins(&event->nb_spins, nb_spins, true);
+			return;
+		}
+		cpuPause();
+	}
+	adaptNbSpins(&event->nb_spins, nb_spins, false);
+
+	while(true)
+	{
+		int32_t state = atomicLoadAcquire(&event->state);
+		if(state == EVENT_TRIGGERED)
+			return;
+
+		// Tell the triggering thread that it has to wake us, then sleep
+		if(state == EVENT_RESET &&
+		   !atomicCompareExchange(&event->state, (int32_t)EVENT_RESET, (int32_t)EVENT_RESET_WITH_WAITERS))
+			continue;
+		futexWait(&event->state, EVENT_RESET_WITH_WAITERS);
+	}
+}
+
+// --- Barrier ---
+void barrierCreate(Barrier* barrier, int nb_threads)
+{
+	barrier->nb_threads = nb_threads;
+	barrier->nb_remaining = nb_threads;
+	barrier->generation = 0;
+	barrier->nb_spins = getInitialNbSpins();
+}
+
+void barrierDestroy(Barrier* barrier)
+{
+}
+
+static bool barrierWaitImpl(Barrier* barrier)
+{
+	// The generation cannot change before we arrive
+	int32_t generation = atomicLoadAcquire(&barrier->generation);
+
+	if(atomicFetchAdd(&barrier->nb_remaining, -1) == 1)
+	{
+		// Last one: prepare the next generation and release everybody with a single syscall
+		atomicStoreRelaxed(&barrier->nb_remaining, barrier->nb_threads);
+		atomicFetchAdd(&barrier->generation, 1);
+		futexWakeAll(&barrier->generation);
+		return true;
+	}
+
+	int32_t nb_spins = atomicLoadRelaxed(&barrier->nb_spins);
+	for(int32_t i=0 ; i < nb_spins ; i++)
+	{
+		if(atomicLoadAcquire(&barrier->generation) != generation)
+		{
+			adaptNbSpins(&barrier->nb_spins, nb_spins, true);
+			return false;
+		}
+		cpuPause();
+	}
+	adaptNbSpins(&barrier->nb_spins, nb_spins, false);
+
+	while(atomicLoadAcquire(&barrier->generation) == generation)
+		futexWait(&barrier->generation, generation);
+	return false;
+}
+
+#else
 // --- Event ---
 void eventCreate(Event* event)
 {
@@ -135,7 +597,7 @@ void eventTrigger(Event* event)
 {
 	pthread_mutex_lock(&event->mutex);
 	event->triggered = true;
-	pthread_cond_signal(&event->cond);
+	pthread_cond_broadcast(&event->cond);	// manual-reset: wake all the waiters
 	pthread_mutex_unlock(&event->mutex);
 }
 
@@ -146,7 +608,7 @@ void eventReset(Event *event)
 	pthread_mutex_unlock(&event->mutex);
 }
 
-void eventWait(Event* event)
+static void eventWaitImpl(Event* event)
 {
 	pthread_mutex_lock(&event->mutex);
 	while (!event->triggered)
@@ -154,4 +616,58 @@ void eventWait(Event* event)
 	pthread_mutex_unlock(&event->mutex);
 }
 
+// --- Barrier ---
+void barrierCreate(Barrier* barrier, int nb_threads)
+{
+	pthread_mutex_init(&barrier->mutex, NULL);
+	pthread_cond_init(&barrier->cond, NULL);
+	barrier->nb_threads = nb_threads;
+	barrier->nb_remaining = nb_threads;
+	barrier->generation = 0;
+}
+
+void barrierDestroy(Barrier* barrier)
+{
+	pthread_cond_destroy(&barrier->cond);
+	pthread_mutex_destroy(&barrier->mutex);
+}
+
+static bool barrierWaitImpl(Barrier* barrier)
+{
+	pthread_mutex_lock(&barrier->mutex);
+	int generation = barrier->generation;
+	bool last = (--barrier->nb_remaining == 0);
+	if(last)
+	{
+		barrier->nb_remaining = barrier->nb_threads;
+		barrier->generation++;
+		pthread_cond_broadcast(&barrier->cond);
+	}
+	else
+	{
+		while(barrier->generation == generation)
+			pthread_cond_wait(&barrier->cond, &barrier->mutex);
+	}
+	pthread_mutex_unlock(&barrier->mutex);
+	return last;
+}
+#endif
+
 #endif
+
+// ------------------------- Common to all the platforms ----------------------
+// The waits are timed around the platform implementations above
+void eventWait(Event* event)
+{
+	uint64_t start = beginWait();
+	eventWaitImpl(event);
+	endWait(THREAD_WAIT_EVENT, event, start);
+}
+
+bool barrierWait(Barrier* barrier)
+{
+	uint64_t start = beginWait();
+	bool last = barrierWaitImpl(barrier);
+	endWait(THREAD_WAIT_BARRIER, barrier, start);
+	return last;
+}
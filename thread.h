@@ -4,31 +4,101 @@
 #ifndef __THREAD_H__
 #define __THREAD_H__
 
-// Basic types: ThreadHandle, ThreadId, Mutex, Event
+#include <stdint.h>
+
+// Basic types: ThreadHandle, ThreadId, Mutex, Event, Barrier
+// Events are manual-reset: a trigger wakes all the waiters and the event stays triggered until reset.
 #ifdef WIN32
 	#include <windows.h>
 	typedef	HANDLE				ThreadHandle;
 	typedef	DWORD				ThreadId;
 	typedef	CRITICAL_SECTION	Mutex;
 	typedef	HANDLE				Event;
+	struct						Barrier
+	{
+		CRITICAL_SECTION	mutex;
+		HANDLE				events[2];		// One per parity of the generation
+		int					nb_threads;
+		int					nb_remaining;
+		int					generation;
+	};
 #else
 	#include <pthread.h>
 	typedef	pthread_t			ThreadHandle;
 	typedef	pthread_t			ThreadId;
 	typedef	pthread_mutex_t		Mutex;
-	struct						Event
-	{
-		pthread_mutex_t	mutex;
-		pthread_cond_t	cond;
-		bool			triggered;
-	};
+	#ifdef __linux__
+		// futex: spin for a while, then sleep in the kernel. Waking sleepers is a single syscall.
+		struct					Event
+		{
+			int32_t	state;		// EVENT_RESET, EVENT_TRIGGERED or EVENT_RESET_WITH_WAITERS
+			int32_t	nb_spins;	// Adapted to how long the last waits took
+		};
+		struct					Barrier
+		{
+			int32_t	nb_threads;
+			int32_t	nb_remaining;
+			int32_t	generation;	// Futex word, incremented each time all the threads have arrived
+			int32_t	nb_spins;
+		};
+	#else
+		struct					Event
+		{
+			pthread_mutex_t	mutex;
+			pthread_cond_t	cond;
+			bool			triggered;
+		};
+		struct					Barrier
+		{
+			pthread_mutex_t	mutex;
+			pthread_cond_t	cond;
+			int				nb_threads;
+			int				nb_remaining;
+			int				generation;
+		};
+	#endif
+#endif
+
+// Thread-local storage for POD variables
+#ifdef _MSC_VER
+	#define THREAD_LOCAL	__declspec(thread)
+#else
+	#define THREAD_LOCAL	__thread
 #endif
 
 typedef	void*	(*ThreadProc)(void* arg);
 
-ThreadHandle	threadCreate(ThreadProc proc, void* arg);
+static const size_t	THREAD_NAME_MAX_LENGTH = 32;
+
+enum ThreadPriority
+{
+	THREAD_PRIO_LOW = 0,
+	THREAD_PRIO_NORMAL,
+	THREAD_PRIO_HIGH,		// Usually needs privileges on Linux
+};
+
+// Applied by the new thread itself before it calls its ThreadProc
+struct ThreadOptions
+{
+	const char*		name;			// NULL: no name. The OS may truncate it (15 characters on Linux).
+	uint64_t		affinity_mask;	// Bit i set: may run on logical core i. 0: any core.
+	ThreadPriority	priority;
+
+	ThreadOptions() : name(NULL), affinity_mask(0), priority(THREAD_PRIO_NORMAL) {}
+};
+
+ThreadHandle	threadCreate(ThreadProc proc, void* arg, const ThreadOptions& options = ThreadOptions());
 ThreadId		threadGetCurrentId();
 void			threadJoin(ThreadHandle id);
+void			threadYield();
+int				threadGetNbCores();	// Logical cores available to the process
+int				threadGetProcessCores(int* cores, int max_cores);	// Their indices, in increasing order. Returns how many were written.
+
+// Calling thread. The setters return false if the OS refused or does not support the request.
+void			threadSetName(const char* name);
+const char*		threadGetName();	// "" if the thread has no name
+bool			threadSetAffinity(uint64_t affinity_mask);
+bool			threadSetPriority(ThreadPriority priority);
 
 void			mutexCreate(Mutex* mutex);
 void			mutexDestroy(Mutex* mutex);
@@ -41,4 +111,25 @@ void			eventTrigger(Event* event);
 void			eventReset(Event* event);
 void			eventWait(Event* event);
 
+// Barrier: all the threads wait until nb_threads have called barrierWait(), then they are
+// released together. Returns true for exactly one thread per generation, the last one to arrive.
+void			barrierCreate(Barrier* barrier, int nb_threads);
+void			barrierDestroy(Barrier* barrier);
+bool			barrierWait(Barrier* barrier);
+
+// Wait hook, for profilers: called on the waiting thread when mutexLock(), eventWait() or barrierWait() blocked
+// for at least threshold_ns, with the address of the primitive. NULL (the default) disables it: the primitives
+// then only pay a relaxed load. Otherwise mutexLock() tries the lock first, and the waits read the clock twice.
+// The hook is not called again for the primitives it uses itself.
+enum ThreadWaitType
+{
+	THREAD_WAIT_MUTEX = 0,
+	THREAD_WAIT_EVENT,
+	THREAD_WAIT_BARRIER
+};
+
+typedef	void	(*ThreadWaitHook)(ThreadWaitType type, const void* object, uint64_t wait_ns);
+
+void			threadSetWaitHook(ThreadWaitHook hook, uint32_t threshold_ns);
+
 #endif // __THREAD_H__
@@ -0,0 +1,354 @@
+// profiler_dump.cpp
+// Reference client for the profiler server: connects to a running application and dumps the
+// frames it receives as text.
+// Usage: profiler_dump [-v] [-r on|off] [host] [port]
+// -r resumes or stops the recording of the markers in the application.
+
+#ifdef WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	typedef	SOCKET	Socket;
+	#define INVALID_SOCKET_VALUE	INVALID_SOCKET
+	#define socketClose				closesocket
+#else
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <netdb.h>
+	#include <unistd.h>
+	typedef	int		Socket;
+	#define INVALID_SOCKET_VALUE	(-1)
+	#define socketClose				close
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../profiler_protocol.h"
+
+#define NB_MAX_NAMES	65536
+#define NB_MAX_LINES	256
+
+static std::string	names[NB_MAX_NAMES];
+static std::string	lines[NB_MAX_LINES];
+
+//-----------------------------------------------------------------------------
+static bool recvAll(Socket s, uint8_t* data, size_t size)
+{
+	while(size > 0)
+	{
+		int nb_received = (int)recv(s, (char*)data, (int)size, 0);
+		if(nb_received <= 0)
+			return false;
+		data += nb_received;
+		size -= (size_t)nb_received;
+	}
+	return true;
+}
+
+// Little-endian reader over a packet
+struct Reader
+{
+	const uint8_t*	p;
+	const uint8_t*	end;
+
+	bool		ok(size_t size) const	{return p + size <= end;}
+	uint32_t	u8()	{return *p++;}
+	uint32_t	u16()	{uint32_t v = p[0] | (p[1] << 8); p += 2; return v;}
+	uint32_t	u32()	{uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); p += 4; return v;}
+	uint64_t	u64()	{uint64_t lo = u32(); uint64_t hi = u32(); return lo | (hi << 32);}
+	std::string	str()	{size_t len = u8(); std::string s((const char*)p, len); p += len; return s;}
+};
+
+//-----------------------------------------------------------------------------
+static bool dumpPacket(const std::vector<uint8_t>& packet, bool verbose)
+{
+	Reader	r;
+	r.p = &packet[0];
+	r.end = r.p + packet.size();
+
+	size_t	nb_markers = 0;
+	size_t	nb_counter_samples = 0;
+	size_t	nb_flow_points = 0;
+	size_t	nb_critical_steps = 0;
+
+	while(r.p < r.end)
+	{
+		uint32_t type = r.u8();
+		switch(type)
+		{
+		case RECORD_FRAME:
+		{
+			if(!r.ok(20))
+				return false;
+			int			frame		= (int)r.u32();
+			uint32_t	nb_dropped	= r.u32();
+			uint64_t	start		= r.u64();
+			uint32_t	duration	= r.u32();
+			if(nb_dropped)
+				printf("(%u frames dropped)\n", nb_dropped);
+			printf("frame %d: start=%.3lfms duration=%.3lfms\n", frame, double(start) / 1000000.0, double(duration) / 1000000.0);
+			break;
+		}
+
+		case RECORD_THREAD:
+		{
+			if(!r.ok(2))
+				return false;
+			uint32_t line = r.u8();
+			if(!r.ok(*r.p + 1))
+				return false;
+			lines[line] = r.str();
+			printf("  new line %u: %s\n", line, lines[line].c_str());
+			break;
+		}
+
+		case RECORD_NAME:
+		{
+			if(!r.ok(3))
+				return false;
+			uint32_t id = r.u16();
+			if(!r.ok(*r.p + 1))
+				return false;
+			names[id] = r.str();
+			break;
+		}
+
+		case RECORD_MARKER:
+		{
+			if(!r.ok(15))
+				return false;
+			uint32_t	line	= r.u8();
+			uint32_t	layer	= r.u8();
+			uint32_t	name_id	= r.u16();
+			r.p += 3;	// color
+			int32_t		start	= (int32_t)r.u32();
+			uint32_t	duration= r.u32();
+			nb_markers++;
+
+			if(verbose)
+			{
+				std::string	indent(layer, '+');
+				printf("  [%-12s] %8.3lfms %8.3lfms %s%s\n", lines[line].c_str(),
+					   double(start) / 1000000.0, double(duration) / 1000000.0,
+					   indent.c_str(), names[name_id].c_str());
+			}
+			break;
+		}
+
+		case RECORD_COUNTER:
+		{
+			if(!r.ok(15))
+				return false;
+			uint32_t	line	= r.u8();
+			uint32_t	name_id	= r.u16();
+			int32_t		time	= (int32_t)r.u32();
+			uint64_t	bits	= r.u64();
+			double		value;
+			memcpy(&value, &bits, sizeof(value));
+			nb_counter_samples++;
+
+			if(verbose)
+			{
+				printf("  [%-12s] %8.3lfms            %s = %.15g\n", lines[line].c_str(),
+					   double(time) / 1000000.0, names[name_id].c_str(), value);
+			}
+			break;
+		}
+
+		case RECORD_FLOW:
+		{
+			if(!r.ok(10))
+				return false;
+			uint32_t	line	= r.u8();
+			uint32_t	begin	= r.u8();
+			uint32_t	id		= r.u32();
+			int32_t		time	= (int32_t)r.u32();
+			nb_flow_points++;
+
+			if(verbose)
+			{
+				printf("  [%-12s] %8.3lfms            flow %u %s\n", lines[line].c_str(),
+					   double(time) / 1000000.0, id, begin ? "begins" : "ends");
+			}
+			break;
+		}
+
+		case RECORD_CRITICAL_STEP:
+		{
+			if(!r.ok(11))
+				return false;
+			uint32_t	line	= r.u8();
+			uint32_t	name_id	= r.u16();
+			int32_t		start	= (int32_t)r.u32();
+			uint32_t	duration= r.u32();
+			nb_critical_steps++;
+
+			if(verbose)
+			{
+				printf("  [%-12s] %8.3lfms %8.3lfms critical path: %s\n", lines[line].c_str(),
+					   double(start) / 1000000.0, double(duration) / 1000000.0, names[name_id].c_str());
+			}
+			break;
+		}
+
+		case RECORD_ALLOCATIONS:
+		{
+			if(!r.ok(13))
+				return false;
+			uint32_t	line	= r.u8();
+			uint32_t	calls	= r.u32();
+			uint64_t	bytes	= r.u64();
+
+			if(verbose)	// Under the marker it applies to
+				printf("  [%-12s] %21s %u allocs, %.1lf KB\n", lines[line].c_str(), "", calls, double(bytes) / 1024.0);
+			break;
+		}
+
+		case RECORD_PERF_COUNTERS:
+		{
+			if(!r.ok(2))
+				return false;
+			uint32_t	line		= r.u8();
+			uint32_t	nb_counters	= r.u8();
+			if(!r.ok(8*nb_counters))
+				return false;
+			double		values[4] = {0.0, 0.0, 0.0, 0.0};	// cycles, instructions, LLC misses, branch misses
+			for(uint32_t i=0 ; i < nb_counters ; i++)
+			{
+				double	value = double(r.u64());
+				if(i < 4)
+					values[i] = value;
+			}
+
+			if(verbose)	// Under the marker it applies to
+			{
+				printf("  [%-12s] %21s %.2lfM cycles, IPC %.2lf, %.0lf LLC misses, %.0lf branch misses\n", lines[line].c_str(), "",
+					   values[0] / 1000000.0, values[0] > 0.0 ? values[1] / values[0] : 0.0, values[2], values[3]);
+			}
+			break;
+		}
+
+		default:
+			fprintf(stderr, "*** unknown record type %u\n", type);
+			return false;
+		}
+	}
+
+	if(!verbose)
+		printf("  %u markers, %u counter samples, %u flow points, %u critical path steps\n", (unsigned)nb_markers,
+			   (unsigned)nb_counter_samples, (unsigned)nb_flow_points, (unsigned)nb_critical_steps);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	bool		verbose = false;
+	int			recording = -1;
+	const char*	host = "127.0.0.1";
+	int			port = PROFILER_SERVER_DEFAULT_PORT;
+
+	int arg = 1;
+	if(arg < argc && strcmp(argv[arg], "-v") == 0)
+	{
+		verbose = true;
+		arg++;
+	}
+	if(arg+1 < argc && strcmp(argv[arg], "-r") == 0)
+	{
+		recording = (strcmp(argv[arg+1], "off") != 0);
+		arg += 2;
+	}
+	if(arg < argc)
+		host = argv[arg++];
+	if(arg < argc)
+		port = atoi(argv[arg++]);
+
+#ifdef WIN32
+	WSADATA	wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+
+	// Try each address of the host, e.g. ::1 then 127.0.0.1 for "localhost"
+	char	port_str[16];
+	sprintf(port_str, "%d", port);
+
+	struct addrinfo	hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	struct addrinfo*	addresses = NULL;
+	int error = getaddrinfo(host, port_str, &hints, &addresses);
+	if(error != 0)
+	{
+		fprintf(stderr, "*** FAILED resolving %s: %s\n", host, gai_strerror(error));
+		return EXIT_FAILURE;
+	}
+
+	Socket s = INVALID_SOCKET_VALUE;
+	for(struct addrinfo* address = addresses ; address ; address = address->ai_next)
+	{
+		s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if(s == INVALID_SOCKET_VALUE)
+			continue;
+		if(connect(s, address->ai_addr, (int)address->ai_addrlen) == 0)
+			break;
+		socketClose(s);
+		s = INVALID_SOCKET_VALUE;
+	}
+	freeaddrinfo(addresses);
+
+	if(s == INVALID_SOCKET_VALUE)
+	{
+		fprintf(stderr, "*** FAILED connecting to %s:%d\n", host, port);
+		return EXIT_FAILURE;
+	}
+	printf("Connected to %s:%d\n", host, port);
+
+	if(recording >= 0)
+	{
+		uint8_t	command[2] = {COMMAND_SET_RECORDING, (uint8_t)recording};
+		if(send(s, (const char*)command, sizeof(command), 0) != (int)sizeof(command))
+			fprintf(stderr, "*** FAILED sending the command\n");
+		else
+			printf("Recording %s\n", recording ? "resumed" : "stopped");
+	}
+
+	std::vector<uint8_t>	packet;
+	while(true)
+	{
+		uint8_t	header[4];
+		if(!recvAll(s, header, sizeof(header)))
+			break;
+
+		uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+		if(size == 0 || size > PROFILER_PACKET_MAX_SIZE)
+		{
+			fprintf(stderr, "*** invalid packet size %u\n", size);
+			break;
+		}
+
+		packet.resize(size);
+		if(!recvAll(s, &packet[0], size))
+			break;
+
+		if(!dumpPacket(packet, verbose))
+		{
+			fprintf(stderr, "*** malformed packet\n");
+			break;
+		}
+	}
+
+	printf("Disconnected\n");
+	socketClose(s);
+
+#ifdef WIN32
+	WSACleanup();
+#endif
+	return EXIT_SUCCESS;
+}
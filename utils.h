@@ -5,6 +5,23 @@
 
 #include <GL/glew.h>
 
+// Visual C++ before 2015 has no snprintf(), and its _vsnprintf() does not terminate the strings it truncates
+#if defined(_MSC_VER) && _MSC_VER < 1900
+	#include <stdarg.h>
+	#include <stdio.h>
+
+	inline int snprintf(char* buffer, size_t size, const char* format, ...)
+	{
+		va_list	args;
+		va_start(args, format);
+		int len = _vsnprintf(buffer, size, format, args);
+		va_end(args);
+		if(size != 0)
+			buffer[size-1] = '\0';
+		return len;
+	}
+#endif
+
 void		msleep(int ms);
 const char* loadText(const char* filename);
 bool		loadShaders(const char* vert_filename, const char* frag_filename,